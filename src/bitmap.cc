@@ -0,0 +1,313 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "bitmap.h"
+
+/* a group switches to a bitset past this many ids, which is where the
+ * 2 byte array entries would take more room than the 8KB bitset */
+#define ARRAY_MAX 4096
+#define GROUP_WORDS (65536 / 64)
+
+#define KEY(id) ((uint16_t)((id) >> 16))
+#define LOW(id) ((uint16_t)((id) & 0xffff))
+
+size_t adaapd::Bitmap::find(uint16_t key) const {
+	size_t lo = 0, hi = groups.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (groups[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+bool adaapd::Bitmap::Has(item_id_t id) const {
+	size_t i = find(KEY(id));
+	if (i == groups.size() || groups[i].key != KEY(id)) {
+		return false;
+	}
+	const group& g = groups[i];
+	uint16_t low = LOW(id);
+	if (!g.bits.empty()) {
+		return (g.bits[low >> 6] >> (low & 63)) & 1;
+	}
+	return std::binary_search(g.array.begin(), g.array.end(), low);
+}
+
+bool adaapd::Bitmap::Add(item_id_t id) {
+	size_t i = find(KEY(id));
+	if (i == groups.size() || groups[i].key != KEY(id)) {
+		group g;
+		g.key = KEY(id);
+		g.count = 0;
+		groups.insert(groups.begin() + i, g);
+	}
+	group& g = groups[i];
+	uint16_t low = LOW(id);
+	if (!g.bits.empty()) {
+		uint64_t bit = (uint64_t)1 << (low & 63);
+		if (g.bits[low >> 6] & bit) {
+			return false;
+		}
+		g.bits[low >> 6] |= bit;
+	} else {
+		std::vector<uint16_t>::iterator iter =
+			std::lower_bound(g.array.begin(), g.array.end(), low);
+		if (iter != g.array.end() && *iter == low) {
+			return false;
+		}
+		g.array.insert(iter, low);
+	}
+	++g.count;
+	++count;
+	if (g.count > ARRAY_MAX && g.bits.empty()) {
+		normalize(g);
+	}
+	return true;
+}
+
+bool adaapd::Bitmap::Remove(item_id_t id) {
+	size_t i = find(KEY(id));
+	if (i == groups.size() || groups[i].key != KEY(id)) {
+		return false;
+	}
+	group& g = groups[i];
+	uint16_t low = LOW(id);
+	if (!g.bits.empty()) {
+		uint64_t bit = (uint64_t)1 << (low & 63);
+		if (!(g.bits[low >> 6] & bit)) {
+			return false;
+		}
+		g.bits[low >> 6] &= ~bit;
+	} else {
+		std::vector<uint16_t>::iterator iter =
+			std::lower_bound(g.array.begin(), g.array.end(), low);
+		if (iter == g.array.end() || *iter != low) {
+			return false;
+		}
+		g.array.erase(iter);
+	}
+	--g.count;
+	--count;
+	if (g.count == 0) {
+		groups.erase(groups.begin() + i);
+	} else if (g.count <= ARRAY_MAX / 2 && !g.bits.empty()) {
+		/* not right at ARRAY_MAX, so that flipping a single id back and
+		 * forth doesn't convert every time */
+		normalize(g);
+	}
+	return true;
+}
+
+void adaapd::Bitmap::Ids(std::vector<item_id_t>& ids) const {
+	ids.reserve(ids.size() + count);
+	for (size_t i = 0; i < groups.size(); ++i) {
+		const group& g = groups[i];
+		item_id_t high = (item_id_t)g.key << 16;
+		if (g.bits.empty()) {
+			for (size_t j = 0; j < g.array.size(); ++j) {
+				ids.push_back(high | g.array[j]);
+			}
+			continue;
+		}
+		for (size_t word = 0; word < GROUP_WORDS; ++word) {
+			for (uint64_t bits = g.bits[word]; bits != 0; bits &= bits - 1) {
+				ids.push_back(high | (item_id_t)(word << 6) | __builtin_ctzll(bits));
+			}
+		}
+	}
+}
+
+void adaapd::Bitmap::Mask(item_id_t base, uint8_t* out) const {
+	memset(out, 0, CHUNK_SIZE);
+	/* a chunk never spans two groups */
+	size_t i = find(KEY(base));
+	if (i == groups.size() || groups[i].key != KEY(base)) {
+		return;
+	}
+	const group& g = groups[i];
+	uint32_t low = LOW(base);
+	if (!g.bits.empty()) {
+		for (uint32_t j = 0; j < CHUNK_SIZE; ++j) {
+			out[j] = (g.bits[(low + j) >> 6] >> ((low + j) & 63)) & 1;
+		}
+		return;
+	}
+	std::vector<uint16_t>::const_iterator iter =
+		std::lower_bound(g.array.begin(), g.array.end(), low);
+	for (; iter != g.array.end() && *iter < low + CHUNK_SIZE; ++iter) {
+		out[*iter - low] = 1;
+	}
+}
+
+bool adaapd::Bitmap::operator==(const Bitmap& other) const {
+	if (count != other.count || groups.size() != other.groups.size()) {
+		return false;
+	}
+	/* groups are always normalized the same way for the same count, apart
+	 * from the hysteresis in Remove(), so compare the bits */
+	std::vector<uint64_t> a, b;
+	for (size_t i = 0; i < groups.size(); ++i) {
+		if (groups[i].key != other.groups[i].key ||
+				groups[i].count != other.groups[i].count) {
+			return false;
+		}
+		to_bits(groups[i], a);
+		to_bits(other.groups[i], b);
+		if (a != b) {
+			return false;
+		}
+	}
+	return true;
+}
+
+adaapd::Bitmap adaapd::Bitmap::Or(const Bitmap& a, const Bitmap& b) {
+	return combine(a, b, OP_OR);
+}
+
+adaapd::Bitmap adaapd::Bitmap::And(const Bitmap& a, const Bitmap& b) {
+	return combine(a, b, OP_AND);
+}
+
+adaapd::Bitmap adaapd::Bitmap::AndNot(const Bitmap& a, const Bitmap& b) {
+	return combine(a, b, OP_ANDNOT);
+}
+
+adaapd::Bitmap adaapd::Bitmap::combine(const Bitmap& a, const Bitmap& b, OP op) {
+	/* merge the two sorted lists of groups */
+	Bitmap out;
+	size_t i = 0, j = 0;
+	while (i < a.groups.size() || j < b.groups.size()) {
+		const group* ga = (i < a.groups.size()) ? &a.groups[i] : NULL;
+		const group* gb = (j < b.groups.size()) ? &b.groups[j] : NULL;
+		if (ga != NULL && (gb == NULL || ga->key < gb->key)) {
+			/* only in a */
+			if (op != OP_AND) {
+				out.groups.push_back(*ga);
+			}
+			++i;
+		} else if (gb != NULL && (ga == NULL || gb->key < ga->key)) {
+			/* only in b */
+			if (op == OP_OR) {
+				out.groups.push_back(*gb);
+			}
+			++j;
+		} else {
+			group g;
+			if (combine(*ga, *gb, op, g)) {
+				out.groups.push_back(g);
+			}
+			++i;
+			++j;
+		}
+	}
+	for (size_t k = 0; k < out.groups.size(); ++k) {
+		out.count += out.groups[k].count;
+	}
+	return out;
+}
+
+bool adaapd::Bitmap::combine(const group& a, const group& b, OP op, group& out) {
+	out.key = a.key;
+	if (a.bits.empty() && b.bits.empty()) {
+		/* both sparse: merge the arrays */
+		std::back_insert_iterator<std::vector<uint16_t> > dest(out.array);
+		switch (op) {
+		case OP_OR:
+			std::set_union(a.array.begin(), a.array.end(),
+					b.array.begin(), b.array.end(), dest);
+			break;
+		case OP_AND:
+			std::set_intersection(a.array.begin(), a.array.end(),
+					b.array.begin(), b.array.end(), dest);
+			break;
+		case OP_ANDNOT:
+			std::set_difference(a.array.begin(), a.array.end(),
+					b.array.begin(), b.array.end(), dest);
+			break;
+		}
+		out.count = out.array.size();
+	} else if (a.bits.empty() && op != OP_OR) {
+		/* sparse a: just check each of its entries against b */
+		for (size_t i = 0; i < a.array.size(); ++i) {
+			uint16_t low = a.array[i];
+			bool in_b = (b.bits[low >> 6] >> (low & 63)) & 1;
+			if (in_b == (op == OP_AND)) {
+				out.array.push_back(low);
+			}
+		}
+		out.count = out.array.size();
+	} else {
+		/* a word at a time */
+		std::vector<uint64_t> other;
+		to_bits(a, out.bits);
+		to_bits(b, other);
+		out.count = 0;
+		for (size_t w = 0; w < GROUP_WORDS; ++w) {
+			switch (op) {
+			case OP_OR:
+				out.bits[w] |= other[w];
+				break;
+			case OP_AND:
+				out.bits[w] &= other[w];
+				break;
+			case OP_ANDNOT:
+				out.bits[w] &= ~other[w];
+				break;
+			}
+			out.count += __builtin_popcountll(out.bits[w]);
+		}
+	}
+	normalize(out);
+	return out.count != 0;
+}
+
+void adaapd::Bitmap::to_bits(const group& g, std::vector<uint64_t>& bits) {
+	if (!g.bits.empty()) {
+		bits = g.bits;
+		return;
+	}
+	bits.assign(GROUP_WORDS, 0);
+	for (size_t i = 0; i < g.array.size(); ++i) {
+		bits[g.array[i] >> 6] |= (uint64_t)1 << (g.array[i] & 63);
+	}
+}
+
+void adaapd::Bitmap::normalize(group& g) {
+	if (g.count > ARRAY_MAX && g.bits.empty()) {
+		to_bits(g, g.bits);
+		std::vector<uint16_t>().swap(g.array);
+	} else if (g.count <= ARRAY_MAX && !g.bits.empty()) {
+		g.array.clear();
+		g.array.reserve(g.count);
+		for (size_t word = 0; word < GROUP_WORDS; ++word) {
+			for (uint64_t bits = g.bits[word]; bits != 0; bits &= bits - 1) {
+				g.array.push_back((uint16_t)((word << 6) | __builtin_ctzll(bits)));
+			}
+		}
+		std::vector<uint64_t>().swap(g.bits);
+	}
+}
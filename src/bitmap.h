@@ -0,0 +1,106 @@
+#ifndef _adaapd_bitmap_h_
+#define _adaapd_bitmap_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "track-store.h"
+
+namespace adaapd {
+	/*! A compressed set of item ids, in the style of a roaring bitmap: ids
+	 * are grouped by their upper 16 bits, and each group is stored either
+	 * as a sorted array of the lower 16 bits while it's sparse, or as a 2^16
+	 * bit bitset once it's dense. A small playlist costs a couple bytes per
+	 * track, a large one 1 bit per possible id, and set operations work a
+	 * group at a time. */
+	class Bitmap {
+	public:
+		Bitmap() : count(0) { }
+
+		bool Has(item_id_t id) const;
+
+		/*! Adds 'id', returning whether it wasn't already there. */
+		bool Add(item_id_t id);
+
+		/*! Removes 'id', returning whether it was there. */
+		bool Remove(item_id_t id);
+
+		/*! The number of ids in the set. */
+		size_t Count() const {
+			return count;
+		}
+
+		/*! Appends the ids in the set to 'ids', in increasing order. */
+		void Ids(std::vector<item_id_t>& ids) const;
+
+		/*! Sets out[i] to whether 'base + i' is in the set, for each of the
+		 * CHUNK_SIZE ids in the Column chunk starting at 'base'. */
+		void Mask(item_id_t base, uint8_t* out) const;
+
+		void Clear() {
+			groups.clear();
+			count = 0;
+		}
+
+		bool operator==(const Bitmap& other) const;
+		bool operator!=(const Bitmap& other) const {
+			return !(*this == other);
+		}
+
+		/*! The ids in either of 'a' and 'b'. */
+		static Bitmap Or(const Bitmap& a, const Bitmap& b);
+		/*! The ids in both 'a' and 'b'. */
+		static Bitmap And(const Bitmap& a, const Bitmap& b);
+		/*! The ids in 'a' but not in 'b'. */
+		static Bitmap AndNot(const Bitmap& a, const Bitmap& b);
+
+	private:
+		/* the ids which share their upper 16 bits */
+		struct group {
+			uint16_t key;
+			uint32_t count;
+			/* sorted lower bits while count <= ARRAY_MAX, otherwise empty */
+			std::vector<uint16_t> array;
+			/* 2^16 bits once count > ARRAY_MAX, otherwise empty */
+			std::vector<uint64_t> bits;
+		};
+
+		enum OP {
+			OP_OR,
+			OP_AND,
+			OP_ANDNOT
+		};
+
+		static Bitmap combine(const Bitmap& a, const Bitmap& b, OP op);
+		static bool combine(const group& a, const group& b, OP op, group& out);
+		static void to_bits(const group& g, std::vector<uint64_t>& bits);
+		static void normalize(group& g);
+
+		/* the index of the group for 'key', or where it'd be inserted */
+		size_t find(uint16_t key) const;
+
+		std::vector<group> groups;/* sorted by key */
+		size_t count;
+	};
+}
+
+#endif
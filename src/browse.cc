@@ -0,0 +1,163 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "browse.h"
+#include "dmap.h"
+
+namespace {
+	struct list_info {
+		const char* name;
+		adaapd::Tag_StrId field;
+		const char* code;
+	};
+
+	const list_info LISTS[] = {
+		{ "artists", adaapd::ARTIST, "abar" },
+		{ "albums", adaapd::ALBUM, "abal" },
+		{ "genres", adaapd::GENRE, "abgn" },
+		{ "composers", adaapd::COMPOSER, "abcp" }
+	};
+
+	typedef std::pair<std::string, adaapd::str_id_t> keyed_t;
+}
+
+adaapd::BrowseLists::BrowseLists(const Collation& collation)
+	: collation(collation) { }
+
+adaapd::Tag_StrId adaapd::BrowseLists::Field(LIST list) {
+	return LISTS[list].field;
+}
+
+bool adaapd::BrowseLists::Find(const char* name, size_t len, LIST& list) {
+	for (int i = 0; i < LIST_COUNT; ++i) {
+		if (strlen(LISTS[i].name) == len && memcmp(LISTS[i].name, name, len) == 0) {
+			list = (LIST)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void adaapd::BrowseLists::Sort(const StringPool& pool, std::vector<str_id_t>& values) {
+	std::sort(values.begin(), values.end());
+	values.erase(std::unique(values.begin(), values.end()), values.end());
+	std::vector<keyed_t> keyed;
+	keyed.reserve(values.size());
+	for (size_t i = 0; i < values.size(); ++i) {
+		keyed.push_back(keyed_t(CollationKey(pool.Get(values[i])), values[i]));
+	}
+	std::sort(keyed.begin(), keyed.end());
+	for (size_t i = 0; i < keyed.size(); ++i) {
+		values[i] = keyed[i].second;
+	}
+}
+
+void adaapd::BrowseLists::Encode(const StringPool& pool, LIST list,
+		const std::vector<str_id_t>& values, std::string& out) {
+	size_t size = 0;
+	for (size_t i = 0; i < values.size(); ++i) {
+		size += dmap::HEADER_SIZE + pool.Len(values[i]);
+	}
+	out.reserve(out.size() + size + 64);
+	size_t abro = dmap::Begin(out, "abro");
+	dmap::Int(out, "mstt", 200);
+	dmap::Byte(out, "muty", 0);
+	dmap::Int(out, "mtco", values.size());
+	dmap::Int(out, "mrco", values.size());
+	dmap::Container(out, LISTS[list].code, size);
+	for (size_t i = 0; i < values.size(); ++i) {
+		dmap::String(out, "mlit", pool.Get(values[i]), pool.Len(values[i]));
+	}
+	dmap::End(out, abro);
+}
+
+void adaapd::BrowseLists::Build(const TrackStore& tracks) {
+	for (int l = 0; l < LIST_COUNT; ++l) {
+		list_t& list = lists[l];
+		list.values.clear();
+		list.counts.clear();
+		list.encoded.reset();
+		for (item_id_t id = 0; id < tracks.End(); ++id) {
+			str_id_t value = tracks.Has(id) ? tracks.StrId(id, LISTS[l].field) : STR_NONE;
+			if (value != STR_NONE && list.counts[value]++ == 0) {
+				list.values.push_back(value);
+			}
+		}
+		std::sort(list.values.begin(), list.values.end(), less(collation));
+	}
+}
+
+void adaapd::BrowseLists::Remove(const TrackStore& tracks, item_id_t id, tag_mask_t fields) {
+	if (!tracks.Has(id)) {
+		return;
+	}
+	for (int l = 0; l < LIST_COUNT; ++l) {
+		str_id_t value = tracks.StrId(id, LISTS[l].field);
+		if ((fields & TagBit(LISTS[l].field)) == 0 || value == STR_NONE) {
+			continue;
+		}
+		list_t& list = lists[l];
+		std::unordered_map<str_id_t, uint32_t>::iterator count = list.counts.find(value);
+		if (count == list.counts.end() || --count->second != 0) {
+			continue;
+		}
+		/* the last track with this value */
+		list.counts.erase(count);
+		std::vector<str_id_t>::iterator iter = std::lower_bound(list.values.begin(),
+				list.values.end(), value, less(collation));
+		if (iter != list.values.end() && *iter == value) {
+			list.values.erase(iter);
+		}
+		list.encoded.reset();
+	}
+}
+
+void adaapd::BrowseLists::Add(const TrackStore& tracks, item_id_t id, tag_mask_t fields) {
+	if (!tracks.Has(id)) {
+		return;
+	}
+	for (int l = 0; l < LIST_COUNT; ++l) {
+		str_id_t value = tracks.StrId(id, LISTS[l].field);
+		if ((fields & TagBit(LISTS[l].field)) == 0 || value == STR_NONE) {
+			continue;
+		}
+		list_t& list = lists[l];
+		if (list.counts[value]++ != 0) {
+			continue;
+		}
+		/* the first track with this value */
+		list.values.insert(std::lower_bound(list.values.begin(), list.values.end(),
+						value, less(collation)), value);
+		list.encoded.reset();
+	}
+}
+
+std::shared_ptr<const std::string> adaapd::BrowseLists::Encoded(const StringPool& pool,
+		LIST list) {
+	list_t& l = lists[list];
+	if (!l.encoded) {
+		std::shared_ptr<std::string> out(new std::string);
+		Encode(pool, list, l.values, *out);
+		l.encoded = out;
+	}
+	return l.encoded;
+}
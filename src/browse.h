@@ -0,0 +1,107 @@
+#ifndef _adaapd_browse_h_
+#define _adaapd_browse_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "collation.h"
+
+namespace adaapd {
+	/*! The distinct artists, albums, genres and composers in the library,
+	 * for /databases/N/browse/. Each value is counted by the tracks which
+	 * have it, so that a list is only touched when a value comes or goes,
+	 * and each list is kept sorted as it changes. The encoded response for
+	 * a list is kept until the list changes again, so that every client
+	 * at a revision gets the same buffer. */
+	class BrowseLists {
+	public:
+		enum LIST {
+			ARTISTS,
+			ALBUMS,
+			GENRES,
+			COMPOSERS,
+			LIST_COUNT
+		};
+
+		/*! Values are sorted by their keys in 'collation', which is kept up
+		 * to date by the caller for the strings of any tracks given here. */
+		BrowseLists(const Collation& collation);
+
+		/*! The field which 'list' is made of. */
+		static Tag_StrId Field(LIST list);
+
+		/*! Finds the list named in a browse path, eg "artists". */
+		static bool Find(const char* name, size_t len, LIST& list);
+
+		/*! Sorts 'values' into list order, dropping duplicates. Keys are
+		 * computed here, for lists other than these. */
+		static void Sort(const StringPool& pool, std::vector<str_id_t>& values);
+
+		/*! Writes the browse response for the sorted 'values' of 'list'. */
+		static void Encode(const StringPool& pool, LIST list,
+				const std::vector<str_id_t>& values, std::string& out);
+
+		/*! Rebuilds the lists from scratch. */
+		void Build(const TrackStore& tracks);
+
+		/*! Like TagIndex::Remove() and Add(): uncounts the values of 'fields'
+		 * for track 'id' before it's changed or removed, then counts them
+		 * again once it's changed. */
+		void Remove(const TrackStore& tracks, item_id_t id, tag_mask_t fields);
+		void Add(const TrackStore& tracks, item_id_t id, tag_mask_t fields);
+
+		/*! The distinct values of 'list', in order. */
+		const std::vector<str_id_t>& Values(LIST list) const {
+			return lists[list].values;
+		}
+
+		/*! The encoded response for 'list', which is only encoded again
+		 * if the list has changed since the last call. */
+		std::shared_ptr<const std::string> Encoded(const StringPool& pool, LIST list);
+
+	private:
+		struct list_t {
+			std::vector<str_id_t> values;
+			std::unordered_map<str_id_t, uint32_t> counts;
+			std::shared_ptr<const std::string> encoded;/* empty when stale */
+		};
+
+		/* orders string ids by their keys, with the ids settling ties
+		 * between eg "abc" and "ABC" */
+		struct less {
+			less(const Collation& collation) : collation(collation) { }
+			bool operator()(str_id_t a, str_id_t b) const {
+				int cmp = collation.Compare(a, b);
+				return (cmp != 0) ? cmp < 0 : a < b;
+			}
+			const Collation& collation;
+		};
+
+		const Collation& collation;
+		list_t lists[LIST_COUNT];
+	};
+}
+
+#endif
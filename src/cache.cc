@@ -0,0 +1,494 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sqlite3.h>
+
+#include <chrono>
+#include <sstream>
+
+#include "cache.h"
+#include "logging.h"
+#include "metrics.h"
+#include "tag.h"
+#include "trace.h"
+
+/* bump this whenever the files table changes, the cache is then rebuilt */
+#define SCHEMA_VERSION 2
+
+/* how many queued files to tag per loop iteration/transaction */
+#define FLUSH_BATCH 32
+
+namespace {
+	adaapd::Histogram& commit_files = adaapd::Metrics::Get().GetHistogram(
+			"adaapd_cache_commit_files", "Files stored or removed per cache transaction",
+			adaapd::SizeBuckets(), 1);
+	adaapd::Histogram& commit_latency = adaapd::Metrics::Get().GetHistogram(
+			"adaapd_cache_commit_seconds", "Time taken by each cache transaction, including tagging",
+			adaapd::LatencyBuckets(), adaapd::LATENCY_SCALE);
+	adaapd::Gauge& queued_files = adaapd::Metrics::Get().GetGauge(
+			"adaapd_cache_queued_files", "Files waiting to be tagged and stored");
+
+	/* column names, in Tag_IntId/Tag_StrId order */
+	const char* INT_COLS[adaapd::TAG_INT_COUNT] = {
+		"bpm", "bit_rate", "compilation", "disc_count", "disc_number",
+		"relative_volume", "sample_rate", "size_bytes", "time_ms",
+		"track_count", "track_number", "user_rating", "year"
+	};
+	const char* STR_COLS[adaapd::TAG_STR_COUNT] = {
+		"album", "artist", "comment", "composer", "genre", "title"
+	};
+
+	/* fixed columns which precede the tag columns */
+	enum {
+		COL_ID = 1, COL_PATH, COL_INODE, COL_SIZE, COL_MTIME, COL_VALID,
+		COL_FIRST_TAG
+	};
+}
+
+adaapd::Cache::Cache(ev::default_loop* loop, const std::string& db_path,
+		track_subscriber_t subscriber, commit_subscriber_t committed)
+	: db_path(db_path), subscriber(subscriber), committed(committed),
+	  loop(loop), db(NULL),
+	  stmt_store(NULL), stmt_remove(NULL), stmt_revision(NULL),
+	  revision(0) { }
+
+adaapd::Cache::~Cache() {
+	idle.stop();
+	if (stmt_store != NULL) {
+		sqlite3_finalize(stmt_store);
+		stmt_store = NULL;
+	}
+	if (stmt_remove != NULL) {
+		sqlite3_finalize(stmt_remove);
+		stmt_remove = NULL;
+	}
+	if (stmt_revision != NULL) {
+		sqlite3_finalize(stmt_revision);
+		stmt_revision = NULL;
+	}
+	if (db != NULL) {
+		sqlite3_close(db);
+		db = NULL;
+	}
+}
+
+bool adaapd::Cache::Init() {
+	if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK) {
+		ERR("Unable to open cache %s: %s", db_path.c_str(), sqlite3_errmsg(db));
+		return false;
+	}
+
+	/* the cache can always be rebuilt from the library, so favor speed */
+	if (!exec("PRAGMA journal_mode=WAL") || !exec("PRAGMA synchronous=NORMAL")) {
+		return false;
+	}
+
+	{
+		int version = 0;
+		sqlite3_stmt* stmt;
+		if (sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, NULL) != SQLITE_OK) {
+			ERR("Unable to get cache version: %s", sqlite3_errmsg(db));
+			return false;
+		}
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			version = sqlite3_column_int(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+		if (version != 0 && version != SCHEMA_VERSION) {
+			LOG("Cache version %d != %d, rebuilding.", version, SCHEMA_VERSION);
+			if (!exec("DROP TABLE IF EXISTS files") || !exec("DROP TABLE IF EXISTS meta")) {
+				return false;
+			}
+		}
+	}
+
+	std::ostringstream create, store;
+	create << "CREATE TABLE IF NOT EXISTS files ("
+		   << "id INTEGER PRIMARY KEY, path TEXT UNIQUE NOT NULL, "
+		   << "inode INTEGER NOT NULL, size INTEGER NOT NULL, "
+		   << "mtime INTEGER NOT NULL, valid INTEGER NOT NULL";
+	store << "INSERT OR REPLACE INTO files "
+		  << "(id, path, inode, size, mtime, valid";
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		create << ", " << INT_COLS[i] << " INTEGER";
+		store << ", " << INT_COLS[i];
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		create << ", " << STR_COLS[i] << " TEXT";
+		store << ", " << STR_COLS[i];
+	}
+	create << ")";
+	store << ") VALUES (?";
+	for (int i = COL_ID; i < COL_FIRST_TAG - 1 + TAG_INT_COUNT + TAG_STR_COUNT; ++i) {
+		store << ", ?";
+	}
+	store << ")";
+
+	std::ostringstream set_version;
+	set_version << "PRAGMA user_version = " << SCHEMA_VERSION;
+	if (!exec(create.str().c_str()) || !exec(set_version.str().c_str()) ||
+			!exec("CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value INTEGER)")) {
+		return false;
+	}
+
+	if (sqlite3_prepare_v2(db, store.str().c_str(), -1, &stmt_store, NULL) != SQLITE_OK ||
+			sqlite3_prepare_v2(db, "DELETE FROM files WHERE id = ?", -1,
+					&stmt_remove, NULL) != SQLITE_OK ||
+			sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO meta VALUES ('revision', ?)", -1,
+					&stmt_revision, NULL) != SQLITE_OK) {
+		ERR("Unable to prepare cache statements: %s", sqlite3_errmsg(db));
+		return false;
+	}
+
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v2(db, "SELECT value FROM meta WHERE key = 'revision'",
+					-1, &stmt, NULL) != SQLITE_OK) {
+		ERR("Unable to get cache revision: %s", sqlite3_errmsg(db));
+		return false;
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		revision = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	/* load the stored stats, to be compared against what the Listener finds */
+	if (sqlite3_prepare_v2(db, "SELECT id, path, inode, size, mtime, valid FROM files",
+					-1, &stmt, NULL) != SQLITE_OK) {
+		ERR("Unable to query cache: %s", sqlite3_errmsg(db));
+		return false;
+	}
+	int ret;
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		std::string path((const char*)sqlite3_column_text(stmt, 1),
+				sqlite3_column_bytes(stmt, 1));
+		entry& e = files[path];
+		e.id = sqlite3_column_int64(stmt, 0);
+		e.stat.inode = sqlite3_column_int64(stmt, 2);
+		e.stat.size = sqlite3_column_int64(stmt, 3);
+		e.stat.mtime = sqlite3_column_int64(stmt, 4);
+		e.valid = sqlite3_column_int(stmt, 5) != 0;
+	}
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_DONE) {
+		ERR("Unable to load cache: %s", sqlite3_errmsg(db));
+		return false;
+	}
+	LOG("Loaded %lu files at revision %u from cache %s",
+			files.size(), revision, db_path.c_str());
+
+	idle.set(*loop);
+	idle.set<Cache, &Cache::cb_idle>(this);
+	return true;
+}
+
+bool adaapd::Cache::LoadTracks() {
+	sqlite3_stmt* stmt;
+	if (sqlite3_prepare_v2(db, "SELECT * FROM files WHERE valid != 0",
+					-1, &stmt, NULL) != SQLITE_OK) {
+		ERR("Unable to query cache: %s", sqlite3_errmsg(db));
+		return false;
+	}
+	size_t count = 0;
+	int ret;
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		/* column indexes are 0-based, bind indexes are 1-based */
+		TrackInfo info;
+		info.path.assign((const char*)sqlite3_column_text(stmt, COL_PATH - 1),
+				sqlite3_column_bytes(stmt, COL_PATH - 1));
+		info.mtime = sqlite3_column_int64(stmt, COL_MTIME - 1);
+		int col = COL_FIRST_TAG - 1;
+		for (int i = 0; i < TAG_INT_COUNT; ++i, ++col) {
+			if (sqlite3_column_type(stmt, col) != SQLITE_NULL) {
+				info.ints[i] = sqlite3_column_int64(stmt, col);
+			}
+		}
+		for (int i = 0; i < TAG_STR_COUNT; ++i, ++col) {
+			if (sqlite3_column_type(stmt, col) != SQLITE_NULL) {
+				info.strs[i].assign((const char*)sqlite3_column_text(stmt, col),
+						sqlite3_column_bytes(stmt, col));
+			}
+		}
+		subscriber(sqlite3_column_int64(stmt, COL_ID - 1), FILE_CREATED, info, revision);
+		++count;
+	}
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_DONE) {
+		ERR("Unable to load tracks: %s", sqlite3_errmsg(db));
+		return false;
+	}
+	LOG("Loaded %lu tracks from cache %s", count, db_path.c_str());
+	return true;
+}
+
+void adaapd::Cache::FileEvent(const std::string& path, FILE_EVENT_TYPE type,
+		const FileStat& stat) {
+	switch (type) {
+	case FILE_CREATED:
+	case FILE_CHANGED: {
+		entry& e = files[path];
+		e.seen = true;
+		e.removed = false;
+		if (e.id != 0 && e.stat == stat) {
+			DEBUG("Unchanged: %s", path.c_str());
+			return;
+		}
+		e.stat = stat;
+		enqueue(path, e);
+		break;
+	}
+	case FILE_REMOVED: {
+		files_t::iterator iter = files.find(path);
+		if (iter == files.end()) {
+			return;
+		}
+		entry& e = iter->second;
+		if (e.id == 0 && !e.queued) {
+			files.erase(iter);
+			return;
+		}
+		e.removed = true;
+		enqueue(path, e);
+		break;
+	}
+	}
+}
+
+size_t adaapd::Cache::Prune() {
+	size_t count = 0;
+	for (files_t::iterator iter = files.begin(); iter != files.end(); ) {
+		if (iter->second.seen) {
+			++iter;
+			continue;
+		}
+		++count;
+		if (iter->second.id == 0 && !iter->second.queued) {
+			iter = files.erase(iter);
+		} else {
+			iter->second.removed = true;
+			enqueue(iter->first, iter->second);
+			++iter;
+		}
+	}
+	if (count != 0) {
+		LOG("Pruning %lu missing files from cache", count);
+	}
+	return count;
+}
+
+size_t adaapd::Cache::Flush(size_t max) {
+	if (queue.empty()) {
+		return 0;
+	}
+	TraceSpan span("cache flush");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (!exec("BEGIN")) {
+		/* retried with the next file event */
+		idle.stop();
+		return 0;
+	}
+	batch.clear();
+	undo.clear();
+	size_t count = 0;
+	while (!queue.empty() && count < max) {
+		std::string path = queue.front();
+		queue.pop_front();
+		++count;
+
+		files_t::iterator iter = files.find(path);
+		if (iter == files.end()) {
+			ERR("INTERNAL ERROR: Queued file %s isn't tracked!", path.c_str());
+			continue;
+		}
+		undo.push_back(*iter);
+		entry& e = iter->second;
+		e.queued = false;
+		if (e.removed) {
+			remove(path, e);
+			files.erase(iter);
+		} else {
+			store(path, e);
+		}
+	}
+	if (!batch.empty()) {
+		/* the revision only moves when tracks actually changed */
+		sqlite3_reset(stmt_revision);
+		sqlite3_bind_int64(stmt_revision, 1, revision + 1);
+		if (sqlite3_step(stmt_revision) != SQLITE_DONE) {
+			ERR("Unable to store revision: %s", sqlite3_errmsg(db));
+		}
+	}
+
+	TraceSpan commit_span("commit");
+	if (!exec("COMMIT")) {
+		/* The db is rolled back, so the entries are too and the subscriber
+		 * never hears about the batch. Its files are queued again, but not
+		 * retried until the next file event, rather than spinning on a db
+		 * which keeps failing. */
+		exec("ROLLBACK");
+		for (size_t i = undo.size(); i-- != 0; ) {
+			files[undo[i].first] = undo[i].second;
+			queue.push_front(undo[i].first);
+		}
+		ERR("Unable to commit %lu files to the cache, will retry", undo.size());
+		batch.clear();
+		undo.clear();
+		idle.stop();
+		queued_files.Set(queue.size());
+		return 0;
+	}
+	if (!batch.empty()) {
+		/* changes within a batch all belong to the next revision */
+		for (size_t i = 0; i < batch.size(); ++i) {
+			subscriber(batch[i].id, batch[i].type, batch[i].info, revision + 1);
+		}
+		++revision;
+		if (committed) {
+			committed(revision);
+		}
+	}
+	batch.clear();
+	undo.clear();
+	commit_files.Observe(count);
+	commit_latency.ObserveSince(start);
+	queued_files.Set(queue.size());
+	return count;
+}
+
+adaapd::revision_t adaapd::Cache::Bump() {
+	/* only called between batches, so this is its own transaction */
+	sqlite3_reset(stmt_revision);
+	sqlite3_bind_int64(stmt_revision, 1, revision + 1);
+	if (sqlite3_step(stmt_revision) != SQLITE_DONE) {
+		ERR("Unable to store revision: %s", sqlite3_errmsg(db));
+		return revision;
+	}
+	return ++revision;
+}
+
+void adaapd::Cache::enqueue(const std::string& path, entry& e) {
+	if (e.queued) {
+		return;
+	}
+	e.queued = true;
+	queue.push_back(path);
+	queued_files.Set(queue.size());
+	if (!idle.is_active()) {
+		idle.start();
+	}
+}
+
+bool adaapd::Cache::store(const std::string& path, entry& e) {
+	tag_t tag = Tag::Create(path);
+	TrackInfo info;
+	info.path = path;
+	info.mtime = e.stat.mtime;
+
+	sqlite3_reset(stmt_store);
+	if (e.id == 0) {
+		sqlite3_bind_null(stmt_store, COL_ID);
+	} else {
+		sqlite3_bind_int64(stmt_store, COL_ID, e.id);
+	}
+	sqlite3_bind_text(stmt_store, COL_PATH, path.c_str(), path.size(), SQLITE_TRANSIENT);
+	sqlite3_bind_int64(stmt_store, COL_INODE, e.stat.inode);
+	sqlite3_bind_int64(stmt_store, COL_SIZE, e.stat.size);
+	sqlite3_bind_int64(stmt_store, COL_MTIME, e.stat.mtime);
+	/* unsupported files are stored too, so that they're skipped next time */
+	sqlite3_bind_int(stmt_store, COL_VALID, tag ? 1 : 0);
+
+	int col = COL_FIRST_TAG;
+	for (int i = 0; i < TAG_INT_COUNT; ++i, ++col) {
+		if (tag && tag->Value((Tag_IntId)i, info.ints[i])) {
+			sqlite3_bind_int64(stmt_store, col, info.ints[i]);
+		} else {
+			info.ints[i] = TAG_INT_NONE;
+			sqlite3_bind_null(stmt_store, col);
+		}
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i, ++col) {
+		if (tag && tag->Value((Tag_StrId)i, info.strs[i])) {
+			sqlite3_bind_text(stmt_store, col, info.strs[i].c_str(),
+					info.strs[i].size(), SQLITE_TRANSIENT);
+		} else {
+			info.strs[i].clear();
+			sqlite3_bind_null(stmt_store, col);
+		}
+	}
+
+	if (sqlite3_step(stmt_store) != SQLITE_DONE) {
+		ERR("Unable to store %s: %s", path.c_str(), sqlite3_errmsg(db));
+		return false;
+	}
+	e.id = sqlite3_last_insert_rowid(db);
+
+	if (tag) {
+		notify(e.id, e.valid ? FILE_CHANGED : FILE_CREATED, info);
+		e.valid = true;
+	} else if (e.valid) {
+		/* no longer readable as a track */
+		notify(e.id, FILE_REMOVED, info);
+		e.valid = false;
+	}
+	return true;
+}
+
+bool adaapd::Cache::remove(const std::string& path, entry& e) {
+	if (e.valid) {
+		TrackInfo info;
+		info.path = path;
+		notify(e.id, FILE_REMOVED, info);
+		e.valid = false;
+	}
+	if (e.id == 0) {
+		return true;
+	}
+	sqlite3_reset(stmt_remove);
+	sqlite3_bind_int64(stmt_remove, 1, e.id);
+	if (sqlite3_step(stmt_remove) != SQLITE_DONE) {
+		ERR("Unable to remove %s: %s", path.c_str(), sqlite3_errmsg(db));
+		return false;
+	}
+	return true;
+}
+
+void adaapd::Cache::notify(item_id_t id, FILE_EVENT_TYPE type,
+		const TrackInfo& info) {
+	/* delivered once the batch has been committed */
+	event change;
+	change.id = id;
+	change.type = type;
+	change.info = info;
+	batch.push_back(change);
+}
+
+bool adaapd::Cache::exec(const char* sql) {
+	char* err = NULL;
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		ERR("Cache query '%s' failed: %s", sql, err);
+		sqlite3_free(err);
+		return false;
+	}
+	return true;
+}
+
+void adaapd::Cache::cb_idle(ev::idle& /*idle*/, int /*revents*/) {
+	Flush(FLUSH_BATCH);
+	if (queue.empty()) {
+		idle.stop();
+	}
+}
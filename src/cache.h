@@ -0,0 +1,141 @@
+#ifndef _adaapd_cache_h_
+#define _adaapd_cache_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <ev++.h>
+
+#include "listener.h"
+#include "track-store.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace adaapd {
+	/*! Called when a track is added, retagged, or removed from the Cache.
+	 * 'revision' is the Cache revision which includes the change. */
+	typedef std::function<void(item_id_t id, FILE_EVENT_TYPE type,
+			const TrackInfo& info, revision_t revision)> track_subscriber_t;
+	/*! Called once the changes for 'revision' have been committed, ie after
+	 * the last track_subscriber_t call for that revision. */
+	typedef std::function<void(revision_t revision)> commit_subscriber_t;
+
+	/*! Stores file and tag information in an sqlite db. Receives file events
+	 * from a Listener and only queues a file for tagging when its
+	 * (inode, size, mtime) differs from what's already in the db, so that a
+	 * restart against an unchanged library doesn't touch TagLib at all.
+	 * Tracks are passed to the track subscriber via LoadTracks() and whenever
+	 * they're tagged or removed after that. */
+	class Cache {
+	public:
+		Cache(ev::default_loop* loop, const std::string& db_path,
+				track_subscriber_t subscriber,
+				commit_subscriber_t committed = commit_subscriber_t());
+		virtual ~Cache();
+
+		/*! Opens (creating if needed) the db and loads the stored file stats. */
+		bool Init();
+
+		/*! Passes each stored track to the subscriber. Not needed if the
+		 * subscriber already has the tracks for the current Revision(). */
+		bool LoadTracks();
+
+		/*! The revision of the tracks as of the last Flush(). */
+		revision_t Revision() const {
+			return revision;
+		}
+
+		/*! Moves to a new revision without changing any tracks, for a change
+		 * which clients only notice through the revision, eg reloaded
+		 * playlists. Unlike a Flush(), the commit_subscriber_t isn't called:
+		 * publishing the revision is up to the caller. Returns the new
+		 * revision, or the current one if it couldn't be stored. */
+		revision_t Bump();
+
+		/*! A subscriber_t for the Listener. New or modified files are queued
+		 * for tagging, unchanged files are skipped. */
+		void FileEvent(const std::string& path, FILE_EVENT_TYPE type,
+				const FileStat& stat);
+
+		/*! Removes any stored files which haven't been reported by the
+		 * Listener since Init(). Call after the Listener's initial scan to
+		 * drop files which were deleted while we weren't running. */
+		size_t Prune();
+
+		/*! Tags and stores up to 'max' queued files in a single transaction.
+		 * Returns the number of queued entries which were processed. This is
+		 * called automatically from the loop while files are queued. */
+		size_t Flush(size_t max);
+
+		/*! The number of files waiting to be tagged or removed. */
+		size_t Pending() const {
+			return queue.size();
+		}
+
+	private:
+		struct entry {
+			entry() : id(0), valid(false), seen(false), queued(false), removed(false) { }
+
+			item_id_t id;/* 0 if not in the db yet */
+			FileStat stat;
+			bool valid;/* whether the subscriber knows about this track */
+			bool seen, queued, removed;
+		};
+		typedef std::unordered_map<std::string, entry> files_t;
+
+		/* a change for the subscriber, held until its batch is committed */
+		struct event {
+			item_id_t id;
+			FILE_EVENT_TYPE type;
+			TrackInfo info;
+		};
+
+		void enqueue(const std::string& path, entry& e);
+		bool store(const std::string& path, entry& e);
+		bool remove(const std::string& path, entry& e);
+		void notify(item_id_t id, FILE_EVENT_TYPE type, const TrackInfo& info);
+		bool exec(const char* sql);
+		void cb_idle(ev::idle& idle, int revents);
+
+		const std::string db_path;
+		const track_subscriber_t subscriber;
+		const commit_subscriber_t committed;
+		files_t files;
+		std::deque<std::string> queue;
+
+		ev::idle idle;
+		ev::default_loop* loop;
+		sqlite3* db;
+		sqlite3_stmt *stmt_store, *stmt_remove, *stmt_revision;
+		revision_t revision;
+
+		/* the current Flush() batch: its changes, and the entries as they
+		 * were before it so that a failed commit can be undone */
+		std::vector<event> batch;
+		std::vector<std::pair<std::string, entry> > undo;
+	};
+}
+
+#endif
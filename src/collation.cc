@@ -0,0 +1,121 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctype.h>
+#include <string.h>
+
+#include "collation.h"
+
+namespace {
+	/* U+00C0 to U+00FF, whose UTF-8 is 0xC3 followed by 0x80 to 0xBF */
+	const char* const LATIN1[64] = {
+		"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+		"d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th", "ss",
+		"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+		"d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th", "y"
+	};
+
+	/* the first 8 bytes of a key, so that comparing these agrees with
+	 * comparing the keys unless they're equal */
+	uint64_t prefix(const char* key, size_t len) {
+		uint64_t out = 0;
+		for (size_t i = 0; i < 8; ++i) {
+			out = out << 8 | ((i < len) ? (uint8_t)key[i] : 0);
+		}
+		return out;
+	}
+}
+
+std::string adaapd::CollationKey(const char* str) {
+	std::string key;
+	bool space = true;/* drops leading spaces and repeats */
+	const unsigned char* c = (const unsigned char*)str;
+	while (*c != 0) {
+		char ascii[2] = { 0, 0 };
+		const char* folded;
+		if (*c < 0x80) {
+			if (isalnum(*c)) {
+				ascii[0] = tolower(*c);
+				folded = ascii;
+			} else {
+				folded = " ";
+			}
+			++c;
+		} else if (*c == 0xC3 && c[1] >= 0x80 && c[1] <= 0xBF) {
+			folded = LATIN1[c[1] - 0x80];
+			c += 2;
+		} else {
+			/* anything else sorts by its UTF-8, after ASCII */
+			key.push_back(*c++);
+			space = false;
+			continue;
+		}
+		if (folded[0] != ' ') {
+			key.append(folded);
+			space = false;
+		} else if (!space) {
+			key.push_back(' ');
+			space = true;
+		}
+	}
+	if (!key.empty() && key[key.size() - 1] == ' ') {
+		key.resize(key.size() - 1);
+	}
+	if (key.size() > 4 && key.compare(0, 4, "the ") == 0) {
+		key.erase(0, 4);
+	}
+	return key;
+}
+
+adaapd::Collation::Collation() {
+	Clear();
+}
+
+void adaapd::Collation::Clear() {
+	prefixes.clear();
+	offsets.assign(1, 0);
+	data.clear();
+}
+
+void adaapd::Collation::Update(const StringPool& pool) {
+	while (prefixes.size() < pool.Size()) {
+		std::string key = CollationKey(pool.Get(prefixes.size()));
+		prefixes.push_back(prefix(key.data(), key.size()));
+		data.append(key);
+		offsets.push_back(data.size());
+	}
+}
+
+int adaapd::Collation::Compare(str_id_t a, str_id_t b) const {
+	if (a == b) {
+		return 0;
+	} else if (prefixes[a] != prefixes[b]) {
+		return (prefixes[a] < prefixes[b]) ? -1 : 1;
+	}
+	/* the prefixes include the ends of keys shorter than 8 bytes */
+	size_t a_len = offsets[a + 1] - offsets[a], b_len = offsets[b + 1] - offsets[b];
+	if (a_len <= 8 && b_len <= 8) {
+		return (a_len == b_len) ? 0 : ((a_len < b_len) ? -1 : 1);
+	}
+	int cmp = memcmp(data.data() + offsets[a], data.data() + offsets[b],
+			(a_len < b_len) ? a_len : b_len);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (a_len == b_len) ? 0 : ((a_len < b_len) ? -1 : 1);
+}
@@ -0,0 +1,72 @@
+#ifndef _adaapd_collation_h_
+#define _adaapd_collation_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "track-store.h"
+
+namespace adaapd {
+	/*! The key which 'str' is sorted by: case and accents are folded (for
+	 * Latin-1 letters), runs of punctuation and spaces count as a single
+	 * space, and a leading "The " is dropped, so that "The Beatles" sorts
+	 * as "beatles" and "Björk" next to "Bjork". Keys compare with memcmp(). */
+	std::string CollationKey(const char* str);
+
+	/*! The CollationKey() of each string in a TrackStore's tag pool, so
+	 * that sorting by a string field compares precomputed keys rather than
+	 * folding strings in every comparison. Paths have a pool of their own,
+	 * so they don't get keys. Keys are packed into a single buffer,
+	 * with the first 8 bytes of each also kept as an integer which settles
+	 * most comparisons on its own.
+	 *
+	 * As with the pool, keys are only ever added: Update() computes them
+	 * for whatever was interned since the last call, once per distinct
+	 * string. */
+	class Collation {
+	public:
+		Collation();
+
+		/*! Computes keys for any strings added to 'pool' since last time. */
+		void Update(const StringPool& pool);
+
+		/*! Forgets all keys, eg when the pool has been replaced. */
+		void Clear();
+
+		/*! Compares the keys of strings 'a' and 'b', which must have been
+		 * Update()d. Returns <0, 0 or >0 as with strcmp(). */
+		int Compare(str_id_t a, str_id_t b) const;
+
+		/*! The number of strings with keys. */
+		size_t Size() const {
+			return prefixes.size();
+		}
+
+	private:
+		std::vector<uint64_t> prefixes;
+		std::vector<uint32_t> offsets;/* into data, one more than prefixes */
+		std::string data;
+	};
+}
+
+#endif
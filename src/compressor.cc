@@ -0,0 +1,199 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include <zlib.h>
+
+#include "compressor.h"
+#include "logging.h"
+
+/* DMAP is very repetitive, so the higher levels don't buy much */
+#define COMPRESS_LEVEL 6
+/* zlib's windowBits, +16 for a gzip wrapper */
+#define WINDOW_BITS 15
+#define GZIP_BITS 16
+
+#define OUT_CHUNK 65536
+
+namespace {
+	/* feeds each body piece to deflate() */
+	class deflater {
+	public:
+		deflater(z_stream& stream, std::string& out)
+			: stream(stream), out(out), ok(true) { }
+
+		void feed(const char* data, size_t len, int flush) {
+			stream.next_in = (Bytef*)data;
+			stream.avail_in = len;
+			do {
+				size_t used = out.size();
+				out.resize(used + OUT_CHUNK);
+				stream.next_out = (Bytef*)&out[used];
+				stream.avail_out = OUT_CHUNK;
+				int ret = deflate(&stream, flush);
+				out.resize(used + OUT_CHUNK - stream.avail_out);
+				if (ret == Z_STREAM_ERROR) {
+					ok = false;
+					return;
+				}
+			} while (stream.avail_out == 0);
+		}
+
+		void piece(const char* data, size_t len) {
+			if (ok) {
+				feed(data, len, Z_NO_FLUSH);
+			}
+		}
+
+		z_stream& stream;
+		std::string& out;
+		bool ok;
+	};
+}
+
+adaapd::Compressor::Compressor()
+	: stop(false), revision(0) {
+	thread = std::thread(std::bind(&Compressor::run, this));
+}
+
+adaapd::Compressor::~Compressor() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	wake.notify_all();
+	thread.join();
+}
+
+std::shared_ptr<const std::string> adaapd::Compressor::Get(revision_t revision_,
+		uint64_t variant, ENCODING encoding) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (revision_ != revision) {
+		return std::shared_ptr<const std::string>();
+	}
+	std::map<variant_t, entry_t>::const_iterator iter = entries.find(variant_t(variant, encoding));
+	if (iter == entries.end()) {
+		return std::shared_ptr<const std::string>();
+	}
+	return iter->second->data;
+}
+
+void adaapd::Compressor::Compress(revision_t revision_, uint64_t variant,
+		ENCODING encoding, const std::shared_ptr<const Response>& body,
+		compress_done_t done) {
+	std::unique_lock<std::mutex> guard(lock);
+	if (revision_ > revision) {
+		revision = revision_;
+		entries.clear();
+	}
+
+	job j;
+	if (revision_ < revision) {
+		/* an old snapshot, which nobody else will ask for */
+		j.entry.reset(new entry);
+	} else {
+		entry_t& e = entries[variant_t(variant, encoding)];
+		if (!e) {
+			e.reset(new entry);
+		} else if (e->data) {
+			std::shared_ptr<const std::string> data = e->data;
+			guard.unlock();
+			done(data);
+			return;
+		} else {
+			/* already on its way */
+			e->waiters.push_back(done);
+			return;
+		}
+		j.entry = e;
+	}
+	j.entry->waiters.push_back(done);
+	j.encoding = encoding;
+	j.body = body;
+	jobs.push_back(j);
+	wake.notify_one();
+}
+
+bool adaapd::Compressor::Deflate(const Response& body, ENCODING encoding, std::string& out) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	int bits = (encoding == ENCODING_GZIP) ? WINDOW_BITS + GZIP_BITS : WINDOW_BITS;
+	if (deflateInit2(&stream, COMPRESS_LEVEL, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		ERR("Unable to init zlib: %s", (stream.msg != NULL) ? stream.msg : "?");
+		return false;
+	}
+	/* roughly what listings compress to, to avoid most reallocations */
+	out.reserve(body.BodySize() / 4);
+
+	deflater d(stream, out);
+	body.ForEach(std::bind(&deflater::piece, &d, std::placeholders::_1,
+					std::placeholders::_2));
+	if (d.ok) {
+		d.feed(NULL, 0, Z_FINISH);
+	}
+	deflateEnd(&stream);
+	if (!d.ok) {
+		ERR("Failed to compress %lu bytes", (unsigned long)body.BodySize());
+	}
+	return d.ok;
+}
+
+void adaapd::Compressor::run() {
+	for (;;) {
+		job j;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (!stop && jobs.empty()) {
+				wake.wait(guard);
+			}
+			if (stop) {
+				return;
+			}
+			j = jobs.front();
+			jobs.pop_front();
+		}
+
+		std::shared_ptr<std::string> data(new std::string);
+		if (!Deflate(*j.body, j.encoding, *data)) {
+			data.reset();
+		}
+		j.body.reset();
+
+		std::vector<compress_done_t> waiters;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			waiters.swap(j.entry->waiters);
+			if (data) {
+				j.entry->data = data;
+			} else {
+				/* let the next request try again */
+				for (std::map<variant_t, entry_t>::iterator iter = entries.begin();
+					 iter != entries.end(); ++iter) {
+					if (iter->second == j.entry) {
+						entries.erase(iter);
+						break;
+					}
+				}
+			}
+		}
+		for (size_t i = 0; i < waiters.size(); ++i) {
+			waiters[i](data);
+		}
+	}
+}
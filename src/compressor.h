@@ -0,0 +1,99 @@
+#ifndef _adaapd_compressor_h_
+#define _adaapd_compressor_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server.h"
+#include "track-store.h"
+
+namespace adaapd {
+	enum ENCODING {
+		ENCODING_GZIP,
+		ENCODING_DEFLATE
+	};
+
+	/*! Called with the compressed body once it's ready, or with an empty
+	 * pointer if compression failed. Called from the compression thread, or
+	 * from within Compressor::Compress() if the result was already there. */
+	typedef std::function<void(const std::shared_ptr<const std::string>& data)> compress_done_t;
+
+	/*! Compresses response bodies on its own thread, and keeps the results
+	 * for the latest revision so that each one is only compressed once per
+	 * library change, however many clients ask for it. A body is identified
+	 * by its revision, the encoding and a caller-defined 'variant' (eg
+	 * which listing, with which fields). Thread-safe. */
+	class Compressor {
+	public:
+		Compressor();
+		virtual ~Compressor();
+
+		/*! Returns the compressed body if it's ready. */
+		std::shared_ptr<const std::string> Get(revision_t revision, uint64_t variant,
+				ENCODING encoding);
+
+		/*! Calls 'done' with the compressed 'body' once it's ready, which may
+		 * be right away. 'body' is only compressed if nobody else has
+		 * already asked for it. */
+		void Compress(revision_t revision, uint64_t variant, ENCODING encoding,
+				const std::shared_ptr<const Response>& body, compress_done_t done);
+
+		/*! Compresses 'body' on the calling thread. Returns false on error. */
+		static bool Deflate(const Response& body, ENCODING encoding, std::string& out);
+
+	private:
+		typedef std::pair<uint64_t, int> variant_t;
+		struct entry {
+			std::shared_ptr<const std::string> data;/* empty while pending */
+			std::vector<compress_done_t> waiters;
+		};
+		typedef std::shared_ptr<entry> entry_t;
+		struct job {
+			/* the waiters are answered even if the entry's been dropped
+			 * meanwhile for a newer revision */
+			entry_t entry;
+			ENCODING encoding;
+			std::shared_ptr<const Response> body;
+		};
+
+		void run();
+
+		std::mutex lock;
+		std::condition_variable wake;
+		bool stop;
+		std::deque<job> jobs;
+
+		/* everything for 'revision', which only moves forward */
+		revision_t revision;
+		std::map<variant_t, entry_t> entries;
+
+		std::thread thread;
+	};
+}
+
+#endif
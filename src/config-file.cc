@@ -16,6 +16,29 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <strings.h>
+
 #include "config-file.h"
+#include "config-yaml.h"
+#include "logging.h"
+
+#define DEFAULT_PORT 3689
+#define DEFAULT_CACHE_PATH "adaapd.db"
+#define DEFAULT_IMAGE_PATH "adaapd.img"
+
+adaapd::Config::Config()
+	: cache_path(DEFAULT_CACHE_PATH), image_path(DEFAULT_IMAGE_PATH),
+	  port(DEFAULT_PORT) { }
+
+adaapd::config_file_t adaapd::ConfigFile::Create(const std::string& path) {
+	if (HasExtension(path, "yaml") || HasExtension(path, "yml")) {
+		return config_file_t(new ConfigFile_Yaml(path));
+	}
+	ERR("Unsupported config file format: %s", path.c_str());
+	return config_file_t();
+}
 
-//TODO
+bool adaapd::HasExtension(const std::string& path, const char* ext) {
+	size_t dot = path.rfind('.');
+	return dot != std::string::npos && strcasecmp(path.c_str() + dot + 1, ext) == 0;
+}
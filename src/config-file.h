@@ -19,13 +19,23 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdint.h>
+
 #include <string>
 #include <memory>
 
 namespace adaapd {
-	/*! Representation of a configuration. */
-	class Config {
-		//TODO...
+	/*! Representation of a configuration. Options which aren't in the file
+	 * keep their defaults. */
+	struct Config {
+		Config();
+
+		std::string music_dir;
+		/* empty if there's no playlist file */
+		std::string playlist_path;
+		std::string cache_path;
+		std::string image_path;
+		uint16_t port;
 	};
 
 	class ConfigFile;
@@ -34,12 +44,27 @@ namespace adaapd {
 	/*! Accesses configuration in a file. */
 	class ConfigFile {
 	public:
-		static config_file_t Create(std::string& path);
+		/*! Returns a ConfigFile for 'path' in the format matching its
+		 * extension, or an empty pointer if the format isn't supported. */
+		static config_file_t Create(const std::string& path);
+
+		virtual ~ConfigFile() { }
 
 		virtual bool Read(Config& config) = 0;
 		virtual bool Write(const Config& config) = 0;
+
+		const std::string& Path() const {
+			return path;
+		}
+
+	protected:
+		ConfigFile(const std::string& path) : path(path) { }
+
+		const std::string path;
 	};
 
+	/*! Whether 'path' ends with '.ext', ignoring case. */
+	bool HasExtension(const std::string& path, const char* ext);
 }
 
 #endif
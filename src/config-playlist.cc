@@ -16,6 +16,179 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "config-playlist.h"
+#include "config-yaml.h"
+#include "logging.h"
+#include "trace.h"
+
+#define INVALID_FD -1
+/* only whole files: written and closed, moved in, or newly created */
+#define WATCH_MODE IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE
+#define INOTIFY_BUF_LEN (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+adaapd::playlist_file_t adaapd::PlaylistFile::Create(const std::string& path) {
+	if (HasExtension(path, "yaml") || HasExtension(path, "yml")) {
+		return playlist_file_t(new PlaylistFile_Yaml(path));
+	}
+	ERR("Unsupported playlist file format: %s", path.c_str());
+	return playlist_file_t();
+}
+
+adaapd::PlaylistReloader::PlaylistReloader(ev::default_loop* loop, Library& library,
+		playlist_file_t file, revision_source_t next_revision)
+	: library(library), file(file), next_revision(next_revision),
+	  inotify_fd(INVALID_FD), watch(*loop), generation(0), building(false),
+	  swapped(0), built(*loop) {
+	const std::string& path = file->Path();
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos) {
+		dir = ".";
+		name = path;
+	} else {
+		dir = (slash == 0) ? "/" : path.substr(0, slash);
+		name = path.substr(slash + 1);
+	}
+
+	built.set<PlaylistReloader, &PlaylistReloader::cb_built>(this);
+	built.start();
+}
+
+adaapd::PlaylistReloader::~PlaylistReloader() {
+	if (inotify_fd != INVALID_FD) {
+		watch.stop();
+		close(inotify_fd);
+		inotify_fd = INVALID_FD;
+	}
+	if (thread.joinable()) {
+		thread.join();
+	}
+	built.stop();
+}
+
+bool adaapd::PlaylistReloader::Init() {
+	/* a single watch on the directory, not a Listener: nothing below it
+	 * matters, and only events naming the file are looked at */
+	inotify_fd = inotify_init();
+	if (inotify_fd == INVALID_FD) {
+		ERR("Unable to init inotify_fd: %d/%s", errno, strerror(errno));
+		return false;
+	}
+	if (inotify_add_watch(inotify_fd, dir.c_str(), WATCH_MODE) == INVALID_FD) {
+		ERR("Unable to watch playlist directory %s: %d/%s",
+				dir.c_str(), errno, strerror(errno));
+		return false;
+	}
+	watch.set<PlaylistReloader, &PlaylistReloader::cb_watch>(this);
+	watch.start(inotify_fd, ev::READ);
+
+	struct stat sb;
+	if (stat(file->Path().c_str(), &sb) == 0) {
+		Reload();
+	}
+	return true;
+}
+
+void adaapd::PlaylistReloader::Reload() {
+	++generation;
+	if (!building) {
+		start();
+	}
+}
+
+void adaapd::PlaylistReloader::cb_watch(ev::io& /*io*/, int /*revents*/) {
+	char buf[INOTIFY_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len = read(inotify_fd, buf, sizeof(buf));
+	if (len < 0) {
+		ERR("Failed to read from inotify file %d: %d/%s",
+				inotify_fd, errno, strerror(errno));
+		return;
+	}
+
+	/* Removals aren't watched: eg an editor which writes a new file and
+	 * moves it over the old one keeps the current playlists until it's
+	 * back. Several events for the file make a single Reload(). */
+	bool changed = false;
+	for (ssize_t i = 0; i < len; ) {
+		const struct inotify_event* event = (const struct inotify_event*)&buf[i];
+		if (event->len != 0 && name == event->name) {
+			changed = true;
+		}
+		i += sizeof(struct inotify_event) + event->len;
+	}
+	if (changed) {
+		DEBUG("Playlist file %s changed, reloading", file->Path().c_str());
+		Reload();
+	}
+}
+
+void adaapd::PlaylistReloader::start() {
+	if (thread.joinable()) {
+		thread.join();
+	}
+	building = true;
+	thread = std::thread(std::bind(&PlaylistReloader::build, this, generation));
+}
+
+void adaapd::PlaylistReloader::build(size_t generation_) {
+	/* nothing here touches the Library's own state: the snapshot is
+	 * immutable, and the new set isn't shared until it's handed over */
+	trace::SetThreadName("playlist build");
+	TraceSpan span("playlist build", file->Path());
+	std::shared_ptr<const LibrarySnapshot> from = library.Published();
+	playlists_t specs;
+	bool ok = file->Read(specs);
+	std::unique_ptr<PlaylistSet> playlists;
+	if (ok) {
+		playlists.reset(new PlaylistSet);
+		if (!playlists->Load(specs, *from->tracks, from->paths.get())) {
+			ERR("Some playlists in %s are malformed and will be empty",
+					file->Path().c_str());
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(result_lock);
+	result.generation = generation_;
+	result.ok = ok;
+	result.specs.swap(specs);
+	result.playlists = std::move(playlists);
+	result.from = from;
+	built.send();
+}
+
+void adaapd::PlaylistReloader::cb_built(ev::async& /*async*/, int /*revents*/) {
+	result_t done;
+	{
+		std::lock_guard<std::mutex> lock(result_lock);
+		done.generation = result.generation;
+		done.ok = result.ok;
+		done.specs.swap(result.specs);
+		done.playlists = std::move(result.playlists);
+		done.from.swap(result.from);
+	}
+	thread.join();
+	building = false;
 
-//TODO
+	if (done.generation != generation) {
+		/* the file changed again while this was being built */
+		DEBUG("Dropping stale playlists from build %lu, now at %lu",
+				done.generation, generation);
+		start();
+		return;
+	}
+	if (!done.ok) {
+		ERR("Couldn't read playlist file %s, keeping current playlists",
+				file->Path().c_str());
+		return;
+	}
+	library.SwapPlaylists(done.specs, std::move(done.playlists), *done.from,
+			next_revision ? next_revision() : library.Revision());
+	++swapped;
+	LOG("Loaded %lu playlists from %s", done.specs.size(), file->Path().c_str());
+}
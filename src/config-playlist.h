@@ -19,15 +19,20 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <functional>
 #include <string>
-#include <list>
+#include <vector>
 #include <memory>
+#include <mutex>
+#include <thread>
+
+#include <ev++.h>
+
+#include "library.h"
+#include "playlist.h"
 
 namespace adaapd {
-	/*! Representation of a playlist spec. */
-	class Playlist {
-	};
-	typedef std::list<Playlist> playlists_t;
+	typedef std::vector<Playlist> playlists_t;
 
 	class PlaylistFile;
 	typedef std::shared_ptr<PlaylistFile> playlist_file_t;
@@ -35,15 +40,94 @@ namespace adaapd {
 	/*! Accesses playlist specs in a file. */
 	class PlaylistFile {
 	public:
-		static playlist_file_t Create(std::string& path, Subscriber& subscriber, libev_loop& loop);
+		/*! Returns a PlaylistFile for 'path' in the format matching its
+		 * extension, or an empty pointer if the format isn't supported. */
+		static playlist_file_t Create(const std::string& path);
+
+		virtual ~PlaylistFile() { }
 
 		virtual bool Read(playlists_t& list) = 0;
 		virtual bool Write(const playlists_t& list) = 0;
 
-	private:
+		const std::string& Path() const {
+			return path;
+		}
+
+	protected:
+		PlaylistFile(const std::string& path) : path(path) { }
+
 		const std::string path;
-		Listener listener;
-		Subscriber& subscriber;
+	};
+
+	/*! Returns a new revision for a set of swapped playlists, eg
+	 * Cache::Bump(). */
+	typedef std::function<revision_t()> revision_source_t;
+
+	/*! Reloads a Library's playlists whenever their PlaylistFile changes.
+	 *
+	 * The file is read and its playlists matched against the latest
+	 * published snapshot on a background thread, so that the loop thread
+	 * only has to catch up with whatever tracks changed meanwhile before
+	 * swapping the new set in, see Library::SwapPlaylists(). Until then,
+	 * clients keep being served the old playlists. Changes which arrive
+	 * during a build are coalesced into one more build once it's done, and
+	 * the result of a build which has been overtaken by such a change is
+	 * dropped rather than published. Each swap is published under a revision
+	 * from 'next_revision', or the Library's current one without it. */
+	class PlaylistReloader {
+	public:
+		PlaylistReloader(ev::default_loop* loop, Library& library, playlist_file_t file,
+				revision_source_t next_revision = revision_source_t());
+		virtual ~PlaylistReloader();
+
+		/*! Starts watching the file, which also loads it for the first time
+		 * if it exists. Returns false if its directory can't be watched. */
+		bool Init();
+
+		/*! Starts a build, or schedules another once the current one is
+		 * done. Only for the loop thread. */
+		void Reload();
+
+		/*! The number of builds which have been swapped into the Library. */
+		size_t Swapped() const {
+			return swapped;
+		}
+
+	private:
+		void cb_watch(ev::io& io, int revents);
+		void start();
+		void build(size_t generation);
+		void cb_built(ev::async& async, int revents);
+
+		Library& library;
+		const playlist_file_t file;
+		const revision_source_t next_revision;
+		/* the file's directory and its name within it: the directory is
+		 * watched so that a new file moved over it is picked up too */
+		std::string dir, name;
+		int inotify_fd;
+		ev::io watch;
+
+		/* bumped by each Reload(), a build is only kept if it's still the
+		 * latest one when it's done */
+		size_t generation;
+		bool building;
+		size_t swapped;
+		std::thread thread;
+
+		/* handed over from the build thread to the loop thread */
+		struct result_t {
+			result_t() : generation(0), ok(false) { }
+
+			size_t generation;
+			bool ok;
+			playlists_t specs;
+			std::unique_ptr<PlaylistSet> playlists;
+			std::shared_ptr<const LibrarySnapshot> from;
+		};
+		std::mutex result_lock;
+		result_t result;
+		ev::async built;
 	};
 }
 
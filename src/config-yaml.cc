@@ -16,6 +16,761 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <errno.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <yaml.h>
+
 #include "config-yaml.h"
+#include "logging.h"
+
+/* how deeply rules may be nested */
+#define MAX_DEPTH 32
+
+namespace {
+	struct field_name {
+		const char* name;
+		bool is_int;
+		int field;
+	};
+
+	const field_name FIELD_NAMES[] = {
+		{ "bpm", true, adaapd::BPM },
+		{ "bit_rate", true, adaapd::BIT_RATE },
+		{ "compilation", true, adaapd::COMPILATION },
+		{ "disc_count", true, adaapd::DISC_COUNT },
+		{ "disc_number", true, adaapd::DISC_NUMBER },
+		{ "relative_volume", true, adaapd::RELATIVE_VOLUME },
+		{ "sample_rate", true, adaapd::SAMPLE_RATE },
+		{ "size", true, adaapd::SIZE },
+		{ "time", true, adaapd::TIME },
+		{ "track_count", true, adaapd::TRACK_COUNT },
+		{ "track_number", true, adaapd::TRACK_NUMBER },
+		{ "rating", true, adaapd::USER_RATING },
+		{ "year", true, adaapd::YEAR },
+		{ "album", false, adaapd::ALBUM },
+		{ "artist", false, adaapd::ARTIST },
+		{ "comment", false, adaapd::COMMENT },
+		{ "composer", false, adaapd::COMPOSER },
+		{ "genre", false, adaapd::GENRE },
+		{ "title", false, adaapd::TITLE }
+	};
+	const size_t FIELD_COUNT = sizeof(FIELD_NAMES) / sizeof(field_name);
+
+	struct op_name {
+		const char* name;
+		adaapd::Rule::TYPE type;
+	};
+
+	const op_name OP_NAMES[] = {
+		{ "eq", adaapd::Rule::INT_EQ },
+		{ "ne", adaapd::Rule::INT_NE },
+		{ "lt", adaapd::Rule::INT_LT },
+		{ "le", adaapd::Rule::INT_LE },
+		{ "gt", adaapd::Rule::INT_GT },
+		{ "ge", adaapd::Rule::INT_GE },
+		{ "range", adaapd::Rule::INT_RANGE },
+		{ "is", adaapd::Rule::STR_IS },
+		{ "contains", adaapd::Rule::STR_CONTAINS },
+		{ "starts", adaapd::Rule::STR_STARTS },
+		{ "ends", adaapd::Rule::STR_ENDS },
+		{ "matches", adaapd::Rule::STR_MATCHES }
+	};
+	const size_t OP_COUNT = sizeof(OP_NAMES) / sizeof(op_name);
+
+	bool is_int_op(adaapd::Rule::TYPE type) {
+		return type >= adaapd::Rule::INT_EQ && type <= adaapd::Rule::INT_RANGE;
+	}
+
+	const field_name* find_field(const char* name) {
+		for (size_t i = 0; i < FIELD_COUNT; ++i) {
+			if (strcmp(name, FIELD_NAMES[i].name) == 0) {
+				return &FIELD_NAMES[i];
+			}
+		}
+		return NULL;
+	}
+
+	const char* field_of(const adaapd::Rule& rule) {
+		for (size_t i = 0; i < FIELD_COUNT; ++i) {
+			if (FIELD_NAMES[i].is_int == is_int_op(rule.type) &&
+					FIELD_NAMES[i].field == rule.field) {
+				return FIELD_NAMES[i].name;
+			}
+		}
+		return NULL;
+	}
+
+	const char* op_of(adaapd::Rule::TYPE type) {
+		for (size_t i = 0; i < OP_COUNT; ++i) {
+			if (OP_NAMES[i].type == type) {
+				return OP_NAMES[i].name;
+			}
+		}
+		return NULL;
+	}
+
+	/* Pulls events from libyaml one at a time. The values of scalars are
+	 * only valid until the next call to Next(). */
+	class yaml_reader {
+	public:
+		yaml_reader(const std::string& path)
+			: path(path), file(NULL), have_event(false) {
+			yaml_parser_initialize(&parser);
+		}
+		~yaml_reader() {
+			if (have_event) {
+				yaml_event_delete(&event);
+			}
+			yaml_parser_delete(&parser);
+			if (file != NULL) {
+				fclose(file);
+			}
+		}
+
+		bool Open() {
+			file = fopen(path.c_str(), "rb");
+			if (file == NULL) {
+				ERR("Unable to open %s: %d/%s", path.c_str(), errno, strerror(errno));
+				return false;
+			}
+			yaml_parser_set_input_file(&parser, file);
+			return true;
+		}
+
+		/* moves on to the next event, returning false on a syntax error */
+		bool Next() {
+			if (have_event) {
+				yaml_event_delete(&event);
+				have_event = false;
+			}
+			if (!yaml_parser_parse(&parser, &event)) {
+				ERR("%s:%lu: %s", path.c_str(), parser.problem_mark.line + 1,
+						(parser.problem != NULL) ? parser.problem : "syntax error");
+				return false;
+			}
+			have_event = true;
+			if (event.type == YAML_ALIAS_EVENT) {
+				return Fail("aliases aren't supported");
+			}
+			return true;
+		}
+
+		yaml_event_type_t Type() const {
+			return event.type;
+		}
+
+		/* the NUL-terminated value of the current scalar */
+		const char* Value() const {
+			return (const char*)event.data.scalar.value;
+		}
+		size_t Length() const {
+			return event.data.scalar.length;
+		}
+		bool Is(const char* value) const {
+			return strcmp(Value(), value) == 0;
+		}
+		/* a plain empty scalar, eg the root of an empty document */
+		bool IsNull() const {
+			return event.type == YAML_SCALAR_EVENT && event.data.scalar.length == 0 &&
+				event.data.scalar.plain_implicit;
+		}
+
+		size_t Line() const {
+			return event.start_mark.line + 1;
+		}
+
+		bool Expect(yaml_event_type_t type, const char* what) {
+			if (event.type != type) {
+				return Fail("expected", what);
+			}
+			return true;
+		}
+
+		bool Fail(const char* problem, const char* detail = NULL) {
+			return FailAt(Line(), problem, detail);
+		}
+		bool FailAt(size_t line, const char* problem, const char* detail = NULL) {
+			ERR("%s:%lu: %s%s%s", path.c_str(), line, problem,
+					(detail != NULL) ? " " : "", (detail != NULL) ? detail : "");
+			return false;
+		}
+
+	private:
+		const std::string path;
+		FILE* file;
+		yaml_parser_t parser;
+		yaml_event_t event;
+		bool have_event;
+	};
+
+	/* moves to the root node, setting 'empty' if there isn't one */
+	bool begin_document(yaml_reader& in, bool& empty) {
+		if (!in.Next() || !in.Expect(YAML_STREAM_START_EVENT, "start of stream") ||
+				!in.Next()) {
+			return false;
+		}
+		if (in.Type() == YAML_STREAM_END_EVENT) {
+			empty = true;
+			return true;
+		}
+		if (!in.Expect(YAML_DOCUMENT_START_EVENT, "start of document") || !in.Next()) {
+			return false;
+		}
+		empty = in.IsNull();
+		return true;
+	}
+
+	/* moves past the end of the root node, which must be the only one */
+	bool end_document(yaml_reader& in) {
+		if (!in.Next() || !in.Expect(YAML_DOCUMENT_END_EVENT, "end of document") ||
+				!in.Next()) {
+			return false;
+		}
+		if (in.Type() != YAML_STREAM_END_EVENT) {
+			return in.Fail("only one document is supported");
+		}
+		return true;
+	}
+
+	bool read_number(yaml_reader& in, adaapd::tag_int_t& value) {
+		if (!in.Expect(YAML_SCALAR_EVENT, "a number")) {
+			return false;
+		}
+		char* end;
+		errno = 0;
+		value = strtoll(in.Value(), &end, 10);
+		if (in.Length() == 0 || *end != 0 || errno != 0) {
+			return in.Fail("not a number:", in.Value());
+		}
+		return true;
+	}
+
+	/* a single comparison 'op' against the field, whose value is the
+	 * current node */
+	bool read_comparison(yaml_reader& in, const field_name& field, const char* op,
+			adaapd::Rule& rule) {
+		const op_name* found = NULL;
+		for (size_t i = 0; i < OP_COUNT; ++i) {
+			if (strcmp(op, OP_NAMES[i].name) == 0 && is_int_op(OP_NAMES[i].type) == field.is_int) {
+				found = &OP_NAMES[i];
+				break;
+			}
+		}
+		if (found == NULL) {
+			return in.Fail(field.is_int ? "unknown comparison for a number:" :
+					"unknown comparison for a string:", op);
+		}
+
+		if (!field.is_int) {
+			if (!in.Expect(YAML_SCALAR_EVENT, "a string")) {
+				return false;
+			}
+			if (found->type == adaapd::Rule::STR_MATCHES) {
+				/* caught here rather than when the playlist is compiled, so
+				 * that there's a line to go with it */
+				regex_t regex;
+				int err = regcomp(&regex, in.Value(), REG_EXTENDED | REG_ICASE | REG_NOSUB);
+				if (err != 0) {
+					char msg[256];
+					regerror(err, &regex, msg, sizeof(msg));
+					return in.Fail("bad regex:", msg);
+				}
+				regfree(&regex);
+			}
+			rule = adaapd::Rule::Str((adaapd::Tag_StrId)field.field, found->type,
+					std::string(in.Value(), in.Length()));
+			return true;
+		}
+
+		adaapd::tag_int_t lo, hi = 0;
+		if (found->type == adaapd::Rule::INT_RANGE) {
+			if (!in.Expect(YAML_SEQUENCE_START_EVENT, "a sequence of two numbers") ||
+					!in.Next() || !read_number(in, lo) ||
+					!in.Next() || !read_number(in, hi) || !in.Next()) {
+				return false;
+			}
+			if (in.Type() != YAML_SEQUENCE_END_EVENT) {
+				return in.Fail("a range has only two numbers");
+			}
+		} else if (!read_number(in, lo)) {
+			return false;
+		}
+		rule = adaapd::Rule::Int((adaapd::Tag_IntId)field.field, found->type, lo, hi);
+		return true;
+	}
+
+	/* the condition on a field, either a plain value or a mapping of
+	 * comparisons which must all hold */
+	bool read_condition(yaml_reader& in, const field_name& field, adaapd::Rule& rule) {
+		if (in.Type() == YAML_SCALAR_EVENT) {
+			return read_comparison(in, field, field.is_int ? "eq" : "is", rule);
+		}
+		if (!in.Expect(YAML_MAPPING_START_EVENT, "a value or a mapping of comparisons")) {
+			return false;
+		}
+		std::vector<adaapd::Rule> comparisons;
+		for (;;) {
+			if (!in.Next()) {
+				return false;
+			}
+			if (in.Type() == YAML_MAPPING_END_EVENT) {
+				break;
+			}
+			if (!in.Expect(YAML_SCALAR_EVENT, "a comparison")) {
+				return false;
+			}
+			std::string op(in.Value(), in.Length());
+			comparisons.push_back(adaapd::Rule());
+			if (!in.Next() || !read_comparison(in, field, op.c_str(), comparisons.back())) {
+				return false;
+			}
+		}
+		if (comparisons.empty()) {
+			return in.Fail("no comparisons for", field.name);
+		}
+		if (comparisons.size() == 1) {
+			rule = comparisons[0];
+		} else {
+			rule = adaapd::Rule::Group(adaapd::Rule::ALL);
+			rule.rules.swap(comparisons);
+		}
+		return true;
+	}
+
+	bool read_rule(yaml_reader& in, adaapd::Rule& rule, size_t depth) {
+		if (depth > MAX_DEPTH) {
+			return in.Fail("rules are nested too deeply");
+		}
+		if (!in.Expect(YAML_MAPPING_START_EVENT, "a rule") || !in.Next() ||
+				!in.Expect(YAML_SCALAR_EVENT, "all, any, not, in or a field name")) {
+			return false;
+		}
+		std::string key(in.Value(), in.Length());
+		if (!in.Next()) {
+			return false;
+		}
+
+		if (key == "all" || key == "any") {
+			rule = adaapd::Rule::Group((key == "all") ? adaapd::Rule::ALL : adaapd::Rule::ANY);
+			if (!in.Expect(YAML_SEQUENCE_START_EVENT, "a sequence of rules")) {
+				return false;
+			}
+			for (;;) {
+				if (!in.Next()) {
+					return false;
+				}
+				if (in.Type() == YAML_SEQUENCE_END_EVENT) {
+					break;
+				}
+				rule.rules.push_back(adaapd::Rule());
+				if (!read_rule(in, rule.rules.back(), depth + 1)) {
+					return false;
+				}
+			}
+		} else if (key == "not") {
+			rule = adaapd::Rule::Group(adaapd::Rule::NOT);
+			rule.rules.push_back(adaapd::Rule());
+			if (!read_rule(in, rule.rules.back(), depth + 1)) {
+				return false;
+			}
+		} else if (key == "in") {
+			if (!in.Expect(YAML_SCALAR_EVENT, "a playlist name")) {
+				return false;
+			}
+			rule = adaapd::Rule::In(std::string(in.Value(), in.Length()));
+		} else {
+			const field_name* field = find_field(key.c_str());
+			if (field == NULL) {
+				return in.Fail("unknown field:", key.c_str());
+			}
+			if (!read_condition(in, *field, rule)) {
+				return false;
+			}
+		}
+
+		if (!in.Next()) {
+			return false;
+		}
+		if (in.Type() != YAML_MAPPING_END_EVENT) {
+			return in.Fail("a rule has a single key, use 'all' to combine several");
+		}
+		return true;
+	}
+
+	bool read_paths(yaml_reader& in, std::vector<std::string>& paths) {
+		if (!in.Expect(YAML_SEQUENCE_START_EVENT, "a sequence of paths")) {
+			return false;
+		}
+		for (;;) {
+			if (!in.Next()) {
+				return false;
+			}
+			if (in.Type() == YAML_SEQUENCE_END_EVENT) {
+				return true;
+			}
+			if (!in.Expect(YAML_SCALAR_EVENT, "a path")) {
+				return false;
+			}
+			paths.push_back(std::string(in.Value(), in.Length()));
+		}
+	}
+
+	bool read_playlist(yaml_reader& in, adaapd::Playlist& playlist) {
+		if (!in.Expect(YAML_MAPPING_START_EVENT, "a playlist")) {
+			return false;
+		}
+		size_t line = in.Line();
+		bool has_rule = false, has_paths = false;
+		for (;;) {
+			if (!in.Next()) {
+				return false;
+			}
+			if (in.Type() == YAML_MAPPING_END_EVENT) {
+				break;
+			}
+			if (!in.Expect(YAML_SCALAR_EVENT, "name, rule or paths")) {
+				return false;
+			}
+			if (in.Is("name")) {
+				if (!in.Next() || !in.Expect(YAML_SCALAR_EVENT, "a playlist name")) {
+					return false;
+				}
+				playlist.name.assign(in.Value(), in.Length());
+			} else if (in.Is("rule")) {
+				if (!in.Next() || !read_rule(in, playlist.rule, 0)) {
+					return false;
+				}
+				has_rule = true;
+			} else if (in.Is("paths")) {
+				if (!in.Next() || !read_paths(in, playlist.paths)) {
+					return false;
+				}
+				has_paths = true;
+			} else {
+				return in.Fail("unknown playlist key:", in.Value());
+			}
+		}
+
+		if (playlist.name.empty()) {
+			return in.FailAt(line, "playlist has no name");
+		}
+		if (!has_rule) {
+			if (!has_paths) {
+				return in.FailAt(line, "playlist has neither a rule nor paths:",
+						playlist.name.c_str());
+			}
+			/* only the listed paths */
+			playlist.rule = adaapd::Rule::Group(adaapd::Rule::ANY);
+		}
+		return true;
+	}
+
+	/* Pushes events to libyaml one at a time, into a temporary file which
+	 * replaces the real one once it's complete. */
+	class yaml_writer {
+	public:
+		yaml_writer(const std::string& path)
+			: path(path), tmp_path(path + ".tmp"), file(NULL), ok(true) {
+			yaml_emitter_initialize(&emitter);
+		}
+		~yaml_writer() {
+			yaml_emitter_delete(&emitter);
+			if (file != NULL) {
+				fclose(file);
+				unlink(tmp_path.c_str());
+			}
+		}
+
+		bool Open() {
+			file = fopen(tmp_path.c_str(), "wb");
+			if (file == NULL) {
+				ERR("Unable to open %s: %d/%s", tmp_path.c_str(), errno, strerror(errno));
+				return false;
+			}
+			yaml_emitter_set_output_file(&emitter, file);
+			yaml_emitter_set_unicode(&emitter, 1);
+
+			yaml_event_t event;
+			yaml_stream_start_event_initialize(&event, YAML_UTF8_ENCODING);
+			emit(event);
+			yaml_document_start_event_initialize(&event, NULL, NULL, NULL, 1);
+			emit(event);
+			return ok;
+		}
+
+		void Scalar(const char* value, size_t len) {
+			yaml_event_t event;
+			yaml_scalar_event_initialize(&event, NULL, NULL, (yaml_char_t*)value, len,
+					1, 1, YAML_ANY_SCALAR_STYLE);
+			emit(event);
+		}
+		void Scalar(const std::string& value) {
+			Scalar(value.data(), value.size());
+		}
+		void Scalar(const char* value) {
+			Scalar(value, strlen(value));
+		}
+		void Number(adaapd::tag_int_t value) {
+			char buf[32];
+			Scalar(buf, snprintf(buf, sizeof(buf), "%lld", (long long)value));
+		}
+
+		void BeginMap(bool flow = false) {
+			yaml_event_t event;
+			yaml_mapping_start_event_initialize(&event, NULL, NULL, 1,
+					flow ? YAML_FLOW_MAPPING_STYLE : YAML_BLOCK_MAPPING_STYLE);
+			emit(event);
+		}
+		void EndMap() {
+			yaml_event_t event;
+			yaml_mapping_end_event_initialize(&event);
+			emit(event);
+		}
+		void BeginSeq(bool flow = false) {
+			yaml_event_t event;
+			yaml_sequence_start_event_initialize(&event, NULL, NULL, 1,
+					flow ? YAML_FLOW_SEQUENCE_STYLE : YAML_BLOCK_SEQUENCE_STYLE);
+			emit(event);
+		}
+		void EndSeq() {
+			yaml_event_t event;
+			yaml_sequence_end_event_initialize(&event);
+			emit(event);
+		}
+
+		void Fail(const char* problem) {
+			if (ok) {
+				ERR("Unable to write %s: %s", path.c_str(), problem);
+				ok = false;
+			}
+		}
+
+		bool Close() {
+			yaml_event_t event;
+			yaml_document_end_event_initialize(&event, 1);
+			emit(event);
+			yaml_stream_end_event_initialize(&event);
+			emit(event);
+			if (ok && !yaml_emitter_flush(&emitter)) {
+				Fail(emitter.problem);
+			}
+			if (fclose(file) != 0 && ok) {
+				Fail(strerror(errno));
+			}
+			file = NULL;
+			if (ok && rename(tmp_path.c_str(), path.c_str()) != 0) {
+				ERR("Unable to rename %s to %s: %d/%s",
+						tmp_path.c_str(), path.c_str(), errno, strerror(errno));
+				ok = false;
+			}
+			if (!ok) {
+				unlink(tmp_path.c_str());
+			}
+			return ok;
+		}
+
+	private:
+		/* the emitter frees the event whether or not it succeeds */
+		void emit(yaml_event_t& event) {
+			if (!ok) {
+				yaml_event_delete(&event);
+			} else if (!yaml_emitter_emit(&emitter, &event)) {
+				Fail((emitter.problem != NULL) ? emitter.problem : "emitter error");
+			}
+		}
+
+		const std::string path, tmp_path;
+		FILE* file;
+		yaml_emitter_t emitter;
+		bool ok;
+	};
+
+	void write_rule(yaml_writer& out, const adaapd::Rule& rule) {
+		out.BeginMap();
+		switch (rule.type) {
+		case adaapd::Rule::ALL:
+		case adaapd::Rule::ANY:
+			out.Scalar((rule.type == adaapd::Rule::ALL) ? "all" : "any");
+			out.BeginSeq();
+			for (size_t i = 0; i < rule.rules.size(); ++i) {
+				write_rule(out, rule.rules[i]);
+			}
+			out.EndSeq();
+			break;
+		case adaapd::Rule::NOT:
+			out.Scalar("not");
+			write_rule(out, rule.rules.empty() ? adaapd::Rule() : rule.rules[0]);
+			break;
+		case adaapd::Rule::IN:
+			out.Scalar("in");
+			out.Scalar(rule.text);
+			break;
+		default: {
+			const char* field = field_of(rule);
+			if (field == NULL) {
+				out.Fail("rule has an unknown field");
+				break;
+			}
+			out.Scalar(field);
+			out.BeginMap(true);
+			out.Scalar(op_of(rule.type));
+			if (rule.type == adaapd::Rule::INT_RANGE) {
+				out.BeginSeq(true);
+				out.Number(rule.value);
+				out.Number(rule.value2);
+				out.EndSeq();
+			} else if (is_int_op(rule.type)) {
+				out.Number(rule.value);
+			} else {
+				out.Scalar(rule.text);
+			}
+			out.EndMap();
+			break;
+		}
+		}
+		out.EndMap();
+	}
+}
+
+bool adaapd::ConfigFile_Yaml::Read(Config& config) {
+	yaml_reader in(path);
+	bool empty;
+	if (!in.Open() || !begin_document(in, empty)) {
+		return false;
+	}
+	if (empty) {
+		return true;
+	}
+	if (!in.Expect(YAML_MAPPING_START_EVENT, "a mapping of options")) {
+		return false;
+	}
+	for (;;) {
+		if (!in.Next()) {
+			return false;
+		}
+		if (in.Type() == YAML_MAPPING_END_EVENT) {
+			break;
+		}
+		if (!in.Expect(YAML_SCALAR_EVENT, "an option name")) {
+			return false;
+		}
+		std::string key(in.Value(), in.Length());
+		if (!in.Next()) {
+			return false;
+		}
+		if (key == "port") {
+			adaapd::tag_int_t port;
+			if (!read_number(in, port)) {
+				return false;
+			}
+			if (port <= 0 || port > 65535) {
+				return in.Fail("port out of range:", in.Value());
+			}
+			config.port = port;
+			continue;
+		}
+
+		std::string* value;
+		if (key == "music") {
+			value = &config.music_dir;
+		} else if (key == "playlists") {
+			value = &config.playlist_path;
+		} else if (key == "cache") {
+			value = &config.cache_path;
+		} else if (key == "image") {
+			value = &config.image_path;
+		} else {
+			return in.Fail("unknown option:", key.c_str());
+		}
+		if (!in.Expect(YAML_SCALAR_EVENT, "a path")) {
+			return false;
+		}
+		value->assign(in.Value(), in.Length());
+	}
+	return end_document(in);
+}
+
+bool adaapd::ConfigFile_Yaml::Write(const Config& config) {
+	yaml_writer out(path);
+	if (!out.Open()) {
+		return false;
+	}
+	out.BeginMap();
+	out.Scalar("music");
+	out.Scalar(config.music_dir);
+	if (!config.playlist_path.empty()) {
+		out.Scalar("playlists");
+		out.Scalar(config.playlist_path);
+	}
+	out.Scalar("cache");
+	out.Scalar(config.cache_path);
+	out.Scalar("image");
+	out.Scalar(config.image_path);
+	out.Scalar("port");
+	out.Number(config.port);
+	out.EndMap();
+	return out.Close();
+}
+
+bool adaapd::PlaylistFile_Yaml::Read(playlists_t& list) {
+	yaml_reader in(path);
+	bool empty;
+	if (!in.Open() || !begin_document(in, empty)) {
+		return false;
+	}
+	if (empty) {
+		return true;
+	}
+	if (!in.Expect(YAML_SEQUENCE_START_EVENT, "a sequence of playlists")) {
+		return false;
+	}
+	for (;;) {
+		if (!in.Next()) {
+			return false;
+		}
+		if (in.Type() == YAML_SEQUENCE_END_EVENT) {
+			break;
+		}
+		list.push_back(Playlist());
+		if (!read_playlist(in, list.back())) {
+			return false;
+		}
+	}
+	return end_document(in);
+}
 
-//TODO
+bool adaapd::PlaylistFile_Yaml::Write(const playlists_t& list) {
+	yaml_writer out(path);
+	if (!out.Open()) {
+		return false;
+	}
+	out.BeginSeq();
+	for (size_t i = 0; i < list.size(); ++i) {
+		const Playlist& playlist = list[i];
+		out.BeginMap();
+		out.Scalar("name");
+		out.Scalar(playlist.name);
+		/* a paths-only playlist is read back with an empty ANY rule */
+		if (playlist.paths.empty() || playlist.rule.type != Rule::ANY ||
+				!playlist.rule.rules.empty()) {
+			out.Scalar("rule");
+			write_rule(out, playlist.rule);
+		}
+		if (!playlist.paths.empty()) {
+			out.Scalar("paths");
+			out.BeginSeq();
+			for (size_t j = 0; j < playlist.paths.size(); ++j) {
+				out.Scalar(playlist.paths[j]);
+			}
+			out.EndSeq();
+		}
+		out.EndMap();
+	}
+	out.EndSeq();
+	return out.Close();
+}
@@ -23,16 +23,51 @@
 #include "config-file.h"
 
 namespace adaapd {
-	/*! Accesses configuration in a file. */
+	/*! Accesses configuration in a YAML file, a mapping of option names to
+	 * values:
+	 *
+	 *   music: /path/to/music
+	 *   playlists: /path/to/playlists.yaml
+	 *   cache: adaapd.db
+	 *   image: adaapd.img
+	 *   port: 3689
+	 *
+	 * Problems are logged along with the line they're on. */
 	class ConfigFile_Yaml : public ConfigFile {
 	public:
+		ConfigFile_Yaml(const std::string& path) : ConfigFile(path) { }
+
 		bool Read(Config& config);
 		bool Write(const Config& config);
 	};
 
-	/*! Accesses playlist specs in a file. */
+	/*! Accesses playlist specs in a YAML file, a sequence of playlists each
+	 * with a name and a rule, a list of paths, or both:
+	 *
+	 *   - name: Nineties rock
+	 *     rule:
+	 *       all:
+	 *         - genre: {contains: rock}
+	 *         - year: {range: [1990, 1999]}
+	 *         - not: {in: Christmas}
+	 *   - name: Favourites
+	 *     paths:
+	 *       - /music/a.mp3
+	 *       - /music/b.mp3
+	 *
+	 * A rule is a mapping with one of all/any (a sequence of rules), not (a
+	 * rule), in (a playlist name), or a field name. A field's value is
+	 * either compared for equality, or given as a mapping of one or more
+	 * comparisons: is/contains/starts/ends/matches for strings, and
+	 * eq/ne/lt/le/gt/ge/range for numbers.
+	 *
+	 * The file is decoded as it's parsed, without building a document tree
+	 * first, so a long list of paths costs little more than the strings
+	 * themselves. Problems are logged along with the line they're on. */
 	class PlaylistFile_Yaml : public PlaylistFile {
 	public:
+		PlaylistFile_Yaml(const std::string& path) : PlaylistFile(path) { }
+
 		bool Read(playlists_t& list);
 		bool Write(const playlists_t& list);
 	};
@@ -0,0 +1,166 @@
+#ifndef _adaapd_daap_sm_h_
+#define _adaapd_daap_sm_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <string>
+
+namespace adaapd {
+	/*! A range of bytes within the buffer passed to DaapRequest::Parse(). */
+	struct Span {
+		Span() : off(0), len(0) { }
+
+		uint16_t off, len;
+	};
+
+	enum DAAP_METHOD {
+		METHOD_GET,
+		METHOD_HEAD,
+		METHOD_POST
+	};
+
+	/*! Query parameters which DAAP requests care about. */
+	enum DAAP_PARAM {
+		PARAM_META,
+		PARAM_QUERY,
+		PARAM_SESSION_ID,
+		PARAM_REVISION_NUMBER,
+		PARAM_DELTA,
+		PARAM_TYPE,
+		PARAM_GROUP_TYPE,
+		PARAM_SORT,
+		PARAM_INDEX,
+		PARAM_FILTER
+	};
+	static const int DAAP_PARAM_COUNT = PARAM_FILTER + 1;
+
+	/*! Headers which DAAP requests care about. Connection is folded into
+	 * KeepAlive() and Content-Length into ContentLength(). */
+	enum DAAP_HEADER {
+		HEADER_ACCEPT_ENCODING,
+		HEADER_CLIENT_DAAP_VERSION,
+		HEADER_RANGE
+	};
+	static const int DAAP_HEADER_COUNT = HEADER_RANGE + 1;
+
+	/*! Incremental parser for the request line and headers of a single DAAP
+	 * (HTTP/1.x) request, generated by Ragel from daap-sm.rl.
+	 *
+	 * Nothing is copied: the results are Spans into the caller's buffer, which
+	 * must start at the first byte of the request. The buffer may be
+	 * reallocated between calls to Parse() as long as the bytes already passed
+	 * in don't change. All state lives in this small fixed-size object, so a
+	 * client connection can simply embed one and Reset() it for each request. */
+	class DaapRequest {
+	public:
+		enum RESULT {
+			INCOMPLETE,/* need more bytes */
+			COMPLETE,/* headers done, Size() is the header length */
+			INVALID,/* malformed request */
+			TOO_LARGE/* headers don't fit in MAX_SIZE */
+		};
+
+		/*! The largest request line + headers we're willing to buffer. */
+		static const uint16_t MAX_SIZE = 8192;
+
+		DaapRequest() {
+			Reset();
+		}
+
+		/*! Prepares for parsing a new request. */
+		void Reset();
+
+		/*! Parses the bytes in buf[0, len) which haven't been seen by a
+		 * previous call. Once COMPLETE, anything after Size() belongs to the
+		 * body or to the next pipelined request. */
+		RESULT Parse(const char* buf, size_t len);
+
+		/*! The number of bytes consumed so far. */
+		size_t Size() const {
+			return parsed;
+		}
+
+		DAAP_METHOD Method() const {
+			return (DAAP_METHOD)method;
+		}
+
+		/*! Whether the connection should stay open after the response, from
+		 * the HTTP version and any Connection header. */
+		bool KeepAlive() const {
+			return keep_alive;
+		}
+
+		uint32_t ContentLength() const {
+			return content_length;
+		}
+
+		/*! The path portion of the request URI, still percent-encoded. */
+		const Span& Path() const {
+			return path;
+		}
+
+		/*! Whether 'param' was present in the query string, with or without
+		 * a value. */
+		bool HasParam(DAAP_PARAM param) const {
+			return params[param].off != 0;
+		}
+		/*! The value of 'param', still percent-encoded. */
+		const Span& Param(DAAP_PARAM param) const {
+			return params[param];
+		}
+
+		bool HasHeader(DAAP_HEADER header) const {
+			return headers[header].off != 0;
+		}
+		/*! The value of 'header', with surrounding whitespace trimmed. */
+		const Span& Header(DAAP_HEADER header) const {
+			return headers[header];
+		}
+
+		/*! Parses a decimal value, eg session-id or revision-number. */
+		static bool ToUInt(const char* buf, const Span& span, uint32_t& out);
+
+		/*! Returns a copy of 'span' with any %XX or '+' escapes decoded. */
+		static std::string Decode(const char* buf, const Span& span);
+
+	private:
+		void param(const char* buf, uint16_t end);
+		void header(const char* buf, uint16_t end);
+		void finish();
+
+		int cs;
+		uint16_t parsed;
+
+		/* marks for the param/header currently being parsed */
+		uint16_t param_start, param_eq;
+		uint16_t header_start, header_colon;
+
+		uint8_t method, version_minor, connection;
+		bool keep_alive, invalid;
+		uint32_t content_length;
+
+		Span path;
+		Span params[DAAP_PARAM_COUNT];
+		Span headers[DAAP_HEADER_COUNT];
+	};
+}
+
+#endif
@@ -0,0 +1,307 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <strings.h>
+
+#include "daap-sm.h"
+
+/* values for 'connection' */
+#define CONNECTION_DEFAULT 0
+#define CONNECTION_CLOSE 1
+#define CONNECTION_KEEP_ALIVE 2
+
+/* header ids which aren't exposed as a DAAP_HEADER */
+#define HEADER_CONNECTION -1
+#define HEADER_CONTENT_LENGTH -2
+
+%%{
+	machine daap_request;
+
+	action param_start { param_start = p - buf; param_eq = 0; }
+	action param_eq { param_eq = p - buf; }
+	action param_end { param(buf, p - buf); }
+
+	action path_start { path.off = p - buf; }
+	action path_end { path.len = p - buf - path.off; }
+
+	action header_start { header_start = p - buf; }
+	action header_colon { header_colon = p - buf; }
+	action header_end { header(buf, p - buf); }
+
+	action done {
+		finish();
+		fbreak;
+	}
+
+	CRLF = "\r"? "\n";
+
+	method =
+		"GET" @{ method = adaapd::METHOD_GET; } |
+		"HEAD" @{ method = adaapd::METHOD_HEAD; } |
+		"POST" @{ method = adaapd::METHOD_POST; };
+
+	version = "HTTP/1." (
+		"0" @{ version_minor = 0; } |
+		"1" @{ version_minor = 1; } );
+
+	# The query string is split into name[=value] pairs as it goes by. Values
+	# may contain '=' but names may not.
+	path = ( "/" ( any - ( cntrl | space | "?" | "#" ) )* ) >path_start %path_end;
+	name_char = any - ( cntrl | space | "&" | "=" | "#" );
+	value_char = any - ( cntrl | space | "&" | "#" );
+	param = ( name_char+ >param_start ( "=" @param_eq value_char* )? ) %param_end;
+	query = param? ( "&" param? )*;
+	fragment = "#" ( any - ( cntrl | space ) )*;
+
+	request_line = method " " path ( "?" query )? fragment? " " version CRLF;
+
+	# Header values start right after the ':' and are trimmed in header().
+	field_char = any - ( cntrl | space | ":" );
+	text_char = ( any - cntrl ) | "\t";
+	header = ( field_char+ >header_start ":" @header_colon text_char* ) %header_end CRLF;
+
+	main := request_line header* CRLF @done;
+}%%
+
+%% write data;
+
+namespace {
+	struct name_t {
+		const char* name;
+		size_t len;
+		int id;
+	};
+#define NAME(str, id) { str, sizeof(str) - 1, id }
+
+	const name_t PARAM_NAMES[] = {
+		NAME("meta", adaapd::PARAM_META),
+		NAME("query", adaapd::PARAM_QUERY),
+		NAME("session-id", adaapd::PARAM_SESSION_ID),
+		NAME("revision-number", adaapd::PARAM_REVISION_NUMBER),
+		NAME("delta", adaapd::PARAM_DELTA),
+		NAME("type", adaapd::PARAM_TYPE),
+		NAME("group-type", adaapd::PARAM_GROUP_TYPE),
+		NAME("sort", adaapd::PARAM_SORT),
+		NAME("index", adaapd::PARAM_INDEX),
+		NAME("filter", adaapd::PARAM_FILTER)
+	};
+
+	const name_t HEADER_NAMES[] = {
+		NAME("Connection", HEADER_CONNECTION),
+		NAME("Content-Length", HEADER_CONTENT_LENGTH),
+		NAME("Accept-Encoding", adaapd::HEADER_ACCEPT_ENCODING),
+		NAME("Client-DAAP-Version", adaapd::HEADER_CLIENT_DAAP_VERSION),
+		NAME("Range", adaapd::HEADER_RANGE)
+	};
+#undef NAME
+
+	int find_name(const name_t* names, size_t count, const char* str, size_t len,
+			bool ignore_case) {
+		for (size_t i = 0; i < count; ++i) {
+			if (names[i].len != len) {
+				continue;
+			}
+			if (ignore_case ? strncasecmp(names[i].name, str, len) == 0 :
+					memcmp(names[i].name, str, len) == 0) {
+				return names[i].id;
+			}
+		}
+		return -100;
+	}
+
+	/* whether the comma-separated list in str[0, len) contains 'token' */
+	bool has_token(const char* str, size_t len, const char* token) {
+		size_t token_len = strlen(token);
+		const char* end = str + len;
+		while (str < end) {
+			while (str < end && (*str == ' ' || *str == '\t' || *str == ',')) {
+				++str;
+			}
+			const char* start = str;
+			while (str < end && *str != ',') {
+				++str;
+			}
+			const char* tok_end = str;
+			while (tok_end > start && (tok_end[-1] == ' ' || tok_end[-1] == '\t')) {
+				--tok_end;
+			}
+			if ((size_t)(tok_end - start) == token_len &&
+					strncasecmp(start, token, token_len) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	int hex_val(char c) {
+		if (c >= '0' && c <= '9') {
+			return c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			return c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			return c - 'A' + 10;
+		}
+		return -1;
+	}
+}
+
+void adaapd::DaapRequest::Reset() {
+	%% write init;
+	parsed = 0;
+	param_start = param_eq = 0;
+	header_start = header_colon = 0;
+	method = METHOD_GET;
+	version_minor = 0;
+	connection = CONNECTION_DEFAULT;
+	keep_alive = false;
+	invalid = false;
+	content_length = 0;
+	path = Span();
+	for (int i = 0; i < DAAP_PARAM_COUNT; ++i) {
+		params[i] = Span();
+	}
+	for (int i = 0; i < DAAP_HEADER_COUNT; ++i) {
+		headers[i] = Span();
+	}
+}
+
+adaapd::DaapRequest::RESULT adaapd::DaapRequest::Parse(const char* buf, size_t len) {
+	if (invalid || cs == daap_request_error) {
+		return INVALID;
+	}
+	if (cs >= daap_request_first_final) {
+		return COMPLETE;
+	}
+
+	/* everything past MAX_SIZE is ignored, so that offsets fit in a Span */
+	if (len > MAX_SIZE) {
+		len = MAX_SIZE;
+	}
+	const char* p = buf + parsed;
+	const char* pe = buf + len;
+
+	%% write exec;
+
+	parsed = p - buf;
+	if (invalid || cs == daap_request_error) {
+		return INVALID;
+	}
+	if (cs >= daap_request_first_final) {
+		return COMPLETE;
+	}
+	return (parsed >= MAX_SIZE) ? TOO_LARGE : INCOMPLETE;
+}
+
+bool adaapd::DaapRequest::ToUInt(const char* buf, const Span& span, uint32_t& out) {
+	if (span.len == 0 || span.len > 10) {
+		return false;
+	}
+	uint64_t val = 0;
+	for (const char* c = buf + span.off; c < buf + span.off + span.len; ++c) {
+		if (*c < '0' || *c > '9') {
+			return false;
+		}
+		val = val * 10 + (*c - '0');
+	}
+	if (val > UINT32_MAX) {
+		return false;
+	}
+	out = val;
+	return true;
+}
+
+std::string adaapd::DaapRequest::Decode(const char* buf, const Span& span) {
+	std::string out;
+	out.reserve(span.len);
+	const char* c = buf + span.off;
+	const char* end = c + span.len;
+	while (c < end) {
+		int hi, lo;
+		if (*c == '%' && end - c >= 3 &&
+				(hi = hex_val(c[1])) >= 0 && (lo = hex_val(c[2])) >= 0) {
+			out.push_back((char)(hi << 4 | lo));
+			c += 3;
+		} else {
+			out.push_back((*c == '+') ? ' ' : *c);
+			++c;
+		}
+	}
+	return out;
+}
+
+void adaapd::DaapRequest::param(const char* buf, uint16_t end) {
+	uint16_t name_end = (param_eq != 0) ? param_eq : end;
+	int id = find_name(PARAM_NAMES, sizeof(PARAM_NAMES) / sizeof(name_t),
+			buf + param_start, name_end - param_start, false);
+	if (id < 0) {
+		return;/* not one of ours */
+	}
+	/* a value-less param is still marked as present, with an empty value */
+	params[id].off = (param_eq != 0) ? param_eq + 1 : end;
+	params[id].len = end - params[id].off;
+}
+
+void adaapd::DaapRequest::header(const char* buf, uint16_t end) {
+	uint16_t start = header_colon + 1;
+	while (start < end && (buf[start] == ' ' || buf[start] == '\t')) {
+		++start;
+	}
+	while (end > start && (buf[end - 1] == ' ' || buf[end - 1] == '\t')) {
+		--end;
+	}
+	Span value;
+	value.off = start;
+	value.len = end - start;
+
+	int id = find_name(HEADER_NAMES, sizeof(HEADER_NAMES) / sizeof(name_t),
+			buf + header_start, header_colon - header_start, true);
+	switch (id) {
+	case HEADER_CONNECTION:
+		if (has_token(buf + value.off, value.len, "close")) {
+			connection = CONNECTION_CLOSE;
+		} else if (has_token(buf + value.off, value.len, "keep-alive")) {
+			connection = CONNECTION_KEEP_ALIVE;
+		}
+		break;
+	case HEADER_CONTENT_LENGTH:
+		if (!ToUInt(buf, value, content_length)) {
+			invalid = true;
+		}
+		break;
+	default:
+		if (id >= 0) {
+			headers[id] = value;
+		}
+		break;
+	}
+}
+
+void adaapd::DaapRequest::finish() {
+	switch (connection) {
+	case CONNECTION_CLOSE:
+		keep_alive = false;
+		break;
+	case CONNECTION_KEEP_ALIVE:
+		keep_alive = true;
+		break;
+	default:
+		keep_alive = (version_minor >= 1);
+		break;
+	}
+}
@@ -0,0 +1,866 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "daap.h"
+#include "dmap.h"
+#include "logging.h"
+
+/* open files kept around per worker, for clients which seek */
+#define FILE_CACHE_SIZE 64
+
+#define MAX_EXT_LEN 7
+
+#define SERVER_NAME "adaapd"
+#define DMAP_VERSION 0x00020000/* 2.0 */
+#define DAAP_VERSION 0x00030000/* 3.0 */
+#define SESSION_TIMEOUT_SECS 1800
+
+/* the one database and its base playlist */
+#define DATABASE_ID 1
+#define BASE_PLAYLIST_ID 1
+/* the Library's playlists follow, in order */
+#define FIRST_PLAYLIST_ID 2
+
+
+/* the size of a listing's mstt/muty/mtco/mrco/mlcl fields, up to the items */
+#define HEADER_SIZES (12 + 9 + 12 + 12 + adaapd::dmap::HEADER_SIZE)
+
+/* distinct meta= field sets to keep an EncodePlan for */
+#define MAX_PLANS 64
+
+/* responses smaller than this aren't worth compressing */
+#define MIN_COMPRESS_SIZE 1024
+
+/* the listings which are compressed, for the Compressor 'variant' along with
+ * their fields */
+#define VARIANT_ITEMS 1
+#define VARIANT_CONTAINER_ITEMS 2
+#define VARIANT_BROWSE 3
+
+namespace {
+	/* parses a decimal number from [*c, end), advancing *c past it */
+	bool parse_num(const char** c, const char* end, uint64_t& out) {
+		const char* start = *c;
+		out = 0;
+		while (*c < end && **c >= '0' && **c <= '9' && *c - start < 19) {
+			out = out * 10 + (**c - '0');
+			++*c;
+		}
+		return *c != start;
+	}
+
+	/* matches "literal" at [*c, end), advancing *c past it */
+	bool skip(const char** c, const char* end, const char* literal) {
+		size_t len = strlen(literal);
+		if ((size_t)(end - *c) < len || memcmp(*c, literal, len) != 0) {
+			return false;
+		}
+		*c += len;
+		return true;
+	}
+
+	enum RANGE_RESULT {
+		RANGE_NONE,/* missing or unsupported: send everything */
+		RANGE_OK,
+		RANGE_UNSATISFIABLE
+	};
+
+	/* Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+	 * range against a file of 'size' bytes. Multiple ranges would need a
+	 * multipart response, so they're ignored in favor of the whole file, as
+	 * HTTP allows. */
+	RANGE_RESULT parse_range(const char* c, const char* end, uint64_t size,
+			uint64_t& first, uint64_t& last) {
+		if (!skip(&c, end, "bytes=") || memchr(c, ',', end - c) != NULL) {
+			return RANGE_NONE;
+		}
+		if (skip(&c, end, "-")) {
+			uint64_t suffix;
+			if (!parse_num(&c, end, suffix) || c != end) {
+				return RANGE_NONE;
+			}
+			if (suffix == 0 || size == 0) {
+				return RANGE_UNSATISFIABLE;
+			}
+			first = (suffix < size) ? size - suffix : 0;
+			last = size - 1;
+			return RANGE_OK;
+		}
+		if (!parse_num(&c, end, first) || !skip(&c, end, "-")) {
+			return RANGE_NONE;
+		}
+		if (c == end) {
+			last = size - 1;
+		} else if (!parse_num(&c, end, last) || c != end || last < first) {
+			return RANGE_NONE;
+		} else if (last >= size) {
+			last = size - 1;
+		}
+		return (first < size) ? RANGE_OK : RANGE_UNSATISFIABLE;
+	}
+
+	/* Whether the Accept-Encoding list in [c, end) contains 'coding' without
+	 * a zero q-value, eg "gzip", "gzip;q=0.5" but not "gzip;q=0". */
+	bool accepts_coding(const char* c, const char* end, const char* coding) {
+		size_t len = strlen(coding);
+		while (c < end) {
+			while (c < end && (*c == ' ' || *c == '\t' || *c == ',')) {
+				++c;
+			}
+			const char* start = c;
+			while (c < end && *c != ',' && *c != ';' && *c != ' ' && *c != '\t') {
+				++c;
+			}
+			bool match = ((size_t)(c - start) == len && strncasecmp(start, coding, len) == 0);
+			bool zero = false;
+			while (c < end && *c != ',') {
+				if ((*c == 'q' || *c == 'Q') && end - c >= 3 && c[1] == '=') {
+					const char* q = c + 2;
+					zero = (*q == '0');
+					for (++q; zero && q < end && *q != ',' && *q != ';'; ++q) {
+						zero = (*q == '.' || *q == '0' || *q == ' ');
+					}
+				}
+				++c;
+			}
+			if (match) {
+				return !zero;
+			}
+		}
+		return false;
+	}
+
+	const char* encoding_name(adaapd::ENCODING encoding) {
+		return (encoding == adaapd::ENCODING_GZIP) ? "gzip" : "deflate";
+	}
+
+	/* the ids of all tracks */
+	void live(const adaapd::TrackStore& tracks, std::vector<adaapd::item_id_t>& ids) {
+		ids.reserve(tracks.Size());
+		for (adaapd::item_id_t id = 0; id < tracks.End(); ++id) {
+			if (tracks.Has(id)) {
+				ids.push_back(id);
+			}
+		}
+	}
+
+	/* the size of write_deleted() */
+	size_t deleted_size(const std::vector<adaapd::item_id_t>& deleted) {
+		return deleted.empty() ? 0 : adaapd::dmap::HEADER_SIZE + deleted.size() * 12;
+	}
+
+	/* lists the ids which were removed since a delta revision */
+	void write_deleted(std::string& out, const std::vector<adaapd::item_id_t>& deleted) {
+		if (deleted.empty()) {
+			return;
+		}
+		size_t mudl = adaapd::dmap::Begin(out, "mudl");
+		for (size_t i = 0; i < deleted.size(); ++i) {
+			adaapd::dmap::Int(out, "miid", deleted[i]);
+		}
+		adaapd::dmap::End(out, mudl);
+	}
+
+	/* Writes the fields of a listing up to its entries, which are
+	 * 'items_size' bytes, followed by write_deleted(). */
+	void listing(std::string& out, const char* code, uint32_t total, uint32_t returned,
+			uint64_t items_size, const std::vector<adaapd::item_id_t>& deleted) {
+		adaapd::dmap::Container(out, code, HEADER_SIZES + items_size + deleted_size(deleted));
+		adaapd::dmap::Int(out, "mstt", 200);
+		adaapd::dmap::Byte(out, "muty", 0);
+		adaapd::dmap::Int(out, "mtco", total);
+		adaapd::dmap::Int(out, "mrco", returned);
+		adaapd::dmap::Container(out, "mlcl", items_size);
+	}
+
+	const char* content_type(const char* ext) {
+		if (strcasecmp(ext, "mp3") == 0) {
+			return "audio/mpeg";
+		} else if (strcasecmp(ext, "m4a") == 0 || strcasecmp(ext, "mp4") == 0) {
+			return "audio/mp4";
+		} else if (strcasecmp(ext, "ogg") == 0) {
+			return "audio/ogg";
+		} else if (strcasecmp(ext, "flac") == 0) {
+			return "audio/flac";
+		}
+		return "application/octet-stream";
+	}
+}
+
+adaapd::Daap::Daap(Library& library, ev::loop_ref loop, Compressor* compressor)
+	: library(library), reader(library), files(FILE_CACHE_SIZE),
+	  wakeup(loop), compressor(compressor), inbox(new inbox_t), ready(loop),
+	  next_session(0) {
+	wakeup.set<Daap, &Daap::cb_wakeup>(this);
+	wakeup.start();
+	subscription = library.Subscribe(std::bind(&ev::async::send, &wakeup));
+
+	inbox->ready = &ready;
+	ready.set<Daap, &Daap::cb_compressed>(this);
+	ready.start();
+}
+
+adaapd::Daap::~Daap() {
+	library.Unsubscribe(subscription);
+	wakeup.stop();
+
+	/* anything still being compressed is dropped when it's delivered */
+	std::lock_guard<std::mutex> guard(inbox->lock);
+	inbox->ready = NULL;
+	inbox->done.clear();
+	ready.stop();
+}
+
+void adaapd::Daap::Handle(const char* buf, const DaapRequest& request,
+		Response& response) {
+	const LibrarySnapshot& snapshot = reader.Get();
+	const char* c = buf + request.Path().off;
+	const char* end = c + request.Path().len;
+
+	uint64_t db, id;
+	if (skip(&c, end, "/databases/")) {
+		if (!parse_num(&c, end, db) || db != DATABASE_ID) {
+			response.status = 404;
+		} else if (c == end) {
+			response.status = 404;
+		} else if (skip(&c, end, "/items")) {
+			if (c == end) {
+				items(snapshot, buf, request, response);
+			} else if (skip(&c, end, "/") && parse_num(&c, end, id) &&
+					skip(&c, end, ".") && c != end && end - c <= MAX_EXT_LEN &&
+					memchr(c, '/', end - c) == NULL) {
+				/* /databases/<db>/items/<id>.<ext> */
+				char ext[MAX_EXT_LEN + 1];
+				memcpy(ext, c, end - c);
+				ext[end - c] = 0;
+				stream(snapshot, (item_id_t)id, ext, buf, request, response);
+			} else {
+				response.status = 404;
+			}
+		} else if (skip(&c, end, "/browse/")) {
+			BrowseLists::LIST list;
+			if (BrowseLists::Find(c, end - c, list)) {
+				browse(snapshot, list, buf, request, response);
+			} else {
+				response.status = 404;
+			}
+		} else if (skip(&c, end, "/containers")) {
+			if (c == end) {
+				containers(snapshot, response);
+			} else if (skip(&c, end, "/") && parse_num(&c, end, id) &&
+					skip(&c, end, "/items") && c == end) {
+				container_items(snapshot, id, buf, request, response);
+			} else {
+				response.status = 404;
+			}
+		} else {
+			response.status = 404;
+		}
+	} else if (skip(&c, end, "/databases") && c == end) {
+		databases(snapshot, response);
+	} else if (skip(&c, end, "/server-info") && c == end) {
+		server_info(response);
+	} else if (skip(&c, end, "/login") && c == end) {
+		login(response);
+	} else if (skip(&c, end, "/logout") && c == end) {
+		response.status = 204;
+		response.content_type.clear();
+	} else if (skip(&c, end, "/update") && c == end) {
+		update(snapshot, buf, request, response);
+	} else {
+		response.status = 404;
+	}
+}
+
+void adaapd::Daap::server_info(Response& response) {
+	std::string out;
+	size_t msrv = dmap::Begin(out, "msrv");
+	dmap::Int(out, "mstt", 200);
+	dmap::Int(out, "mpro", DMAP_VERSION);
+	dmap::Int(out, "apro", DAAP_VERSION);
+	dmap::String(out, "minm", SERVER_NAME);
+	dmap::Byte(out, "mslr", 0);/* no login required */
+	dmap::Int(out, "mstm", SESSION_TIMEOUT_SECS);
+	dmap::Byte(out, "msal", 0);/* auto-logout */
+	dmap::Byte(out, "msup", 1);/* update */
+	dmap::Byte(out, "msqy", 1);/* query */
+	dmap::Byte(out, "msbr", 1);/* browse */
+	dmap::Int(out, "msdc", 1);/* database count */
+	dmap::End(out, msrv);
+	response.Append(out);
+}
+
+void adaapd::Daap::login(Response& response) {
+	std::string out;
+	size_t mlog = dmap::Begin(out, "mlog");
+	dmap::Int(out, "mstt", 200);
+	dmap::Int(out, "mlid", ++next_session);
+	dmap::End(out, mlog);
+	response.Append(out);
+}
+
+void adaapd::Daap::update(const LibrarySnapshot& snapshot, const char* buf,
+		const DaapRequest& request, Response& response) {
+	/* A client which is already up to date waits here until there's
+	 * something new, rather than polling */
+	uint32_t client_revision;
+	if (request.HasParam(PARAM_REVISION_NUMBER) &&
+			DaapRequest::ToUInt(buf, request.Param(PARAM_REVISION_NUMBER), client_revision) &&
+			client_revision == snapshot.revision) {
+		for (size_t i = 0; i < waiting.size(); ) {
+			if (waiting[i].parked->Waiting()) {
+				++i;
+			} else {
+				waiting[i] = waiting.back();
+				waiting.pop_back();
+			}
+		}
+		waiter_t waiter;
+		waiter.revision = client_revision;
+		waiter.parked = response.Park();
+		waiting.push_back(waiter);
+		return;
+	}
+	update_response(snapshot, response);
+}
+
+void adaapd::Daap::update_response(const LibrarySnapshot& snapshot, Response& response) {
+	std::string out;
+	size_t mupd = dmap::Begin(out, "mupd");
+	dmap::Int(out, "mstt", 200);
+	dmap::Int(out, "musr", snapshot.revision);
+	dmap::End(out, mupd);
+	response.Append(out);
+}
+
+void adaapd::Daap::cb_wakeup(ev::async& /*async*/, int /*revents*/) {
+	/* every publish wakes us, but only a new revision is news to a
+	 * client. finishing may handle a pipelined /update which parks again,
+	 * so the woken ones are taken out first. */
+	const LibrarySnapshot& snapshot = reader.Get();
+	std::vector<waiter_t> woken;
+	for (size_t i = 0; i < waiting.size(); ) {
+		if (waiting[i].revision < snapshot.revision) {
+			woken.push_back(waiting[i]);
+			waiting[i] = waiting.back();
+			waiting.pop_back();
+		} else {
+			++i;
+		}
+	}
+	for (size_t i = 0; i < woken.size(); ++i) {
+		Response response;
+		update_response(snapshot, response);
+		woken[i].parked->Finish(response);
+	}
+}
+
+void adaapd::Daap::databases(const LibrarySnapshot& snapshot, Response& response) {
+	std::string out;
+	size_t avdb = dmap::Begin(out, "avdb");
+	dmap::Int(out, "mstt", 200);
+	dmap::Byte(out, "muty", 0);
+	dmap::Int(out, "mtco", 1);
+	dmap::Int(out, "mrco", 1);
+	size_t mlcl = dmap::Begin(out, "mlcl");
+	size_t mlit = dmap::Begin(out, "mlit");
+	dmap::Int(out, "miid", DATABASE_ID);
+	dmap::Long(out, "mper", DATABASE_ID);
+	dmap::String(out, "minm", SERVER_NAME);
+	dmap::Int(out, "mimc", snapshot.tracks->Size());
+	dmap::Int(out, "mctc", 1);/* container count */
+	dmap::End(out, mlit);
+	dmap::End(out, mlcl);
+	dmap::End(out, avdb);
+	response.Append(out);
+}
+
+void adaapd::Daap::items(const LibrarySnapshot& snapshot, const char* buf,
+		const DaapRequest& request, Response& response) {
+	const TrackStore& tracks = *snapshot.tracks;
+	const Column<blob_t>& blobs = *snapshot.blobs;
+	dmap::field_mask_t fields = meta(buf, request, dmap::ITEM_FIELDS);
+	revision_t since;
+	std::vector<item_id_t> ids, deleted;
+	/* Which tracks stopped matching a query isn't known, so a query always
+	 * gets a full listing of its matches. */
+	bool is_query = request.HasParam(PARAM_QUERY);
+	bool is_delta = !is_query && delta(snapshot, buf, request, since);
+	TrackOrders::ORDER order;
+	bool is_sorted = !is_delta && sorted(buf, request, order);
+
+	/* a full listing only changes with the revision, so it's only
+	 * compressed once for everyone */
+	uint64_t variant = (uint64_t)VARIANT_ITEMS << 32 | fields;
+	if (is_sorted) {
+		variant |= (uint64_t)(order + 1) << 40;
+	}
+	ENCODING encoding = ENCODING_GZIP;
+	bool compressible = !is_delta && !is_query && accepts(buf, request, encoding);
+	if (compressible && cached(snapshot.revision, variant, encoding, response)) {
+		return;
+	}
+
+	if (is_query) {
+		if (!query(snapshot, buf, request, ids)) {
+			response.status = 400;
+			return;
+		}
+		if (is_sorted) {
+			arrange(snapshot, order, ids);
+		}
+	} else if (is_delta) {
+		changes(snapshot, since, ids, deleted);
+	} else if (is_sorted) {
+		ids = *snapshot.orders[order];
+	} else if (fields != dmap::ITEM_FIELDS) {
+		live(tracks, ids);
+	}
+
+	uint32_t total = is_query ? ids.size() : tracks.Size();
+	std::string head;
+	if (fields != dmap::ITEM_FIELDS) {
+		std::shared_ptr<std::string> body(new std::string);
+		plan(fields).Items(*body, tracks, ids);
+		listing(head, "adbs", total, ids.size(), body->size(), deleted);
+		response.Append(head);
+		response.Append(body);
+	} else if (is_delta || is_query || is_sorted) {
+		/* the preencoded entries for just these tracks */
+		uint64_t size = 0;
+		for (size_t i = 0; i < ids.size(); ++i) {
+			size += blobs.Get(ids[i])->size();
+		}
+		listing(head, "adbs", total, ids.size(), size, deleted);
+		response.Append(head);
+		response.Keep(snapshot.blobs);
+		for (size_t i = 0; i < ids.size(); ++i) {
+			const std::string& blob = *blobs.Get(ids[i]);
+			response.Append(std::shared_ptr<const void>(), blob.data(), blob.size());
+		}
+	} else {
+		/* only the headers are written here, the listing itself is a gather
+		 * of the snapshot's preencoded entries */
+		listing(head, "adbs", tracks.Size(), tracks.Size(), snapshot.blobs_size, deleted);
+		response.Append(head);
+		response.Keep(snapshot.blobs);
+		for (size_t chunk = 0; chunk < blobs.ChunkCount(); ++chunk) {
+			const blob_t* blob = blobs.Chunk(chunk);
+			for (item_id_t i = 0; i < CHUNK_SIZE; ++i) {
+				if (blob[i]) {
+					response.Append(std::shared_ptr<const void>(),
+							blob[i]->data(), blob[i]->size());
+				}
+			}
+		}
+	}
+
+	if (!deleted.empty()) {
+		std::string mudl;
+		write_deleted(mudl, deleted);
+		response.Append(mudl);
+	}
+	if (compressible) {
+		compress(snapshot.revision, variant, encoding, response);
+	}
+}
+
+void adaapd::Daap::containers(const LibrarySnapshot& snapshot, Response& response) {
+	/* the base playlist, ie everything, then the configured ones */
+	const playlist_members_t& playlists = *snapshot.playlists;
+	std::string out;
+	size_t aply = dmap::Begin(out, "aply");
+	dmap::Int(out, "mstt", 200);
+	dmap::Byte(out, "muty", 0);
+	dmap::Int(out, "mtco", 1 + playlists.size());
+	dmap::Int(out, "mrco", 1 + playlists.size());
+	size_t mlcl = dmap::Begin(out, "mlcl");
+	size_t mlit = dmap::Begin(out, "mlit");
+	dmap::Int(out, "miid", BASE_PLAYLIST_ID);
+	dmap::Long(out, "mper", BASE_PLAYLIST_ID);
+	dmap::String(out, "minm", SERVER_NAME);
+	dmap::Int(out, "mimc", snapshot.tracks->Size());
+	dmap::Byte(out, "abpl", 1);
+	dmap::End(out, mlit);
+	for (size_t i = 0; i < playlists.size(); ++i) {
+		mlit = dmap::Begin(out, "mlit");
+		dmap::Int(out, "miid", FIRST_PLAYLIST_ID + i);
+		dmap::Long(out, "mper", FIRST_PLAYLIST_ID + i);
+		dmap::String(out, "minm", playlists[i].name);
+		dmap::Int(out, "mimc", playlists[i].members.Count());
+		dmap::End(out, mlit);
+	}
+	dmap::End(out, mlcl);
+	dmap::End(out, aply);
+	response.Append(out);
+}
+
+void adaapd::Daap::container_items(const LibrarySnapshot& snapshot, uint64_t container,
+		const char* buf, const DaapRequest& request, Response& response) {
+	const TrackStore& tracks = *snapshot.tracks;
+	const playlist_members_t& playlists = *snapshot.playlists;
+	if (container != BASE_PLAYLIST_ID &&
+			(container < FIRST_PLAYLIST_ID || container - FIRST_PLAYLIST_ID >= playlists.size())) {
+		response.status = 404;
+		return;
+	}
+	dmap::field_mask_t fields = meta(buf, request, dmap::CONTAINER_ITEM_FIELDS);
+	std::vector<item_id_t> ids, deleted;
+	TrackOrders::ORDER order;
+	bool is_query = request.HasParam(PARAM_QUERY);
+	if (is_query && !query(snapshot, buf, request, ids)) {
+		response.status = 400;
+		return;
+	}
+
+	if (container != BASE_PLAYLIST_ID || is_query) {
+		/* Which tracks left a playlist (or a query) isn't kept per
+		 * revision, so these are always full listings. Nor are they
+		 * compressed, since the playlists may be reloaded without a new
+		 * revision. */
+		uint32_t total = ids.size();
+		if (container != BASE_PLAYLIST_ID) {
+			const Bitmap& members = playlists[container - FIRST_PLAYLIST_ID].members;
+			if (is_query) {
+				size_t out = 0;
+				for (size_t i = 0; i < ids.size(); ++i) {
+					if (members.Has(ids[i])) {
+						ids[out++] = ids[i];
+					}
+				}
+				ids.resize(out);
+				total = out;
+			} else {
+				members.Ids(ids);
+				total = members.Count();
+			}
+		}
+		if (sorted(buf, request, order)) {
+			arrange(snapshot, order, ids);
+		}
+		std::shared_ptr<std::string> body(new std::string);
+		plan(fields).Items(*body, tracks, ids);
+		std::string head;
+		listing(head, "apso", total, ids.size(), body->size(), deleted);
+		response.Append(head);
+		response.Append(body);
+		return;
+	}
+
+	revision_t since;
+	bool is_delta = delta(snapshot, buf, request, since);
+	bool is_sorted = !is_delta && sorted(buf, request, order);
+
+	uint64_t variant = (uint64_t)VARIANT_CONTAINER_ITEMS << 32 | fields;
+	if (is_sorted) {
+		variant |= (uint64_t)(order + 1) << 40;
+	}
+	ENCODING encoding = ENCODING_GZIP;
+	bool compressible = !is_delta && accepts(buf, request, encoding);
+	if (compressible && cached(snapshot.revision, variant, encoding, response)) {
+		return;
+	}
+
+	if (is_delta) {
+		changes(snapshot, since, ids, deleted);
+	} else if (is_sorted) {
+		ids = *snapshot.orders[order];
+	} else {
+		live(tracks, ids);
+	}
+
+	std::shared_ptr<std::string> body(new std::string);
+	plan(fields).Items(*body, tracks, ids);
+	std::string head;
+	listing(head, "apso", tracks.Size(), ids.size(), body->size(), deleted);
+	response.Append(head);
+	response.Append(body);
+	if (!deleted.empty()) {
+		std::string mudl;
+		write_deleted(mudl, deleted);
+		response.Append(mudl);
+	}
+	if (compressible) {
+		compress(snapshot.revision, variant, encoding, response);
+	}
+}
+
+void adaapd::Daap::browse(const LibrarySnapshot& snapshot, BrowseLists::LIST list,
+		const char* buf, const DaapRequest& request, Response& response) {
+	const TrackStore& tracks = *snapshot.tracks;
+	if (request.HasParam(PARAM_FILTER)) {
+		/* the distinct values among the matching tracks, eg the albums of
+		 * an artist */
+		Rule rule;
+		if (!ParseQuery(DaapRequest::Decode(buf, request.Param(PARAM_FILTER)), rule)) {
+			response.status = 400;
+			return;
+		}
+		std::vector<item_id_t> ids;
+		queries.Match(rule, tracks, *snapshot.index, *snapshot.search, ids);
+		std::vector<str_id_t> values;
+		Tag_StrId field = BrowseLists::Field(list);
+		for (size_t i = 0; i < ids.size(); ++i) {
+			str_id_t value = tracks.StrId(ids[i], field);
+			if (value != STR_NONE) {
+				values.push_back(value);
+			}
+		}
+		BrowseLists::Sort(tracks.Strings(), values);
+		std::string out;
+		BrowseLists::Encode(tracks.Strings(), list, values, out);
+		response.Append(out);
+		return;
+	}
+
+	/* the whole list was encoded once for the revision */
+	uint64_t variant = (uint64_t)VARIANT_BROWSE << 32 | list;
+	ENCODING encoding = ENCODING_GZIP;
+	bool compressible = accepts(buf, request, encoding);
+	if (compressible && cached(snapshot.revision, variant, encoding, response)) {
+		return;
+	}
+	response.Append(snapshot.browse[list]);
+	if (compressible) {
+		compress(snapshot.revision, variant, encoding, response);
+	}
+}
+
+bool adaapd::Daap::sorted(const char* buf, const DaapRequest& request,
+		TrackOrders::ORDER& order) {
+	if (!request.HasParam(PARAM_SORT)) {
+		return false;
+	}
+	const Span& span = request.Param(PARAM_SORT);
+	return TrackOrders::Find(buf + span.off, span.len, order);
+}
+
+void adaapd::Daap::arrange(const LibrarySnapshot& snapshot, TrackOrders::ORDER order,
+		std::vector<item_id_t>& ids) {
+	/* a walk over the whole order, picking out the tracks in 'ids' */
+	const TrackStore& tracks = *snapshot.tracks;
+	std::vector<uint8_t> wanted(tracks.End(), 0);
+	for (size_t i = 0; i < ids.size(); ++i) {
+		wanted[ids[i]] = 1;
+	}
+	const std::vector<item_id_t>& all = *snapshot.orders[order];
+	size_t out = 0;
+	for (size_t i = 0; i < all.size() && out < ids.size(); ++i) {
+		if (wanted[all[i]] != 0) {
+			ids[out++] = all[i];
+		}
+	}
+	ids.resize(out);
+}
+
+bool adaapd::Daap::query(const LibrarySnapshot& snapshot, const char* buf,
+		const DaapRequest& request, std::vector<item_id_t>& ids) {
+	Rule rule;
+	if (!ParseQuery(DaapRequest::Decode(buf, request.Param(PARAM_QUERY)), rule)) {
+		return false;
+	}
+	queries.Match(rule, *snapshot.tracks, *snapshot.index, *snapshot.search, ids);
+	return true;
+}
+
+adaapd::dmap::field_mask_t adaapd::Daap::meta(const char* buf,
+		const DaapRequest& request, dmap::field_mask_t fields) {
+	if (!request.HasParam(PARAM_META)) {
+		return fields;
+	}
+	return dmap::Fields(DaapRequest::Decode(buf, request.Param(PARAM_META)));
+}
+
+const adaapd::dmap::EncodePlan& adaapd::Daap::plan(dmap::field_mask_t fields) {
+	plans_t::const_iterator iter = plans.find(fields);
+	if (iter != plans.end()) {
+		return *iter->second;
+	}
+	/* clients only ever use a few, so this only guards against abuse */
+	if (plans.size() >= MAX_PLANS) {
+		plans.clear();
+	}
+	std::shared_ptr<const dmap::EncodePlan> plan(new dmap::EncodePlan(fields));
+	plans[fields] = plan;
+	return *plan;
+}
+
+bool adaapd::Daap::accepts(const char* buf, const DaapRequest& request,
+		ENCODING& encoding) {
+	if (compressor == NULL || !request.HasHeader(HEADER_ACCEPT_ENCODING)) {
+		return false;
+	}
+	const char* c = buf + request.Header(HEADER_ACCEPT_ENCODING).off;
+	const char* end = c + request.Header(HEADER_ACCEPT_ENCODING).len;
+	if (accepts_coding(c, end, "gzip")) {
+		encoding = ENCODING_GZIP;
+		return true;
+	} else if (accepts_coding(c, end, "deflate")) {
+		encoding = ENCODING_DEFLATE;
+		return true;
+	}
+	return false;
+}
+
+bool adaapd::Daap::cached(revision_t revision, uint64_t variant, ENCODING encoding,
+		Response& response) {
+	std::shared_ptr<const std::string> data = compressor->Get(revision, variant, encoding);
+	if (!data) {
+		return false;
+	}
+	response.Header("Content-Encoding", encoding_name(encoding));
+	response.Header("Vary", "Accept-Encoding");
+	response.Append(data);
+	return true;
+}
+
+void adaapd::Daap::compress(revision_t revision, uint64_t variant, ENCODING encoding,
+		Response& response) {
+	if (response.BodySize() < MIN_COMPRESS_SIZE) {
+		return;
+	}
+	/* the uncompressed body is kept in case compression fails */
+	std::shared_ptr<Response> body(new Response(response));
+	body->Header("Vary", "Accept-Encoding");
+	compressor->Compress(revision, variant, encoding, body,
+			std::bind(&Daap::deliver, inbox, response.Park(), body, encoding,
+					std::placeholders::_1));
+}
+
+void adaapd::Daap::deliver(std::shared_ptr<inbox_t> inbox, parked_t parked,
+		std::shared_ptr<const Response> body, ENCODING encoding,
+		const std::shared_ptr<const std::string>& data) {
+	compressed_t done;
+	done.parked = parked;
+	done.body = body;
+	done.data = data;
+	done.encoding = encoding;
+
+	std::lock_guard<std::mutex> guard(inbox->lock);
+	if (inbox->ready != NULL) {
+		inbox->done.push_back(done);
+		inbox->ready->send();
+	}
+}
+
+void adaapd::Daap::cb_compressed(ev::async& /*async*/, int /*revents*/) {
+	std::vector<compressed_t> done;
+	{
+		std::lock_guard<std::mutex> guard(inbox->lock);
+		done.swap(inbox->done);
+	}
+	for (size_t i = 0; i < done.size(); ++i) {
+		if (!done[i].data) {
+			/* compression failed: send it as-is */
+			Response response(*done[i].body);
+			done[i].parked->Finish(response);
+			continue;
+		}
+		Response response;
+		response.Header("Content-Encoding", encoding_name(done[i].encoding));
+		response.Header("Vary", "Accept-Encoding");
+		response.Append(done[i].data);
+		done[i].parked->Finish(response);
+	}
+}
+
+bool adaapd::Daap::delta(const LibrarySnapshot& snapshot, const char* buf,
+		const DaapRequest& request, revision_t& since) {
+	uint32_t val;
+	if (!request.HasParam(PARAM_DELTA) ||
+			!DaapRequest::ToUInt(buf, request.Param(PARAM_DELTA), val) || val == 0) {
+		return false;
+	}
+	/* we can't say what changed before we started, or in the future */
+	if (val < snapshot.base_revision || val > snapshot.revision) {
+		return false;
+	}
+	since = val;
+	return true;
+}
+
+void adaapd::Daap::changes(const LibrarySnapshot& snapshot, revision_t since,
+		std::vector<item_id_t>& updated, std::vector<item_id_t>& deleted) {
+	/* a scan of one small column, rather than a walk over a change log */
+	const TrackStore& tracks = *snapshot.tracks;
+	const Column<revision_t>& changed = *snapshot.changed;
+	for (size_t chunk = 0; chunk < changed.ChunkCount(); ++chunk) {
+		const revision_t* revisions = changed.Chunk(chunk);
+		for (item_id_t i = 0; i < CHUNK_SIZE; ++i) {
+			if (revisions[i] > since) {
+				item_id_t id = (chunk << CHUNK_BITS) + i;
+				if (tracks.Has(id)) {
+					updated.push_back(id);
+				} else {
+					deleted.push_back(id);
+				}
+			}
+		}
+	}
+}
+
+void adaapd::Daap::stream(const LibrarySnapshot& snapshot, item_id_t id,
+		const char* ext, const char* buf, const DaapRequest& request,
+		Response& response) {
+	const TrackStore& tracks = *snapshot.tracks;
+	if (!tracks.Has(id)) {
+		response.status = 404;
+		return;
+	}
+	std::shared_ptr<const OpenFile> file = files.Open(tracks.Path(id), tracks.Mtime(id));
+	if (!file) {
+		response.status = 404;
+		return;
+	}
+
+	response.content_type = content_type(ext);
+	response.Header("Accept-Ranges", "bytes");
+
+	uint64_t size = file->size, first = 0, last = 0;
+	RANGE_RESULT range = RANGE_NONE;
+	if (request.HasHeader(HEADER_RANGE)) {
+		const Span& span = request.Header(HEADER_RANGE);
+		range = parse_range(buf + span.off, buf + span.off + span.len, size, first, last);
+	}
+
+	char value[64];
+	switch (range) {
+	case RANGE_OK:
+		response.status = 206;
+		snprintf(value, sizeof(value), "bytes %llu-%llu/%llu",
+				(unsigned long long)first, (unsigned long long)last,
+				(unsigned long long)size);
+		response.Header("Content-Range", value);
+		response.File(file, first, last - first + 1);
+		break;
+	case RANGE_UNSATISFIABLE:
+		response.status = 416;
+		snprintf(value, sizeof(value), "bytes */%llu", (unsigned long long)size);
+		response.Header("Content-Range", value);
+		break;
+	case RANGE_NONE:
+		if (size != 0) {
+			response.File(file, 0, size);
+		}
+		break;
+	}
+}
@@ -0,0 +1,151 @@
+#ifndef _adaapd_daap_h_
+#define _adaapd_daap_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <ev++.h>
+
+#include "compressor.h"
+#include "dmap.h"
+#include "file-cache.h"
+#include "library.h"
+#include "query.h"
+#include "server.h"
+
+namespace adaapd {
+	/*! Answers DAAP requests against a Library. One per Workers thread, each
+	 * with its own LibraryReader and FileCache, so nothing here is locked. */
+	class Daap {
+	public:
+		/*! Parked /update requests are woken from 'loop', which must be the
+		 * loop the handler runs on. Full listings are compressed with
+		 * 'compressor' for clients which accept it, unless it's NULL. */
+		Daap(Library& library, ev::loop_ref loop, Compressor* compressor = NULL);
+		virtual ~Daap();
+
+		/*! A handler_t for the Server. */
+		void Handle(const char* buf, const DaapRequest& request, Response& response);
+
+	private:
+		void server_info(Response& response);
+		void login(Response& response);
+		void update(const LibrarySnapshot& snapshot, const char* buf,
+				const DaapRequest& request, Response& response);
+		void update_response(const LibrarySnapshot& snapshot, Response& response);
+		void databases(const LibrarySnapshot& snapshot, Response& response);
+		void items(const LibrarySnapshot& snapshot, const char* buf,
+				const DaapRequest& request, Response& response);
+		void containers(const LibrarySnapshot& snapshot, Response& response);
+		void container_items(const LibrarySnapshot& snapshot, uint64_t container,
+				const char* buf, const DaapRequest& request, Response& response);
+		void browse(const LibrarySnapshot& snapshot, BrowseLists::LIST list,
+				const char* buf, const DaapRequest& request, Response& response);
+		void stream(const LibrarySnapshot& snapshot, item_id_t id, const char* ext,
+				const char* buf, const DaapRequest& request, Response& response);
+
+		/*! Whether the request is for the changes since some revision, which
+		 * is put into 'since'. */
+		bool delta(const LibrarySnapshot& snapshot, const char* buf,
+				const DaapRequest& request, revision_t& since);
+		/*! The tracks matching the request's query=, in increasing order.
+		 * Returns false if it's malformed. */
+		bool query(const LibrarySnapshot& snapshot, const char* buf,
+				const DaapRequest& request, std::vector<item_id_t>& ids);
+		/*! Whether the request asks for a listing in one of the
+		 * TrackOrders with sort=, which is put into 'order'. */
+		bool sorted(const char* buf, const DaapRequest& request, TrackOrders::ORDER& order);
+		/*! Puts 'ids', which are all in the snapshot, into 'order'. */
+		void arrange(const LibrarySnapshot& snapshot, TrackOrders::ORDER order,
+				std::vector<item_id_t>& ids);
+		/*! The fields requested with meta=, or 'fields' if there's no meta=. */
+		dmap::field_mask_t meta(const char* buf, const DaapRequest& request,
+				dmap::field_mask_t fields);
+		/*! The plan for encoding 'fields', made on first use. */
+		const dmap::EncodePlan& plan(dmap::field_mask_t fields);
+
+		/*! Whether the client accepts a compressed response, and which
+		 * encoding to use if so. */
+		bool accepts(const char* buf, const DaapRequest& request, ENCODING& encoding);
+		/*! Answers with the compressed 'variant' if it's ready. */
+		bool cached(revision_t revision, uint64_t variant, ENCODING encoding,
+				Response& response);
+		/*! Parks 'response' until its compressed 'variant' is ready, or leaves
+		 * it alone if it's too small to bother. */
+		void compress(revision_t revision, uint64_t variant, ENCODING encoding,
+				Response& response);
+
+		/*! The ids which were changed or removed after 'since'. */
+		void changes(const LibrarySnapshot& snapshot, revision_t since,
+				std::vector<item_id_t>& updated, std::vector<item_id_t>& deleted);
+
+		/* a new snapshot was published */
+		void cb_wakeup(ev::async& async, int revents);
+		/* compressed responses are ready */
+		void cb_compressed(ev::async& async, int revents);
+
+		/* a compressed response on its way back from the Compressor thread */
+		struct compressed_t {
+			parked_t parked;
+			std::shared_ptr<const Response> body;
+			std::shared_ptr<const std::string> data;
+			ENCODING encoding;
+		};
+		/* shared with the Compressor's callbacks, which may outlive us */
+		struct inbox_t {
+			std::mutex lock;
+			ev::async* ready;/* NULL once we're gone */
+			std::vector<compressed_t> done;
+		};
+		static void deliver(std::shared_ptr<inbox_t> inbox, parked_t parked,
+				std::shared_ptr<const Response> body, ENCODING encoding,
+				const std::shared_ptr<const std::string>& data);
+
+		Library& library;
+		LibraryReader reader;
+		FileCache files;
+
+		QueryEvaluator queries;
+
+		typedef std::unordered_map<dmap::field_mask_t,
+				std::shared_ptr<const dmap::EncodePlan> > plans_t;
+		plans_t plans;
+
+		/* an /update request waiting for a revision after 'revision' */
+		struct waiter_t {
+			revision_t revision;
+			parked_t parked;
+		};
+		std::vector<waiter_t> waiting;
+		ev::async wakeup;
+		size_t subscription;
+
+		Compressor* compressor;
+		std::shared_ptr<inbox_t> inbox;
+		ev::async ready;
+
+		/* sessions aren't checked, so these only need to be nonzero */
+		uint32_t next_session;
+	};
+}
+
+#endif
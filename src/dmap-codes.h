@@ -0,0 +1,126 @@
+#ifndef _adaapd_dmap_codes_h_
+#define _adaapd_dmap_codes_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include "tag.h"
+
+/* The DMAP content codes for each track field. Everything else about a
+ * field (its FIELD id, meta= bit, wire size, encoder) is generated from
+ * these lists, so adding a field is a one-line change here. */
+
+/* X(Tag_IntId, code, wire type, meta= name) */
+#define DMAP_INT_FIELDS(X) \
+	X(BPM, "asbt", uint16_t, "daap.songbeatsperminute") \
+	X(BIT_RATE, "asbr", uint16_t, "daap.songbitrate") \
+	X(COMPILATION, "asco", uint8_t, "daap.songcompilation") \
+	X(DISC_COUNT, "asdc", uint16_t, "daap.songdisccount") \
+	X(DISC_NUMBER, "asdn", uint16_t, "daap.songdiscnumber") \
+	X(RELATIVE_VOLUME, "asrv", uint8_t, "daap.songrelativevolume") \
+	X(SAMPLE_RATE, "assr", uint32_t, "daap.songsamplerate") \
+	X(SIZE, "assz", uint32_t, "daap.songsize") \
+	X(TIME, "astm", uint32_t, "daap.songtime") \
+	X(TRACK_COUNT, "astc", uint16_t, "daap.songtrackcount") \
+	X(TRACK_NUMBER, "astn", uint16_t, "daap.songtracknumber") \
+	X(USER_RATING, "asur", uint8_t, "daap.songuserrating") \
+	X(YEAR, "asyr", uint16_t, "daap.songyear")
+
+/* X(Tag_StrId, code, meta= name) */
+#define DMAP_STR_FIELDS(X) \
+	X(ALBUM, "asal", "daap.songalbum") \
+	X(ARTIST, "asar", "daap.songartist") \
+	X(COMMENT, "ascm", "daap.songcomment") \
+	X(COMPOSER, "ascp", "daap.songcomposer") \
+	X(GENRE, "asgn", "daap.songgenre") \
+	X(TITLE, "minm", "dmap.itemname")
+
+/* X(FIELD suffix, code, wire type, meta= name) for fields which come from
+ * the db rather than the tag */
+#define DMAP_DB_FIELDS(X) \
+	X(ITEM_KIND, "mikd", uint8_t, "dmap.itemkind") \
+	X(ITEM_ID, "miid", uint32_t, "dmap.itemid") \
+	X(PERSISTENT_ID, "mper", uint64_t, "dmap.persistentid") \
+	X(CONTAINER_ITEM_ID, "mcti", uint32_t, "dmap.containeritemid") \
+	X(FORMAT, "asfm", const char*, "daap.songformat")
+
+namespace adaapd {
+	namespace dmap {
+		/*! A 4-char code as the big-endian int which goes on the wire. */
+		constexpr uint32_t Code(const char* code) {
+			return (uint32_t)(uint8_t)code[0] << 24 | (uint32_t)(uint8_t)code[1] << 16 |
+				(uint32_t)(uint8_t)code[2] << 8 | (uint32_t)(uint8_t)code[3];
+		}
+
+		/*! Every field which may be listed for a track, in the order they're
+		 * written. Also the bit for the field in a field_mask_t. */
+		enum FIELD {
+#define DB_FIELD(field, code, type, name) FIELD_##field,
+#define INT_FIELD(field, code, type, name) FIELD_##field,
+#define STR_FIELD(field, code, name) FIELD_##field,
+			DMAP_DB_FIELDS(DB_FIELD)
+			DMAP_STR_FIELDS(STR_FIELD)
+			DMAP_INT_FIELDS(INT_FIELD)
+#undef DB_FIELD
+#undef INT_FIELD
+#undef STR_FIELD
+			FIELD_COUNT
+		};
+
+		/*! A set of FIELDs. */
+		typedef uint32_t field_mask_t;
+		static_assert(FIELD_COUNT <= 32, "field_mask_t is too small");
+
+		inline constexpr field_mask_t Bit(FIELD field) {
+			return (field_mask_t)1 << field;
+		}
+
+		/*! Compile-time code and wire type for each Tag_IntId. */
+		template <Tag_IntId F> struct int_field;
+#define INT_FIELD(field, code_, type_, name) \
+		template <> struct int_field<field> { \
+			typedef type_ type; \
+			static constexpr uint32_t code = Code(code_); \
+		};
+		DMAP_INT_FIELDS(INT_FIELD)
+#undef INT_FIELD
+
+		/*! Compile-time code and wire type for each db FIELD. */
+		template <FIELD F> struct db_field;
+#define DB_FIELD(field, code_, type_, name) \
+		template <> struct db_field<FIELD_##field> { \
+			typedef type_ type; \
+			static constexpr uint32_t code = Code(code_); \
+		};
+		DMAP_DB_FIELDS(DB_FIELD)
+#undef DB_FIELD
+
+		/*! Compile-time code for each Tag_StrId. */
+		template <Tag_StrId F> struct str_field;
+#define STR_FIELD(field, code_, name) \
+		template <> struct str_field<field> { \
+			static constexpr uint32_t code = Code(code_); \
+		};
+		DMAP_STR_FIELDS(STR_FIELD)
+#undef STR_FIELD
+	}
+}
+
+#endif
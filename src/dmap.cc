@@ -0,0 +1,271 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "dmap.h"
+
+/* mikd value for songs */
+#define ITEM_KIND_MUSIC 2
+
+using adaapd::dmap::HEADER_SIZE;
+
+namespace {
+	/* Writes a field header and a T, returning the end of the field. The
+	 * loops are over sizeof(T) so they unroll into a few stores. */
+	inline char* put_header(char* out, uint32_t code, uint32_t len) {
+		for (int i = 0; i < 4; ++i) {
+			out[i] = (char)(code >> (24 - 8 * i));
+			out[4 + i] = (char)(len >> (24 - 8 * i));
+		}
+		return out + HEADER_SIZE;
+	}
+	template <typename T>
+	inline char* put(char* out, uint32_t code, T val) {
+		out = put_header(out, code, sizeof(T));
+		for (size_t i = 0; i < sizeof(T); ++i) {
+			out[i] = (char)(val >> (8 * (sizeof(T) - 1 - i)));
+		}
+		return out + sizeof(T);
+	}
+	template <typename T>
+	inline void append(std::string& out, const char* code, T val) {
+		char buf[HEADER_SIZE + sizeof(T)];
+		put<T>(buf, adaapd::dmap::Code(code), val);
+		out.append(buf, sizeof(buf));
+	}
+
+	/* The per-field encoders for an EncodePlan. Each writes its field at
+	 * 'out' and returns where the next one goes. Missing values are written
+	 * anyway and then skipped over by not advancing, so that there's no
+	 * branch on them. */
+	using adaapd::TrackStore;
+	using adaapd::item_id_t;
+
+	template <adaapd::Tag_IntId F>
+	char* int_step(char* out, const TrackStore& tracks, item_id_t id) {
+		typedef typename adaapd::dmap::int_field<F>::type type;
+		adaapd::tag_int_t val = tracks.Int(id, F);
+		put<type>(out, adaapd::dmap::int_field<F>::code, (type)val);
+		return out + (val != adaapd::TAG_INT_NONE) * (HEADER_SIZE + sizeof(type));
+	}
+
+	template <adaapd::Tag_StrId F>
+	char* str_step(char* out, const TrackStore& tracks, item_id_t id) {
+		adaapd::str_id_t str = tracks.StrId(id, F);
+		size_t len = tracks.Strings().Len(str);
+		put_header(out, adaapd::dmap::str_field<F>::code, len);
+		memcpy(out + HEADER_SIZE, tracks.Strings().Get(str), len);
+		return out + (len != 0) * (HEADER_SIZE + len);
+	}
+
+	/* the values of the db fields, other than FIELD_FORMAT */
+	template <adaapd::dmap::FIELD F>
+	uint64_t db_value(const TrackStore& tracks, item_id_t id);
+	template <>
+	uint64_t db_value<adaapd::dmap::FIELD_ITEM_KIND>(const TrackStore& /*tracks*/,
+			item_id_t /*id*/) {
+		return ITEM_KIND_MUSIC;
+	}
+	template <>
+	uint64_t db_value<adaapd::dmap::FIELD_ITEM_ID>(const TrackStore& /*tracks*/, item_id_t id) {
+		return id;
+	}
+	template <>
+	uint64_t db_value<adaapd::dmap::FIELD_PERSISTENT_ID>(const TrackStore& /*tracks*/,
+			item_id_t id) {
+		return id;
+	}
+	template <>
+	uint64_t db_value<adaapd::dmap::FIELD_CONTAINER_ITEM_ID>(const TrackStore& /*tracks*/,
+			item_id_t id) {
+		/* only the base playlist for now, where these are the same */
+		return id;
+	}
+
+	template <adaapd::dmap::FIELD F>
+	char* db_step(char* out, const TrackStore& tracks, item_id_t id) {
+		typedef typename adaapd::dmap::db_field<F>::type type;
+		return put<type>(out, adaapd::dmap::db_field<F>::code, (type)db_value<F>(tracks, id));
+	}
+
+	/* the file extension doubles as the format, which is also what clients
+	 * ask for in the stream url */
+	const char* format(const TrackStore& tracks, item_id_t id, size_t& len) {
+		const char* path = tracks.Path(id);
+		const char* ext = strrchr(path, '.');
+		if (ext == NULL || strchr(ext, '/') != NULL) {
+			len = 0;
+			return path;
+		}
+		len = strlen(ext + 1);
+		return ext + 1;
+	}
+	template <>
+	char* db_step<adaapd::dmap::FIELD_FORMAT>(char* out, const TrackStore& tracks, item_id_t id) {
+		size_t len;
+		const char* ext = format(tracks, id, len);
+		put_header(out, adaapd::dmap::db_field<adaapd::dmap::FIELD_FORMAT>::code, len);
+		memcpy(out + HEADER_SIZE, ext, len);
+		return out + (len != 0) * (HEADER_SIZE + len);
+	}
+
+	typedef char* (*step_t)(char* out, const TrackStore& tracks, item_id_t id);
+
+	struct field_info {
+		const char* name;/* for meta= */
+		step_t step;
+		size_t size;/* on the wire, not counting any string */
+	};
+
+	/* wire size of a db field's type, with strings only counting the header */
+	template <typename T> struct db_size {
+		static const size_t size = HEADER_SIZE + sizeof(T);
+	};
+	template <> struct db_size<const char*> {
+		static const size_t size = HEADER_SIZE;
+	};
+
+	/* indexed by FIELD */
+	const field_info FIELDS[adaapd::dmap::FIELD_COUNT] = {
+#define DB_FIELD(field, code, type, name) \
+		{ name, &db_step<adaapd::dmap::FIELD_##field>, db_size<type>::size },
+		DMAP_DB_FIELDS(DB_FIELD)
+#undef DB_FIELD
+#define STR_FIELD(field, code, name) \
+		{ name, &str_step<adaapd::field>, HEADER_SIZE },
+		DMAP_STR_FIELDS(STR_FIELD)
+#undef STR_FIELD
+#define INT_FIELD(field, code, type, name) \
+		{ name, &int_step<adaapd::field>, HEADER_SIZE + sizeof(type) },
+		DMAP_INT_FIELDS(INT_FIELD)
+#undef INT_FIELD
+	};
+}
+
+void adaapd::dmap::Byte(std::string& out, const char* code, uint8_t val) {
+	append<uint8_t>(out, code, val);
+}
+
+void adaapd::dmap::Short(std::string& out, const char* code, uint16_t val) {
+	append<uint16_t>(out, code, val);
+}
+
+void adaapd::dmap::Int(std::string& out, const char* code, uint32_t val) {
+	append<uint32_t>(out, code, val);
+}
+
+void adaapd::dmap::Long(std::string& out, const char* code, uint64_t val) {
+	append<uint64_t>(out, code, val);
+}
+
+void adaapd::dmap::String(std::string& out, const char* code, const char* val, size_t len) {
+	Container(out, code, len);
+	out.append(val, len);
+}
+
+void adaapd::dmap::Container(std::string& out, const char* code, uint32_t len) {
+	char buf[HEADER_SIZE];
+	put_header(buf, Code(code), len);
+	out.append(buf, sizeof(buf));
+}
+
+size_t adaapd::dmap::Begin(std::string& out, const char* code) {
+	size_t begin = out.size();
+	Container(out, code, 0);
+	return begin;
+}
+
+void adaapd::dmap::End(std::string& out, size_t begin) {
+	put_header(&out[begin], Code(&out[begin]), out.size() - begin - HEADER_SIZE);
+}
+
+adaapd::dmap::field_mask_t adaapd::dmap::Fields(const std::string& meta) {
+	field_mask_t fields = 0;
+	size_t start = 0;
+	while (start <= meta.size()) {
+		size_t end = meta.find(',', start);
+		if (end == std::string::npos) {
+			end = meta.size();
+		}
+		for (int i = 0; i < FIELD_COUNT; ++i) {
+			if (meta.compare(start, end - start, FIELDS[i].name) == 0) {
+				fields |= Bit((FIELD)i);
+				break;
+			}
+		}
+		start = end + 1;
+	}
+	return fields;
+}
+
+adaapd::dmap::EncodePlan::EncodePlan(field_mask_t fields)
+	: fields(fields), fixed_size(HEADER_SIZE), format(false) {
+	for (int i = 0; i < FIELD_COUNT; ++i) {
+		if ((fields & Bit((FIELD)i)) == 0) {
+			continue;
+		}
+		steps.push_back(FIELDS[i].step);
+		fixed_size += FIELDS[i].size;
+	}
+#define STR_FIELD(field, code, name) \
+	if ((fields & Bit(FIELD_##field)) != 0) { \
+		strs.push_back(field); \
+	}
+	DMAP_STR_FIELDS(STR_FIELD)
+#undef STR_FIELD
+	format = (fields & Bit(FIELD_FORMAT)) != 0;
+}
+
+size_t adaapd::dmap::EncodePlan::max_size(const TrackStore& tracks, item_id_t id) const {
+	size_t size = fixed_size;
+	for (size_t i = 0; i < strs.size(); ++i) {
+		size += tracks.Strings().Len(tracks.StrId(id, strs[i]));
+	}
+	if (format) {
+		size_t len;
+		::format(tracks, id, len);
+		size += len;
+	}
+	return size;
+}
+
+void adaapd::dmap::EncodePlan::Item(std::string& out, const TrackStore& tracks,
+		item_id_t id) const {
+	size_t begin = out.size();
+	out.resize(begin + max_size(tracks, id));
+	char* start = &out[begin];
+	char* end = start + HEADER_SIZE;
+	for (size_t i = 0; i < steps.size(); ++i) {
+		end = steps[i](end, tracks, id);
+	}
+	put_header(start, Code("mlit"), end - start - HEADER_SIZE);
+	out.resize(end - out.data());
+}
+
+void adaapd::dmap::EncodePlan::Items(std::string& out, const TrackStore& tracks,
+		const std::vector<item_id_t>& ids) const {
+	size_t size = out.size();
+	for (size_t i = 0; i < ids.size(); ++i) {
+		size += max_size(tracks, ids[i]);
+	}
+	out.reserve(size);
+	for (size_t i = 0; i < ids.size(); ++i) {
+		Item(out, tracks, ids[i]);
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef _adaapd_dmap_h_
+#define _adaapd_dmap_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "dmap-codes.h"
+#include "track-store.h"
+
+namespace adaapd {
+	/*! Writers for DMAP fields: a 4-char code, a 32-bit length, then the
+	 * value, all big-endian. */
+	namespace dmap {
+		/*! The size of a field's code and length, ie of an empty container. */
+		static const size_t HEADER_SIZE = 8;
+
+		void Byte(std::string& out, const char* code, uint8_t val);
+		void Short(std::string& out, const char* code, uint16_t val);
+		void Int(std::string& out, const char* code, uint32_t val);
+		void Long(std::string& out, const char* code, uint64_t val);
+		void String(std::string& out, const char* code, const char* val, size_t len);
+		inline void String(std::string& out, const char* code, const std::string& val) {
+			String(out, code, val.data(), val.size());
+		}
+
+		/*! Writes the header of a container whose contents are 'len' bytes,
+		 * for when the contents are sent separately. */
+		void Container(std::string& out, const char* code, uint32_t len);
+
+		/*! Starts a container whose contents are written to 'out' next.
+		 * Returns the position to pass to End(). */
+		size_t Begin(std::string& out, const char* code);
+		/*! Fills in the length of the container started at 'begin'. */
+		void End(std::string& out, size_t begin);
+
+		/*! The fields of a full "items" listing entry. */
+		static const field_mask_t ITEM_FIELDS = ~Bit(FIELD_CONTAINER_ITEM_ID) &
+			(Bit(FIELD_COUNT) - 1);
+		/*! The fields of a playlist's "items" listing entry. */
+		static const field_mask_t CONTAINER_ITEM_FIELDS = Bit(FIELD_ITEM_KIND) |
+			Bit(FIELD_ITEM_ID) | Bit(FIELD_CONTAINER_ITEM_ID);
+
+		/*! Returns the fields named in a meta= value, eg
+		 * "dmap.itemid,dmap.itemname". Unknown names are ignored. */
+		field_mask_t Fields(const std::string& meta);
+
+		/*! Writes "mlit" listing entries with a given set of fields. The
+		 * fields are looked up once, when the plan is made, leaving a list
+		 * of per-field encoders which each write a fixed-size field (or a
+		 * string) straight into a buffer which is sized up front. */
+		class EncodePlan {
+		public:
+			EncodePlan(field_mask_t fields);
+
+			field_mask_t Fields() const {
+				return fields;
+			}
+
+			/*! Appends the entry for track 'id'. */
+			void Item(std::string& out, const TrackStore& tracks, item_id_t id) const;
+
+			/*! Appends the entries for each track in 'ids'. */
+			void Items(std::string& out, const TrackStore& tracks,
+					const std::vector<item_id_t>& ids) const;
+
+		private:
+			typedef char* (*step_t)(char* out, const TrackStore& tracks, item_id_t id);
+
+			/* the most that Item() could write for 'id' */
+			size_t max_size(const TrackStore& tracks, item_id_t id) const;
+
+			const field_mask_t fields;
+			std::vector<step_t> steps;
+			/* the size of the entry without any strings */
+			size_t fixed_size;
+			/* the strings which need room */
+			std::vector<Tag_StrId> strs;
+			bool format;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "file-cache.h"
+#include "logging.h"
+
+adaapd::OpenFile::~OpenFile() {
+	close(fd);
+}
+
+adaapd::FileCache::FileCache(size_t capacity)
+	: capacity(capacity) { }
+
+std::shared_ptr<const adaapd::OpenFile> adaapd::FileCache::Open(
+		const std::string& path, time_t mtime) {
+	std::unordered_map<std::string, lru_t::iterator>::iterator iter = files.find(path);
+	if (iter != files.end()) {
+		if (iter->second->second->mtime == mtime) {
+			lru.splice(lru.begin(), lru, iter->second);
+			return lru.front().second;
+		}
+		/* stale: anyone still streaming the old one keeps it open */
+		lru.erase(iter->second);
+		files.erase(iter);
+	}
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ERR("Unable to open %s: %d/%s", path.c_str(), errno, strerror(errno));
+		return std::shared_ptr<const OpenFile>();
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		ERR("Unable to stat %s: %d/%s", path.c_str(), errno, strerror(errno));
+		close(fd);
+		return std::shared_ptr<const OpenFile>();
+	}
+	/* we'll be reading the whole thing front to back */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	std::shared_ptr<const OpenFile> file(new OpenFile(fd, st.st_size, mtime));
+	lru.push_front(entry_t(path, file));
+	files[path] = lru.begin();
+	while (files.size() > capacity) {
+		files.erase(lru.back().first);
+		lru.pop_back();
+	}
+	return file;
+}
@@ -0,0 +1,68 @@
+#ifndef _adaapd_file_cache_h_
+#define _adaapd_file_cache_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace adaapd {
+	/*! A read-only file descriptor, closed once the last reference is gone. */
+	struct OpenFile {
+		OpenFile(int fd, off_t size, time_t mtime)
+			: fd(fd), size(size), mtime(mtime) { }
+		virtual ~OpenFile();
+
+		const int fd;
+		const off_t size;
+		const time_t mtime;
+	};
+
+	/*! Keeps the most recently streamed files open, so that a client which
+	 * seeks around a track (one Range request per seek) doesn't pay for an
+	 * open()+fstat() each time. Not thread-safe: one per worker. */
+	class FileCache {
+	public:
+		FileCache(size_t capacity);
+
+		/*! Returns the open file for 'path', opening it if it isn't cached or
+		 * if the cached one doesn't match 'mtime' (ie the file was changed
+		 * since). Returns an empty pointer if the file can't be opened. */
+		std::shared_ptr<const OpenFile> Open(const std::string& path, time_t mtime);
+
+		size_t Size() const {
+			return files.size();
+		}
+
+	private:
+		typedef std::pair<std::string, std::shared_ptr<const OpenFile> > entry_t;
+		typedef std::list<entry_t> lru_t;
+
+		const size_t capacity;
+		/* most recently used first */
+		lru_t lru;
+		std::unordered_map<std::string, lru_t::iterator> files;
+	};
+}
+
+#endif
@@ -0,0 +1,648 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "library-image.h"
+#include "logging.h"
+
+/* bump this whenever the layout changes, old images are then ignored */
+#define IMAGE_VERSION 1
+#define IMAGE_MAGIC "ADAAPDIM"
+#define BYTE_ORDER_MARK 0x01020304
+
+/* sections are aligned to cache lines */
+#define SECTION_ALIGN 64
+
+#define INVALID_FD -1
+
+/* how far past the largest known id a delta record may go. New ids come
+ * from the Cache, which also numbers files that aren't tracks, so there
+ * can be gaps. Anything further is treated as corrupt rather than making
+ * the TrackStore grow to fit it. */
+#define MAX_ID_GAP (1 << 20)
+
+namespace {
+	enum {
+		SEC_LIVE = 0,
+		SEC_INT0,
+		SEC_STR0 = SEC_INT0 + adaapd::TAG_INT_COUNT,
+		SEC_PATHS = SEC_STR0 + adaapd::TAG_STR_COUNT,
+		SEC_MTIMES,
+		SEC_STR_OFFSETS,
+		SEC_STR_DATA,
+		SEC_PATH_OFFSETS,
+		SEC_PATH_DATA,
+		SEC_COUNT
+	};
+
+	struct header {
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order;
+		uint32_t chunk_size;
+		uint32_t revision;
+		uint32_t end;
+		uint32_t count;
+		uint32_t chunks;
+		uint32_t str_count;
+		uint32_t path_count;
+		uint64_t str_data_size;
+		uint64_t path_data_size;
+		uint64_t file_size;
+		uint64_t sections[SEC_COUNT];/* file offsets */
+	};
+
+	/* fixed part of a delta record, followed by TAG_STR_COUNT+1 strings (tags
+	 * then path), each a uint32_t length and that many bytes */
+	struct delta_header {
+		uint32_t size;/* of the whole record, including this header */
+		uint32_t revision;
+		uint32_t id;
+		uint32_t type;
+		int64_t ints[adaapd::TAG_INT_COUNT];
+		int64_t mtime;
+	};
+
+	/* fsyncs the directory containing 'path' */
+	bool sync_dir(const std::string& path) {
+		size_t slash = path.rfind('/');
+		std::string dir = (slash == std::string::npos) ? "." :
+			(slash == 0) ? "/" : path.substr(0, slash);
+		int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+		if (fd == INVALID_FD) {
+			ERR("Unable to open directory %s: %d/%s", dir.c_str(), errno, strerror(errno));
+			return false;
+		}
+		bool ok = fsync(fd) == 0;
+		if (!ok) {
+			ERR("Unable to sync directory %s: %d/%s", dir.c_str(), errno, strerror(errno));
+		}
+		close(fd);
+		return ok;
+	}
+
+	class writer {
+	public:
+		writer(FILE* f) : f(f), off(0), ok(true) { }
+
+		void write(const void* data, size_t size) {
+			if (ok && size != 0 && fwrite(data, size, 1, f) != 1) {
+				ok = false;
+			}
+			off += size;
+		}
+
+		/* pads to SECTION_ALIGN and returns the resulting offset */
+		uint64_t align() {
+			static const char zeros[SECTION_ALIGN] = { 0 };
+			size_t pad = (SECTION_ALIGN - (off % SECTION_ALIGN)) % SECTION_ALIGN;
+			write(zeros, pad);
+			return off;
+		}
+
+		template <typename T>
+		void column(const adaapd::Column<T>& col) {
+			for (size_t i = 0; i < col.ChunkCount(); ++i) {
+				write(col.Chunk(i), adaapd::CHUNK_SIZE * sizeof(T));
+			}
+		}
+
+		FILE* f;
+		uint64_t off;
+		bool ok;
+	};
+
+	template <typename T>
+	void map_column(adaapd::Column<T>& col, const std::shared_ptr<const void>& owner,
+			const char* base, uint64_t offset, uint32_t chunks) {
+		col = adaapd::Column<T>();
+		const T* data = (const T*)(base + offset);
+		for (uint32_t i = 0; i < chunks; ++i) {
+			col.AddShared(owner, data + i * adaapd::CHUNK_SIZE);
+		}
+	}
+
+	/* the strings of a pool which are still in use, renumbered densely */
+	struct packed_strings {
+		packed_strings(size_t pool_size)
+			: remap(pool_size, adaapd::STR_NONE), data(1, '\0'), count(1) {
+			/* id 0: empty string */
+			offsets.push_back(0);
+		}
+
+		void add(const adaapd::StringPool& pool, adaapd::str_id_t old_id) {
+			if (old_id == adaapd::STR_NONE || remap[old_id] != adaapd::STR_NONE) {
+				return;
+			}
+			remap[old_id] = count++;
+			offsets.push_back(data.size());
+			data.append(pool.Get(old_id), pool.Len(old_id) + 1);
+		}
+
+		void finish() {
+			offsets.push_back(data.size());
+		}
+
+		std::vector<adaapd::str_id_t> remap;
+		std::vector<uint32_t> offsets;
+		std::string data;
+		adaapd::str_id_t count;
+	};
+
+	/* whether a pool's offsets and data, already known to fit in the
+	 * file, hold 'count' NUL-terminated strings */
+	bool check_strings(const uint32_t* offsets, const char* data, uint32_t count,
+			uint64_t data_size) {
+		if (count == 0 || offsets[0] != 0 || offsets[count] != data_size) {
+			return false;
+		}
+		for (uint32_t i = 0; i < count; ++i) {
+			/* each string ends with its NUL, right before the next one */
+			if (offsets[i] >= offsets[i + 1] || data[offsets[i + 1] - 1] != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/* whether every id in a mapped column of 'items' ids is below 'count' */
+	bool check_ids(const adaapd::str_id_t* ids, uint64_t items, uint32_t count) {
+		for (uint64_t i = 0; i < items; ++i) {
+			if (ids[i] >= count) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/* the number of live ids in a mapped live column of 'items' ids, or -1
+	 * if any of them is at or past 'end' */
+	uint64_t count_live(const uint8_t* live, uint64_t items, uint32_t end) {
+		uint64_t count = 0;
+		for (uint64_t i = 0; i < items; ++i) {
+			if (live[i] == 0) {
+				continue;
+			}
+			if (i >= end) {
+				return (uint64_t)-1;
+			}
+			++count;
+		}
+		return count;
+	}
+
+	inline void append_str(std::string& buf, const std::string& str) {
+		uint32_t len = str.size();
+		buf.append((const char*)&len, sizeof(len));
+		buf.append(str);
+	}
+
+	inline bool read_str(const char*& ptr, const char* end, std::string& out) {
+		uint32_t len;
+		if (ptr + sizeof(len) > end) {
+			return false;
+		}
+		memcpy(&len, ptr, sizeof(len));
+		ptr += sizeof(len);
+		if (ptr + len > end) {
+			return false;
+		}
+		out.assign(ptr, len);
+		ptr += len;
+		return true;
+	}
+}
+
+adaapd::LibraryImage::LibraryImage(const std::string& path)
+	: path(path), delta_path(path + ".delta"),
+	  delta_fd(INVALID_FD), delta_count(0) { }
+
+adaapd::LibraryImage::~LibraryImage() {
+	if (delta_fd != INVALID_FD) {
+		close(delta_fd);
+		delta_fd = INVALID_FD;
+	}
+}
+
+bool adaapd::LibraryImage::Load(TrackStore& store, revision_t max_revision,
+		revision_t& revision) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == INVALID_FD) {
+		if (errno == ENOENT) {
+			LOG("No library image at %s", path.c_str());
+		} else {
+			ERR("Unable to open library image %s: %d/%s",
+					path.c_str(), errno, strerror(errno));
+		}
+		return false;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(header)) {
+		ERR("Library image %s is truncated, ignoring", path.c_str());
+		close(fd);
+		return false;
+	}
+	void* addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		ERR("Unable to map library image %s: %d/%s",
+				path.c_str(), errno, strerror(errno));
+		return false;
+	}
+	size_t map_size = sb.st_size;
+	std::shared_ptr<const void> owner(addr, [map_size](const void* p) {
+			munmap(const_cast<void*>(p), map_size);
+		});
+	const char* base = (const char*)addr;
+
+	const header* h = (const header*)base;
+	if (memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) != 0 ||
+			h->version != IMAGE_VERSION ||
+			h->byte_order != BYTE_ORDER_MARK ||
+			h->chunk_size != CHUNK_SIZE) {
+		LOG("Library image %s is from an incompatible version, ignoring",
+				path.c_str());
+		return false;
+	}
+	if (h->file_size != map_size ||
+			(uint64_t)h->chunks * CHUNK_SIZE < h->end ||
+			h->revision > max_revision) {
+		ERR("Library image %s is inconsistent, ignoring", path.c_str());
+		return false;
+	}
+
+	/* check that every section fits within the file */
+	uint64_t chunk_items = (uint64_t)h->chunks * CHUNK_SIZE;
+	uint64_t sizes[SEC_COUNT];
+	sizes[SEC_LIVE] = chunk_items * sizeof(uint8_t);
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		sizes[SEC_INT0 + i] = chunk_items * sizeof(tag_int_t);
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		sizes[SEC_STR0 + i] = chunk_items * sizeof(str_id_t);
+	}
+	sizes[SEC_PATHS] = chunk_items * sizeof(str_id_t);
+	sizes[SEC_MTIMES] = chunk_items * sizeof(int64_t);
+	sizes[SEC_STR_OFFSETS] = ((uint64_t)h->str_count + 1) * sizeof(uint32_t);
+	sizes[SEC_STR_DATA] = h->str_data_size;
+	sizes[SEC_PATH_OFFSETS] = ((uint64_t)h->path_count + 1) * sizeof(uint32_t);
+	sizes[SEC_PATH_DATA] = h->path_data_size;
+	for (int i = 0; i < SEC_COUNT; ++i) {
+		if (h->sections[i] % SECTION_ALIGN != 0 ||
+				h->sections[i] + sizes[i] > map_size) {
+			ERR("Library image %s has a bad section %d, ignoring", path.c_str(), i);
+			return false;
+		}
+	}
+	const uint32_t* str_offsets = (const uint32_t*)(base + h->sections[SEC_STR_OFFSETS]);
+	const char* str_data = base + h->sections[SEC_STR_DATA];
+	const uint32_t* path_offsets = (const uint32_t*)(base + h->sections[SEC_PATH_OFFSETS]);
+	const char* path_data = base + h->sections[SEC_PATH_DATA];
+	if (!check_strings(str_offsets, str_data, h->str_count, h->str_data_size) ||
+			!check_strings(path_offsets, path_data, h->path_count, h->path_data_size)) {
+		ERR("Library image %s has bad strings, ignoring", path.c_str());
+		return false;
+	}
+	/* the columns are used as they are, so every id in them has to resolve
+	 * and the live tracks have to be the ones the header counted */
+	for (int i = 0; i <= TAG_STR_COUNT; ++i) {
+		bool is_path = i == TAG_STR_COUNT;
+		const str_id_t* ids = (const str_id_t*)
+			(base + h->sections[is_path ? SEC_PATHS : SEC_STR0 + i]);
+		if (!check_ids(ids, chunk_items, is_path ? h->path_count : h->str_count)) {
+			ERR("Library image %s has bad string ids, ignoring", path.c_str());
+			return false;
+		}
+	}
+	if (count_live((const uint8_t*)(base + h->sections[SEC_LIVE]),
+					chunk_items, h->end) != h->count) {
+		ERR("Library image %s has a bad track count, ignoring", path.c_str());
+		return false;
+	}
+
+	map_column(store.live, owner, base, h->sections[SEC_LIVE], h->chunks);
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		map_column(store.ints[i], owner, base, h->sections[SEC_INT0 + i], h->chunks);
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		map_column(store.strs[i], owner, base, h->sections[SEC_STR0 + i], h->chunks);
+	}
+	map_column(store.paths, owner, base, h->sections[SEC_PATHS], h->chunks);
+	map_column(store.mtimes, owner, base, h->sections[SEC_MTIMES], h->chunks);
+	store.pool.setBase(owner, str_data, str_offsets, h->str_count);
+	store.path_pool.setBase(owner, path_data, path_offsets, h->path_count);
+	store.end = h->end;
+	store.count = h->count;
+
+	revision = h->revision;
+	size_t replayed = replay(store, h->revision, max_revision, revision);
+	LOG("Mapped %u tracks at revision %u from %s (+%lu delta)",
+			h->count, revision, path.c_str(), replayed);
+	return true;
+}
+
+bool adaapd::LibraryImage::Append(item_id_t id, FILE_EVENT_TYPE type,
+		const TrackInfo& info, revision_t revision) {
+	if (delta_fd == INVALID_FD && !openDelta()) {
+		return false;
+	}
+	delta_header h;
+	memset(&h, 0, sizeof(h));
+	h.revision = revision;
+	h.id = id;
+	h.type = type;
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		h.ints[i] = info.ints[i];
+	}
+	h.mtime = info.mtime;
+
+	std::string buf((const char*)&h, sizeof(h));
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		append_str(buf, info.strs[i]);
+	}
+	append_str(buf, info.path);
+	uint32_t size = buf.size();
+	memcpy(&buf[0], &size, sizeof(size));
+
+	/* single O_APPEND write: a crash leaves at worst a truncated last record */
+	if (write(delta_fd, buf.data(), buf.size()) != (ssize_t)buf.size()) {
+		ERR("Unable to append to %s: %d/%s",
+				delta_path.c_str(), errno, strerror(errno));
+		return false;
+	}
+	++delta_count;
+	return true;
+}
+
+bool adaapd::LibraryImage::Mark(revision_t revision) {
+	/* id 0 is never a track */
+	return Append(0, FILE_CHANGED, TrackInfo(), revision);
+}
+
+bool adaapd::LibraryImage::Write(const TrackStore& store, revision_t revision) {
+	uint64_t end = DeltaEnd();
+	return WriteImage(store, revision) && DropDelta(end);
+}
+
+bool adaapd::LibraryImage::WriteImage(const TrackStore& store, revision_t revision) const {
+	/* gather the strings which are still in use */
+	packed_strings strs(store.pool.Size()), paths(store.path_pool.Size());
+	for (item_id_t id = 0; id < store.End(); ++id) {
+		if (!store.Has(id)) {
+			continue;
+		}
+		for (int i = 0; i < TAG_STR_COUNT; ++i) {
+			strs.add(store.pool, store.strs[i].Get(id));
+		}
+		paths.add(store.path_pool, store.paths.Get(id));
+	}
+	strs.finish();
+	paths.finish();
+
+	std::string tmp_path = path + ".tmp";
+	FILE* f = fopen(tmp_path.c_str(), "wb");
+	if (f == NULL) {
+		ERR("Unable to open %s: %d/%s", tmp_path.c_str(), errno, strerror(errno));
+		return false;
+	}
+
+	header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, IMAGE_MAGIC, sizeof(h.magic));
+	h.version = IMAGE_VERSION;
+	h.byte_order = BYTE_ORDER_MARK;
+	h.chunk_size = CHUNK_SIZE;
+	h.revision = revision;
+	h.end = store.End();
+	h.count = store.Size();
+	h.chunks = store.live.ChunkCount();
+	h.str_count = strs.count;
+	h.str_data_size = strs.data.size();
+	h.path_count = paths.count;
+	h.path_data_size = paths.data.size();
+
+	writer w(f);
+	w.write(&h, sizeof(h));/* placeholder, rewritten below */
+
+	h.sections[SEC_LIVE] = w.align();
+	w.column(store.live);
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		h.sections[SEC_INT0 + i] = w.align();
+		w.column(store.ints[i]);
+	}
+	std::vector<str_id_t> chunk(CHUNK_SIZE);
+	for (int i = 0; i <= TAG_STR_COUNT; ++i) {
+		const Column<str_id_t>& col = (i == TAG_STR_COUNT) ? store.paths : store.strs[i];
+		const std::vector<str_id_t>& remap = (i == TAG_STR_COUNT) ? paths.remap : strs.remap;
+		h.sections[(i == TAG_STR_COUNT) ? SEC_PATHS : SEC_STR0 + i] = w.align();
+		for (size_t c = 0; c < col.ChunkCount(); ++c) {
+			const str_id_t* src = col.Chunk(c);
+			for (item_id_t j = 0; j < CHUNK_SIZE; ++j) {
+				chunk[j] = remap[src[j]];
+			}
+			w.write(chunk.data(), CHUNK_SIZE * sizeof(str_id_t));
+		}
+	}
+	h.sections[SEC_MTIMES] = w.align();
+	w.column(store.mtimes);
+	h.sections[SEC_STR_OFFSETS] = w.align();
+	w.write(strs.offsets.data(), strs.offsets.size() * sizeof(uint32_t));
+	h.sections[SEC_STR_DATA] = w.align();
+	w.write(strs.data.data(), strs.data.size());
+	h.sections[SEC_PATH_OFFSETS] = w.align();
+	w.write(paths.offsets.data(), paths.offsets.size() * sizeof(uint32_t));
+	h.sections[SEC_PATH_DATA] = w.align();
+	w.write(paths.data.data(), paths.data.size());
+	h.file_size = w.off;
+
+	bool ok = w.ok && fseek(f, 0, SEEK_SET) == 0 &&
+		fwrite(&h, sizeof(h), 1, f) == 1 &&
+		fflush(f) == 0 && fdatasync(fileno(f)) == 0;
+	if (fclose(f) != 0 || !ok) {
+		ERR("Unable to write %s: %d/%s", tmp_path.c_str(), errno, strerror(errno));
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+		ERR("Unable to rename %s to %s: %d/%s",
+				tmp_path.c_str(), path.c_str(), errno, strerror(errno));
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	/* the rename itself has to be durable before the delta log is dropped */
+	if (!sync_dir(path)) {
+		return false;
+	}
+	LOG("Wrote %u tracks at revision %u to %s (%lu bytes)",
+			h.count, revision, path.c_str(), h.file_size);
+	return true;
+}
+
+uint64_t adaapd::LibraryImage::DeltaEnd() {
+	struct stat sb;
+	if ((delta_fd == INVALID_FD && !openDelta()) || fstat(delta_fd, &sb) != 0) {
+		return 0;
+	}
+	return sb.st_size;
+}
+
+bool adaapd::LibraryImage::DropDelta(uint64_t end) {
+	/* the image now includes everything before 'end'. if we die before
+	 * dropping it, Load() skips the records the image already has. */
+	if (delta_fd == INVALID_FD && !openDelta()) {
+		return false;
+	}
+	std::string kept;
+	char tmp[65536];
+	ssize_t len;
+	while ((len = pread(delta_fd, tmp, sizeof(tmp), end + kept.size())) > 0) {
+		kept.append(tmp, len);
+	}
+	if (kept.empty()) {
+		if (ftruncate(delta_fd, 0) != 0) {
+			ERR("Unable to truncate %s: %d/%s",
+					delta_path.c_str(), errno, strerror(errno));
+			return false;
+		}
+		delta_count = 0;
+		return true;
+	}
+
+	/* records were appended meanwhile: they go into a fresh log which
+	 * replaces this one, so that neither is ever missing any of them */
+	std::string tmp_path = delta_path + ".tmp";
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == INVALID_FD) {
+		ERR("Unable to open %s: %d/%s", tmp_path.c_str(), errno, strerror(errno));
+		return false;
+	}
+	bool ok = write(fd, kept.data(), kept.size()) == (ssize_t)kept.size() &&
+		fdatasync(fd) == 0;
+	if (close(fd) != 0 || !ok || rename(tmp_path.c_str(), delta_path.c_str()) != 0) {
+		ERR("Unable to replace %s: %d/%s", delta_path.c_str(), errno, strerror(errno));
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	close(delta_fd);
+	delta_fd = INVALID_FD;
+	if (!sync_dir(delta_path) || !openDelta()) {
+		return false;
+	}
+	delta_count = 0;
+	for (size_t off = 0; off + sizeof(uint32_t) <= kept.size(); ++delta_count) {
+		uint32_t size;
+		memcpy(&size, kept.data() + off, sizeof(size));
+		if (size == 0) {
+			break;
+		}
+		off += size;
+	}
+	return true;
+}
+
+bool adaapd::LibraryImage::openDelta() {
+	delta_fd = open(delta_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (delta_fd == INVALID_FD) {
+		ERR("Unable to open %s: %d/%s",
+				delta_path.c_str(), errno, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+size_t adaapd::LibraryImage::replay(TrackStore& store, revision_t min_revision,
+		revision_t max_revision, revision_t& revision) {
+	if (delta_fd == INVALID_FD && !openDelta()) {
+		return 0;
+	}
+	std::string buf;
+	char tmp[65536];
+	ssize_t len;
+	while ((len = pread(delta_fd, tmp, sizeof(tmp), buf.size())) > 0) {
+		buf.append(tmp, len);
+	}
+
+	size_t applied = 0;
+	delta_count = 0;
+	const char* ptr = buf.data();
+	const char* end = ptr + buf.size();
+	while (ptr != end) {
+		delta_header h;
+		if (ptr + sizeof(h) <= end) {
+			memcpy(&h, ptr, sizeof(h));
+		}
+		if (ptr + sizeof(h) > end || h.size < sizeof(h) || ptr + h.size > end) {
+			/* drop it so that later records aren't appended after garbage */
+			ERR("Dropping truncated record at the end of %s", delta_path.c_str());
+			if (ftruncate(delta_fd, ptr - buf.data()) != 0) {
+				ERR("Unable to truncate %s: %d/%s",
+						delta_path.c_str(), errno, strerror(errno));
+			}
+			break;
+		}
+		const char* rec_end = ptr + h.size;
+		const char* str_ptr = ptr + sizeof(h);
+		ptr = rec_end;
+		++delta_count;
+
+		/* already in the image, or never committed to the Cache */
+		if (h.revision <= min_revision || h.revision > max_revision) {
+			continue;
+		}
+		if (h.id == 0) {
+			/* see Mark() */
+			if (h.revision > revision) {
+				revision = h.revision;
+			}
+			continue;
+		}
+		TrackInfo info;
+		bool ok = true;
+		for (int i = 0; i < TAG_STR_COUNT && ok; ++i) {
+			ok = read_str(str_ptr, rec_end, info.strs[i]);
+		}
+		if (!ok || !read_str(str_ptr, rec_end, info.path) ||
+				h.id == 0 || h.id >= (uint64_t)store.End() + MAX_ID_GAP) {
+			ERR("Ignoring corrupt record in %s", delta_path.c_str());
+			continue;
+		}
+		for (int i = 0; i < TAG_INT_COUNT; ++i) {
+			info.ints[i] = h.ints[i];
+		}
+		info.mtime = h.mtime;
+
+		if (h.type == FILE_REMOVED) {
+			store.Remove(h.id);
+		} else {
+			store.Set(h.id, info);
+		}
+		if (h.revision > revision) {
+			revision = h.revision;
+		}
+		++applied;
+	}
+	return applied;
+}
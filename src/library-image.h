@@ -0,0 +1,88 @@
+#ifndef _adaapd_library_image_h_
+#define _adaapd_library_image_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+
+#include "track-store.h"
+
+namespace adaapd {
+	/*! A versioned binary copy of a TrackStore which is mmap()ed read-only
+	 * on startup, so that the store is usable right away regardless of the
+	 * library size. All offsets in the file are relative to its start, so the
+	 * mapping may land anywhere. Changes made after the image was written
+	 * are appended to a delta log next to it, which is replayed by Load()
+	 * and folded back into the image by Write(). */
+	class LibraryImage {
+	public:
+		LibraryImage(const std::string& path);
+		virtual ~LibraryImage();
+
+		/*! Maps the image into 'store', which should be empty, then replays
+		 * any delta records up to 'max_revision'. 'revision' is set to the
+		 * revision of the result. Returns false if there's no usable image,
+		 * eg one which isn't consistent with itself, in which case 'store' is
+		 * left empty. */
+		bool Load(TrackStore& store, revision_t max_revision, revision_t& revision);
+
+		/*! Appends a change to the delta log. */
+		bool Append(item_id_t id, FILE_EVENT_TYPE type, const TrackInfo& info,
+				revision_t revision);
+
+		/*! Appends a record for a revision which didn't change any tracks,
+		 * so that Load() still brings the image up to it. */
+		bool Mark(revision_t revision);
+
+		/*! Replaces the image with the content of 'store' as of 'revision',
+		 * then empties the delta log. Strings which are no longer referenced
+		 * by any track are left out. */
+		bool Write(const TrackStore& store, revision_t revision);
+
+		/*! The first half of Write(): replaces the image, leaving the delta
+		 * log alone. Doesn't touch anything else here, so it may run on
+		 * another thread (eg with a snapshot of the store) while records
+		 * keep being appended. */
+		bool WriteImage(const TrackStore& store, revision_t revision) const;
+
+		/*! Where the delta log currently ends, for DropDelta(). */
+		uint64_t DeltaEnd();
+
+		/*! The second half of Write(): drops the delta records before 'end',
+		 * which was the DeltaEnd() when the store given to WriteImage() was
+		 * as of its revision. Records appended since are kept. */
+		bool DropDelta(uint64_t end);
+
+		/*! The number of records in the delta log. */
+		size_t DeltaCount() const {
+			return delta_count;
+		}
+
+	private:
+		bool openDelta();
+		size_t replay(TrackStore& store, revision_t min_revision,
+				revision_t max_revision, revision_t& revision);
+
+		const std::string path, delta_path;
+		int delta_fd;
+		size_t delta_count;
+	};
+}
+
+#endif
@@ -0,0 +1,332 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "library.h"
+#include "logging.h"
+#include "trace.h"
+
+/* rewrite the image once this many changes have piled up in the delta log */
+#define COMPACT_THRESHOLD 4096
+
+adaapd::Library::Library(const std::string& image_path)
+	: image(image_path), compacted(false), compact_ok(false), compact_delta(0),
+	  store(new TrackStore), revision(0), epoch(0), loading(false),
+	  blob_plan(dmap::ITEM_FIELDS), blobs_size(0), base_revision(0), browse(collation),
+	  orders(collation), playlists(new PlaylistSet), playlist_generation(0),
+	  next_subscriber(0), generation(0) {
+	publish();
+}
+
+adaapd::Library::~Library() {
+	finish_compact(true);
+}
+
+bool adaapd::Library::Load(Cache& cache) {
+	if (image.Load(*store, cache.Revision(), revision) &&
+			revision == cache.Revision()) {
+		for (item_id_t id = 0; id < store->End(); ++id) {
+			dirty.push_back(id);
+		}
+		base_revision = revision;
+		rebuild();
+		playlists->Load(playlist_specs, *store, &paths);
+		publish();
+		return true;
+	}
+
+	LOG("Library image is stale, loading revision %u from cache", cache.Revision());
+	store.reset(new TrackStore);
+	loading = true;
+	bool ok = cache.LoadTracks();
+	loading = false;
+	if (!ok) {
+		return false;
+	}
+	revision = cache.Revision();
+	Compact();
+	dirty.clear();
+	for (item_id_t id = 0; id < store->End(); ++id) {
+		dirty.push_back(id);
+	}
+	base_revision = revision;
+	rebuild();
+	playlists->Load(playlist_specs, *store, &paths);
+	publish();
+	return true;
+}
+
+void adaapd::Library::TrackEvent(item_id_t id, FILE_EVENT_TYPE type,
+		const TrackInfo& info, revision_t revision_) {
+	tag_mask_t fields = 0;
+	switch (type) {
+	case FILE_CREATED:
+	case FILE_CHANGED: {
+		if (!loading) {
+			fields = store->Diff(id, info);
+			index.Remove(*store, id, fields);
+			browse.Remove(*store, id, fields);
+			orders.Remove(*store, id, fields);
+		}
+		/* a track's path rarely changes, unlike its tags */
+		bool moved = !loading && (!store->Has(id) || info.path != store->Path(id));
+		if (moved && store->Has(id)) {
+			paths.Remove(*store, id);
+		}
+		store->Set(id, info);
+		if (!loading) {
+			collation.Update(store->Strings());
+			search.Update(store->Strings());
+			index.Add(*store, id, fields);
+			browse.Add(*store, id, fields);
+			orders.Add(*store, id, fields);
+		}
+		if (moved) {
+			paths.Add(*store, id);
+		}
+		break;
+	}
+	case FILE_REMOVED:
+		if (store->Has(id)) {
+			fields = TAG_MASK_ALL;
+		}
+		if (!loading) {
+			index.Remove(*store, id, fields);
+			browse.Remove(*store, id, fields);
+			orders.Remove(*store, id, fields);
+			if (store->Has(id)) {
+				paths.Remove(*store, id);
+			}
+		}
+		store->Remove(id);
+		break;
+	}
+	if (fields != 0 && !loading) {
+		/* only the playlists which look at one of these fields, which are
+		 * all rebuilt once loading is done */
+		playlists->Update(*store, id, fields);
+	}
+
+	if (!loading) {
+		image.Append(id, type, info, revision_);
+		changed.Grow(id + 1, 0);
+		changed.Set(id, revision_);
+	}
+	dirty.push_back(id);
+}
+
+void adaapd::Library::Committed(revision_t revision_) {
+	/* the store is now exactly at 'revision', so this is the place to take
+	 * the tracks for the image, which is written without holding up the
+	 * loop. Records appended meanwhile are kept when the delta log is
+	 * dropped, since they're newer than the image. */
+	revision = revision_;
+	finish_compact(false);
+	if (!compactor.joinable() && image.DeltaCount() >= COMPACT_THRESHOLD) {
+		compacted = false;
+		compact_delta = image.DeltaEnd();
+		compactor = std::thread(std::bind(&Library::compact, this,
+						store->Snapshot(), revision));
+	}
+	publish();
+}
+
+bool adaapd::Library::SetPlaylists(const std::vector<Playlist>& specs) {
+	playlist_specs = specs;
+	bool ok = playlists->Load(playlist_specs, *store, &paths);
+	++playlist_generation;
+	publish();
+	return ok;
+}
+
+bool adaapd::Library::Compact() {
+	finish_compact(true);
+	return image.Write(*store, revision);
+}
+
+void adaapd::Library::compact(std::shared_ptr<const TrackStore> tracks,
+		revision_t revision_) {
+	trace::SetThreadName("compact");
+	TraceSpan span("compact");
+	compact_ok = image.WriteImage(*tracks, revision_);
+	compacted = true;
+}
+
+void adaapd::Library::finish_compact(bool wait) {
+	if (!compactor.joinable() || (!wait && !compacted)) {
+		return;
+	}
+	compactor.join();
+	if (compact_ok) {
+		image.DropDelta(compact_delta);
+	}
+}
+
+void adaapd::Library::SwapPlaylists(const std::vector<Playlist>& specs,
+		std::unique_ptr<PlaylistSet> built, const LibrarySnapshot& from,
+		revision_t revision_) {
+	/* while a revision is being applied the live tracks are ahead of what
+	 * has been committed, so the new playlists are first brought up to the
+	 * last published snapshot and go out with that */
+	std::shared_ptr<const LibrarySnapshot> committed = Published();
+	const TrackStore& tracks = dirty.empty() ? *store : *committed->tracks;
+	playlist_specs = specs;
+	if (from.epoch != epoch) {
+		/* the tracks were reloaded meanwhile, nothing to salvage */
+		built->Load(playlist_specs, tracks, &paths);
+	} else {
+		/* catch up with whatever changed after 'from' */
+		item_id_t end = changed.ChunkCount() << CHUNK_BITS;
+		for (item_id_t id = 0; id < end; ++id) {
+			if (changed.Get(id) > from.revision) {
+				built->Update(tracks, id, TAG_MASK_ALL);
+			}
+		}
+	}
+	playlists = std::move(built);
+	++playlist_generation;
+	if (dirty.empty()) {
+		if (revision_ > revision) {
+			/* no tracks changed, but the image has to reach it as well */
+			image.Mark(revision_);
+			revision = revision_;
+		}
+		publish();
+		return;
+	}
+
+	publish_playlists(*committed);
+	/* then the uncommitted changes, which go out with their revision */
+	for (size_t i = 0; i < dirty.size(); ++i) {
+		playlists->Update(*store, dirty[i], TAG_MASK_ALL);
+	}
+}
+
+void adaapd::Library::rebuild() {
+	/* the pool may have been replaced along with the tracks */
+	++epoch;
+	collation.Clear();
+	collation.Update(store->Strings());
+	index.Build(*store);
+	search.Clear();
+	search.Update(store->Strings());
+	paths.Build(*store);
+	browse.Build(*store);
+	orders.Build(*store);
+}
+
+void adaapd::Library::encode(item_id_t id) {
+	blobs.Grow(id + 1, blob_t());
+	blob_t old = blobs.Get(id);
+	if (old) {
+		blobs_size -= old->size();
+	}
+	if (store->Has(id)) {
+		std::shared_ptr<std::string> blob(new std::string);
+		blob_plan.Item(*blob, *store, id);
+		blobs_size += blob->size();
+		blobs.Set(id, blob);
+	} else if (old) {
+		blobs.Set(id, blob_t());
+	}
+}
+
+void adaapd::Library::publish() {
+	for (size_t i = 0; i < dirty.size(); ++i) {
+		encode(dirty[i]);
+	}
+	dirty.clear();
+
+	std::shared_ptr<LibrarySnapshot> snapshot(new LibrarySnapshot);
+	snapshot->tracks = store->Snapshot();
+	snapshot->revision = revision;
+	snapshot->epoch = epoch;
+	snapshot->blobs.reset(new Column<blob_t>(blobs.Share()));
+	snapshot->blobs_size = blobs_size;
+	snapshot->changed.reset(new Column<revision_t>(changed.Share()));
+	snapshot->base_revision = base_revision;
+	snapshot->index = index.Snapshot();
+	snapshot->search = search.Snapshot();
+	snapshot->paths = paths.Snapshot();
+	for (int i = 0; i < BrowseLists::LIST_COUNT; ++i) {
+		snapshot->browse[i] = browse.Encoded(store->Strings(), (BrowseLists::LIST)i);
+	}
+	for (int i = 0; i < TrackOrders::ORDER_COUNT; ++i) {
+		snapshot->orders[i] = orders.Order((TrackOrders::ORDER)i);
+	}
+	if (playlists->Changed() || !playlist_members) {
+		std::shared_ptr<playlist_members_t> members(new playlist_members_t(playlists->Size()));
+		for (size_t i = 0; i < playlists->Size(); ++i) {
+			(*members)[i].name = playlists->Name(i);
+			(*members)[i].members = playlists->Members(i);
+		}
+		playlist_members = members;
+	}
+	snapshot->playlists = playlist_members;
+	snapshot->playlist_generation = playlist_generation;
+	release(snapshot);
+}
+
+void adaapd::Library::publish_playlists(const LibrarySnapshot& base) {
+	std::shared_ptr<LibrarySnapshot> snapshot(new LibrarySnapshot(base));
+	std::shared_ptr<playlist_members_t> members(new playlist_members_t(playlists->Size()));
+	for (size_t i = 0; i < playlists->Size(); ++i) {
+		(*members)[i].name = playlists->Name(i);
+		(*members)[i].members = playlists->Members(i);
+	}
+	playlists->Changed();
+	playlist_members = members;
+	snapshot->playlists = playlist_members;
+	snapshot->playlist_generation = playlist_generation;
+	release(snapshot);
+}
+
+void adaapd::Library::release(std::shared_ptr<LibrarySnapshot> snapshot) {
+	std::atomic_store(&published, std::shared_ptr<const LibrarySnapshot>(snapshot));
+	generation.fetch_add(1, std::memory_order_release);
+
+	std::lock_guard<std::mutex> lock(subscribers_lock);
+	for (std::map<size_t, publish_subscriber_t>::const_iterator iter = subscribers.begin();
+		 iter != subscribers.end(); ++iter) {
+		iter->second();
+	}
+}
+
+size_t adaapd::Library::Subscribe(publish_subscriber_t subscriber) {
+	std::lock_guard<std::mutex> lock(subscribers_lock);
+	subscribers[next_subscriber] = subscriber;
+	return next_subscriber++;
+}
+
+void adaapd::Library::Unsubscribe(size_t id) {
+	std::lock_guard<std::mutex> lock(subscribers_lock);
+	subscribers.erase(id);
+}
+
+adaapd::LibraryReader::LibraryReader(const Library& library)
+	: library(library), generation(0) {
+	Get();
+}
+
+const adaapd::LibrarySnapshot& adaapd::LibraryReader::Get() {
+	uint32_t current = library.generation.load(std::memory_order_acquire);
+	if (current != generation || !snapshot) {
+		snapshot = std::atomic_load(&library.published);
+		generation = current;
+	}
+	return *snapshot;
+}
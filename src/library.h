@@ -0,0 +1,261 @@
+#ifndef _adaapd_library_h_
+#define _adaapd_library_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "browse.h"
+#include "cache.h"
+#include "dmap.h"
+#include "library-image.h"
+#include "path-index.h"
+#include "search-index.h"
+#include "playlist.h"
+#include "tag-index.h"
+#include "track-order.h"
+#include "track-store.h"
+
+namespace adaapd {
+	/*! A track's encoded DMAP listing entry. */
+	typedef std::shared_ptr<const std::string> blob_t;
+
+	/*! Called after each new snapshot is published, on the thread which
+	 * feeds the Library. */
+	typedef std::function<void()> publish_subscriber_t;
+
+	/*! A playlist's members as of some revision. */
+	struct PlaylistMembers {
+		std::string name;
+		Bitmap members;
+	};
+	typedef std::vector<PlaylistMembers> playlist_members_t;
+
+	/*! An immutable view of the library at some revision. */
+	struct LibrarySnapshot {
+		LibrarySnapshot() : revision(0), epoch(0), base_revision(0), blobs_size(0),
+			playlist_generation(0) { }
+
+		std::shared_ptr<const TrackStore> tracks;
+		revision_t revision;
+		/* bumped each time the tracks are loaded from scratch, after which
+		 * string ids from before don't mean the same thing */
+		uint32_t epoch;
+
+		/* The revision in which each id was last added, changed or removed,
+		 * for answering "what changed since revision N". Changes from before
+		 * 'base_revision' (ie before we were started) aren't known, so
+		 * anything older needs a full listing. */
+		std::shared_ptr<const Column<revision_t> > changed;
+		revision_t base_revision;
+
+		/* the listing entry with all of dmap::ITEM_FIELDS for each track,
+		 * so that a full listing is a gather of these rather than an
+		 * encode. Empty for missing ids. */
+		std::shared_ptr<const Column<blob_t> > blobs;
+		/* the total size of 'blobs' */
+		uint64_t blobs_size;
+
+		/* the tracks with each artist, album, genre and composer */
+		std::shared_ptr<const TagIndex> index;
+		/* the strings of the tracks' tag pool, for wildcard queries */
+		std::shared_ptr<const SearchIndex> search;
+		/* the tracks by path */
+		std::shared_ptr<const PathIndex> paths;
+
+		/* the encoded response for each browse list */
+		std::shared_ptr<const std::string> browse[BrowseLists::LIST_COUNT];
+
+		/* the ids of all tracks in each sort= order */
+		std::shared_ptr<const std::vector<item_id_t> > orders[TrackOrders::ORDER_COUNT];
+
+		/* the playlists, in the order they were given to the Library */
+		std::shared_ptr<const playlist_members_t> playlists;
+		/* bumped each time the playlists are replaced */
+		uint32_t playlist_generation;
+	};
+
+	/*! The in-memory library. Applies track changes from the Cache to the
+	 * TrackStore and keeps its LibraryImage up to date, so that the next
+	 * startup can map the image instead of reloading every track.
+	 *
+	 * Each committed revision is published as a LibrarySnapshot, which other
+	 * threads pick up through a LibraryReader. Publishing never waits for
+	 * readers and readers never wait for changes to be applied. */
+	class Library {
+	public:
+		Library(const std::string& image_path);
+		virtual ~Library();
+
+		/*! Loads the tracks for the cache's current revision, preferably from
+		 * the image. Falls back to loading them from the cache itself (then
+		 * writing a fresh image) when the image is missing or out of date. */
+		bool Load(Cache& cache);
+
+		/*! A track_subscriber_t for the Cache. */
+		void TrackEvent(item_id_t id, FILE_EVENT_TYPE type, const TrackInfo& info,
+				revision_t revision);
+
+		/*! A commit_subscriber_t for the Cache. Publishes a new snapshot.
+		 * Once the delta log has gotten large, this also starts writing the
+		 * image from a snapshot of the tracks on another thread, and a later
+		 * call drops the delta records it covers once it's done. */
+		void Committed(revision_t revision);
+
+		/*! Folds the delta log back into the image right away, after any
+		 * write which Committed() has started. */
+		bool Compact();
+
+		/*! The live tracks. Only for the thread which feeds the Library. */
+		const TrackStore& Tracks() const {
+			return *store;
+		}
+
+		/*! Replaces the playlists, whose membership is then kept up to date
+		 * as tracks change, and publishes them. Returns false if any of them
+		 * are malformed, in which case those are left empty. */
+		bool SetPlaylists(const std::vector<Playlist>& specs);
+
+		/*! Replaces the playlists with 'built', which was loaded from 'specs'
+		 * against the snapshot 'from', eg on another thread so that a large
+		 * library isn't matched on this one. Tracks which have changed since
+		 * 'from' are matched again here, then the playlists are published
+		 * with a new playlist_generation under 'revision', which should be
+		 * one taken for the swap (see Cache::Bump()) so that clients notice
+		 * it. If a revision is being applied they're instead published
+		 * against the last committed one, and its changes go out with the
+		 * revision being applied. */
+		void SwapPlaylists(const std::vector<Playlist>& specs,
+				std::unique_ptr<PlaylistSet> built, const LibrarySnapshot& from,
+				revision_t revision);
+
+		/*! The playlists and their members. Only for the thread which feeds
+		 * the Library. */
+		const PlaylistSet& Playlists() const {
+			return *playlists;
+		}
+
+		/*! The latest published snapshot, for a thread which only needs
+		 * one of them rather than a LibraryReader. May be called from any
+		 * thread. */
+		std::shared_ptr<const LibrarySnapshot> Published() const {
+			return std::atomic_load(&published);
+		}
+
+		/*! The latest revision which has been applied to Tracks(). */
+		revision_t Revision() const {
+			return revision;
+		}
+
+		/*! Adds a subscriber which is told about each new snapshot, eg to
+		 * wake up another thread. Returns an id for Unsubscribe(). These
+		 * may be called from any thread. */
+		size_t Subscribe(publish_subscriber_t subscriber);
+		void Unsubscribe(size_t id);
+
+	private:
+		friend class LibraryReader;
+
+		/* rebuilds the indexes of the tracks after a Load() */
+		void rebuild();
+		void encode(item_id_t id);
+		void publish();
+		/* publishes 'base' with the current playlists, for when the live
+		 * tracks are ahead of it */
+		void publish_playlists(const LibrarySnapshot& base);
+		void release(std::shared_ptr<LibrarySnapshot> snapshot);
+		/* writes the image on the compactor thread */
+		void compact(std::shared_ptr<const TrackStore> tracks, revision_t revision);
+		/* drops the delta records which the compactor thread has written
+		 * out, if it's done or 'wait' */
+		void finish_compact(bool wait);
+
+		LibraryImage image;
+		/* set by the compactor thread once the image is written, after
+		 * 'compact_ok' */
+		std::thread compactor;
+		std::atomic<bool> compacted;
+		bool compact_ok;
+		/* where the delta log ended when the compactor's tracks were taken */
+		uint64_t compact_delta;
+		std::unique_ptr<TrackStore> store;
+		revision_t revision;
+		uint32_t epoch;
+		bool loading;
+
+		/* only the tracks which changed since the last publish are encoded
+		 * again, everything else is shared with the previous snapshot */
+		const dmap::EncodePlan blob_plan;
+		Column<blob_t> blobs;
+		uint64_t blobs_size;
+		std::vector<item_id_t> dirty;
+
+		Column<revision_t> changed;
+		revision_t base_revision;
+
+		/* sort keys for the store's strings, for 'browse' and 'orders' */
+		Collation collation;
+		TagIndex index;
+		SearchIndex search;
+		PathIndex paths;
+		BrowseLists browse;
+		TrackOrders orders;
+
+		std::vector<Playlist> playlist_specs;
+		std::unique_ptr<PlaylistSet> playlists;
+		uint32_t playlist_generation;
+		/* only copied again when a membership has changed */
+		std::shared_ptr<const playlist_members_t> playlist_members;
+
+		std::mutex subscribers_lock;
+		std::map<size_t, publish_subscriber_t> subscribers;
+		size_t next_subscriber;
+
+		/* written with std::atomic_store(), read with std::atomic_load() */
+		std::shared_ptr<const LibrarySnapshot> published;
+		/* bumped after each publish, so that readers can tell when to pick
+		 * up the new snapshot without touching 'published' */
+		std::atomic<uint32_t> generation;
+	};
+
+	/*! A thread's view of a Library's published snapshots. Get() is a single
+	 * atomic load unless there's a new snapshot, so it can be called for
+	 * every request. The snapshot is kept alive until the next Get() which
+	 * finds a newer one. */
+	class LibraryReader {
+	public:
+		LibraryReader(const Library& library);
+
+		const LibrarySnapshot& Get();
+
+	private:
+		const Library& library;
+		std::shared_ptr<const LibrarySnapshot> snapshot;
+		uint32_t generation;
+	};
+}
+
+#endif
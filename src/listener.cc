@@ -28,9 +28,19 @@
 
 #include "listener.h"
 #include "logging.h"
+#include "metrics.h"
+#include "trace.h"
 
 namespace sp = std::placeholders;
 
+namespace {
+	adaapd::Counter& inotify_events = adaapd::Metrics::Get().GetCounter(
+			"adaapd_listener_events_total", "inotify events handled");
+	adaapd::Histogram& inotify_batch = adaapd::Metrics::Get().GetHistogram(
+			"adaapd_listener_batch_events", "inotify events per read",
+			adaapd::SizeBuckets(), 1);
+}
+
 #ifdef _WIN32
 #define SEP '\\'
 #define SEP_STR "\\"
@@ -108,9 +118,9 @@ namespace adaapd {
 			removeAll(removed_subdirs, false);
 		}
 
-		/*! A file was added with a given mtime. Add to tracked list and notify
+		/*! A file was added with a given stat. Add to tracked list and notify
 		 * the callback. */
-		void AddFile(const std::string& filename, time_t mtime) {
+		void AddFile(const std::string& filename, const FileStat& stat) {
 			std::pair<files_t::const_iterator,bool> result =
 				files.insert(filename);
 			if (!result.second) {
@@ -118,15 +128,16 @@ namespace adaapd {
 						path.c_str(), filename.c_str());
 				return;
 			}
-			cb(join(path, filename), FILE_CREATED, mtime);
+			TraceSpan span("subscriber");
+			cb(join(path, filename), FILE_CREATED, stat);
 		}
 
-		/*! A file was added. Get its mtime then call AddFile(name, mtime). */
+		/*! A file was added. Get its stat then call AddFile(name, stat). */
 		void AddFile(const std::string& filename) {
 			std::string filepath = join(path, filename);
 			TYPE type;
-			time_t mtime;
-			if (!fileInfo(filepath, type, mtime)) {
+			FileStat stat;
+			if (!fileInfo(filepath, type, stat)) {
 				return;
 			}
 			if (type != FILE && type != SYMLINK) {
@@ -134,7 +145,7 @@ namespace adaapd {
 						filename.c_str(), path.c_str(), type);
 				return;
 			}
-			AddFile(filename, mtime);
+			AddFile(filename, stat);
 		}
 
 		/*! A file was moved or deleted. Remove from tracked list and notify the
@@ -144,10 +155,11 @@ namespace adaapd {
 				ERR("WARNING: %s told to remove untracked file %s!",
 						path.c_str(), filename.c_str());
 			}
-			cb(join(path, filename), FILE_REMOVED, 0);
+			TraceSpan span("subscriber");
+			cb(join(path, filename), FILE_REMOVED, FileStat());
 		}
 
-		/*! A file was modified. Notify the callback with the new mtime. */
+		/*! A file was modified. Notify the callback with the new stat. */
 		void ChangeFile(const std::string& filename) {
 			files_t::const_iterator iter = files.find(filename);
 			if (iter == files.end()) {
@@ -157,8 +169,8 @@ namespace adaapd {
 			}
 			std::string filepath = join(path, filename);
 			TYPE type;
-			time_t mtime;
-			if (!fileInfo(filepath, type, mtime)) {
+			FileStat stat;
+			if (!fileInfo(filepath, type, stat)) {
 				return;
 			}
 			if (type != FILE && type != SYMLINK) {
@@ -166,7 +178,8 @@ namespace adaapd {
 						filename.c_str(), path.c_str(), type);
 				return;
 			}
-			cb(filepath, FILE_CHANGED, mtime);
+			TraceSpan span("subscriber");
+			cb(filepath, FILE_CHANGED, stat);
 		}
 
 		/*! A directory was added. Recursively track its files/subdirectories,
@@ -208,14 +221,17 @@ namespace adaapd {
 		typedef std::unordered_map<std::string, dirnode*> dirmap_t;
 
 		enum TYPE { FILE, DIRECTORY, SYMLINK };
-		bool fileInfo(const std::string& filepath, TYPE& type, time_t& mtime) {
+		bool fileInfo(const std::string& filepath, TYPE& type, FileStat& stat) {
+			TraceSpan span("lstat");
 			struct stat sb;
 			if (lstat(filepath.c_str(), &sb) != 0) {
 				ERR("Unable to stat file %s: %d/%s",
 						filepath.c_str(), errno, strerror(errno));
 				return false;
 			}
-			mtime = sb.st_mtime;
+			stat.mtime = sb.st_mtime;
+			stat.size = sb.st_size;
+			stat.inode = sb.st_ino;
 			if (S_ISDIR(sb.st_mode)) {
 				type = DIRECTORY;
 			} else if (S_ISREG(sb.st_mode)) {
@@ -232,6 +248,8 @@ namespace adaapd {
 		/*! Add all entries within this directory, recursively calling
 		 * AddDir/AddFile for each. */
 		bool addAll(dirlist_t& added_subdirs) {
+			/* includes the subdirectories, which have spans of their own */
+			TraceSpan span("readdir", path);
 			DIR* dirp = opendir(path.c_str());
 			if (dirp == NULL) {
 				ERR("Couldn't open directory %s: %d/%s",
@@ -247,7 +265,7 @@ namespace adaapd {
 			}
 
 			TYPE file_type;
-			time_t file_mtime;
+			FileStat file_stat;
 			struct dirent* ep;
 			while ((ep = readdir(dirp)) != NULL) {
 				/* ignore any files that start with "." */
@@ -255,7 +273,7 @@ namespace adaapd {
 					continue;
 				}
 				/* add files/dirs, automatically recurse into dirs: */
-				if (!fileInfo(join(path, ep->d_name), file_type, file_mtime)) {
+				if (!fileInfo(join(path, ep->d_name), file_type, file_stat)) {
 					continue;/* keep going */
 				}
 				switch (file_type) {
@@ -263,10 +281,10 @@ namespace adaapd {
 					AddDir(ep->d_name, added_subdirs);
 					break;
 				case FILE:
-					AddFile(ep->d_name, file_mtime);
+					AddFile(ep->d_name, file_stat);
 					break;
 				case SYMLINK:
-					AddFile(ep->d_name, file_mtime);//TODO
+					AddFile(ep->d_name, file_stat);//TODO
 					break;
 				}
 			}
@@ -281,7 +299,7 @@ namespace adaapd {
 			if (notify) {
 				for (files_t::const_iterator iter = files.begin();
 					 iter != files.end(); ++iter) {
-					cb(join(path, *iter), FILE_REMOVED, 0);
+					cb(join(path, *iter), FILE_REMOVED, FileStat());
 				}
 			}
 			files.clear();
@@ -455,6 +473,7 @@ bool adaapd::Listener::Init() {
 	}
 
 	tree = new dir_tree;
+	TraceSpan span("scan", root);
 	if (!tree->Init(inotify_fd, subscriber, root)) {
 		return false;
 	}
@@ -465,6 +484,7 @@ bool adaapd::Listener::Init() {
 }
 
 void adaapd::Listener::cb_ready(ev::io& /*io*/, int revents) {
+	TraceSpan span("inotify");
 	ssize_t len = read(inotify_fd, inotify_buf, INOTIFY_BUF_LEN);
 	if (len < 0) {
 		ERR("Failed to read from inotify file %d: %d/%s",
@@ -473,11 +493,15 @@ void adaapd::Listener::cb_ready(ev::io& /*io*/, int revents) {
 	}
 
 	ssize_t i = 0;
+	size_t count = 0;
 	while (i < len) {
 		struct inotify_event* event = (struct inotify_event*)&inotify_buf[i];
 		handle_event(event);
 		i += (sizeof(struct inotify_event) + event->len);
+		++count;
 	}
+	inotify_events.Add(count);
+	inotify_batch.Observe(count);
 }
 
 void adaapd::Listener::handle_event(struct inotify_event* event) {
@@ -487,12 +511,12 @@ void adaapd::Listener::handle_event(struct inotify_event* event) {
 		if ((mask & IN_DELETE_SELF) != 0) {
 			/* note: any children were already deleted
 			 * also, DONT remove watch, it's already done for us! TODO is this still the case?? */
-			LOG("auto-unwatched dir %s", event->name);
+			DEBUG("auto-unwatched dir %s", event->name);
 		} else if ((mask & (IN_DELETE | IN_MOVED_FROM)) != 0) {
-			LOG("unwatch deled/moved dir %s", event->name);
+			DEBUG("unwatch deled/moved dir %s", event->name);
 			tree->RemoveDir(event->wd, event->name);
 		} else if ((mask & (IN_MOVED_TO | IN_CREATE)) != 0) {
-			LOG("watch new dir %s", event->name);
+			DEBUG("watch new dir %s", event->name);
 			tree->AddDir(event->wd, event->name);
 		} else {
 			ERR("Unknown directory event code: %d", mask);
@@ -501,15 +525,15 @@ void adaapd::Listener::handle_event(struct inotify_event* event) {
 		/* It's a file */
 		if ((mask & IN_DELETE_SELF) != 0) {
 			/* for some reason this is hit for deleted directories (with ISDIR off!) */
-			LOG_DIR("delete self");
+			DEBUG_DIR("delete self");
 		} else if ((mask & (IN_MOVED_FROM | IN_DELETE)) != 0) {
-			LOG("deleted file %s", event->name);
+			DEBUG("deleted file %s", event->name);
 			tree->RemoveFile(event->wd, event->name);
 		} else if ((mask & (IN_MOVED_TO | IN_CREATE)) != 0) {
-			LOG("created file %s", event->name);
+			DEBUG("created file %s", event->name);
 			tree->AddFile(event->wd, event->name);
 		} else if ((mask & IN_MODIFY) != 0) {
-			LOG("modified file %s", event->name);
+			DEBUG("modified file %s", event->name);
 			tree->ChangeFile(event->wd, event->name);
 		} else {
 			ERR("Unknown file event code: %d", mask);
@@ -22,6 +22,8 @@
 #include <functional>
 #include <string>
 
+#include <sys/types.h>
+
 #include <ev++.h>
 
 namespace adaapd {
@@ -31,8 +33,25 @@ namespace adaapd {
 		FILE_REMOVED/* file is deleted or moved away */
 	};
 
+	/*! The attributes of a file which are used to tell whether it has changed
+	 * since it was last seen. Zeroed for FILE_REMOVED. */
+	struct FileStat {
+		FileStat() : mtime(0), size(0), inode(0) { }
+
+		time_t mtime;
+		off_t size;
+		ino_t inode;
+	};
+
+	inline bool operator==(const FileStat& a, const FileStat& b) {
+		return a.mtime == b.mtime && a.size == b.size && a.inode == b.inode;
+	}
+	inline bool operator!=(const FileStat& a, const FileStat& b) {
+		return !(a == b);
+	}
+
 	/*! Called when a change occurs within the Listener's path. */
-	typedef std::function<void(const std::string& path, FILE_EVENT_TYPE type, time_t mtime)> subscriber_t;
+	typedef std::function<void(const std::string& path, FILE_EVENT_TYPE type, const FileStat& stat)> subscriber_t;
 
 	/*! The listener waits for modifications to files within the given root path,
 	 * and notifies the subscriber of those changes. */
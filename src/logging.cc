@@ -18,35 +18,896 @@
 
 #include "logging.h"
 
-#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* the size of each thread's buffer, a power of two */
+#define RING_SIZE (64 * 1024)
+/* anything larger is written out directly by the thread logging it */
+#define MAX_RECORD (RING_SIZE / 4)
+/* how long the writer lets messages pile up once there are some. With
+ * nothing to write it sleeps until a thread logs something */
+#define WRITER_INTERVAL_MS 20
+/* messages from a single call site beyond this many per window are only
+ * counted, and the count is written out once the window is over. Errors
+ * are never held back */
+#define RATE_LIMIT 100
+#define RATE_WINDOW_MS 1000
+
+/* A message is packed into the buffer as a header followed by each
+ * argument: a tag byte, then either 8 bytes for a number or pointer, or a
+ * 4-byte length and the NUL-terminated bytes for a string. Messages are
+ * padded to 8 bytes, and one which doesn't fit before the end of the
+ * buffer starts over at the beginning after a zero size. */
+
+namespace {
+	enum TAG {
+		TAG_INT = 'i',
+		TAG_DOUBLE = 'd',
+		TAG_PTR = 'p',
+		TAG_STR = 's'
+	};
+
+	struct header {
+		uint32_t size;/* including the header and padding, 0 to skip to the end */
+		uint8_t level;
+		uint8_t nargs;
+		uint64_t seq;/* for putting messages from different threads in order */
+		const char* format;
+		const logging::_site* site;
+	};
+	const size_t HEADER_SIZE = (sizeof(header) + 7) & ~(size_t)7;
+
+	const char* LEVEL_NAMES[] = { "DEBUG", "LOG", "ERR" };
+
+	/* a single-producer, single-consumer queue of packed messages */
+	struct ring_buffer {
+		ring_buffer() : buf(new char[RING_SIZE]), write(0), read(0), orphaned(false) { }
+
+		std::unique_ptr<char[]> buf;
+		/* only moved forward by the thread which owns the buffer */
+		std::atomic<uint64_t> write;
+		/* only moved forward by the writer thread */
+		std::atomic<uint64_t> read;
+		/* set once the owning thread has exited */
+		std::atomic<bool> orphaned;
+	};
+	typedef std::shared_ptr<ring_buffer> ring_t;
+
+	/* lets go of the thread's buffer when the thread exits. the writer
+	 * drops it once it's empty */
+	struct local_ring {
+		~local_ring() {
+			if (ring) {
+				ring->orphaned = true;
+			}
+		}
+		ring_t ring;
+	};
+	thread_local local_ring local;
+
+	struct arg {
+		char tag;
+		int64_t i;
+		double d;
+		const void* ptr;
+		const char* str;
+	};
+
+	/* unpacks the header and arguments of a message */
+	void unpack(const char* record, header& h, std::vector<arg>& args) {
+		memcpy(&h, record, sizeof(h));
+		const char* p = record + HEADER_SIZE;
+		args.resize(h.nargs);
+		for (size_t i = 0; i < h.nargs; ++i) {
+			arg& a = args[i];
+			a.tag = *p++;
+			switch (a.tag) {
+			case TAG_STR: {
+				uint32_t len;
+				memcpy(&len, p, sizeof(len));
+				a.str = p + sizeof(len);
+				p += sizeof(len) + len + 1;
+				break;
+			}
+			case TAG_PTR: {
+				uint64_t ptr;
+				memcpy(&ptr, p, sizeof(ptr));
+				a.ptr = (const void*)(uintptr_t)ptr;
+				p += 8;
+				break;
+			}
+			case TAG_DOUBLE:
+				memcpy(&a.d, p, sizeof(a.d));
+				p += 8;
+				break;
+			default:
+				memcpy(&a.i, p, sizeof(a.i));
+				p += 8;
+				break;
+			}
+		}
+	}
+
+	template <typename T>
+	int print(char* buf, size_t size, const char* spec, const int* stars, int nstars, T value) {
+		switch (nstars) {
+		case 0:
+			return snprintf(buf, size, spec, value);
+		case 1:
+			return snprintf(buf, size, spec, stars[0], value);
+		default:
+			return snprintf(buf, size, spec, stars[0], stars[1], value);
+		}
+	}
+
+	/* appends a single conversion */
+	template <typename T>
+	void append(std::string& out, const char* spec, const int* stars, int nstars, T value) {
+		char buf[256];
+		int n = print(buf, sizeof(buf), spec, stars, nstars, value);
+		if (n < 0) {
+			return;
+		}
+		if ((size_t)n < sizeof(buf)) {
+			out.append(buf, n);
+			return;
+		}
+		size_t at = out.size();
+		out.resize(at + n + 1);
+		print(&out[at], n + 1, spec, stars, nstars, value);
+		out.resize(at + n);
+	}
+
+	/* integers are packed as 64 bits, so they're cut back down to whatever
+	 * the conversion says they were */
+	void append_signed(std::string& out, const char* spec, const int* stars, int nstars,
+			const std::string& length, int64_t v) {
+		if (length == "hh") {
+			append(out, spec, stars, nstars, (int)(signed char)v);
+		} else if (length == "h") {
+			append(out, spec, stars, nstars, (int)(short)v);
+		} else if (length == "l") {
+			append(out, spec, stars, nstars, (long)v);
+		} else if (length == "ll" || length == "q" || length == "j") {
+			append(out, spec, stars, nstars, (long long)v);
+		} else if (length == "z") {
+			append(out, spec, stars, nstars, (ssize_t)v);
+		} else if (length == "t") {
+			append(out, spec, stars, nstars, (ptrdiff_t)v);
+		} else {
+			append(out, spec, stars, nstars, (int)v);
+		}
+	}
+	void append_unsigned(std::string& out, const char* spec, const int* stars, int nstars,
+			const std::string& length, uint64_t v) {
+		if (length == "hh") {
+			append(out, spec, stars, nstars, (unsigned)(unsigned char)v);
+		} else if (length == "h") {
+			append(out, spec, stars, nstars, (unsigned)(unsigned short)v);
+		} else if (length == "l") {
+			append(out, spec, stars, nstars, (unsigned long)v);
+		} else if (length == "ll" || length == "q" || length == "j") {
+			append(out, spec, stars, nstars, (unsigned long long)v);
+		} else if (length == "z") {
+			append(out, spec, stars, nstars, (size_t)v);
+		} else if (length == "t") {
+			append(out, spec, stars, nstars, (size_t)v);
+		} else {
+			append(out, spec, stars, nstars, (unsigned)v);
+		}
+	}
+
+	/* printf(), with the arguments coming from a packed message. An
+	 * argument which doesn't fit its conversion is shown as such rather
+	 * than handed to snprintf() */
+	void format(std::string& out, const char* fmt, const std::vector<arg>& args) {
+		size_t next = 0;
+		const char* c = fmt;
+		for (;;) {
+			const char* pct = strchr(c, '%');
+			if (pct == NULL) {
+				out.append(c);
+				return;
+			}
+			out.append(c, pct - c);
+			c = pct + 1;
+			if (*c == '%') {
+				out += '%';
+				++c;
+				continue;
+			}
+
+			std::string spec("%"), length;
+			int stars[2];
+			int nstars = 0;
+			bool bad = false;
+			while (*c != 0 && strchr("-+ #0'", *c) != NULL) {
+				spec += *c++;
+			}
+			for (int part = 0; part < 2; ++part) {/* width, then precision */
+				if (*c == '*') {
+					if (next < args.size() && args[next].tag == TAG_INT) {
+						stars[nstars++] = (int)args[next++].i;
+					} else {
+						bad = true;
+					}
+					spec += *c++;
+				} else {
+					while (*c >= '0' && *c <= '9') {
+						spec += *c++;
+					}
+				}
+				if (part == 0 && *c == '.') {
+					spec += *c++;
+				} else {
+					break;
+				}
+			}
+			while (*c != 0 && strchr("hlLqjzt", *c) != NULL) {
+				length += *c;
+				spec += *c++;
+			}
+			char conv = *c;
+			if (conv == 0) {
+				out.append(spec);
+				return;
+			}
+			spec += conv;
+			++c;
+
+			if (bad || next >= args.size()) {
+				out.append("(missing)");
+				continue;
+			}
+			const arg& a = args[next++];
+			switch (conv) {
+			case 'd':
+			case 'i':
+				if (a.tag != TAG_INT) {
+					bad = true;
+				} else {
+					append_signed(out, spec.c_str(), stars, nstars, length, a.i);
+				}
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				if (a.tag != TAG_INT) {
+					bad = true;
+				} else {
+					append_unsigned(out, spec.c_str(), stars, nstars, length, a.i);
+				}
+				break;
+			case 'c':
+				if (a.tag != TAG_INT) {
+					bad = true;
+				} else {
+					append(out, spec.c_str(), stars, nstars, (int)a.i);
+				}
+				break;
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+				if (a.tag != TAG_DOUBLE) {
+					bad = true;
+				} else if (length == "L") {
+					append(out, spec.c_str(), stars, nstars, (long double)a.d);
+				} else {
+					append(out, spec.c_str(), stars, nstars, a.d);
+				}
+				break;
+			case 's':
+				if (a.tag != TAG_STR) {
+					bad = true;
+				} else {
+					append(out, spec.c_str(), stars, nstars, a.str);
+				}
+				break;
+			case 'p':
+				if (a.tag != TAG_PTR) {
+					bad = true;
+				} else {
+					append(out, spec.c_str(), stars, nstars, a.ptr);
+				}
+				break;
+			default:
+				bad = true;
+				break;
+			}
+			if (bad) {
+				out.append("(bad ");
+				out.append(spec);
+				out.append(")");
+			}
+		}
+	}
+
+	/* per call site, for rate limiting */
+	struct site {
+		site() : window(0), count(0), suppressed(0), level(0), format(NULL) { }
+
+		uint64_t window;/* start, in ms */
+		size_t count;
+		size_t suppressed;
+		uint8_t level;
+		const char* format;
+	};
+
+	/* Owns the writer thread and the list of every thread's buffer. Never
+	 * destroyed, so that logging during exit still works: after Stop(),
+	 * messages are written out directly. */
+	class backend {
+	public:
+		static backend& Get() {
+			static backend* instance = new backend;
+			return *instance;
+		}
+
+		bool Running() const {
+			return running;
+		}
+
+		uint64_t Seq() {
+			return seq.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void Dropped() {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		/* room for 'total' bytes in the calling thread's buffer, or NULL if
+		 * it's full. 'advance' is what to pass to Publish() */
+		char* Reserve(ring_buffer*& ring, size_t total, size_t& advance) {
+			if (!local.ring) {
+				local.ring.reset(new ring_buffer);
+				std::lock_guard<std::mutex> lock(rings_lock);
+				rings.push_back(local.ring);
+			}
+			ring = local.ring.get();
+			uint64_t w = ring->write.load(std::memory_order_relaxed);
+			uint64_t r = ring->read.load(std::memory_order_acquire);
+			size_t at = w & (RING_SIZE - 1);
+			size_t pad = (RING_SIZE - at < total) ? RING_SIZE - at : 0;
+			if (w + pad + total - r > RING_SIZE) {
+				wake();
+				return NULL;
+			}
+			if (pad != 0) {
+				uint32_t skip = 0;
+				memcpy(ring->buf.get() + at, &skip, sizeof(skip));
+				at = 0;
+			}
+			advance = pad + total;
+			return ring->buf.get() + at;
+		}
+
+		void Publish(ring_buffer& ring, size_t advance) {
+			uint64_t w = ring.write.load(std::memory_order_relaxed) + advance;
+			ring.write.store(w, std::memory_order_release);
+			/* pairs with the writer's check for messages after it sets
+			 * 'idle', so that one of the two sees the other */
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (idle.load(std::memory_order_relaxed) && idle.exchange(false)) {
+				wake();
+			} else if (w - ring.read.load(std::memory_order_relaxed) > RING_SIZE / 2) {
+				wake();
+			}
+		}
+
+		/* formats and writes a message on the calling thread */
+		void WriteDirect(const char* record) {
+			header h;
+			std::vector<arg> args;
+			unpack(record, h, args);
+			std::string line;
+			format(line, h.format, args);
+			line += '\n';
+			std::lock_guard<std::mutex> lock(out_lock);
+			FILE* f = (h.level == logging::LEVEL_ERROR) ? logging::ferr : logging::fout;
+			fwrite(line.data(), 1, line.size(), f);
+			fflush(f);
+		}
+
+		void Flush() {
+			std::unique_lock<std::mutex> lock(mutex);
+			if (!running) {
+				return;
+			}
+			uint64_t target = ++flush_requested;
+			wakeup = true;
+			cond.notify_one();
+			while (flushed < target && running) {
+				flushed_cond.wait(lock);
+			}
+		}
+
+		void Stop() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!running) {
+					return;
+				}
+				stopping = true;
+				cond.notify_one();
+			}
+			thread.join();
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+			flushed_cond.notify_all();
+		}
+
+	private:
+		backend()
+			: running(true), seq(0), dropped(0), idle(false), wakeup(false), stopping(false),
+			  flush_requested(0), flushed(0), suppressing(false),
+			  epoch(std::chrono::steady_clock::now()) {
+			thread = std::thread(std::bind(&backend::run, this));
+			atexit(&backend::stop_at_exit);
+		}
+
+		static void stop_at_exit() {
+			Get().Stop();
+		}
+
+		void wake() {
+			std::lock_guard<std::mutex> lock(mutex);
+			wakeup = true;
+			cond.notify_one();
+		}
+
+		void run() {
+			for (;;) {
+				uint64_t target;
+				bool last;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					if (!wakeup && !stopping) {
+						if (suppressing || pending()) {
+							cond.wait_for(lock, std::chrono::milliseconds(WRITER_INTERVAL_MS));
+						} else {
+							idle = true;
+							std::atomic_thread_fence(std::memory_order_seq_cst);
+							if (pending()) {
+								idle = false;
+							}
+							while (!wakeup && !stopping && idle) {
+								cond.wait(lock);
+							}
+							idle = false;
+						}
+					}
+					wakeup = false;
+					target = flush_requested;
+					last = stopping;
+				}
+				pass();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					flushed = target;
+					flushed_cond.notify_all();
+				}
+				if (last) {
+					return;
+				}
+			}
+		}
+
+		/* whether any thread has messages which haven't been taken yet */
+		bool pending() {
+			std::lock_guard<std::mutex> lock(rings_lock);
+			for (size_t i = 0; i < rings.size(); ++i) {
+				if (rings[i]->read.load(std::memory_order_relaxed) !=
+						rings[i]->write.load(std::memory_order_relaxed)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/* writes out everything which is in the buffers now */
+		void pass() {
+			{
+				std::lock_guard<std::mutex> lock(rings_lock);
+				current = rings;
+			}
+			batch.clear();
+			order.clear();
+			for (size_t i = 0; i < current.size(); ++i) {
+				take(*current[i]);
+			}
+			{
+				/* threads which have exited and whose messages are all out */
+				std::lock_guard<std::mutex> lock(rings_lock);
+				for (size_t i = 0; i < rings.size();) {
+					ring_buffer& ring = *rings[i];
+					if (ring.orphaned && ring.read.load() == ring.write.load()) {
+						rings[i] = rings.back();
+						rings.pop_back();
+					} else {
+						++i;
+					}
+				}
+			}
+			current.clear();
+
+			std::sort(order.begin(), order.end());
+			uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - epoch).count();
+			bool wrote = false;
+			std::lock_guard<std::mutex> lock(out_lock);
+			for (size_t i = 0; i < order.size(); ++i) {
+				header h;
+				unpack(&batch[order[i].second], h, args);
+				if (!allow(h, now)) {
+					continue;
+				}
+				line.clear();
+				format(line, h.format, args);
+				line += '\n';
+				write(h.level, line);
+				wrote = true;
+			}
+			suppressing = false;
+			for (std::unordered_map<const logging::_site*, site>::iterator iter = sites.begin();
+				 iter != sites.end(); ++iter) {
+				if (iter->second.suppressed == 0) {
+					continue;
+				}
+				if (now - iter->second.window >= RATE_WINDOW_MS) {
+					report(iter->second);
+					wrote = true;
+				} else {
+					/* wake up again to report these */
+					suppressing = true;
+				}
+			}
+			uint64_t lost = dropped.exchange(0);
+			if (lost != 0) {
+				char buf[128];
+				snprintf(buf, sizeof(buf), "ERR logging  Dropped %llu messages, the log buffer was full\n",
+						(unsigned long long)lost);
+				write(logging::LEVEL_ERROR, buf);
+				wrote = true;
+			}
+			if (wrote) {
+				fflush(logging::fout);
+				fflush(logging::ferr);
+			}
+		}
+
+		/* copies out the messages in 'ring' */
+		void take(ring_buffer& ring) {
+			uint64_t r = ring.read.load(std::memory_order_relaxed);
+			uint64_t w = ring.write.load(std::memory_order_acquire);
+			const char* buf = ring.buf.get();
+			while (r < w) {
+				size_t at = r & (RING_SIZE - 1);
+				uint32_t size;
+				memcpy(&size, buf + at, sizeof(size));
+				if (size == 0) {
+					r += RING_SIZE - at;
+					continue;
+				}
+				uint64_t seq;
+				memcpy(&seq, buf + at + offsetof(header, seq), sizeof(seq));
+				order.push_back(std::make_pair(seq, batch.size()));
+				batch.insert(batch.end(), buf + at, buf + at + size);
+				r += size;
+			}
+			ring.read.store(r, std::memory_order_release);
+		}
+
+		bool allow(const header& h, uint64_t now) {
+			if (h.level == logging::LEVEL_ERROR) {
+				return true;
+			}
+			site& s = sites[h.site];
+			if (now - s.window >= RATE_WINDOW_MS) {
+				report(s);
+				s.window = now;
+				s.count = 0;
+			}
+			s.level = h.level;
+			s.format = h.format;
+			if (s.count < RATE_LIMIT) {
+				++s.count;
+				return true;
+			}
+			++s.suppressed;
+			return false;
+		}
+
+		void report(site& s) {
+			if (s.suppressed == 0) {
+				return;
+			}
+			/* the call site's own format, rather than the LEVEL/function
+			 * prefix which the macros put in front of it */
+			const char* format = s.format;
+			size_t prefix = strlen(_PRINT_PREFIX);
+			if (strncmp(format, _PRINT_PREFIX, prefix) == 0) {
+				format += prefix;
+			}
+			char buf[128];
+			snprintf(buf, sizeof(buf), "%s logging  Suppressed %lu more messages like: ",
+					LEVEL_NAMES[s.level], (unsigned long)s.suppressed);
+			line = buf;
+			line += format;
+			line += '\n';
+			write(s.level, line);
+			s.suppressed = 0;
+		}
+
+		void write(uint8_t level, const std::string& text) {
+			FILE* f = (level == logging::LEVEL_ERROR) ? logging::ferr : logging::fout;
+			fwrite(text.data(), 1, text.size(), f);
+		}
+
+		std::atomic<bool> running;
+		std::atomic<uint64_t> seq;
+		std::atomic<uint64_t> dropped;
+		/* set while the writer sleeps with nothing to write, for the next
+		 * message to wake it */
+		std::atomic<bool> idle;
+
+		std::mutex rings_lock;
+		std::vector<ring_t> rings;
+
+		std::mutex mutex;
+		std::condition_variable cond, flushed_cond;
+		bool wakeup, stopping;
+		uint64_t flush_requested, flushed;
+		std::thread thread;
+
+		/* only for the writer thread */
+		std::vector<ring_t> current;
+		std::vector<char> batch;
+		std::vector<std::pair<uint64_t, size_t> > order;/* seq, offset in batch */
+		std::vector<arg> args;
+		std::string line;
+		std::unordered_map<const logging::_site*, site> sites;
+		/* whether any of 'sites' has suppressed messages to report */
+		bool suppressing;
+		const std::chrono::steady_clock::time_point epoch;
+
+		/* held while writing, so that direct writes don't interleave */
+		std::mutex out_lock;
+	};
+
+	/* every module's level, plus those set for modules which haven't been
+	 * registered yet */
+	class registry {
+	public:
+		static registry& Get() {
+			static registry* instance = new registry;
+			return *instance;
+		}
+
+		void Add(const std::string& name, logging::_module* module) {
+			std::lock_guard<std::mutex> lock(mutex);
+			modules.push_back(std::make_pair(name, module));
+			std::map<std::string, int>::const_iterator iter = levels.find(name);
+			module->min = (iter != levels.end()) ? iter->second : all;
+		}
+
+		void Set(int level) {
+			std::lock_guard<std::mutex> lock(mutex);
+			all = level;
+			levels.clear();
+			for (size_t i = 0; i < modules.size(); ++i) {
+				modules[i].second->min = level;
+			}
+		}
+
+		void Set(const std::string& name, int level) {
+			std::lock_guard<std::mutex> lock(mutex);
+			levels[name] = level;
+			for (size_t i = 0; i < modules.size(); ++i) {
+				if (modules[i].first == name) {
+					modules[i].second->min = level;
+				}
+			}
+		}
+
+	private:
+		registry() : all(logging::LEVEL_LOG) { }
+
+		std::mutex mutex;
+		int all;
+		std::map<std::string, int> levels;
+		std::vector<std::pair<std::string, logging::_module*> > modules;
+	};
+
+	bool parse_level(const std::string& str, logging::LEVEL& level) {
+		if (str == "debug") {
+			level = logging::LEVEL_DEBUG;
+		} else if (str == "log") {
+			level = logging::LEVEL_LOG;
+		} else if (str == "error") {
+			level = logging::LEVEL_ERROR;
+		} else if (str == "none") {
+			level = logging::LEVEL_NONE;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	std::string trim(const std::string& str) {
+		size_t start = str.find_first_not_of(" \t");
+		if (start == std::string::npos) {
+			return std::string();
+		}
+		return str.substr(start, str.find_last_not_of(" \t") + 1 - start);
+	}
+}
 
 namespace logging {
 	FILE *fout = stdout, *ferr = stderr;
-	bool debug_enabled = false;
 
-	void _debug(const char* format, ...) {
-		if (debug_enabled) {
-			va_list args;
-			va_start(args, format);
-			vfprintf(fout, format, args);
-			va_end(args);
-			fprintf(fout, "\n");
+	void SetLevel(LEVEL level) {
+		registry::Get().Set(level);
+	}
+
+	void SetLevel(const std::string& module, LEVEL level) {
+		registry::Get().Set(module, level);
+	}
+
+	bool Configure(const std::string& levels) {
+		/* module name (empty for all of them) and level */
+		std::vector<std::pair<std::string, LEVEL> > parsed;
+		size_t start = 0;
+		for (;;) {
+			size_t end = levels.find(',', start);
+			std::string entry = trim(levels.substr(start,
+							(end == std::string::npos) ? std::string::npos : end - start));
+			std::string module;
+			size_t eq = entry.find('=');
+			if (eq != std::string::npos) {
+				module = trim(entry.substr(0, eq));
+				entry = trim(entry.substr(eq + 1));
+				if (module.empty()) {
+					ERR("Missing module name in log levels: %s", levels.c_str());
+					return false;
+				}
+			}
+			LEVEL level;
+			if (!parse_level(entry, level)) {
+				ERR("Unknown log level '%s' in: %s", entry.c_str(), levels.c_str());
+				return false;
+			}
+			parsed.push_back(std::make_pair(module, level));
+			if (end == std::string::npos) {
+				break;
+			}
+			start = end + 1;
+		}
+
+		for (size_t i = 0; i < parsed.size(); ++i) {
+			if (parsed[i].first.empty()) {
+				SetLevel(parsed[i].second);
+			} else {
+				SetLevel(parsed[i].first, parsed[i].second);
+			}
+		}
+		return true;
+	}
+
+	void Flush() {
+		backend::Get().Flush();
+	}
+}
+
+logging::_module::_module(const char* file) {
+	const char* name = strrchr(file, '/');
+	name = (name != NULL) ? name + 1 : file;
+	const char* ext = strrchr(name, '.');
+	registry::Get().Add((ext != NULL) ? std::string(name, ext - name) : std::string(name), this);
+}
+
+logging::_record::_record(const _site* site, LEVEL level, const char* format,
+		size_t nargs, size_t size)
+	: start(NULL), out(NULL), ring(NULL), advance(0) {
+	backend& b = backend::Get();
+	size_t total = (HEADER_SIZE + size + 7) & ~(size_t)7;
+	bool queued = b.Running() && total <= MAX_RECORD;
+	if (queued) {
+		ring_buffer* r;
+		start = b.Reserve(r, total, advance);
+		if (start != NULL) {
+			ring = r;
+		} else if (level != LEVEL_ERROR) {
+			/* rather than holding up the caller. errors always make it */
+			b.Dropped();
+			return;
 		}
 	}
+	if (start == NULL) {
+		start = new char[total];
+	}
+
+	header h;
+	h.size = total;
+	h.level = level;
+	h.nargs = nargs;
+	h.seq = b.Seq();
+	h.format = format;
+	h.site = site;
+	memcpy(start, &h, sizeof(h));
+	out = start + HEADER_SIZE;
+}
+
+logging::_record::~_record() {
+	if (start == NULL) {
+		return;
+	}
+	if (ring != NULL) {
+		backend::Get().Publish(*(ring_buffer*)ring, advance);
+	} else {
+		backend::Get().WriteDirect(start);
+		delete[] start;
+	}
+}
 
-	void _log(const char* format, ...) {
-		va_list args;
-		va_start(args, format);
-		vfprintf(fout, format, args);
-		va_end(args);
-		fprintf(fout, "\n");
+void logging::_record::put(const char* str) {
+	if (out == NULL) {
+		return;
+	}
+	if (str == NULL) {
+		str = "(null)";
 	}
+	uint32_t len = strlen(str);
+	*out++ = TAG_STR;
+	memcpy(out, &len, sizeof(len));
+	out += sizeof(len);
+	memcpy(out, str, len + 1);
+	out += len + 1;
+}
+
+void logging::_record::put_int(int64_t value) {
+	if (out == NULL) {
+		return;
+	}
+	*out++ = TAG_INT;
+	memcpy(out, &value, 8);
+	out += 8;
+}
+
+void logging::_record::put_double(double value) {
+	if (out == NULL) {
+		return;
+	}
+	*out++ = TAG_DOUBLE;
+	memcpy(out, &value, 8);
+	out += 8;
+}
 
-	void _error(const char* format, ...) {
-		va_list args;
-		va_start(args, format);
-		vfprintf(ferr, format, args);
-		va_end(args);
-		fprintf(ferr, "\n");
+void logging::_record::put_ptr(const void* ptr) {
+	if (out == NULL) {
+		return;
 	}
+	uint64_t value = (uintptr_t)ptr;
+	*out++ = TAG_PTR;
+	memcpy(out, &value, 8);
+	out += 8;
 }
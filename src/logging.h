@@ -19,44 +19,198 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+/* Messages below this level are compiled out: 0 keeps everything, 1 drops
+ * DEBUG, 2 drops DEBUG and LOG, 3 drops everything. Set with
+ * -DLOG_LEVEL_MIN=N, see the LOG_LEVEL_MIN cmake option. */
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN 0
+#endif
 
 #define _PRINT_PREFIX "%s %s  "
 #define _PRINT_ARGS __FUNCTION__
 
+/* The level is checked before any of the arguments are evaluated, so a
+ * disabled message costs a single load and the arguments aren't built.
+ * Each call site has its own _site, which its messages are rate limited
+ * by. */
+#define _LOG_IF(level, ...)											\
+	do {															\
+		if (logging::level >= LOG_LEVEL_MIN &&						\
+				logging::_this_module.Enabled(logging::level)) {	\
+			static logging::_site _log_site;						\
+			logging::_write(&_log_site, logging::level, __VA_ARGS__);	\
+		}															\
+	} while (0)
+
 /* Some simple print helpers */
 
 /* Format str and file/line prefix */
-#define DEBUG(format, ...) logging::_debug(_PRINT_PREFIX format, "DEBUG", _PRINT_ARGS, __VA_ARGS__)
-#define LOG(format, ...) logging::_log(_PRINT_PREFIX format, "LOG", _PRINT_ARGS, __VA_ARGS__)
-#define ERR(format, ...) logging::_error(_PRINT_PREFIX format, "ERR", _PRINT_ARGS, __VA_ARGS__)
+#define DEBUG(format, ...) _LOG_IF(LEVEL_DEBUG, _PRINT_PREFIX format, "DEBUG", _PRINT_ARGS, __VA_ARGS__)
+#define LOG(format, ...) _LOG_IF(LEVEL_LOG, _PRINT_PREFIX format, "LOG", _PRINT_ARGS, __VA_ARGS__)
+#define ERR(format, ...) _LOG_IF(LEVEL_ERROR, _PRINT_PREFIX format, "ERR", _PRINT_ARGS, __VA_ARGS__)
 
 /* No file/line prefix ("RAW") */
-#define DEBUG_RAW(format, ...) logging::_debug(format, __VA_ARGS__)
-#define LOG_RAW(format, ...) logging::_log(format, __VA_ARGS__)
-#define ERR_RAW(format, ...) logging::_error(format, __VA_ARGS__)
+#define DEBUG_RAW(format, ...) _LOG_IF(LEVEL_DEBUG, format, __VA_ARGS__)
+#define LOG_RAW(format, ...) _LOG_IF(LEVEL_LOG, format, __VA_ARGS__)
+#define ERR_RAW(format, ...) _LOG_IF(LEVEL_ERROR, format, __VA_ARGS__)
 
 /* No format str ("Direct" -> "DIR") */
-#define DEBUG_DIR(...) logging::_debug(_PRINT_PREFIX "%s", "DEBUG", _PRINT_ARGS, __VA_ARGS__)
-#define LOG_DIR(...) logging::_log(_PRINT_PREFIX "%s", "LOG", _PRINT_ARGS, __VA_ARGS__)
-#define ERR_DIR(...) logging::_error(_PRINT_PREFIX "%s", "ERR", _PRINT_ARGS, __VA_ARGS__)
+#define DEBUG_DIR(...) _LOG_IF(LEVEL_DEBUG, _PRINT_PREFIX "%s", "DEBUG", _PRINT_ARGS, __VA_ARGS__)
+#define LOG_DIR(...) _LOG_IF(LEVEL_LOG, _PRINT_PREFIX "%s", "LOG", _PRINT_ARGS, __VA_ARGS__)
+#define ERR_DIR(...) _LOG_IF(LEVEL_ERROR, _PRINT_PREFIX "%s", "ERR", _PRINT_ARGS, __VA_ARGS__)
 
 /* No format str and no file/line prefix */
-#define DEBUG_RAWDIR(...) logging::_debug(__VA_ARGS__)
-#define LOG_RAWDIR(...) logging::_log(__VA_ARGS__)
-#define ERR_RAWDIR(...) logging::_error(__VA_ARGS__)
+#define DEBUG_RAWDIR(...) _LOG_IF(LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_RAWDIR(...) _LOG_IF(LEVEL_LOG, __VA_ARGS__)
+#define ERR_RAWDIR(...) _LOG_IF(LEVEL_ERROR, __VA_ARGS__)
 
 /* "log"'s taken by the math func */
 namespace logging {
 	/* configuration */
 	extern FILE *fout;
 	extern FILE *ferr;
-	extern bool debug_enabled;
 
-	/* DONT USE THESE, use DEBUG()/LOG()/ERR() instead: */
-	void _debug(const char* format, ...);
-	void _log(const char* format, ...);
-	void _error(const char* format, ...);
+	enum LEVEL {
+		LEVEL_DEBUG,
+		LEVEL_LOG,
+		LEVEL_ERROR,
+		LEVEL_NONE
+	};
+
+	/*! Sets the level of every module, including any which have their own
+	 * level. Everything starts at LEVEL_LOG. */
+	void SetLevel(LEVEL level);
+
+	/*! Sets the level of a single module. A module is a source file, named
+	 * without its directory or extension, eg "listener" or "tag". */
+	void SetLevel(const std::string& module, LEVEL level);
+
+	/*! Applies a comma-separated list of levels, each either "level" for
+	 * every module or "module=level", eg "log,listener=debug,tag=error".
+	 * Levels are "debug", "log", "error" or "none". Returns false if the
+	 * list couldn't be parsed, in which case nothing is changed. */
+	bool Configure(const std::string& levels);
+
+	/*! Blocks until everything logged so far has been written out. */
+	void Flush();
+
+	/* the level of the source file including this header. Registered when
+	 * it's constructed, and never unregistered since it's never destroyed
+	 * before exit */
+	class _module {
+	public:
+		_module(const char* file);
+
+		bool Enabled(LEVEL level) const {
+			return level >= min.load(std::memory_order_relaxed);
+		}
+
+		std::atomic<int> min;
+	};
+	namespace {
+		_module _this_module(__BASE_FILE__);
+	}
+
+	/* identifies a call site. Only its address is used, so that two call
+	 * sites with the same format are still told apart */
+	struct _site {
+		char unused;
+	};
+
+	/* DONT USE THESE, use DEBUG()/LOG()/ERR() instead.
+	 *
+	 * Messages aren't formatted where they're logged. The format pointer
+	 * and the arguments are packed into a buffer belonging to the calling
+	 * thread, and a background thread formats and writes them. That means
+	 * the format has to be a string literal which is still around later.
+	 * String arguments are copied and everything else is passed by value.
+	 * See logging.cc. */
+
+	/* a message being packed into the calling thread's buffer, which is
+	 * handed over to the writer when this goes away */
+	class _record {
+	public:
+		_record(const _site* site, LEVEL level, const char* format, size_t nargs,
+				size_t size);
+		~_record();
+
+		void put(const char* str);
+		void put(char* str) {
+			put((const char*)str);
+		}
+		template <typename T>
+		void put(T* ptr) {
+			put_ptr((const void*)ptr);
+		}
+		template <typename T>
+		void put(T value) {
+			put_value(value, std::is_floating_point<T>());
+		}
+
+	private:
+		_record(const _record&) = delete;
+		_record& operator=(const _record&) = delete;
+
+		template <typename T>
+		void put_value(T value, std::true_type /*floating*/) {
+			put_double(value);
+		}
+		template <typename T>
+		void put_value(T value, std::false_type /*floating*/) {
+			put_int((int64_t)value);
+		}
+		void put_int(int64_t value);
+		void put_double(double value);
+		void put_ptr(const void* ptr);
+
+		/* the start of the message and where the next argument goes, both
+		 * NULL if it's being dropped */
+		char* start;
+		char* out;
+		/* the thread's buffer, or NULL if this is written out directly */
+		void* ring;
+		size_t advance;
+	};
+
+	/* the packed size of each argument */
+	inline size_t _size(const char* str) {
+		return 1 + sizeof(uint32_t) + ((str != NULL) ? strlen(str) : 6) + 1;
+	}
+	inline size_t _size(char* str) {
+		return _size((const char*)str);
+	}
+	template <typename T>
+	inline size_t _size(T /*value*/) {
+		return 1 + 8;
+	}
+	inline size_t _sizes() {
+		return 0;
+	}
+	template <typename T, typename... Rest>
+	inline size_t _sizes(T first, Rest... rest) {
+		return _size(first) + _sizes(rest...);
+	}
+
+	inline void _put(_record& /*record*/) { }
+	template <typename T, typename... Rest>
+	inline void _put(_record& record, T first, Rest... rest) {
+		record.put(first);
+		_put(record, rest...);
+	}
+
+	template <typename... Args>
+	void _write(const _site* site, LEVEL level, const char* format, Args... args) {
+		_record record(site, level, format, sizeof...(Args), _sizes(args...));
+		_put(record, args...);
+	}
 }
 
 #endif
@@ -16,43 +16,192 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <thread>
+
+#include "cache.h"
+#include "compressor.h"
+#include "config-file.h"
+#include "config-playlist.h"
+#include "daap.h"
+#include "library.h"
 #include "listener.h"
 #include "logging.h"
+#include "metrics.h"
+#include "server.h"
+#include "trace.h"
+#include "workers.h"
+
+/* metrics for Prometheus, only served to local clients */
+#define STATS_PORT 9689
+/* iTunes polls /update every half hour or so */
+#define IDLE_TIMEOUT_SECS 1800.
+
+#define TRACE_PATH "adaapd-trace.json"
 
 namespace sp = std::placeholders;
 
-void announce(const std::string& path, adaapd::FILE_EVENT_TYPE type) {
-	switch (type) {
-	case adaapd::FILE_CREATED:
-		ERR("NEW: %s", path.c_str());
-		break;
-	case adaapd::FILE_CHANGED:
-		ERR("CHG: %s", path.c_str());
-		break;
-	case adaapd::FILE_REMOVED:
-		ERR("REM: %s", path.c_str());
-		break;
-	default:
-		ERR("???: %s", path.c_str());
-		break;
-	}
-};
-
-time_t lookup(const std::string& path) {
-	ERR("LOOKUP %s", path.c_str());
-	return 0;
+adaapd::handler_t make_handler(adaapd::Library* library, adaapd::Compressor* compressor,
+		size_t /*worker*/, ev::loop_ref loop) {
+	std::shared_ptr<adaapd::Daap> daap(new adaapd::Daap(*library, loop, compressor));
+	return std::bind(&adaapd::Daap::Handle, daap, sp::_1, sp::_2, sp::_3);
+}
+
+/* answers GET /metrics with everything in adaapd::Metrics, and GET /trace
+ * with the spans recorded so far */
+void stats(const char* buf, const adaapd::DaapRequest& request, adaapd::Response& response) {
+	std::string path = adaapd::DaapRequest::Decode(buf, request.Path());
+	std::string text;
+	if (path == "/metrics") {
+		adaapd::Metrics::Get().Write(text);
+		response.content_type = "text/plain; version=0.0.4";
+	} else if (path == "/trace") {
+		adaapd::trace::Write(text);
+		response.content_type = "application/json";
+	} else {
+		response.status = 404;
+		response.content_type.clear();
+		return;
+	}
+	response.Append(text);
+}
+
+/* starts tracing, or stops it and writes out what was recorded */
+void toggle_trace(ev::sig& /*sig*/, int /*revents*/) {
+	if (!adaapd::trace::Enabled()) {
+		LOG_DIR("Tracing enabled");
+		adaapd::trace::Enable(true);
+		return;
+	}
+	adaapd::trace::Enable(false);
+	adaapd::trace::Export(TRACE_PATH);
+	adaapd::trace::Clear();
+}
+
+/* writes out every metric, bypassing the log levels and rate limits. What
+ * was logged before goes out first, so that the dump isn't split up */
+void dump_stats(ev::sig& /*sig*/, int /*revents*/) {
+	std::string text;
+	adaapd::Metrics::Get().Write(text);
+	logging::Flush();
+	fwrite(text.data(), 1, text.size(), logging::fout);
+	fflush(logging::fout);
+}
+
+void shutdown(ev::sig& sig, int /*revents*/) {
+	LOG("Got signal %d, exiting", sig.signum);
+	sig.loop.break_loop(ev::ALL);
+}
+
+/* the options from a config file, or from the command line with the
+ * defaults for everything else */
+bool read_config(int argc, char* argv[], adaapd::Config& config) {
+	if (argc == 2 && (adaapd::HasExtension(argv[1], "yaml") ||
+					adaapd::HasExtension(argv[1], "yml"))) {
+		adaapd::config_file_t file = adaapd::ConfigFile::Create(argv[1]);
+		if (!file || !file->Read(config)) {
+			return false;
+		}
+		if (config.music_dir.empty()) {
+			ERR("No music dir in %s", argv[1]);
+			return false;
+		}
+		return true;
+	}
+	if (argc != 2 && argc != 3) {
+		ERR("Usage: %s <music dir> [playlist file]", argv[0]);
+		ERR("       %s <config file>", argv[0]);
+		return false;
+	}
+	config.music_dir = argv[1];
+	if (argc == 3) {
+		config.playlist_path = argv[2];
+	}
+	return true;
 }
 
 int main(int argc, char* argv[]) {
+	adaapd::Config config;
+	if (!read_config(argc, argv, config)) {
+		return EXIT_FAILURE;
+	}
+
+	/* eg ADAAPD_LOG=log,listener=debug */
+	const char* levels = getenv("ADAAPD_LOG");
+	if (levels != NULL && !logging::Configure(levels)) {
+		return EXIT_FAILURE;
+	}
+	/* otherwise started with SIGUSR2 */
+	if (getenv("ADAAPD_TRACE") != NULL) {
+		adaapd::trace::Enable(true);
+	}
+	adaapd::trace::SetThreadName("main");
+
+	/* writes to closed clients are handled where they happen */
+	signal(SIGPIPE, SIG_IGN);
+
 	ev::default_loop loop;
 	{
-/*
-		adaapd::Listener l(loop, "hey", std::bind(&announce, sp::_1, sp::_2),
-				std::bind(&lookup, sp::_1));
-		if (!l.Init()) {
+		adaapd::Library library(config.image_path);
+		adaapd::Cache cache(&loop, config.cache_path,
+				std::bind(&adaapd::Library::TrackEvent, &library, sp::_1, sp::_2, sp::_3, sp::_4),
+				std::bind(&adaapd::Library::Committed, &library, sp::_1));
+		if (!cache.Init() || !library.Load(cache)) {
 			return EXIT_FAILURE;
 		}
-*/
+
+		adaapd::Listener listener(&loop, config.music_dir,
+				std::bind(&adaapd::Cache::FileEvent, &cache, sp::_1, sp::_2, sp::_3));
+		if (!listener.Init()) {
+			return EXIT_FAILURE;
+		}
+		/* the initial scan is done: anything it didn't report is gone */
+		cache.Prune();
+
+		/* playlists are loaded on another thread, served once they're ready */
+		std::unique_ptr<adaapd::PlaylistReloader> reloader;
+		if (!config.playlist_path.empty()) {
+			adaapd::playlist_file_t file = adaapd::PlaylistFile::Create(config.playlist_path);
+			if (!file) {
+				return EXIT_FAILURE;
+			}
+			/* each reload goes out as a new revision, so clients refetch */
+			reloader.reset(new adaapd::PlaylistReloader(&loop, library, file,
+							std::bind(&adaapd::Cache::Bump, &cache)));
+			if (!reloader->Init()) {
+				return EXIT_FAILURE;
+			}
+		}
+
+		/* shared by all workers, so each listing is only compressed once */
+		adaapd::Compressor compressor;
+
+		size_t threads = std::thread::hardware_concurrency();
+		adaapd::Workers workers((threads != 0) ? threads : 1,
+				std::bind(&make_handler, &library, &compressor, sp::_1, sp::_2),
+				IDLE_TIMEOUT_SECS);
+		if (!workers.Start(config.port)) {
+			return EXIT_FAILURE;
+		}
+
+		adaapd::Server stats_server(loop, &stats, IDLE_TIMEOUT_SECS);
+		if (!stats_server.Listen(STATS_PORT, false, true)) {
+			return EXIT_FAILURE;
+		}
+
+		ev::sig sigint(loop), sigterm(loop), sigusr1(loop), sigusr2(loop);
+		sigint.set<&shutdown>();
+		sigint.start(SIGINT);
+		sigterm.set<&shutdown>();
+		sigterm.start(SIGTERM);
+		sigusr1.set<&dump_stats>();
+		sigusr1.start(SIGUSR1);
+		sigusr2.set<&toggle_trace>();
+		sigusr2.start(SIGUSR2);
+
 		loop.run();
 	}
 	return EXIT_SUCCESS;
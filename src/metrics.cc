@@ -0,0 +1,214 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "metrics.h"
+#include "logging.h"
+
+namespace {
+	std::atomic<size_t> next_shard(0);
+
+	std::vector<uint64_t> make_latency_buckets() {
+		/* 1-2.5-5 steps */
+		std::vector<uint64_t> bounds;
+		for (uint64_t decade = 10000; decade <= 1000000000ULL; decade *= 10) {
+			bounds.push_back(decade);
+			bounds.push_back(decade * 5 / 2);
+			bounds.push_back(decade * 5);
+		}
+		bounds.push_back(10000000000ULL);
+		return bounds;
+	}
+
+	std::vector<uint64_t> make_size_buckets() {
+		std::vector<uint64_t> bounds;
+		for (uint64_t size = 1; size <= 65536; size *= 4) {
+			bounds.push_back(size);
+		}
+		return bounds;
+	}
+
+	/* a single "name{labels} value" line */
+	void sample(std::string& out, const std::string& name, const std::string& labels,
+			const char* value) {
+		out.append(name);
+		if (!labels.empty()) {
+			out.append("{");
+			out.append(labels);
+			out.append("}");
+		}
+		out.append(" ");
+		out.append(value);
+		out.append("\n");
+	}
+
+	void sample(std::string& out, const std::string& name, const std::string& labels,
+			uint64_t value) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+		sample(out, name, labels, buf);
+	}
+}
+
+size_t adaapd::_next_shard() {
+	return next_shard.fetch_add(1, std::memory_order_relaxed) % Counter::SHARDS;
+}
+
+adaapd::Counter::Counter() {
+	for (size_t i = 0; i < SHARDS; ++i) {
+		shards[i].value.store(0, std::memory_order_relaxed);
+	}
+}
+
+uint64_t adaapd::Counter::Value() const {
+	uint64_t total = 0;
+	for (size_t i = 0; i < SHARDS; ++i) {
+		total += shards[i].value.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+adaapd::Histogram::Histogram(const std::vector<uint64_t>& bounds, double scale)
+	: bounds(bounds), scale(scale), buckets(new Counter[bounds.size() + 1]) { }
+
+void adaapd::Histogram::Observe(uint64_t value) {
+	size_t i = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+	buckets[i].Add();
+	sum.Add(value);
+}
+
+uint64_t adaapd::Histogram::Count() const {
+	uint64_t count = 0;
+	for (size_t i = 0; i <= bounds.size(); ++i) {
+		count += buckets[i].Value();
+	}
+	return count;
+}
+
+const std::vector<uint64_t>& adaapd::LatencyBuckets() {
+	static const std::vector<uint64_t> bounds = make_latency_buckets();
+	return bounds;
+}
+
+const std::vector<uint64_t>& adaapd::SizeBuckets() {
+	static const std::vector<uint64_t> bounds = make_size_buckets();
+	return bounds;
+}
+
+/*static*/ adaapd::Metrics& adaapd::Metrics::Get() {
+	/* never destroyed, since metrics may be updated during exit */
+	static Metrics* instance = new Metrics;
+	return *instance;
+}
+
+adaapd::Counter& adaapd::Metrics::GetCounter(const std::string& name,
+		const std::string& help, const std::string& labels) {
+	std::lock_guard<std::mutex> lock(mutex);
+	entry& e = get(name, help, labels, TYPE_COUNTER);
+	if (!e.counter) {
+		e.counter.reset(new Counter);
+	}
+	return *e.counter;
+}
+
+adaapd::Gauge& adaapd::Metrics::GetGauge(const std::string& name,
+		const std::string& help, const std::string& labels) {
+	std::lock_guard<std::mutex> lock(mutex);
+	entry& e = get(name, help, labels, TYPE_GAUGE);
+	if (!e.gauge) {
+		e.gauge.reset(new Gauge);
+	}
+	return *e.gauge;
+}
+
+adaapd::Histogram& adaapd::Metrics::GetHistogram(const std::string& name,
+		const std::string& help, const std::vector<uint64_t>& bounds, double scale,
+		const std::string& labels) {
+	std::lock_guard<std::mutex> lock(mutex);
+	entry& e = get(name, help, labels, TYPE_HISTOGRAM);
+	if (!e.histogram) {
+		e.histogram.reset(new Histogram(bounds, scale));
+	}
+	return *e.histogram;
+}
+
+adaapd::Metrics::entry& adaapd::Metrics::get(const std::string& name,
+		const std::string& help, const std::string& labels, TYPE type) {
+	std::pair<std::map<std::pair<std::string, std::string>, entry>::iterator, bool> result =
+		entries.insert(std::make_pair(std::make_pair(name, labels), entry()));
+	entry& e = result.first->second;
+	if (result.second) {
+		e.type = type;
+		e.help = help;
+	} else if (e.type != type) {
+		/* still handed out so the caller works, but never written out */
+		ERR("INTERNAL ERROR: Metric %s{%s} has another type!", name.c_str(), labels.c_str());
+	}
+	return e;
+}
+
+void adaapd::Metrics::Write(std::string& out) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const std::string* last = NULL;
+	for (std::map<std::pair<std::string, std::string>, entry>::const_iterator iter = entries.begin();
+		 iter != entries.end(); ++iter) {
+		const std::string& name = iter->first.first;
+		const std::string& labels = iter->first.second;
+		const entry& e = iter->second;
+		if (last == NULL || *last != name) {
+			static const char* TYPE_NAMES[] = { "counter", "gauge", "histogram" };
+			out.append("# HELP " + name + " " + e.help + "\n");
+			out.append("# TYPE " + name + " " + TYPE_NAMES[e.type] + "\n");
+			last = &name;
+		}
+
+		switch (e.type) {
+		case TYPE_COUNTER:
+			sample(out, name, labels, e.counter->Value());
+			break;
+		case TYPE_GAUGE: {
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%lld", (long long)e.gauge->Value());
+			sample(out, name, labels, buf);
+			break;
+		}
+		case TYPE_HISTOGRAM: {
+			const Histogram& h = *e.histogram;
+			std::string prefix = labels.empty() ? labels : labels + ",";
+			uint64_t count = 0;
+			char buf[64];
+			for (size_t i = 0; i <= h.Bounds().size(); ++i) {
+				count += h.Bucket(i);
+				if (i < h.Bounds().size()) {
+					snprintf(buf, sizeof(buf), "le=\"%g\"", h.Bounds()[i] * h.Scale());
+				} else {
+					snprintf(buf, sizeof(buf), "le=\"+Inf\"");
+				}
+				sample(out, name + "_bucket", prefix + buf, count);
+			}
+			snprintf(buf, sizeof(buf), "%.9g", h.Sum() * h.Scale());
+			sample(out, name + "_sum", labels, buf);
+			sample(out, name + "_count", labels, count);
+			break;
+		}
+		}
+	}
+}
@@ -0,0 +1,188 @@
+#ifndef _adaapd_metrics_h_
+#define _adaapd_metrics_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace adaapd {
+	/* spreads threads across the shards of each Counter */
+	size_t _next_shard();
+	inline size_t _metric_shard() {
+		static thread_local size_t shard = _next_shard();
+		return shard;
+	}
+
+	/*! A total which only goes up. Each thread adds to one of several
+	 * shards, each on its own cache line, so that threads counting the same
+	 * thing don't contend. Reading it adds up the shards. */
+	class Counter {
+	public:
+		static const size_t SHARDS = 16;
+
+		Counter();
+
+		void Add(uint64_t n = 1) {
+			shards[_metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+		}
+
+		uint64_t Value() const;
+
+	private:
+		Counter(const Counter&) = delete;
+		Counter& operator=(const Counter&) = delete;
+
+		struct shard {
+			std::atomic<uint64_t> value;
+			char pad[64 - sizeof(std::atomic<uint64_t>)];
+		};
+		shard shards[SHARDS];
+	};
+
+	/*! A value which is set, eg the size of a queue. */
+	class Gauge {
+	public:
+		Gauge() : value(0) { }
+
+		void Set(int64_t v) {
+			value.store(v, std::memory_order_relaxed);
+		}
+		void Add(int64_t n) {
+			value.fetch_add(n, std::memory_order_relaxed);
+		}
+		int64_t Value() const {
+			return value.load(std::memory_order_relaxed);
+		}
+
+	private:
+		Gauge(const Gauge&) = delete;
+		Gauge& operator=(const Gauge&) = delete;
+
+		std::atomic<int64_t> value;
+	};
+
+	/*! Counts values into fixed buckets. 'bounds' are the inclusive upper
+	 * bounds of each bucket, in increasing order, and anything larger goes
+	 * into a last bucket of its own. Values are recorded as integers, which
+	 * are multiplied by 'scale' when written out, eg nanoseconds with a
+	 * scale of 1e-9 for seconds. */
+	class Histogram {
+	public:
+		Histogram(const std::vector<uint64_t>& bounds, double scale);
+
+		void Observe(uint64_t value);
+
+		/*! Observes the nanoseconds since 'start', for histograms made with
+		 * LatencyBuckets(). */
+		void ObserveSince(const std::chrono::steady_clock::time_point& start) {
+			Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+							std::chrono::steady_clock::now() - start).count());
+		}
+
+		const std::vector<uint64_t>& Bounds() const {
+			return bounds;
+		}
+		double Scale() const {
+			return scale;
+		}
+		/*! The number of values in bucket 'i', where i == Bounds().size() is
+		 * the last bucket. Not cumulative. */
+		uint64_t Bucket(size_t i) const {
+			return buckets[i].Value();
+		}
+		uint64_t Count() const;
+		uint64_t Sum() const {
+			return sum.Value();
+		}
+
+	private:
+		Histogram(const Histogram&) = delete;
+		Histogram& operator=(const Histogram&) = delete;
+
+		const std::vector<uint64_t> bounds;
+		const double scale;
+		std::unique_ptr<Counter[]> buckets;
+		Counter sum;
+	};
+
+	/*! Bounds in nanoseconds from 10us to 10s, written out in seconds with
+	 * LATENCY_SCALE. */
+	const std::vector<uint64_t>& LatencyBuckets();
+	static const double LATENCY_SCALE = 1e-9;
+
+	/*! Bounds for counts of things, eg batch sizes, from 1 to 64k. */
+	const std::vector<uint64_t>& SizeBuckets();
+
+	/*! Every Counter, Gauge and Histogram in the process, by name and
+	 * labels. Metrics are created the first time they're asked for and live
+	 * until exit, so callers hold on to the references rather than looking
+	 * them up each time.
+	 *
+	 * Names follow Prometheus conventions, eg "adaapd_server_bytes_total",
+	 * and labels are given pre-formatted, eg "format=\"MP3\"". */
+	class Metrics {
+	public:
+		static Metrics& Get();
+
+		Counter& GetCounter(const std::string& name, const std::string& help,
+				const std::string& labels = std::string());
+		Gauge& GetGauge(const std::string& name, const std::string& help,
+				const std::string& labels = std::string());
+		Histogram& GetHistogram(const std::string& name, const std::string& help,
+				const std::vector<uint64_t>& bounds, double scale,
+				const std::string& labels = std::string());
+
+		/*! Appends everything in the Prometheus text exposition format. */
+		void Write(std::string& out);
+
+	private:
+		Metrics() { }
+
+		enum TYPE {
+			TYPE_COUNTER,
+			TYPE_GAUGE,
+			TYPE_HISTOGRAM
+		};
+
+		struct entry {
+			TYPE type;
+			std::string help;
+			std::unique_ptr<Counter> counter;
+			std::unique_ptr<Gauge> gauge;
+			std::unique_ptr<Histogram> histogram;
+		};
+		/* with 'mutex' held */
+		entry& get(const std::string& name, const std::string& help,
+				const std::string& labels, TYPE type);
+
+		std::mutex mutex;
+		/* by name then labels, which keeps each name's samples together */
+		std::map<std::pair<std::string, std::string>, entry> entries;
+	};
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "path-index.h"
+
+/* grow once more than this fraction of the slots are used */
+#define MAX_LOAD_NUM 1
+#define MAX_LOAD_DEN 2
+
+namespace {
+	inline uint32_t slot_hash(uint64_t slot) {
+		return slot >> 32;
+	}
+	inline adaapd::item_id_t slot_id(uint64_t slot) {
+		return slot & 0xffffffff;
+	}
+	inline uint64_t make_slot(uint32_t hash, adaapd::item_id_t id) {
+		return ((uint64_t)hash << 32) | id;
+	}
+}
+
+adaapd::PathIndex::PathIndex()
+	: mask(0), count(0) { }
+
+adaapd::PathIndex::PathIndex(PathIndex& from)
+	: slots(from.slots.Share()), mask(from.mask), count(from.count) { }
+
+std::shared_ptr<const adaapd::PathIndex> adaapd::PathIndex::Snapshot() {
+	return std::shared_ptr<const PathIndex>(new PathIndex(*this));
+}
+
+uint32_t adaapd::PathIndex::hash(const char* path, size_t len) {
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; ++i) {
+		h = (h ^ (uint8_t)path[i]) * 16777619u;
+	}
+	return h;
+}
+
+void adaapd::PathIndex::Build(const TrackStore& tracks) {
+	slots = Column<uint64_t>();
+	mask = 0;
+	count = 0;
+	/* sized up front rather than grown one doubling at a time */
+	item_id_t size = CHUNK_SIZE;
+	while (size * MAX_LOAD_NUM < tracks.Size() * MAX_LOAD_DEN) {
+		size <<= 1;
+	}
+	slots.Grow(size, 0);
+	mask = size - 1;
+	for (item_id_t id = 0; id < tracks.End(); ++id) {
+		if (tracks.Has(id)) {
+			Add(tracks, id);
+		}
+	}
+}
+
+void adaapd::PathIndex::Add(const TrackStore& tracks, item_id_t id) {
+	if ((count + 1) * MAX_LOAD_DEN > (mask + 1) * MAX_LOAD_NUM) {
+		grow();
+	}
+	const char* path = tracks.Path(id);
+	insert(make_slot(hash(path, strlen(path)), id));
+	++count;
+}
+
+void adaapd::PathIndex::Remove(const TrackStore& tracks, item_id_t id) {
+	if (count == 0) {
+		return;
+	}
+	const char* path = tracks.Path(id);
+	uint32_t h = hash(path, strlen(path));
+	uint64_t want = make_slot(h, id);
+	item_id_t i = h & mask;
+	for (;; i = (i + 1) & mask) {
+		uint64_t slot = slots.Get(i);
+		if (slot == 0) {
+			return;
+		}
+		if (slot == want) {
+			break;
+		}
+	}
+
+	/* shift back any later entries of the run which would no longer be
+	 * found past the gap */
+	for (item_id_t j = (i + 1) & mask;; j = (j + 1) & mask) {
+		uint64_t slot = slots.Get(j);
+		if (slot == 0) {
+			break;
+		}
+		item_id_t home = slot_hash(slot) & mask;
+		bool reachable = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+		if (!reachable) {
+			slots.Set(i, slot);
+			i = j;
+		}
+	}
+	slots.Set(i, 0);
+	--count;
+}
+
+bool adaapd::PathIndex::Find(const TrackStore& tracks, const char* path, size_t len,
+		item_id_t& id) const {
+	if (count == 0) {
+		return false;
+	}
+	uint32_t h = hash(path, len);
+	for (item_id_t i = h & mask;; i = (i + 1) & mask) {
+		uint64_t slot = slots.Get(i);
+		if (slot == 0) {
+			return false;
+		}
+		if (slot_hash(slot) != h) {
+			continue;
+		}
+		item_id_t candidate = slot_id(slot);
+		const char* found = tracks.Path(candidate);
+		if (strncmp(found, path, len) == 0 && found[len] == 0) {
+			id = candidate;
+			return true;
+		}
+	}
+}
+
+void adaapd::PathIndex::insert(uint64_t slot) {
+	item_id_t i = slot_hash(slot) & mask;
+	while (slots.Get(i) != 0) {
+		i = (i + 1) & mask;
+	}
+	slots.Set(i, slot);
+}
+
+void adaapd::PathIndex::grow() {
+	item_id_t size = (mask == 0) ? CHUNK_SIZE : (mask + 1) << 1;
+	Column<uint64_t> old(std::move(slots));
+	item_id_t old_size = old.ChunkCount() << CHUNK_BITS;
+	slots = Column<uint64_t>();
+	slots.Grow(size, 0);
+	mask = size - 1;
+	for (item_id_t i = 0; i < old_size; ++i) {
+		uint64_t slot = old.Get(i);
+		if (slot != 0) {
+			insert(slot);
+		}
+	}
+}
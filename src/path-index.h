@@ -0,0 +1,89 @@
+#ifndef _adaapd_path_index_h_
+#define _adaapd_path_index_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "track-store.h"
+
+namespace adaapd {
+	/*! Finds tracks by their path, eg for the static entries of a playlist.
+	 *
+	 * This is an open-addressed hash table whose slots each hold a track's
+	 * id along with 32 bits of the hash of its path. The paths themselves
+	 * are only kept in the TrackStore, where they're interned anyway, and a
+	 * candidate is checked against those: so the whole index is 8 bytes per
+	 * slot, and a lookup is a hash of the path plus one compare for the
+	 * slot which matches.
+	 *
+	 * The slots are kept in a Column, so a snapshot shares them until they
+	 * next change, at which point only the chunks which change are
+	 * copied. */
+	class PathIndex {
+	public:
+		PathIndex();
+
+		/*! Returns a read-only copy which shares all of the current slots. */
+		std::shared_ptr<const PathIndex> Snapshot();
+
+		/*! Rebuilds the index from scratch. */
+		void Build(const TrackStore& tracks);
+
+		/*! Adds track 'id' under its path in 'tracks'. */
+		void Add(const TrackStore& tracks, item_id_t id);
+
+		/*! Removes track 'id' under its path in 'tracks'. Called before the
+		 * track is removed or given another path. */
+		void Remove(const TrackStore& tracks, item_id_t id);
+
+		/*! Finds the track with the given path in 'tracks', which is the
+		 * TrackStore (or snapshot of it) that the index is for. */
+		bool Find(const TrackStore& tracks, const char* path, size_t len,
+				item_id_t& id) const;
+		bool Find(const TrackStore& tracks, const std::string& path,
+				item_id_t& id) const {
+			return Find(tracks, path.data(), path.size(), id);
+		}
+
+		/*! The number of tracks in the index. */
+		size_t Size() const {
+			return count;
+		}
+
+	private:
+		PathIndex(PathIndex& from);
+		PathIndex(const PathIndex&) = delete;
+		PathIndex& operator=(const PathIndex&) = delete;
+
+		static uint32_t hash(const char* path, size_t len);
+		void insert(uint64_t slot);
+		/* doubles the number of slots */
+		void grow();
+
+		/* hash << 32 | id, or 0 if empty since there's no track 0 */
+		Column<uint64_t> slots;
+		item_id_t mask;
+		size_t count;
+	};
+}
+
+#endif
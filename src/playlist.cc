@@ -0,0 +1,590 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+#include "logging.h"
+#include "playlist.h"
+
+/* the smallest int which isn't TAG_INT_NONE, so that a range never
+ * includes missing values */
+#define INT_MIN_VALID (TAG_INT_NONE + 1)
+#define INT_MAX_VALID INT64_MAX
+
+namespace {
+	/* The per-chunk kernels. Masks are one byte per item, 0 or 1, and each
+	 * loop has a fixed trip count over contiguous arrays so that it's
+	 * vectorized where the target allows. */
+
+	void match_range(const adaapd::tag_int_t* vals, adaapd::tag_int_t lo,
+			adaapd::tag_int_t hi, uint8_t* out) {
+		for (adaapd::item_id_t i = 0; i < adaapd::CHUNK_SIZE; ++i) {
+			out[i] = (vals[i] >= lo) & (vals[i] <= hi);
+		}
+	}
+
+	void lookup_strs(const adaapd::str_id_t* ids, const uint8_t* table, uint8_t* out) {
+		for (adaapd::item_id_t i = 0; i < adaapd::CHUNK_SIZE; ++i) {
+			out[i] = table[ids[i]];
+		}
+	}
+
+	void fill(uint8_t* out, uint8_t val) {
+		memset(out, val, adaapd::CHUNK_SIZE);
+	}
+
+	void and_masks(uint8_t* a, const uint8_t* b) {
+		for (adaapd::item_id_t i = 0; i < adaapd::CHUNK_SIZE; ++i) {
+			a[i] &= b[i];
+		}
+	}
+
+	void or_masks(uint8_t* a, const uint8_t* b) {
+		for (adaapd::item_id_t i = 0; i < adaapd::CHUNK_SIZE; ++i) {
+			a[i] |= b[i];
+		}
+	}
+
+	void not_mask(uint8_t* a) {
+		for (adaapd::item_id_t i = 0; i < adaapd::CHUNK_SIZE; ++i) {
+			a[i] ^= 1;
+		}
+	}
+
+	void free_regex(regex_t* regex) {
+		regfree(regex);
+		delete regex;
+	}
+}
+
+adaapd::PlaylistFilter::PlaylistFilter()
+	: max_depth(0), fields(0) {
+	push(OP_FALSE);
+	max_depth = 1;
+}
+
+bool adaapd::PlaylistFilter::Compile(const Rule& rule, lookup_t lookup) {
+	program.clear();
+	tables.clear();
+	max_depth = 0;
+	fields = 0;
+	if (!compile(rule, 0, lookup)) {
+		/* match nothing rather than something half-compiled */
+		program.clear();
+		tables.clear();
+		push(OP_FALSE);
+		max_depth = 1;
+		fields = 0;
+		return false;
+	}
+	return true;
+}
+
+bool adaapd::PlaylistFilter::compile(const Rule& rule, size_t depth, lookup_t& lookup) {
+	if (depth + 2 > max_depth) {
+		/* room for this result and one more, eg for INT_NE */
+		max_depth = depth + 2;
+	}
+
+	switch (rule.type) {
+	case Rule::ALL:
+	case Rule::ANY:
+		if (rule.rules.empty()) {
+			push((rule.type == Rule::ALL) ? OP_TRUE : OP_FALSE);
+			return true;
+		}
+		if (!compile(rule.rules[0], depth, lookup)) {
+			return false;
+		}
+		for (size_t i = 1; i < rule.rules.size(); ++i) {
+			if (!compile(rule.rules[i], depth + 1, lookup)) {
+				return false;
+			}
+			push((rule.type == Rule::ALL) ? OP_AND : OP_OR);
+		}
+		return true;
+
+	case Rule::NOT:
+		if (rule.rules.size() != 1) {
+			ERR("NOT rule needs exactly one rule, got %lu", (unsigned long)rule.rules.size());
+			return false;
+		}
+		if (!compile(rule.rules[0], depth, lookup)) {
+			return false;
+		}
+		push(OP_NOT);
+		return true;
+
+	case Rule::INT_EQ:
+	case Rule::INT_NE:
+	case Rule::INT_LT:
+	case Rule::INT_LE:
+	case Rule::INT_GT:
+	case Rule::INT_GE:
+	case Rule::INT_RANGE: {
+		if (rule.field < 0 || rule.field >= TAG_INT_COUNT) {
+			ERR("Bad int field %d in rule", rule.field);
+			return false;
+		}
+		/* everything becomes a range, which excludes missing values */
+		tag_int_t lo = INT_MIN_VALID, hi = INT_MAX_VALID;
+		switch (rule.type) {
+		case Rule::INT_EQ:
+		case Rule::INT_NE:
+			lo = hi = rule.value;
+			break;
+		case Rule::INT_LT:
+			if (rule.value <= INT_MIN_VALID) {
+				push(OP_FALSE);
+				return true;
+			}
+			hi = rule.value - 1;
+			break;
+		case Rule::INT_LE:
+			hi = rule.value;
+			break;
+		case Rule::INT_GT:
+			if (rule.value == INT_MAX_VALID) {
+				push(OP_FALSE);
+				return true;
+			}
+			lo = rule.value + 1;
+			break;
+		case Rule::INT_GE:
+			lo = rule.value;
+			break;
+		default:
+			lo = rule.value;
+			hi = rule.value2;
+			break;
+		}
+		if (lo < INT_MIN_VALID) {
+			lo = INT_MIN_VALID;
+		}
+		fields |= TagBit((Tag_IntId)rule.field);
+		if (rule.type == Rule::INT_NE) {
+			/* present and not equal */
+			push(OP_INT, rule.field, INT_MIN_VALID, INT_MAX_VALID);
+			push(OP_INT, rule.field, lo, hi);
+			push(OP_NOT);
+			push(OP_AND);
+		} else {
+			push(OP_INT, rule.field, lo, hi);
+		}
+		return true;
+	}
+
+	case Rule::STR_IS:
+	case Rule::STR_CONTAINS:
+	case Rule::STR_STARTS:
+	case Rule::STR_ENDS:
+	case Rule::STR_MATCHES: {
+		if (rule.field < 0 || rule.field >= TAG_STR_COUNT) {
+			ERR("Bad string field %d in rule", rule.field);
+			return false;
+		}
+		str_table table;
+		table.type = rule.type;
+		table.text = rule.text;
+		if (rule.type == Rule::STR_MATCHES) {
+			table.regex.reset(new regex_t, free_regex);
+			int err = regcomp(table.regex.get(), rule.text.c_str(),
+					REG_EXTENDED | REG_ICASE | REG_NOSUB);
+			if (err != 0) {
+				char msg[256];
+				regerror(err, table.regex.get(), msg, sizeof(msg));
+				/* regfree() isn't to be called on a failed regex */
+				table.regex.reset();
+				ERR("Bad regex '%s' in rule: %s", rule.text.c_str(), msg);
+				return false;
+			}
+		}
+		tables.push_back(table);
+		fields |= TagBit((Tag_StrId)rule.field);
+		push(OP_STR, rule.field, 0, 0, tables.size() - 1);
+		return true;
+	}
+
+	case Rule::IN: {
+		const Bitmap* members = NULL;
+		tag_mask_t in_fields = 0;
+		if (!lookup || !lookup(rule.text, members, in_fields)) {
+			ERR("Unknown playlist '%s' in rule", rule.text.c_str());
+			return false;
+		}
+		/* a change which moves a track in or out of the other playlist
+		 * needs to be looked at here too */
+		fields |= in_fields;
+		push(OP_IN, 0, 0, 0, 0, members);
+		return true;
+	}
+	}
+
+	ERR("Unknown rule type %d", rule.type);
+	return false;
+}
+
+void adaapd::PlaylistFilter::push(OP op, int field, tag_int_t lo, tag_int_t hi,
+		size_t table, const Bitmap* members) {
+	instruction ins;
+	ins.op = op;
+	ins.field = field;
+	ins.lo = lo;
+	ins.hi = hi;
+	ins.table = table;
+	ins.members = members;
+	program.push_back(ins);
+}
+
+bool adaapd::PlaylistFilter::str_match(const str_table& table, const char* str) const {
+	switch (table.type) {
+	case Rule::STR_IS:
+		return strcasecmp(str, table.text.c_str()) == 0;
+	case Rule::STR_CONTAINS:
+		return strcasestr(str, table.text.c_str()) != NULL;
+	case Rule::STR_STARTS:
+		return strncasecmp(str, table.text.c_str(), table.text.size()) == 0;
+	case Rule::STR_ENDS: {
+		size_t len = strlen(str);
+		return len >= table.text.size() &&
+			strcasecmp(str + len - table.text.size(), table.text.c_str()) == 0;
+	}
+	case Rule::STR_MATCHES:
+		return regexec(table.regex.get(), str, 0, NULL, 0) == 0;
+	default:
+		return false;
+	}
+}
+
+void adaapd::PlaylistFilter::update_tables(const StringPool& pool) {
+	for (size_t t = 0; t < tables.size(); ++t) {
+		str_table& table = tables[t];
+		size_t from = table.matches.size();
+		if (from >= pool.Size()) {
+			continue;
+		}
+		table.matches.resize(pool.Size());
+		for (str_id_t id = from; id < pool.Size(); ++id) {
+			/* a missing string never matches */
+			table.matches[id] = (id != STR_NONE && str_match(table, pool.Get(id))) ? 1 : 0;
+		}
+	}
+}
+
+void adaapd::PlaylistFilter::Match(const TrackStore& tracks, std::vector<item_id_t>& ids) {
+	update_tables(tracks.Strings());
+	stack.resize(max_depth * CHUNK_SIZE);
+
+	const Column<uint8_t>& live = tracks.LiveColumn();
+	for (size_t chunk = 0; (chunk << CHUNK_BITS) < tracks.End(); ++chunk) {
+		/* 'top' is the mask at the top of the stack */
+		uint8_t* top = &stack[0];
+		for (size_t i = 0; i < program.size(); ++i) {
+			const instruction& ins = program[i];
+			switch (ins.op) {
+			case OP_TRUE:
+			case OP_FALSE:
+				fill(top, (ins.op == OP_TRUE) ? 1 : 0);
+				top += CHUNK_SIZE;
+				break;
+			case OP_INT:
+				match_range(tracks.IntColumn((Tag_IntId)ins.field).Chunk(chunk),
+						ins.lo, ins.hi, top);
+				top += CHUNK_SIZE;
+				break;
+			case OP_STR:
+				lookup_strs(tracks.StrColumn((Tag_StrId)ins.field).Chunk(chunk),
+						&tables[ins.table].matches[0], top);
+				top += CHUNK_SIZE;
+				break;
+			case OP_IN:
+				ins.members->Mask(chunk << CHUNK_BITS, top);
+				top += CHUNK_SIZE;
+				break;
+			case OP_AND:
+				top -= CHUNK_SIZE;
+				and_masks(top - CHUNK_SIZE, top);
+				break;
+			case OP_OR:
+				top -= CHUNK_SIZE;
+				or_masks(top - CHUNK_SIZE, top);
+				break;
+			case OP_NOT:
+				not_mask(top - CHUNK_SIZE);
+				break;
+			}
+		}
+
+		const uint8_t* result = &stack[0];
+		const uint8_t* alive = live.Chunk(chunk);
+		item_id_t base = chunk << CHUNK_BITS;
+		for (item_id_t i = 0; i < CHUNK_SIZE; ++i) {
+			if (result[i] & (alive[i] != 0)) {
+				ids.push_back(base + i);
+			}
+		}
+	}
+}
+
+bool adaapd::PlaylistFilter::Match(const TrackStore& tracks, item_id_t id) {
+	if (!tracks.Has(id)) {
+		return false;
+	}
+	update_tables(tracks.Strings());
+	stack.resize(max_depth * CHUNK_SIZE);
+
+	/* the same program, one item at a time */
+	uint8_t* top = &stack[0];
+	for (size_t i = 0; i < program.size(); ++i) {
+		const instruction& ins = program[i];
+		switch (ins.op) {
+		case OP_TRUE:
+		case OP_FALSE:
+			*top++ = (ins.op == OP_TRUE) ? 1 : 0;
+			break;
+		case OP_INT: {
+			tag_int_t val = tracks.Int(id, (Tag_IntId)ins.field);
+			*top++ = (val >= ins.lo) & (val <= ins.hi);
+			break;
+		}
+		case OP_STR:
+			*top++ = tables[ins.table].matches[tracks.StrId(id, (Tag_StrId)ins.field)];
+			break;
+		case OP_IN:
+			*top++ = ins.members->Has(id) ? 1 : 0;
+			break;
+		case OP_AND:
+			--top;
+			top[-1] &= *top;
+			break;
+		case OP_OR:
+			--top;
+			top[-1] |= *top;
+			break;
+		case OP_NOT:
+			top[-1] ^= 1;
+			break;
+		}
+	}
+	return stack[0] != 0;
+}
+
+adaapd::PlaylistSet::PlaylistSet()
+	: visit(0), changed(false) { }
+
+bool adaapd::PlaylistSet::Load(const std::vector<Playlist>& specs,
+		const TrackStore& tracks, const PathIndex* paths) {
+	bool ok = true;
+	PathIndex built;
+	if (paths == NULL) {
+		bool any = false;
+		for (size_t i = 0; i < specs.size() && !any; ++i) {
+			any = !specs[i].paths.empty();
+		}
+		if (any) {
+			built.Build(tracks);
+		}
+		paths = &built;
+	}
+
+	/* sized up front: filters point at the members of earlier entries */
+	entries.clear();
+	entries.resize(specs.size());
+	for (size_t f = 0; f < TAG_INT_COUNT + TAG_STR_COUNT; ++f) {
+		by_field[f].clear();
+	}
+	visited.assign(specs.size(), 0);
+	changed = true;
+
+	Bitmap all;
+	for (item_id_t id = 0; id < tracks.End(); ++id) {
+		if (tracks.Has(id)) {
+			all.Add(id);
+		}
+	}
+
+	std::vector<item_id_t> ids;
+	for (size_t i = 0; i < specs.size(); ++i) {
+		entry& e = entries[i];
+		e.name = specs[i].name;
+		bool compiled = e.filter.Compile(specs[i].rule, std::bind(&PlaylistSet::lookup,
+						this, i, std::placeholders::_1, std::placeholders::_2,
+						std::placeholders::_3));
+		if (!compiled) {
+			ERR("Playlist '%s' won't match anything", e.name.c_str());
+			ok = false;
+		}
+		e.fields = e.filter.Fields();
+		for (size_t f = 0; f < TAG_INT_COUNT + TAG_STR_COUNT; ++f) {
+			if (e.fields & ((tag_mask_t)1 << f)) {
+				by_field[f].push_back(i);
+			}
+		}
+
+		if (compiled && !combine(i, specs[i].rule, all, e.members)) {
+			e.members.Clear();
+			ids.clear();
+			e.filter.Match(tracks, ids);
+			for (size_t j = 0; j < ids.size(); ++j) {
+				e.members.Add(ids[j]);
+			}
+		}
+
+		const std::vector<std::string>& listed = specs[i].paths;
+		e.statics.insert(listed.begin(), listed.end());
+		size_t missing = 0;
+		for (size_t j = 0; j < listed.size(); ++j) {
+			item_id_t id;
+			if (paths->Find(tracks, listed[j], id)) {
+				e.members.Add(id);
+			} else {
+				++missing;
+			}
+		}
+		if (missing != 0) {
+			DEBUG("%lu of %lu paths in playlist '%s' aren't in the library yet",
+					missing, listed.size(), e.name.c_str());
+		}
+	}
+	return ok;
+}
+
+void adaapd::PlaylistSet::Update(const TrackStore& tracks, item_id_t id,
+		tag_mask_t changed_fields) {
+	if (changed_fields == TAG_MASK_ALL) {
+		/* added or removed: everything may care, including playlists which
+		 * don't look at any fields */
+		for (size_t i = 0; i < entries.size(); ++i) {
+			update(entries[i], tracks, id);
+		}
+		return;
+	}
+
+	if (++visit == 0) {
+		/* wrapped around: forget all the old marks */
+		visited.assign(entries.size(), 0);
+		visit = 1;
+	}
+	pending.clear();
+	for (size_t f = 0; changed_fields != 0; ++f, changed_fields >>= 1) {
+		if (!(changed_fields & 1)) {
+			continue;
+		}
+		const std::vector<size_t>& playlists = by_field[f];
+		for (size_t i = 0; i < playlists.size(); ++i) {
+			if (visited[playlists[i]] != visit) {
+				visited[playlists[i]] = visit;
+				pending.push_back(playlists[i]);
+			}
+		}
+	}
+	/* in order, so that playlists are updated before anything which is
+	 * built from them */
+	std::sort(pending.begin(), pending.end());
+	for (size_t i = 0; i < pending.size(); ++i) {
+		update(entries[pending[i]], tracks, id);
+	}
+}
+
+bool adaapd::PlaylistSet::lookup(size_t before, const std::string& name,
+		const Bitmap*& members, tag_mask_t& fields) const {
+	/* only earlier playlists, which also rules out cycles */
+	for (size_t i = 0; i < before; ++i) {
+		if (entries[i].name == name) {
+			members = &entries[i].members;
+			fields = entries[i].fields;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool adaapd::PlaylistSet::combine(size_t before, const Rule& rule, const Bitmap& all,
+		Bitmap& out) const {
+	switch (rule.type) {
+	case Rule::IN: {
+		const Bitmap* members;
+		tag_mask_t fields;
+		if (!lookup(before, rule.text, members, fields)) {
+			return false;
+		}
+		out = *members;
+		return true;
+	}
+	case Rule::NOT: {
+		Bitmap inner;
+		if (rule.rules.size() != 1 || !combine(before, rule.rules[0], all, inner)) {
+			return false;
+		}
+		out = Bitmap::AndNot(all, inner);
+		return true;
+	}
+	case Rule::ANY:
+		out.Clear();
+		for (size_t i = 0; i < rule.rules.size(); ++i) {
+			Bitmap inner;
+			if (!combine(before, rule.rules[i], all, inner)) {
+				return false;
+			}
+			out = Bitmap::Or(out, inner);
+		}
+		return true;
+	case Rule::ALL: {
+		/* the intersection of the others, minus the NOTs */
+		bool first = true;
+		std::vector<const Rule*> excluded;
+		for (size_t i = 0; i < rule.rules.size(); ++i) {
+			const Rule& child = rule.rules[i];
+			if (child.type == Rule::NOT && child.rules.size() == 1) {
+				excluded.push_back(&child.rules[0]);
+				continue;
+			}
+			Bitmap inner;
+			if (!combine(before, child, all, inner)) {
+				return false;
+			}
+			out = first ? inner : Bitmap::And(out, inner);
+			first = false;
+		}
+		if (first) {
+			out = all;
+		}
+		for (size_t i = 0; i < excluded.size(); ++i) {
+			Bitmap inner;
+			if (!combine(before, *excluded[i], all, inner)) {
+				return false;
+			}
+			out = Bitmap::AndNot(out, inner);
+		}
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+void adaapd::PlaylistSet::update(entry& e, const TrackStore& tracks, item_id_t id) {
+	bool member = e.filter.Match(tracks, id) ||
+		(!e.statics.empty() && tracks.Has(id) && e.statics.count(tracks.Path(id)) != 0);
+	if (member ? e.members.Add(id) : e.members.Remove(id)) {
+		changed = true;
+	}
+}
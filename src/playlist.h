@@ -0,0 +1,268 @@
+#ifndef _adaapd_playlist_h_
+#define _adaapd_playlist_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <regex.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "bitmap.h"
+#include "path-index.h"
+#include "track-store.h"
+
+namespace adaapd {
+	/*! A condition on a track's tags, as written in a playlist spec. A track
+	 * which is missing a field never matches a condition on that field,
+	 * except through NOT. */
+	struct Rule {
+		enum TYPE {
+			ALL,/* every one of 'rules', true if there are none */
+			ANY,/* at least one of 'rules', false if there are none */
+			NOT,/* not the single entry in 'rules' */
+
+			/* Tag_IntId 'field' compared against 'value' */
+			INT_EQ,
+			INT_NE,
+			INT_LT,
+			INT_LE,
+			INT_GT,
+			INT_GE,
+			INT_RANGE,/* value <= field <= value2 */
+
+			/* Tag_StrId 'field' compared against 'text', ignoring case */
+			STR_IS,
+			STR_CONTAINS,
+			STR_STARTS,
+			STR_ENDS,
+			STR_MATCHES,/* 'text' is an extended regex */
+
+			/* a member of the earlier playlist named 'text' */
+			IN
+		};
+
+		Rule() : type(ALL), field(0), value(0), value2(0) { }
+
+		static Rule Group(TYPE type) {
+			Rule rule;
+			rule.type = type;
+			return rule;
+		}
+		static Rule Not(const Rule& inner) {
+			Rule rule = Group(NOT);
+			rule.rules.push_back(inner);
+			return rule;
+		}
+		static Rule Int(Tag_IntId field, TYPE type, tag_int_t value, tag_int_t value2 = 0) {
+			Rule rule = Group(type);
+			rule.field = field;
+			rule.value = value;
+			rule.value2 = value2;
+			return rule;
+		}
+		static Rule Str(Tag_StrId field, TYPE type, const std::string& text) {
+			Rule rule = Group(type);
+			rule.field = field;
+			rule.text = text;
+			return rule;
+		}
+		static Rule In(const std::string& playlist) {
+			Rule rule = Group(IN);
+			rule.text = playlist;
+			return rule;
+		}
+
+		TYPE type;
+		int field;
+		tag_int_t value, value2;
+		std::string text;
+		std::vector<Rule> rules;
+	};
+
+	/*! Representation of a playlist spec. */
+	struct Playlist {
+		std::string name;
+		Rule rule;
+		/* static members, listed by path, in addition to those matching
+		 * 'rule' */
+		std::vector<std::string> paths;
+	};
+
+	/*! A Rule compiled into a flat postfix program over the TrackStore's
+	 * columns. Whole chunks are evaluated one instruction at a time, each a
+	 * tight loop over CHUNK_SIZE contiguous values which the compiler can
+	 * vectorize, so matching a playlist against the library costs a few
+	 * passes over the columns it uses. String conditions are only evaluated
+	 * once per distinct string, as a table indexed by the interned string id.
+	 *
+	 * The tables are extended as new strings are interned, so a filter is
+	 * meant for use with one library's TrackStore (or its snapshots) from a
+	 * single thread. */
+	class PlaylistFilter {
+	public:
+		/*! Finds the members of the playlist named 'name' for an IN rule,
+		 * along with the fields it depends on. Returns false if there's no
+		 * such playlist. */
+		typedef std::function<bool(const std::string& name, const Bitmap*& members,
+				tag_mask_t& fields)> lookup_t;
+
+		PlaylistFilter();
+
+		/*! Compiles 'rule', replacing anything compiled before. Returns false
+		 * if the rule is malformed, eg a bad regex or field, or an IN rule
+		 * which 'lookup' doesn't know about. Bitmaps from 'lookup' need to
+		 * stay around for as long as the filter is used. */
+		bool Compile(const Rule& rule, lookup_t lookup = lookup_t());
+
+		/*! Appends the ids of all matching tracks in 'tracks' to 'ids', in
+		 * increasing order. */
+		void Match(const TrackStore& tracks, std::vector<item_id_t>& ids);
+
+		/*! Whether the track 'id' in 'tracks' matches. */
+		bool Match(const TrackStore& tracks, item_id_t id);
+
+		/*! The fields which the rule looks at. A track's membership only
+		 * changes when one of these does, or when it's added or removed. */
+		tag_mask_t Fields() const {
+			return fields;
+		}
+
+	private:
+		enum OP {
+			OP_TRUE,
+			OP_FALSE,
+			OP_INT,/* lo <= field <= hi */
+			OP_STR,/* tables[table] for the field's string id */
+			OP_IN,/* in *members */
+			OP_AND,
+			OP_OR,
+			OP_NOT
+		};
+
+		struct instruction {
+			OP op;
+			int field;
+			tag_int_t lo, hi;
+			size_t table;
+			const Bitmap* members;
+		};
+
+		/* the result of a string condition for each string id */
+		struct str_table {
+			Rule::TYPE type;
+			std::string text;
+			std::shared_ptr<regex_t> regex;
+			std::vector<uint8_t> matches;
+		};
+
+		bool compile(const Rule& rule, size_t depth, lookup_t& lookup);
+		void push(OP op, int field = 0, tag_int_t lo = 0, tag_int_t hi = 0,
+				size_t table = 0, const Bitmap* members = NULL);
+		bool str_match(const str_table& table, const char* str) const;
+		/* evaluates string tables for any strings interned since last time */
+		void update_tables(const StringPool& pool);
+
+		std::vector<instruction> program;
+		std::vector<str_table> tables;
+		size_t max_depth;
+		tag_mask_t fields;
+
+		/* max_depth masks of CHUNK_SIZE entries, for Match() */
+		std::vector<uint8_t> stack;
+	};
+
+	/*! The membership of each of a list of playlists, kept up to date as
+	 * tracks change. A change to a track is only looked at by the playlists
+	 * which depend on one of the fields that changed, and only for that
+	 * track, so eg a new rating costs one Match() per rating-based
+	 * playlist. Only for the thread which feeds the Library.
+	 *
+	 * Playlists may be built from earlier ones with IN rules. Those which
+	 * are only unions, intersections and exclusions of other playlists are
+	 * loaded with Bitmap operations rather than by matching each track. */
+	class PlaylistSet {
+	public:
+		PlaylistSet();
+
+		/*! Replaces the playlists with 'specs' and matches them against
+		 * 'tracks', whose paths are in 'paths' for looking up the static
+		 * entries of a playlist. If that's NULL, an index is built for the
+		 * occasion. Returns false if any of them failed to compile, in
+		 * which case those are kept but left empty. */
+		bool Load(const std::vector<Playlist>& specs, const TrackStore& tracks,
+				const PathIndex* paths = NULL);
+
+		/*! Updates memberships of track 'id', which has just been set or
+		 * removed in 'tracks'. 'changed_fields' is the fields which changed,
+		 * see TrackStore::Diff(). */
+		void Update(const TrackStore& tracks, item_id_t id, tag_mask_t changed_fields);
+
+		size_t Size() const {
+			return entries.size();
+		}
+		const std::string& Name(size_t playlist) const {
+			return entries[playlist].name;
+		}
+		const Bitmap& Members(size_t playlist) const {
+			return entries[playlist].members;
+		}
+
+		/*! Whether any membership has changed since the last call. */
+		bool Changed() {
+			bool ret = changed;
+			changed = false;
+			return ret;
+		}
+
+	private:
+		struct entry {
+			std::string name;
+			PlaylistFilter filter;
+			tag_mask_t fields;/* including those of any IN playlists */
+			/* the paths listed in the spec, for tracks which show up later */
+			std::unordered_set<std::string> statics;
+			Bitmap members;
+		};
+
+		bool lookup(size_t before, const std::string& name, const Bitmap*& members,
+				tag_mask_t& fields) const;
+		/* evaluates a rule made only of IN/ALL/ANY/NOT with Bitmap
+		 * operations, returning false if it has anything else */
+		bool combine(size_t before, const Rule& rule, const Bitmap& all,
+				Bitmap& out) const;
+		void update(entry& e, const TrackStore& tracks, item_id_t id);
+
+		std::vector<entry> entries;
+
+		/* for each field bit, the playlists which depend on it */
+		std::vector<size_t> by_field[TAG_INT_COUNT + TAG_STR_COUNT];
+		/* marks which playlists were already updated for a change, since
+		 * a playlist is listed under each of its fields */
+		std::vector<uint32_t> visited;
+		uint32_t visit;
+		std::vector<size_t> pending;
+		bool changed;
+	};
+}
+
+#endif
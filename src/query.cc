@@ -0,0 +1,347 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "dmap-codes.h"
+#include "logging.h"
+#include "query.h"
+
+/* how deeply parentheses may be nested */
+#define MAX_DEPTH 32
+
+namespace {
+	struct field_name {
+		const char* name;
+		bool is_int;
+		int field;
+	};
+
+	const field_name FIELD_NAMES[] = {
+#define INT_FIELD(field, code, type, name) { name, true, adaapd::field },
+#define STR_FIELD(field, code, name) { name, false, adaapd::field },
+		DMAP_INT_FIELDS(INT_FIELD)
+		DMAP_STR_FIELDS(STR_FIELD)
+#undef INT_FIELD
+#undef STR_FIELD
+	};
+
+	/* the Rule for a single term, or an always-true one if it's for a field
+	 * which we don't have */
+	adaapd::Rule term(const std::string& name, bool negate, const std::string& value,
+			bool lead, bool trail) {
+		for (size_t i = 0; i < sizeof(FIELD_NAMES) / sizeof(field_name); ++i) {
+			const field_name& f = FIELD_NAMES[i];
+			if (name != f.name) {
+				continue;
+			}
+			adaapd::Rule rule;
+			if (f.is_int) {
+				char* end;
+				long long num = strtoll(value.c_str(), &end, 10);
+				if (lead || trail || value.empty() || *end != 0) {
+					DEBUG("Ignoring non-numeric query term for %s: %s", name.c_str(), value.c_str());
+					return adaapd::Rule::Group(adaapd::Rule::ALL);
+				}
+				rule = adaapd::Rule::Int((adaapd::Tag_IntId)f.field, adaapd::Rule::INT_EQ, num);
+			} else {
+				adaapd::Rule::TYPE type = adaapd::Rule::STR_IS;
+				if (lead && trail) {
+					type = adaapd::Rule::STR_CONTAINS;
+				} else if (lead) {
+					type = adaapd::Rule::STR_ENDS;
+				} else if (trail) {
+					type = adaapd::Rule::STR_STARTS;
+				}
+				rule = adaapd::Rule::Str((adaapd::Tag_StrId)f.field, type, value);
+			}
+			return negate ? adaapd::Rule::Not(rule) : rule;
+		}
+		DEBUG("Ignoring query term for unknown field %s", name.c_str());
+		return adaapd::Rule::Group(adaapd::Rule::ALL);
+	}
+
+	/* parses "'field:value'" at [*c, end), advancing *c past it */
+	bool parse_term(const char** c, const char* end, adaapd::Rule& rule) {
+		++*c;/* the opening quote */
+		const char* name = *c;
+		while (*c < end && **c != ':' && **c != '!' && **c != '\'') {
+			++*c;
+		}
+		std::string field(name, *c - name);
+		bool negate = (*c < end && **c == '!');
+		if (negate) {
+			++*c;
+		}
+		if (*c == end || **c != ':') {
+			return false;
+		}
+		++*c;
+
+		/* a wildcard is an unescaped '*' at either end */
+		std::string value;
+		bool lead = false, trail = false;
+		if (*c < end && **c == '*') {
+			lead = true;
+			++*c;
+		}
+		while (*c < end && **c != '\'') {
+			if (**c == '\\' && *c + 1 < end) {
+				++*c;
+				trail = false;
+			} else {
+				trail = (**c == '*');
+			}
+			value.push_back(**c);
+			++*c;
+		}
+		if (*c == end) {
+			return false;
+		}
+		++*c;/* the closing quote */
+		if (trail) {
+			value.resize(value.size() - 1);
+		}
+		rule = term(field, negate, value, lead, trail);
+		return true;
+	}
+
+	bool parse_any(const char** c, const char* end, adaapd::Rule& rule, size_t depth);
+
+	/* a term or a parenthesized group */
+	bool parse_one(const char** c, const char* end, adaapd::Rule& rule, size_t depth) {
+		if (*c == end) {
+			return false;
+		} else if (**c == '\'') {
+			return parse_term(c, end, rule);
+		} else if (**c == '(' && depth < MAX_DEPTH) {
+			++*c;
+			if (!parse_any(c, end, rule, depth + 1) || *c == end || **c != ')') {
+				return false;
+			}
+			++*c;
+			return true;
+		}
+		return false;
+	}
+
+	/* terms joined with '+' or ' ', which URL decoding turns into ' ' */
+	bool parse_all(const char** c, const char* end, adaapd::Rule& rule, size_t depth) {
+		adaapd::Rule all = adaapd::Rule::Group(adaapd::Rule::ALL);
+		for (;;) {
+			all.rules.push_back(adaapd::Rule());
+			if (!parse_one(c, end, all.rules.back(), depth)) {
+				return false;
+			}
+			if (*c == end || (**c != '+' && **c != ' ')) {
+				break;
+			}
+			++*c;
+		}
+		rule = (all.rules.size() == 1) ? all.rules[0] : all;
+		return true;
+	}
+
+	/* terms joined with ',' */
+	bool parse_any(const char** c, const char* end, adaapd::Rule& rule, size_t depth) {
+		adaapd::Rule any = adaapd::Rule::Group(adaapd::Rule::ANY);
+		for (;;) {
+			any.rules.push_back(adaapd::Rule());
+			if (!parse_all(c, end, any.rules.back(), depth)) {
+				return false;
+			}
+			if (*c == end || **c != ',') {
+				break;
+			}
+			++*c;
+		}
+		rule = (any.rules.size() == 1) ? any.rules[0] : any;
+		return true;
+	}
+
+	/* removes the sorted 'list' from sorted 'ids' */
+	void subtract(std::vector<adaapd::item_id_t>& ids, const adaapd::postings_t& list) {
+		std::vector<adaapd::item_id_t>::iterator end =
+			std::set_difference(ids.begin(), ids.end(), list.begin(), list.end(), ids.begin());
+		ids.erase(end, ids.end());
+	}
+
+	/* adds the sorted 'list' to sorted 'ids' */
+	void unite(std::vector<adaapd::item_id_t>& ids, const adaapd::postings_t& list) {
+		std::vector<adaapd::item_id_t> out;
+		out.reserve(ids.size() + list.size());
+		std::set_union(ids.begin(), ids.end(), list.begin(), list.end(),
+				std::back_inserter(out));
+		ids.swap(out);
+	}
+
+	bool by_size(const adaapd::postings_t& a, const adaapd::postings_t& b) {
+		return a.size() < b.size();
+	}
+}
+
+bool adaapd::ParseQuery(const std::string& query, Rule& rule) {
+	const char* c = query.data();
+	const char* end = c + query.size();
+	if (!parse_any(&c, end, rule, 0) || c != end) {
+		LOG("Bad query: %s", query.c_str());
+		return false;
+	}
+	return true;
+}
+
+adaapd::QueryEvaluator::QueryEvaluator() { }
+
+void adaapd::QueryEvaluator::Match(const Rule& rule, const TrackStore& tracks,
+		const TagIndex& index, const SearchIndex& search, std::vector<item_id_t>& ids) {
+	std::vector<item_id_t> matches;
+	eval(rule, tracks, index, search, matches);
+	ids.insert(ids.end(), matches.begin(), matches.end());
+}
+
+bool adaapd::QueryEvaluator::indexed(const Rule& rule) const {
+	switch (rule.type) {
+	case Rule::STR_IS:
+	case Rule::STR_STARTS:
+	case Rule::STR_ENDS:
+	case Rule::STR_CONTAINS:
+		return TagIndex::Indexed((Tag_StrId)rule.field);
+	case Rule::ALL:
+	case Rule::ANY:
+		for (size_t i = 0; i < rule.rules.size(); ++i) {
+			if (!indexed(rule.rules[i])) {
+				return false;
+			}
+		}
+		return !rule.rules.empty();
+	case Rule::NOT:
+		return indexed(rule.rules[0]);
+	default:
+		return false;
+	}
+}
+
+void adaapd::QueryEvaluator::eval(const Rule& rule, const TrackStore& tracks,
+		const TagIndex& index, const SearchIndex& search, std::vector<item_id_t>& ids) {
+	switch (rule.type) {
+	case Rule::STR_IS:
+	case Rule::STR_STARTS:
+	case Rule::STR_ENDS:
+	case Rule::STR_CONTAINS:
+		if (TagIndex::Indexed((Tag_StrId)rule.field)) {
+			/* the union of the lists for each matching string */
+			values.clear();
+			search.Find(tracks.Strings(), rule.type, rule.text, values);
+			for (size_t i = 0; i < values.size(); ++i) {
+				const postings_t* list = index.Postings((Tag_StrId)rule.field, values[i]);
+				if (list != NULL) {
+					ids.insert(ids.end(), list->begin(), list->end());
+				}
+			}
+			if (values.size() > 1) {
+				std::sort(ids.begin(), ids.end());
+				ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+			}
+			return;
+		}
+		break;
+
+	case Rule::ANY:
+		if (indexed(rule)) {
+			for (size_t i = 0; i < rule.rules.size(); ++i) {
+				std::vector<item_id_t> child;
+				eval(rule.rules[i], tracks, index, search, child);
+				unite(ids, child);
+			}
+			return;
+		}
+		break;
+
+	case Rule::ALL: {
+		/* the indexed conditions narrow things down to a few candidates,
+		 * which the others are then checked against one by one */
+		std::vector<postings_t> lists;
+		std::vector<postings_t> excluded;
+		Rule rest = Rule::Group(Rule::ALL);
+		for (size_t i = 0; i < rule.rules.size(); ++i) {
+			const Rule& child = rule.rules[i];
+			if (child.type == Rule::NOT && indexed(child.rules[0])) {
+				excluded.push_back(postings_t());
+				eval(child.rules[0], tracks, index, search, excluded.back());
+			} else if (child.type != Rule::NOT && indexed(child)) {
+				lists.push_back(postings_t());
+				eval(child, tracks, index, search, lists.back());
+			} else {
+				rest.rules.push_back(child);
+			}
+		}
+		if (lists.empty()) {
+			break;
+		}
+		std::sort(lists.begin(), lists.end(), by_size);
+		ids.swap(lists[0]);
+		for (size_t i = 1; i < lists.size() && !ids.empty(); ++i) {
+			Intersect(ids, lists[i]);
+		}
+		for (size_t i = 0; i < excluded.size() && !ids.empty(); ++i) {
+			subtract(ids, excluded[i]);
+		}
+		if (!rest.rules.empty() && !ids.empty()) {
+			if (!filter.Compile(rest)) {
+				ids.clear();
+				return;
+			}
+			size_t out = 0;
+			for (size_t i = 0; i < ids.size(); ++i) {
+				if (filter.Match(tracks, ids[i])) {
+					ids[out++] = ids[i];
+				}
+			}
+			ids.resize(out);
+		}
+		return;
+	}
+
+	case Rule::NOT:
+		if (indexed(rule)) {
+			std::vector<item_id_t> excluded;
+			eval(rule.rules[0], tracks, index, search, excluded);
+			for (item_id_t id = 0; id < tracks.End(); ++id) {
+				if (tracks.Has(id)) {
+					ids.push_back(id);
+				}
+			}
+			subtract(ids, excluded);
+			return;
+		}
+		break;
+
+	default:
+		break;
+	}
+	scan(rule, tracks, ids);
+}
+
+void adaapd::QueryEvaluator::scan(const Rule& rule, const TrackStore& tracks,
+		std::vector<item_id_t>& ids) {
+	if (filter.Compile(rule)) {
+		filter.Match(tracks, ids);
+	}
+}
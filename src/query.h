@@ -0,0 +1,72 @@
+#ifndef _adaapd_query_h_
+#define _adaapd_query_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <vector>
+
+#include "playlist.h"
+#include "search-index.h"
+#include "tag-index.h"
+
+namespace adaapd {
+	/*! Parses a DAAP query= filter into a Rule, eg
+	 * "('daap.songartist:Foo','daap.songalbum:Bar')". Terms are quoted
+	 * "field:value", or "field!:value" for a negation, with backslash
+	 * escapes in the value. A '*' at either end of a value is a wildcard.
+	 * Terms are joined with '+' or ' ' for "and", ',' for "or" (which binds
+	 * looser), and grouped with parentheses. Terms for fields we don't have
+	 * (eg com.apple.itunes.mediakind) are ignored. Returns false if the
+	 * query is malformed. */
+	bool ParseQuery(const std::string& query, Rule& rule);
+
+	/*! Evaluates parsed queries against a library snapshot. Conditions on
+	 * the TagIndex's fields are answered from its lists, with the snapshot's
+	 * SearchIndex finding the strings for wildcard terms: "and" intersects
+	 * them smallest-first with a galloping search, so the cost follows the
+	 * shortest list rather than the library, and anything else is only
+	 * checked against the tracks which those leave. Queries with nothing
+	 * indexed fall back to a PlaylistFilter scan.
+	 *
+	 * Like a PlaylistFilter, meant for one library (or its snapshots) from a
+	 * single thread. */
+	class QueryEvaluator {
+	public:
+		QueryEvaluator();
+
+		/*! Appends the ids of the tracks in 'tracks' which match 'rule' to
+		 * 'ids', in increasing order. 'index' and 'search' are for the same
+		 * snapshot. */
+		void Match(const Rule& rule, const TrackStore& tracks, const TagIndex& index,
+				const SearchIndex& search, std::vector<item_id_t>& ids);
+
+	private:
+		/* whether 'rule' can be answered from the index alone */
+		bool indexed(const Rule& rule) const;
+		void eval(const Rule& rule, const TrackStore& tracks, const TagIndex& index,
+				const SearchIndex& search, std::vector<item_id_t>& ids);
+		/* matches 'rule' against every track */
+		void scan(const Rule& rule, const TrackStore& tracks, std::vector<item_id_t>& ids);
+		PlaylistFilter filter;
+		std::vector<str_id_t> values;
+	};
+}
+
+#endif
@@ -0,0 +1,275 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+#include "search-index.h"
+#include "tag-index.h"
+
+/* markers for the start and end of a string in its grams, which can't
+ * appear in a tag */
+#define GRAM_START '\1'
+#define GRAM_END '\2'
+
+/* grow once more than this fraction of a table's slots are used */
+#define MAX_LOAD_NUM 1
+#define MAX_LOAD_DEN 2
+
+namespace {
+	std::string fold(const char* str, size_t len) {
+		std::string out(str, len);
+		for (size_t i = 0; i < out.size(); ++i) {
+			out[i] = tolower((unsigned char)out[i]);
+		}
+		return out;
+	}
+
+	/* the gram at str[0, 3) */
+	uint32_t gram(const char* str) {
+		return (uint32_t)(uint8_t)str[0] << 16 | (uint32_t)(uint8_t)str[1] << 8 |
+			(uint32_t)(uint8_t)str[2];
+	}
+
+	bool matches(adaapd::Rule::TYPE type, const char* str, size_t len, const std::string& text) {
+		switch (type) {
+		case adaapd::Rule::STR_IS:
+			return strcasecmp(str, text.c_str()) == 0;
+		case adaapd::Rule::STR_STARTS:
+			return strncasecmp(str, text.c_str(), text.size()) == 0;
+		case adaapd::Rule::STR_ENDS:
+			return len >= text.size() && strcasecmp(str + len - text.size(), text.c_str()) == 0;
+		case adaapd::Rule::STR_CONTAINS:
+			return strcasestr(str, text.c_str()) != NULL;
+		default:
+			return false;
+		}
+	}
+
+	/* FNV-1a */
+	uint32_t hash(const std::string& str) {
+		uint32_t h = 2166136261u;
+		for (size_t i = 0; i < str.size(); ++i) {
+			h = (h ^ (uint8_t)str[i]) * 16777619u;
+		}
+		return h;
+	}
+
+	/* where a key's probe starts: grams differ mostly in their low bits */
+	inline uint32_t home(uint32_t key) {
+		key ^= key >> 16;
+		key *= 0x85ebca6b;
+		key ^= key >> 13;
+		key *= 0xc2b2ae35;
+		key ^= key >> 16;
+		return key;
+	}
+
+	inline uint32_t slot_key(uint64_t slot) {
+		return slot >> 32;
+	}
+	inline uint32_t slot_value(uint64_t slot) {
+		return slot & 0xffffffff;
+	}
+	inline uint64_t make_slot(uint32_t key, uint32_t value) {
+		return ((uint64_t)key << 32) | value;
+	}
+
+	bool by_size(const std::vector<adaapd::str_id_t>* a, const std::vector<adaapd::str_id_t>* b) {
+		return a->size() < b->size();
+	}
+}
+
+adaapd::SearchIndex::SearchIndex()
+	: size(0) { }
+
+adaapd::SearchIndex::SearchIndex(SearchIndex& from)
+	: lists(from.lists.Share()), size(from.size) {
+	exact.slots = from.exact.slots.Share();
+	exact.mask = from.exact.mask;
+	exact.count = from.exact.count;
+	grams.slots = from.grams.slots.Share();
+	grams.mask = from.grams.mask;
+	grams.count = from.grams.count;
+	/* everything is shared now, so any change copies the list again */
+	from.fresh.clear();
+}
+
+std::shared_ptr<const adaapd::SearchIndex> adaapd::SearchIndex::Snapshot() {
+	return std::shared_ptr<const SearchIndex>(new SearchIndex(*this));
+}
+
+void adaapd::SearchIndex::Clear() {
+	exact = table();
+	grams = table();
+	lists = Column<list_t>();
+	fresh.clear();
+	size = 0;
+}
+
+void adaapd::SearchIndex::Update(const StringPool& pool) {
+	for (; size < pool.Size(); ++size) {
+		str_id_t id = size;
+		if (id == STR_NONE) {
+			continue;
+		}
+		std::string folded = fold(pool.Get(id), pool.Len(id));
+		/* never an empty slot, since the id isn't 0 */
+		exact.add(make_slot(hash(folded), id));
+		std::string padded = GRAM_START + folded + GRAM_END;
+		for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+			std::vector<str_id_t>& list = writable(gram(padded.data() + i));
+			/* ids only increase, so a repeated gram is always at the back */
+			if (list.empty() || list.back() != id) {
+				list.push_back(id);
+			}
+		}
+	}
+}
+
+void adaapd::SearchIndex::Find(const StringPool& pool, Rule::TYPE type,
+		const std::string& text, std::vector<str_id_t>& ids) const {
+	if (type == Rule::STR_IS) {
+		if (exact.count == 0) {
+			return;
+		}
+		uint32_t h = hash(fold(text.data(), text.size()));
+		size_t start = ids.size();
+		for (item_id_t i = home(h) & exact.mask;; i = (i + 1) & exact.mask) {
+			uint64_t slot = exact.slots.Get(i);
+			if (slot == 0) {
+				break;
+			}
+			str_id_t id = slot_value(slot);
+			if (slot_key(slot) == h && id < pool.Size() &&
+					matches(type, pool.Get(id), 0, text)) {
+				ids.push_back(id);
+			}
+		}
+		std::sort(ids.begin() + start, ids.end());
+		return;
+	}
+
+	/* the grams which any match has to have */
+	std::string padded = fold(text.data(), text.size());
+	if (type == Rule::STR_STARTS) {
+		padded = GRAM_START + padded;
+	} else if (type == Rule::STR_ENDS) {
+		padded += GRAM_END;
+	}
+	std::vector<const std::vector<str_id_t>*> found_lists;
+	for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+		const std::vector<str_id_t>* found = list(gram(padded.data() + i));
+		if (found == NULL) {
+			return;
+		}
+		found_lists.push_back(found);
+	}
+
+	std::vector<str_id_t> candidates;
+	if (found_lists.empty()) {
+		for (str_id_t id = 1; id < size && id < pool.Size(); ++id) {
+			candidates.push_back(id);
+		}
+	} else {
+		std::sort(found_lists.begin(), found_lists.end(), by_size);
+		candidates = *found_lists[0];
+		for (size_t i = 1; i < found_lists.size() && !candidates.empty(); ++i) {
+			Intersect(candidates, *found_lists[i]);
+		}
+	}
+	/* having the grams doesn't mean they're in the right order */
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		str_id_t id = candidates[i];
+		if (id < pool.Size() && matches(type, pool.Get(id), pool.Len(id), text)) {
+			ids.push_back(id);
+		}
+	}
+}
+
+const std::vector<adaapd::str_id_t>* adaapd::SearchIndex::list(uint32_t gram) const {
+	if (grams.count == 0) {
+		return NULL;
+	}
+	for (item_id_t i = home(gram) & grams.mask;; i = (i + 1) & grams.mask) {
+		uint64_t slot = grams.slots.Get(i);
+		if (slot == 0) {
+			return NULL;
+		}
+		if (slot_key(slot) == gram) {
+			return lists.Get(slot_value(slot)).get();
+		}
+	}
+}
+
+std::vector<adaapd::str_id_t>& adaapd::SearchIndex::writable(uint32_t gram) {
+	uint32_t n = grams.count;
+	for (item_id_t i = home(gram) & grams.mask; grams.count != 0; i = (i + 1) & grams.mask) {
+		uint64_t slot = grams.slots.Get(i);
+		if (slot == 0) {
+			break;
+		}
+		if (slot_key(slot) == gram) {
+			n = slot_value(slot);
+			break;
+		}
+	}
+	if (n == grams.count) {
+		/* a new gram, which can't be 0 since there are no NULs in it */
+		grams.add(make_slot(gram, n));
+		lists.Grow(n + 1, list_t());
+	}
+	list_t found = lists.Get(n);
+	if (fresh.insert(n).second) {
+		/* possibly shared with a snapshot */
+		found.reset(found ? new std::vector<str_id_t>(*found) : new std::vector<str_id_t>);
+		lists.Set(n, found);
+	}
+	return *found;
+}
+
+void adaapd::SearchIndex::table::add(uint64_t slot) {
+	if ((count + 1) * MAX_LOAD_DEN > (mask + 1) * MAX_LOAD_NUM) {
+		grow();
+	}
+	item_id_t i = home(slot_key(slot)) & mask;
+	while (slots.Get(i) != 0) {
+		i = (i + 1) & mask;
+	}
+	slots.Set(i, slot);
+	++count;
+}
+
+void adaapd::SearchIndex::table::grow() {
+	item_id_t size = (mask == 0) ? CHUNK_SIZE : (mask + 1) << 1;
+	Column<uint64_t> old(std::move(slots));
+	item_id_t old_size = old.ChunkCount() << CHUNK_BITS;
+	slots = Column<uint64_t>();
+	slots.Grow(size, 0);
+	mask = size - 1;
+	count = 0;
+	for (item_id_t i = 0; i < old_size; ++i) {
+		uint64_t slot = old.Get(i);
+		if (slot != 0) {
+			add(slot);
+		}
+	}
+}
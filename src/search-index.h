@@ -0,0 +1,112 @@
+#ifndef _adaapd_search_index_h_
+#define _adaapd_search_index_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "playlist.h"
+
+namespace adaapd {
+	/*! Finds the strings in a StringPool which equal, start with, end with
+	 * or contain some text, ignoring case, without looking at every string.
+	 *
+	 * Each string is case-folded and split into overlapping 3-byte grams,
+	 * with markers for its start and end so that prefixes and suffixes
+	 * are grams of their own, and each gram lists the strings which have
+	 * it. A search intersects the lists for the grams of its text and only
+	 * compares the strings which are left. Text too short to have a gram
+	 * (eg a 2-byte substring) is compared against every string. Exact
+	 * matches go through a hash of the folded strings instead.
+	 *
+	 * Strings are never removed from a pool, so keeping up is a matter of
+	 * indexing whatever was interned since last time, and the lists stay
+	 * sorted by appending. Like a TagIndex, the Library keeps one up to date
+	 * and publishes read-only snapshots of it: both hashes are open-addressed
+	 * tables in Columns, like a PathIndex, and a gram's list is only copied
+	 * the first time it changes after a Snapshot(). */
+	class SearchIndex {
+	public:
+		SearchIndex();
+
+		/*! Returns a read-only copy which shares all of the current lists. */
+		std::shared_ptr<const SearchIndex> Snapshot();
+
+		/*! Indexes any strings added to 'pool' since last time. */
+		void Update(const StringPool& pool);
+
+		/*! Forgets all strings, eg when the pool has been replaced. */
+		void Clear();
+
+		/*! Appends the ids of the strings in 'pool' which match 'text' to
+		 * 'ids', in increasing order. 'pool' is the one which was indexed,
+		 * or a snapshot of it from the same time. 'type' is one of
+		 * Rule::STR_IS, STR_STARTS, STR_ENDS or STR_CONTAINS. The empty
+		 * string is never included. */
+		void Find(const StringPool& pool, Rule::TYPE type, const std::string& text,
+				std::vector<str_id_t>& ids) const;
+
+		/*! The number of strings which have been indexed, including the
+		 * empty string. */
+		size_t Size() const {
+			return size;
+		}
+
+	private:
+		typedef std::shared_ptr<std::vector<str_id_t> > list_t;
+
+		/* key << 32 | value for each entry, 0 for an empty slot */
+		struct table {
+			table() : mask(0), count(0) { }
+
+			void add(uint64_t slot);
+			void grow();
+
+			Column<uint64_t> slots;
+			item_id_t mask;
+			size_t count;
+		};
+
+		SearchIndex(SearchIndex& from);
+		SearchIndex(const SearchIndex&) = delete;
+		SearchIndex& operator=(const SearchIndex&) = delete;
+
+		/* the list of 'gram', or NULL if no string has it */
+		const std::vector<str_id_t>* list(uint32_t gram) const;
+		/* the list of 'gram', made writable */
+		std::vector<str_id_t>& writable(uint32_t gram);
+
+		/* the strings by the hash of their folded text */
+		table exact;
+		/* each gram (see gram()) by the number of its list in 'lists' */
+		table grams;
+		Column<list_t> lists;
+		/* lists which were copied (or made) since the last Snapshot(), so
+		 * they may be changed in place */
+		std::unordered_set<uint32_t> fresh;
+		size_t size;
+	};
+}
+
+#endif
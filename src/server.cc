@@ -0,0 +1,675 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <chrono>
+#include <list>
+
+#include "server.h"
+#include "file-cache.h"
+#include "logging.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define INVALID_FD -1
+
+#define LISTEN_BACKLOG 128
+/* connections accepted per loop iteration, so that a flood of connects
+ * doesn't starve everyone else */
+#define ACCEPT_BATCH 64
+/* how long to stop accepting when we're out of fds */
+#define ACCEPT_RETRY_SECS 1.
+
+#define READ_SIZE 4096
+/* stop reading pipelined requests once this many responses are waiting */
+#define MAX_QUEUED 16
+/* listings are gathered from many small pieces */
+#define MAX_IOV 1024
+
+#define SERVER_NAME "adaapd/1.0"
+
+namespace {
+	adaapd::Counter& requests = adaapd::Metrics::Get().GetCounter(
+			"adaapd_server_requests_total", "Requests received");
+	adaapd::Histogram& request_latency = adaapd::Metrics::Get().GetHistogram(
+			"adaapd_server_handler_seconds", "Time taken by the handler for each request",
+			adaapd::LatencyBuckets(), adaapd::LATENCY_SCALE);
+	adaapd::Counter& bytes_sent = adaapd::Metrics::Get().GetCounter(
+			"adaapd_server_bytes_total", "Bytes written to clients, including files");
+	adaapd::Gauge& connections = adaapd::Metrics::Get().GetGauge(
+			"adaapd_server_clients", "Open client connections");
+	adaapd::Gauge& streams = adaapd::Metrics::Get().GetGauge(
+			"adaapd_server_streams", "Responses with a file which are waiting to be sent or being sent");
+
+	const char* status_text(int status) {
+		switch (status) {
+		case 200: return "OK";
+		case 204: return "No Content";
+		case 206: return "Partial Content";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 416: return "Requested Range Not Satisfiable";
+		case 431: return "Request Header Fields Too Large";
+		case 500: return "Internal Server Error";
+		case 503: return "Service Unavailable";
+		default: return "Unknown";
+		}
+	}
+}
+
+namespace adaapd {
+	/*! The state of a single connection. Kept small, since most of them are
+	 * idle clients waiting for their next request. */
+	class Client {
+	public:
+		Client(Server* server, int fd);
+		virtual ~Client();
+
+		void Start();
+
+		/*! Sends the response for a parked request. */
+		void Finish(ParkedResponse* parked, Response& response);
+
+	private:
+		struct output {
+			/* not yet answered: nothing from here on can be sent */
+			parked_t parked;
+			bool head_only, keep_alive;
+
+			std::string head;
+			std::vector<Response::piece> body;
+			/* sent after head and body */
+			std::shared_ptr<const OpenFile> file;
+			off_t file_offset;
+			size_t file_len;
+			size_t size;/* everything */
+		};
+
+		void cb_io(ev::io& io, int revents);
+		void cb_timeout(ev::timer& timer, int revents);
+
+		bool read();
+		bool process();
+		void queue(Response& response, bool head_only, bool keep_alive);
+		void fill(output& o, Response& response);
+		void error(int status);
+		bool flush();
+		/* drops the front output once it's been sent */
+		void pop();
+		void update();
+		void close();
+
+		Server* server;
+		const int fd;
+		ev::io io;
+		ev::timer timer;
+		ev::tstamp last_activity;
+		int events;
+
+		/* received bytes, of which [0, in_start) have been handled */
+		std::string in;
+		size_t in_start;
+		/* request body bytes which are yet to be skipped */
+		uint32_t body_left;
+		DaapRequest request;
+
+		/* responses waiting to be written, of which out_sent bytes of the
+		 * first have been */
+		std::list<output> out;
+		size_t out_sent;
+
+		/* the number of outputs which are parked */
+		size_t parked;
+
+		bool read_closed, close_after;
+	};
+}
+
+adaapd::Response::Response()
+	: status(200), content_type("application/x-dmap-tagged"),
+	  file_offset(0), file_len(0), body_size(0) { }
+
+void adaapd::Response::Header(const char* name, const std::string& value) {
+	headers.append(name);
+	headers.append(": ");
+	headers.append(value);
+	headers.append("\r\n");
+}
+
+void adaapd::Response::Append(const std::string& data) {
+	std::shared_ptr<std::string> copy(new std::string(data));
+	Append(copy, copy->data(), copy->size());
+}
+
+void adaapd::Response::Append(const std::shared_ptr<const void>& owner,
+		const char* data, size_t len) {
+	if (len == 0) {
+		return;
+	}
+	piece p;
+	p.owner = owner;
+	p.data = data;
+	p.len = len;
+	body.push_back(p);
+	body_size += len;
+}
+
+void adaapd::Response::Keep(const std::shared_ptr<const void>& owner) {
+	/* an empty piece is skipped when writing */
+	piece p;
+	p.owner = owner;
+	p.data = NULL;
+	p.len = 0;
+	body.push_back(p);
+}
+
+adaapd::parked_t adaapd::Response::Park() {
+	parked.reset(new ParkedResponse);
+	return parked;
+}
+
+void adaapd::ParkedResponse::Finish(Response& response) {
+	if (client != NULL) {
+		client->Finish(this, response);
+	}
+}
+
+void adaapd::Response::File(const std::shared_ptr<const OpenFile>& file_,
+		off_t offset, size_t len) {
+	file = file_;
+	file_offset = offset;
+	file_len = len;
+	body_size += len;
+}
+
+void adaapd::Response::ForEach(
+		const std::function<void(const char* data, size_t len)>& func) const {
+	for (std::vector<piece>::const_iterator iter = body.begin();
+		 iter != body.end(); ++iter) {
+		if (iter->len != 0) {
+			func(iter->data, iter->len);
+		}
+	}
+}
+
+adaapd::Client::Client(Server* server, int fd)
+	: server(server), fd(fd), io(server->loop), timer(server->loop),
+	  last_activity(0), events(0), in_start(0), body_left(0), out_sent(0),
+	  parked(0), read_closed(false), close_after(false) { }
+
+adaapd::Client::~Client() {
+	for (std::list<output>::iterator iter = out.begin(); iter != out.end(); ++iter) {
+		if (iter->parked) {
+			iter->parked->client = NULL;
+		}
+		if (iter->file) {
+			streams.Add(-1);
+		}
+	}
+	connections.Add(-1);
+	io.stop();
+	timer.stop();
+	::close(fd);
+}
+
+void adaapd::Client::Start() {
+	last_activity = ev_now(server->loop);
+	connections.Add(1);
+
+	io.set<Client, &Client::cb_io>(this);
+	events = ev::READ;
+	io.start(fd, events);
+
+	/* Rather than restarting the timer on every request, it's left to fire
+	 * and then rearmed for whatever's left since the last activity. This
+	 * keeps the timer heap quiet with thousands of clients. */
+	timer.set<Client, &Client::cb_timeout>(this);
+	timer.start(server->idle_timeout, 0.);
+}
+
+void adaapd::Client::cb_io(ev::io& /*io*/, int revents) {
+	last_activity = ev_now(server->loop);
+
+	if ((revents & ev::READ) != 0 && !read()) {
+		close();
+		return;
+	}
+	/* keep going while flushing makes room for more pipelined responses */
+	bool more;
+	do {
+		more = process();
+		if (!flush()) {
+			close();
+			return;
+		}
+	} while (more && out.empty());
+
+	if (out.empty() && (close_after || read_closed)) {
+		close();
+		return;
+	} else if (read_closed && parked != 0) {
+		/* hung up while waiting on a parked request */
+		close();
+		return;
+	}
+	update();
+}
+
+void adaapd::Client::Finish(ParkedResponse* parked_response, Response& response) {
+	for (std::list<output>::iterator iter = out.begin(); iter != out.end(); ++iter) {
+		if (iter->parked.get() == parked_response) {
+			parked_response->client = NULL;
+			/* the parked_t may have been the last reference */
+			parked_t keep = iter->parked;
+			iter->parked.reset();
+			--parked;
+			fill(*iter, response);
+			break;
+		}
+	}
+	last_activity = ev_now(server->loop);
+
+	/* as in cb_io: requests may have been waiting for room in 'out' */
+	bool more;
+	do {
+		more = process();
+		if (!flush()) {
+			close();
+			return;
+		}
+	} while (more && out.empty());
+	if (out.empty() && (close_after || read_closed)) {
+		close();
+		return;
+	}
+	update();
+}
+
+void adaapd::Client::cb_timeout(ev::timer& /*timer*/, int /*revents*/) {
+	ev::tstamp left = last_activity + server->idle_timeout - ev_now(server->loop);
+	if (left <= 0 && parked != 0) {
+		/* not idle, just waiting on us */
+		left = server->idle_timeout;
+	} else if (left <= 0) {
+		DEBUG("Closing idle client %d", fd);
+		close();
+		return;
+	}
+	timer.start(left, 0.);
+}
+
+bool adaapd::Client::read() {
+	size_t old = in.size();
+	in.resize(old + READ_SIZE);
+	ssize_t len = recv(fd, &in[old], READ_SIZE, 0);
+	if (len > 0) {
+		in.resize(old + len);
+		return true;
+	}
+	in.resize(old);
+	if (len == 0) {
+		read_closed = true;
+		return true;
+	}
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+		return true;
+	}
+	DEBUG("Failed to read from client %d: %d/%s", fd, errno, strerror(errno));
+	return false;
+}
+
+bool adaapd::Client::process() {
+	bool more = false;
+	while (!close_after) {
+		if (out.size() >= MAX_QUEUED) {
+			more = true;
+			break;
+		}
+		if (body_left != 0) {
+			size_t skip = in.size() - in_start;
+			if (skip > body_left) {
+				skip = body_left;
+			}
+			in_start += skip;
+			body_left -= skip;
+			if (body_left != 0) {
+				break;
+			}
+		}
+		if (in_start == in.size()) {
+			break;
+		}
+
+		const char* buf = in.data() + in_start;
+		DaapRequest::RESULT result = request.Parse(buf, in.size() - in_start);
+		if (result == DaapRequest::INCOMPLETE) {
+			break;
+		} else if (result == DaapRequest::INVALID) {
+			error(400);
+			break;
+		} else if (result == DaapRequest::TOO_LARGE) {
+			error(431);
+			break;
+		}
+
+		Response response;
+		TraceSpan span("request");
+		if (span.Active()) {
+			span.Detail(DaapRequest::Decode(buf, request.Path()));
+		}
+		requests.Add();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		server->handler(buf, request, response);
+		request_latency.ObserveSince(start);
+		if (response.parked) {
+			out.push_back(output());
+			output& o = out.back();
+			o.parked = response.parked;
+			o.parked->client = this;
+			o.head_only = (request.Method() == METHOD_HEAD);
+			o.keep_alive = request.KeepAlive();
+			o.size = 0;
+			o.file_len = 0;
+			++parked;
+		} else {
+			queue(response, request.Method() == METHOD_HEAD, request.KeepAlive());
+		}
+		if (!request.KeepAlive()) {
+			close_after = true;
+		}
+		in_start += request.Size();
+		body_left = request.ContentLength();
+		request.Reset();
+	}
+
+	/* Give the buffer back once it's drained, so that idle clients only cost
+	 * the Client itself. A partial request is moved to the front: its Spans
+	 * are relative to the start of the request so they're unaffected. */
+	if (in_start == in.size()) {
+		std::string().swap(in);
+		in_start = 0;
+	} else if (in_start > in.size() / 2) {
+		in.erase(0, in_start);
+		in_start = 0;
+	}
+	return more;
+}
+
+void adaapd::Client::queue(Response& response, bool head_only, bool keep_alive) {
+	out.push_back(output());
+	output& o = out.back();
+	o.head_only = head_only;
+	o.keep_alive = keep_alive;
+	fill(o, response);
+}
+
+void adaapd::Client::fill(output& o, Response& response) {
+
+	char line[128];
+	snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n",
+			response.status, status_text(response.status));
+	o.head.append(line);
+	o.head.append("DAAP-Server: " SERVER_NAME "\r\n");
+	if (!response.content_type.empty()) {
+		o.head.append("Content-Type: ");
+		o.head.append(response.content_type);
+		o.head.append("\r\n");
+	}
+	snprintf(line, sizeof(line), "Content-Length: %lu\r\n",
+			(unsigned long)response.body_size);
+	o.head.append(line);
+	if (!o.keep_alive) {
+		o.head.append("Connection: close\r\n");
+	}
+	o.head.append(response.headers);
+	o.head.append("\r\n");
+
+	o.size = o.head.size();
+	o.file_offset = 0;
+	o.file_len = 0;
+	if (!o.head_only) {
+		o.body.swap(response.body);
+		if (response.file_len != 0) {
+			streams.Add(1);
+			o.file = response.file;
+			o.file_offset = response.file_offset;
+			o.file_len = response.file_len;
+		}
+		o.size += response.body_size;
+	}
+}
+
+void adaapd::Client::error(int status) {
+	Response response;
+	response.status = status;
+	response.content_type.clear();
+	queue(response, false, false);
+	close_after = true;
+}
+
+bool adaapd::Client::flush() {
+	while (!out.empty() && !out.front().parked) {
+		output& front = out.front();
+		size_t mem_size = front.size - front.file_len;
+		if (out_sent >= mem_size) {
+			/* the rest of the front output is its file */
+			off_t offset = front.file_offset + (out_sent - mem_size);
+			ssize_t len = sendfile(fd, front.file->fd, &offset, front.size - out_sent);
+			if (len < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return true;
+				} else if (errno == EINTR) {
+					continue;
+				}
+				DEBUG("Failed to send file to client %d: %d/%s", fd, errno, strerror(errno));
+				return false;
+			} else if (len == 0) {
+				/* the file shrank, and we've already promised a length */
+				ERR("File for client %d was truncated while sending", fd);
+				return false;
+			}
+			bytes_sent.Add(len);
+			out_sent += len;
+			if (out_sent == front.size) {
+				pop();
+			}
+			continue;
+		}
+
+		/* gather everything up to the next file */
+		struct iovec iov[MAX_IOV];
+		int count = 0;
+		size_t skip = out_sent;
+		for (std::list<output>::const_iterator iter = out.begin();
+			 iter != out.end() && !iter->parked && count < MAX_IOV; ++iter) {
+			/* the head, then each body piece */
+			for (size_t i = 0; i <= iter->body.size() && count < MAX_IOV; ++i) {
+				const char* data = (i == 0) ? iter->head.data() : iter->body[i - 1].data;
+				size_t len = (i == 0) ? iter->head.size() : iter->body[i - 1].len;
+				if (skip >= len) {
+					skip -= len;
+					continue;
+				}
+				iov[count].iov_base = (void*)(data + skip);
+				iov[count].iov_len = len - skip;
+				++count;
+				skip = 0;
+			}
+			if (iter->file_len != 0) {
+				break;
+			}
+		}
+
+		ssize_t len = writev(fd, iov, count);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return true;
+			} else if (errno == EINTR) {
+				continue;
+			}
+			DEBUG("Failed to write to client %d: %d/%s", fd, errno, strerror(errno));
+			return false;
+		}
+
+		/* can't reach past a file, since the gather stopped there */
+		bytes_sent.Add(len);
+		size_t written = len;
+		while (written != 0) {
+			size_t left = out.front().size - out_sent;
+			if (written < left) {
+				out_sent += written;
+				break;
+			}
+			written -= left;
+			pop();
+		}
+	}
+	return true;
+}
+
+void adaapd::Client::pop() {
+	if (out.front().file) {
+		streams.Add(-1);
+	}
+	out.pop_front();
+	out_sent = 0;
+}
+
+void adaapd::Client::update() {
+	int want = 0;
+	if (!read_closed && !close_after && out.size() < MAX_QUEUED) {
+		want |= ev::READ;
+	}
+	if (!out.empty() && !out.front().parked) {
+		want |= ev::WRITE;
+	}
+	if (want != events) {
+		events = want;
+		io.set(events);
+	}
+}
+
+void adaapd::Client::close() {
+	/* deletes this */
+	server->remove(this);
+}
+
+adaapd::Server::Server(ev::loop_ref loop, handler_t handler, ev::tstamp idle_timeout)
+	: loop(loop), handler(handler), idle_timeout(idle_timeout),
+	  listen_fd(INVALID_FD), port(0), accept_io(loop), retry_timer(loop) { }
+
+adaapd::Server::~Server() {
+	for (std::unordered_set<Client*>::iterator iter = clients.begin();
+		 iter != clients.end(); ++iter) {
+		delete *iter;
+	}
+	clients.clear();
+
+	retry_timer.stop();
+	if (listen_fd != INVALID_FD) {
+		accept_io.stop();
+		close(listen_fd);
+		listen_fd = INVALID_FD;
+	}
+}
+
+bool adaapd::Server::Listen(uint16_t listen_port, bool reuse_port, bool loopback) {
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd == INVALID_FD) {
+		ERR("Unable to create socket: %d/%s", errno, strerror(errno));
+		return false;
+	}
+	int on = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (reuse_port &&
+			setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+		ERR("Unable to set SO_REUSEPORT: %d/%s", errno, strerror(errno));
+		return false;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(loopback ? INADDR_LOOPBACK : INADDR_ANY);
+	addr.sin_port = htons(listen_port);
+	if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		ERR("Unable to bind to port %d: %d/%s", listen_port, errno, strerror(errno));
+		return false;
+	}
+	if (listen(listen_fd, LISTEN_BACKLOG) != 0) {
+		ERR("Unable to listen on port %d: %d/%s", listen_port, errno, strerror(errno));
+		return false;
+	}
+	socklen_t addr_len = sizeof(addr);
+	if (getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) != 0) {
+		ERR("Unable to get socket name: %d/%s", errno, strerror(errno));
+		return false;
+	}
+	port = ntohs(addr.sin_port);
+	DEBUG("Listening on port %d", port);
+
+	retry_timer.set<Server, &Server::cb_retry>(this);
+	accept_io.set<Server, &Server::cb_accept>(this);
+	accept_io.start(listen_fd, ev::READ);
+	return true;
+}
+
+void adaapd::Server::cb_accept(ev::io& /*io*/, int /*revents*/) {
+	for (int i = 0; i < ACCEPT_BATCH; ++i) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == INVALID_FD) {
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				/* the pending connection stays in the backlog, and would keep
+				 * waking us up until some fds are freed */
+				ERR("Unable to accept connection, pausing: %d/%s", errno, strerror(errno));
+				accept_io.stop();
+				retry_timer.start(ACCEPT_RETRY_SECS, 0.);
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK &&
+					errno != EINTR && errno != ECONNABORTED) {
+				ERR("Unable to accept connection: %d/%s", errno, strerror(errno));
+			}
+			return;
+		}
+
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		Client* client = new Client(this, fd);
+		clients.insert(client);
+		client->Start();
+	}
+}
+
+void adaapd::Server::cb_retry(ev::timer& /*timer*/, int /*revents*/) {
+	accept_io.start();
+}
+
+void adaapd::Server::remove(Client* client) {
+	clients.erase(client);
+	delete client;
+}
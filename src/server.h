@@ -0,0 +1,178 @@
+#ifndef _adaapd_server_h_
+#define _adaapd_server_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <ev++.h>
+
+#include "daap-sm.h"
+
+namespace adaapd {
+	struct OpenFile;
+	class Client;
+	class ParkedResponse;
+
+	/*! A request which is answered later, see Response::Park(). */
+	typedef std::shared_ptr<ParkedResponse> parked_t;
+
+	/*! A response to a single request. The body is a list of pieces which are
+	 * handed to writev() as-is, so that shared buffers (eg cached DMAP blobs)
+	 * are never copied on their way to the socket. */
+	class Response {
+	public:
+		Response();
+
+		/*! Adds a "name: value" header line. */
+		void Header(const char* name, const std::string& value);
+
+		/*! Appends a copy of 'data' to the body. */
+		void Append(const std::string& data);
+
+		/*! Appends data[0, len) to the body without copying. 'owner' keeps the
+		 * data alive until it has been written. */
+		void Append(const std::shared_ptr<const void>& owner, const char* data, size_t len);
+
+		/*! Keeps 'owner' alive until the response has been written, so that
+		 * many pieces of the same buffer can be appended with a single
+		 * reference, using an empty owner for each piece. */
+		void Keep(const std::shared_ptr<const void>& owner);
+
+		/*! Appends a shared buffer to the body without copying. */
+		void Append(const std::shared_ptr<const std::string>& data) {
+			Append(data, data->data(), data->size());
+		}
+
+		/*! Ends the body with 'len' bytes of 'file' starting at 'offset'. These
+		 * are sent with sendfile(), so they never pass through userspace. */
+		void File(const std::shared_ptr<const OpenFile>& file, off_t offset, size_t len);
+
+		/*! Leaves the request unanswered for now, eg for a long-poll. The
+		 * returned handle is used to answer it later on, and any pipelined
+		 * responses after it wait until then. Everything else about this
+		 * Response is ignored. */
+		parked_t Park();
+
+		size_t BodySize() const {
+			return body_size;
+		}
+
+		/*! Calls 'func' with each in-memory piece of the body, in order. Any
+		 * File() part isn't included. */
+		void ForEach(const std::function<void(const char* data, size_t len)>& func) const;
+
+		int status;
+		std::string content_type;
+
+	private:
+		friend class Client;
+
+		struct piece {
+			std::shared_ptr<const void> owner;
+			const char* data;
+			size_t len;
+		};
+
+		std::string headers;
+		std::vector<piece> body;
+		std::shared_ptr<const OpenFile> file;
+		off_t file_offset;
+		size_t file_len;
+		size_t body_size;/* including file_len */
+		parked_t parked;
+	};
+
+	/*! A parked request, see Response::Park(). Only to be used from the
+	 * Server's loop, and not from within the handler itself. */
+	class ParkedResponse {
+	public:
+		ParkedResponse() : client(NULL) { }
+
+		/*! Whether the client is still waiting for the response. */
+		bool Waiting() const {
+			return client != NULL;
+		}
+
+		/*! Sends the response to the parked request. Does nothing if the
+		 * client has gone away meanwhile. */
+		void Finish(Response& response);
+
+	private:
+		friend class Client;
+
+		Client* client;
+	};
+
+	/*! Fills in the response for a parsed request. Spans in 'request' refer to
+	 * 'buf', which is only valid for the duration of the call. */
+	typedef std::function<void(const char* buf, const DaapRequest& request,
+			Response& response)> handler_t;
+
+	/*! Serves HTTP/DAAP on a libev loop. Sockets are non-blocking throughout,
+	 * requests may be pipelined and connections are kept alive until they've
+	 * been idle for 'idle_timeout' seconds. Each connection only costs a small
+	 * Client object while idle: buffers are released once drained. */
+	class Server {
+	public:
+		Server(ev::loop_ref loop, handler_t handler, ev::tstamp idle_timeout);
+		virtual ~Server();
+
+		/*! Starts accepting connections on 'port'. 0 picks a free port. With
+		 * 'reuse_port', several Servers (eg one per Workers thread) may listen
+		 * on the same port, with the kernel spreading connections across
+		 * them. With 'loopback', only local connections are accepted. */
+		bool Listen(uint16_t port, bool reuse_port = false, bool loopback = false);
+
+		/*! The port being listened on, once Listen() has succeeded. */
+		uint16_t Port() const {
+			return port;
+		}
+
+		/*! The number of open client connections. */
+		size_t Clients() const {
+			return clients.size();
+		}
+
+	private:
+		friend class Client;
+
+		void cb_accept(ev::io& io, int revents);
+		void cb_retry(ev::timer& timer, int revents);
+		void remove(Client* client);
+
+		ev::loop_ref loop;
+		const handler_t handler;
+		const ev::tstamp idle_timeout;
+
+		int listen_fd;
+		uint16_t port;
+		ev::io accept_io;
+		ev::timer retry_timer;
+		std::unordered_set<Client*> clients;
+	};
+}
+
+#endif
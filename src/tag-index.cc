@@ -0,0 +1,152 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "tag-index.h"
+
+namespace {
+	/* the indexed fields, in slot order */
+	const adaapd::Tag_StrId INDEXED[] = {
+		adaapd::ARTIST, adaapd::ALBUM, adaapd::GENRE, adaapd::COMPOSER, adaapd::TITLE
+	};
+}
+
+void adaapd::Intersect(std::vector<uint32_t>& ids, const std::vector<uint32_t>& list) {
+	const uint32_t* big = list.empty() ? NULL : &list[0];
+	size_t n = list.size(), pos = 0, out = 0;
+	for (size_t i = 0; i < ids.size() && pos < n; ++i) {
+		uint32_t id = ids[i];
+		size_t step = 1;
+		while (pos + step < n && big[pos + step] < id) {
+			step <<= 1;
+		}
+		pos = std::lower_bound(big + pos, big + std::min(pos + step + 1, n), id) - big;
+		if (pos < n && big[pos] == id) {
+			ids[out++] = id;
+		}
+	}
+	ids.resize(out);
+}
+
+adaapd::TagIndex::TagIndex() { }
+
+adaapd::TagIndex::TagIndex(TagIndex& from) {
+	for (int s = 0; s < FIELD_COUNT; ++s) {
+		lists[s] = from.lists[s].Share();
+	}
+	/* everything is shared now, so any change copies the list again */
+	from.fresh.clear();
+}
+
+std::shared_ptr<const adaapd::TagIndex> adaapd::TagIndex::Snapshot() {
+	return std::shared_ptr<const TagIndex>(new TagIndex(*this));
+}
+
+int adaapd::TagIndex::slot(Tag_StrId field) {
+	for (int s = 0; s < FIELD_COUNT; ++s) {
+		if (INDEXED[s] == field) {
+			return s;
+		}
+	}
+	return -1;
+}
+
+adaapd::tag_mask_t adaapd::TagIndex::Fields() {
+	tag_mask_t fields = 0;
+	for (int s = 0; s < FIELD_COUNT; ++s) {
+		fields |= TagBit(INDEXED[s]);
+	}
+	return fields;
+}
+
+void adaapd::TagIndex::Build(const TrackStore& tracks) {
+	fresh.clear();
+	for (int s = 0; s < FIELD_COUNT; ++s) {
+		lists[s] = Column<list_t>();
+	}
+	/* ids are visited in order, so each list is built sorted */
+	for (item_id_t id = 0; id < tracks.End(); ++id) {
+		if (!tracks.Has(id)) {
+			continue;
+		}
+		for (int s = 0; s < FIELD_COUNT; ++s) {
+			str_id_t value = tracks.StrId(id, INDEXED[s]);
+			if (value != STR_NONE) {
+				writable(s, value).push_back(id);
+			}
+		}
+	}
+}
+
+void adaapd::TagIndex::Remove(const TrackStore& tracks, item_id_t id, tag_mask_t fields) {
+	if (!tracks.Has(id)) {
+		return;
+	}
+	for (int s = 0; s < FIELD_COUNT; ++s) {
+		str_id_t value = tracks.StrId(id, INDEXED[s]);
+		if ((fields & TagBit(INDEXED[s])) == 0 || value == STR_NONE) {
+			continue;
+		}
+		postings_t& list = writable(s, value);
+		postings_t::iterator iter = std::lower_bound(list.begin(), list.end(), id);
+		if (iter != list.end() && *iter == id) {
+			list.erase(iter);
+		}
+		if (list.empty()) {
+			lists[s].Set(value, list_t());
+			fresh.erase((uint64_t)s << 32 | value);
+		}
+	}
+}
+
+void adaapd::TagIndex::Add(const TrackStore& tracks, item_id_t id, tag_mask_t fields) {
+	if (!tracks.Has(id)) {
+		return;
+	}
+	for (int s = 0; s < FIELD_COUNT; ++s) {
+		str_id_t value = tracks.StrId(id, INDEXED[s]);
+		if ((fields & TagBit(INDEXED[s])) == 0 || value == STR_NONE) {
+			continue;
+		}
+		postings_t& list = writable(s, value);
+		postings_t::iterator iter = std::lower_bound(list.begin(), list.end(), id);
+		if (iter == list.end() || *iter != id) {
+			list.insert(iter, id);
+		}
+	}
+}
+
+const adaapd::postings_t* adaapd::TagIndex::Postings(Tag_StrId field, str_id_t value) const {
+	int s = slot(field);
+	if (s < 0 || value >= (lists[s].ChunkCount() << CHUNK_BITS)) {
+		return NULL;
+	}
+	return lists[s].Get(value).get();
+}
+
+adaapd::postings_t& adaapd::TagIndex::writable(int s, str_id_t value) {
+	lists[s].Grow(value + 1, list_t());
+	list_t list = lists[s].Get(value);
+	if (fresh.insert((uint64_t)s << 32 | value).second) {
+		/* possibly shared with a snapshot */
+		list.reset(list ? new postings_t(*list) : new postings_t);
+		lists[s].Set(value, list);
+	}
+	return *list;
+}
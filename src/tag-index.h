@@ -0,0 +1,101 @@
+#ifndef _adaapd_tag_index_h_
+#define _adaapd_tag_index_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "track-store.h"
+
+namespace adaapd {
+	/*! The ids of the tracks with some value, in increasing order. */
+	typedef std::vector<item_id_t> postings_t;
+
+	/*! Intersects sorted 'ids' with the sorted 'list', which may be much
+	 * longer: each id is looked for with an exponentially growing step from
+	 * where the last one was found, so the cost follows the shorter list. */
+	void Intersect(std::vector<uint32_t>& ids, const std::vector<uint32_t>& list);
+
+	/*! Inverted index from the interned string ids of the fields which
+	 * clients browse and search by (artist, album, genre, composer and
+	 * title) to the tracks which have them, kept up to date as tracks
+	 * change.
+	 *
+	 * Each list is shared between the index and its snapshots, like the
+	 * chunks of a Column: a list is only copied the first time it changes
+	 * after a Snapshot(), so a batch of changes to a large genre costs one
+	 * copy per publish. */
+	class TagIndex {
+	public:
+		TagIndex();
+
+		/*! Whether 'field' is indexed. */
+		static bool Indexed(Tag_StrId field) {
+			return slot(field) >= 0;
+		}
+
+		/*! Returns a read-only copy which shares all of the current lists. */
+		std::shared_ptr<const TagIndex> Snapshot();
+
+		/*! Rebuilds the index from scratch. */
+		void Build(const TrackStore& tracks);
+
+		/*! The fields which are indexed. */
+		static tag_mask_t Fields();
+
+		/*! Takes track 'id' out of the lists for its current values of
+		 * 'fields' in 'tracks'. Called before the track is changed or
+		 * removed, followed by Add() once it's been changed. */
+		void Remove(const TrackStore& tracks, item_id_t id, tag_mask_t fields);
+
+		/*! Puts track 'id' into the lists for its values of 'fields' in
+		 * 'tracks'. */
+		void Add(const TrackStore& tracks, item_id_t id, tag_mask_t fields);
+
+		/*! The tracks whose 'field' is the string 'value', or NULL if there
+		 * are none. 'field' must be Indexed(). */
+		const postings_t* Postings(Tag_StrId field, str_id_t value) const;
+
+	private:
+		static const int FIELD_COUNT = 5;
+		typedef std::shared_ptr<postings_t> list_t;
+
+		TagIndex(TagIndex& from);
+		TagIndex(const TagIndex&) = delete;
+		TagIndex& operator=(const TagIndex&) = delete;
+
+		/* the position of 'field' in 'lists', or -1 if it isn't indexed */
+		static int slot(Tag_StrId field);
+
+		/* the list for 'value', made writable */
+		postings_t& writable(int s, str_id_t value);
+
+		/* indexed by string id. Empty for strings no track has. */
+		Column<list_t> lists[FIELD_COUNT];
+		/* lists which were copied (or made) since the last Snapshot(), so
+		 * they may be changed in place, by slot << 32 | value */
+		std::unordered_set<uint64_t> fresh;
+	};
+}
+
+#endif
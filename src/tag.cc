@@ -18,6 +18,8 @@
 
 #include "tag.h"
 #include "logging.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <taglib/taglib.h>
 #include <taglib/fileref.h>
@@ -46,8 +48,11 @@
 #include <taglib/tmap.h>
 #include <taglib/tlist.h>
 
+#include <chrono>
+#include <mutex>
 #include <sstream>
 #include <queue>
+#include <unordered_map>
 
 #include <dirent.h>
 #include <sys/types.h>
@@ -990,6 +995,22 @@ namespace {
 	typedef Tag_Riff<TagLib::RIFF::WAV::File> Tag_RiffWav;
 
 
+	/* one histogram per extension, which are only ever those handled by
+	 * Tag::Create() */
+	adaapd::Histogram& tag_latency(const std::string& ext) {
+		static std::mutex lock;
+		static std::unordered_map<std::string, adaapd::Histogram*> by_ext;
+		std::lock_guard<std::mutex> guard(lock);
+		adaapd::Histogram*& histogram = by_ext[ext];
+		if (histogram == NULL) {
+			histogram = &adaapd::Metrics::Get().GetHistogram(
+					"adaapd_tag_seconds", "Time taken to read a file's tags",
+					adaapd::LatencyBuckets(), adaapd::LATENCY_SCALE,
+					"format=\"" + ext + "\"");
+		}
+		return *histogram;
+	}
+
 	inline bool check_file(const std::string& filepath) {
 		struct stat sb;
 		if (stat(filepath.c_str(), &sb) != 0) {
@@ -1009,6 +1030,8 @@ namespace {
 }
 
 /*static*/ adaapd::tag_t adaapd::Tag::Create(const std::string& path) {
+	TraceSpan span("tag", path);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	tag_t ret;
 	if (!check_file(path)) {
 		LOG("Not found: %s", path.c_str());
@@ -1059,11 +1082,15 @@ namespace {
 		ret = Tag_WavPack::Create(path);
 	} else if (ext == "TTA") {
 		ret = Tag_TrueAudio::Create(path);
+	} else {
+		/* don't be too noisy in case someone's got a bunch of album art files */
+		DEBUG("Unsupported/unknown file: %s -> %s", path.c_str(), ext.c_str());
+		return ret;
 	}
 
 	if (!ret) {
-		/* don't be too noisy in case someone's got a bunch of album art files */
 		DEBUG("Unsupported/unknown file: %s -> %s", path.c_str(), ext.c_str());
 	}
+	tag_latency(ext).ObserveSince(start);
 	return ret;
 }
@@ -19,10 +19,14 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdint.h>
+
 #include <string>
 #include <memory>
 
 namespace adaapd {
+	/* The DMAP codes below are what each field is sent as. The table which
+	 * is actually used for encoding is in dmap-codes.h. */
 	enum Tag_IntId {
 		BPM,//asbt: short
 		BIT_RATE,//asbr: short kbit (256)
@@ -48,6 +52,20 @@ namespace adaapd {
 		TITLE//minm
 	};
 
+	/* number of values in Tag_IntId/Tag_StrId, for iterating over all fields */
+	static const int TAG_INT_COUNT = YEAR + 1;
+	static const int TAG_STR_COUNT = TITLE + 1;
+
+	/* a set of Tag_IntId/Tag_StrId fields, eg the ones a playlist looks at */
+	typedef uint32_t tag_mask_t;
+	inline tag_mask_t TagBit(Tag_IntId id) {
+		return (tag_mask_t)1 << id;
+	}
+	inline tag_mask_t TagBit(Tag_StrId id) {
+		return (tag_mask_t)1 << (TAG_INT_COUNT + id);
+	}
+	static const tag_mask_t TAG_MASK_ALL = ((tag_mask_t)1 << (TAG_INT_COUNT + TAG_STR_COUNT)) - 1;
+
 	/* db fields (wouldnt be in file's tag):
 	   DISABLED asdb: byte true/false
 	   ITEM_ID miid: int arbitrary unique id?
@@ -0,0 +1,236 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+#include "logging.h"
+
+/* spans kept per thread, beyond which the oldest are overwritten */
+#define BUFFER_SPANS 16384
+/* buffers kept for threads which have exited, eg playlist builds */
+#define EXITED_BUFFERS 8
+
+namespace {
+	struct span {
+		const char* name;
+		std::string detail;
+		uint64_t start, end;
+	};
+
+	/* a thread's recent spans. Only the exporter contends for the lock */
+	struct buffer {
+		buffer(uint32_t tid) : tid(tid), next(0), exited(false) { }
+
+		std::mutex lock;
+		const uint32_t tid;
+		std::string name;
+		std::vector<span> spans;
+		/* where the next span goes once 'spans' is full */
+		size_t next;
+		std::atomic<bool> exited;
+	};
+	typedef std::shared_ptr<buffer> buffer_t;
+
+	/* marks the thread's buffer once the thread has exited */
+	struct local_buffer {
+		~local_buffer() {
+			if (buf) {
+				buf->exited = true;
+			}
+		}
+		buffer_t buf;
+	};
+
+	/* every thread's buffer, kept after the thread exits so that its spans
+	 * can still be exported */
+	class buffers {
+	public:
+		static buffers& Get() {
+			static buffers* instance = new buffers;
+			return *instance;
+		}
+
+		buffer& Local() {
+			static thread_local local_buffer local;
+			if (!local.buf) {
+				std::lock_guard<std::mutex> guard(lock);
+				local.buf.reset(new buffer(++tids));
+				list.push_back(local.buf);
+				prune(EXITED_BUFFERS);
+			}
+			return *local.buf;
+		}
+
+		/* forgets all but the last 'keep' buffers of exited threads */
+		void Prune(size_t keep) {
+			std::lock_guard<std::mutex> guard(lock);
+			prune(keep);
+		}
+
+		std::vector<buffer_t> All() {
+			std::lock_guard<std::mutex> guard(lock);
+			return list;
+		}
+
+	private:
+		buffers() : tids(0) { }
+
+		void prune(size_t keep) {
+			size_t exited = 0;
+			for (size_t i = 0; i < list.size(); ++i) {
+				exited += list[i]->exited ? 1 : 0;
+			}
+			for (size_t i = 0; i < list.size() && exited > keep;) {
+				if (list[i]->exited) {
+					list.erase(list.begin() + i);
+					--exited;
+				} else {
+					++i;
+				}
+			}
+		}
+
+		std::mutex lock;
+		uint32_t tids;
+		std::vector<buffer_t> list;
+	};
+
+	void append_json(std::string& out, const std::string& str) {
+		out += '"';
+		for (size_t i = 0; i < str.size(); ++i) {
+			unsigned char c = str[i];
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += c;
+			} else if (c < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+		out += '"';
+	}
+}
+
+std::atomic<bool> adaapd::trace::_enabled(false);
+
+void adaapd::trace::Enable(bool enabled) {
+	_enabled = enabled;
+}
+
+void adaapd::trace::Clear() {
+	buffers::Get().Prune(0);
+	std::vector<buffer_t> all = buffers::Get().All();
+	for (size_t i = 0; i < all.size(); ++i) {
+		std::lock_guard<std::mutex> guard(all[i]->lock);
+		all[i]->spans.clear();
+		all[i]->next = 0;
+	}
+}
+
+void adaapd::trace::SetThreadName(const std::string& name) {
+	buffer& b = buffers::Get().Local();
+	std::lock_guard<std::mutex> guard(b.lock);
+	b.name = name;
+}
+
+void adaapd::trace::_record(const char* name, std::string& detail, uint64_t start, uint64_t end) {
+	buffer& b = buffers::Get().Local();
+	std::lock_guard<std::mutex> guard(b.lock);
+	span* s;
+	if (b.spans.size() < BUFFER_SPANS) {
+		b.spans.push_back(span());
+		s = &b.spans.back();
+	} else {
+		s = &b.spans[b.next];
+		b.next = (b.next + 1) % BUFFER_SPANS;
+	}
+	s->name = name;
+	s->detail.swap(detail);
+	s->start = start;
+	s->end = end;
+}
+
+void adaapd::trace::Write(std::string& out) {
+	char buf[128];
+	int pid = getpid();
+	bool first = true;
+	out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	std::vector<buffer_t> all = buffers::Get().All();
+	for (size_t i = 0; i < all.size(); ++i) {
+		buffer& b = *all[i];
+		std::lock_guard<std::mutex> guard(b.lock);
+		if (!b.name.empty()) {
+			snprintf(buf, sizeof(buf),
+					"%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+					first ? "" : ",", pid, b.tid);
+			out.append(buf);
+			append_json(out, b.name);
+			out.append("}}");
+			first = false;
+		}
+		/* oldest first */
+		for (size_t j = 0; j < b.spans.size(); ++j) {
+			const span& s = b.spans[(b.next + j) % b.spans.size()];
+			/* microseconds */
+			snprintf(buf, sizeof(buf),
+					"%s\n{\"name\":\"%s\",\"cat\":\"adaapd\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u",
+					first ? "" : ",", s.name, s.start / 1000., (s.end - s.start) / 1000., pid, b.tid);
+			out.append(buf);
+			if (!s.detail.empty()) {
+				out.append(",\"args\":{\"detail\":");
+				append_json(out, s.detail);
+				out.append("}");
+			}
+			out.append("}");
+			first = false;
+		}
+	}
+	out.append("\n]}\n");
+}
+
+bool adaapd::trace::Export(const std::string& path) {
+	std::string out;
+	Write(out);
+	FILE* f = fopen(path.c_str(), "w");
+	if (f == NULL) {
+		ERR("Unable to open trace file %s: %d/%s", path.c_str(), errno, strerror(errno));
+		return false;
+	}
+	bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		ERR("Unable to write trace file %s: %d/%s", path.c_str(), errno, strerror(errno));
+		return false;
+	}
+	LOG("Wrote %lu bytes of trace to %s", out.size(), path.c_str());
+	return true;
+}
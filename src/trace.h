@@ -0,0 +1,111 @@
+#ifndef _adaapd_trace_h_
+#define _adaapd_trace_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace adaapd {
+	/*! Records what each thread spends its time on as TraceSpans, which are
+	 * exported in the Chrome trace event format for chrome://tracing or
+	 * ui.perfetto.dev.
+	 *
+	 * Each thread records into a buffer of its own, which keeps its most
+	 * recent spans and is only ever locked by the exporter. Nothing is
+	 * recorded until Enable(), and until then a TraceSpan costs a single
+	 * load. */
+	namespace trace {
+		extern std::atomic<bool> _enabled;
+
+		inline bool Enabled() {
+			return _enabled.load(std::memory_order_relaxed);
+		}
+
+		/*! Starts or stops recording. Spans which were already recorded are
+		 * kept until Clear(). */
+		void Enable(bool enabled);
+
+		/*! Forgets every recorded span. */
+		void Clear();
+
+		/*! Names the calling thread in exported traces. */
+		void SetThreadName(const std::string& name);
+
+		/*! Appends everything recorded so far as a JSON trace. */
+		void Write(std::string& out);
+
+		/*! Writes everything recorded so far as a JSON trace to 'path'. */
+		bool Export(const std::string& path);
+
+		/* DONT USE THESE, use TraceSpan instead. */
+		inline uint64_t _now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		void _record(const char* name, std::string& detail, uint64_t start, uint64_t end);
+	}
+
+	/*! Records the time between its construction and destruction, if
+	 * tracing is enabled. 'name' must be a string literal. An optional
+	 * 'detail', eg a path, is shown alongside it. */
+	class TraceSpan {
+	public:
+		explicit TraceSpan(const char* name)
+			: name(name), start(trace::Enabled() ? trace::_now() : 0) { }
+
+		TraceSpan(const char* name, const std::string& detail_)
+			: name(name), start(trace::Enabled() ? trace::_now() : 0) {
+			if (start != 0) {
+				detail = detail_;
+			}
+		}
+
+		~TraceSpan() {
+			if (start != 0) {
+				trace::_record(name, detail, start, trace::_now());
+			}
+		}
+
+		/*! Whether this span is being recorded, eg to only build a detail
+		 * when it'll be used. */
+		bool Active() const {
+			return start != 0;
+		}
+
+		void Detail(const std::string& detail_) {
+			if (start != 0) {
+				detail = detail_;
+			}
+		}
+
+	private:
+		TraceSpan(const TraceSpan&) = delete;
+		TraceSpan& operator=(const TraceSpan&) = delete;
+
+		const char* name;
+		const uint64_t start;
+		std::string detail;
+	};
+}
+
+#endif
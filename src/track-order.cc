@@ -0,0 +1,122 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "track-order.h"
+
+namespace {
+	const char* const ORDER_NAMES[] = { "name", "artist", "album" };
+}
+
+adaapd::TrackOrders::TrackOrders(const Collation& collation)
+	: collation(collation), tracks(NULL) {
+	for (int o = 0; o < ORDER_COUNT; ++o) {
+		sets.push_back(set_t(less(this, (ORDER)o)));
+	}
+}
+
+bool adaapd::TrackOrders::Find(const char* name, size_t len, ORDER& order) {
+	for (int o = 0; o < ORDER_COUNT; ++o) {
+		if (strlen(ORDER_NAMES[o]) == len && memcmp(ORDER_NAMES[o], name, len) == 0) {
+			order = (ORDER)o;
+			return true;
+		}
+	}
+	return false;
+}
+
+adaapd::tag_mask_t adaapd::TrackOrders::fields(ORDER order) {
+	tag_mask_t album = TagBit(ALBUM) | TagBit(DISC_NUMBER) | TagBit(TRACK_NUMBER) |
+		TagBit(TITLE);
+	switch (order) {
+	case BY_NAME:
+		return TagBit(TITLE);
+	case BY_ARTIST:
+		return TagBit(ARTIST) | album;
+	case BY_ALBUM:
+		return album;
+	default:
+		return 0;
+	}
+}
+
+bool adaapd::TrackOrders::less::operator()(item_id_t a, item_id_t b) const {
+	const TrackStore& t = *orders->tracks;
+	int cmp = 0;
+	if (order == BY_ARTIST) {
+		cmp = orders->collation.Compare(t.StrId(a, ARTIST), t.StrId(b, ARTIST));
+	}
+	if (cmp == 0 && order != BY_NAME) {
+		cmp = orders->collation.Compare(t.StrId(a, ALBUM), t.StrId(b, ALBUM));
+		Tag_IntId ints[] = { DISC_NUMBER, TRACK_NUMBER };
+		for (int i = 0; cmp == 0 && i < 2; ++i) {
+			tag_int_t x = t.Int(a, ints[i]), y = t.Int(b, ints[i]);
+			cmp = (x == y) ? 0 : ((x < y) ? -1 : 1);
+		}
+	}
+	if (cmp == 0) {
+		cmp = orders->collation.Compare(t.StrId(a, TITLE), t.StrId(b, TITLE));
+	}
+	/* the id settles any ties, so that each track has one place */
+	return (cmp != 0) ? cmp < 0 : a < b;
+}
+
+void adaapd::TrackOrders::Build(const TrackStore& tracks_) {
+	tracks = &tracks_;
+	for (int o = 0; o < ORDER_COUNT; ++o) {
+		sets[o].clear();
+		copies[o].reset();
+		for (item_id_t id = 0; id < tracks->End(); ++id) {
+			if (tracks->Has(id)) {
+				sets[o].insert(id);
+			}
+		}
+	}
+}
+
+void adaapd::TrackOrders::Remove(const TrackStore& tracks_, item_id_t id, tag_mask_t changed) {
+	tracks = &tracks_;
+	if (!tracks->Has(id)) {
+		return;
+	}
+	for (int o = 0; o < ORDER_COUNT; ++o) {
+		if ((changed & fields((ORDER)o)) != 0 && sets[o].erase(id) != 0) {
+			copies[o].reset();
+		}
+	}
+}
+
+void adaapd::TrackOrders::Add(const TrackStore& tracks_, item_id_t id, tag_mask_t changed) {
+	tracks = &tracks_;
+	if (!tracks->Has(id)) {
+		return;
+	}
+	for (int o = 0; o < ORDER_COUNT; ++o) {
+		if ((changed & fields((ORDER)o)) != 0 && sets[o].insert(id).second) {
+			copies[o].reset();
+		}
+	}
+}
+
+std::shared_ptr<const std::vector<adaapd::item_id_t> > adaapd::TrackOrders::Order(ORDER order) {
+	if (!copies[order]) {
+		copies[order].reset(new std::vector<item_id_t>(sets[order].begin(), sets[order].end()));
+	}
+	return copies[order];
+}
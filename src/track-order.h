@@ -0,0 +1,87 @@
+#ifndef _adaapd_track_order_h_
+#define _adaapd_track_order_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "collation.h"
+
+namespace adaapd {
+	/*! The tracks in each of the orders which clients ask for with sort=,
+	 * kept sorted as tracks change so that a sorted listing is a walk over
+	 * a list rather than a sort. Tracks are compared by the Collation keys
+	 * of their strings. Like the TagIndex, a changed track is taken out
+	 * before it's changed and put back afterwards, which costs a couple of
+	 * lookups in each order which looks at one of the fields that changed. */
+	class TrackOrders {
+	public:
+		enum ORDER {
+			BY_NAME,/* title */
+			BY_ARTIST,/* artist, then as BY_ALBUM */
+			BY_ALBUM,/* album, disc, track number, title */
+			ORDER_COUNT
+		};
+
+		/*! 'collation' is kept up to date by the caller, for any strings
+		 * of the tracks which are given here. */
+		TrackOrders(const Collation& collation);
+
+		/*! Finds the order named by a sort= value, eg "artist". */
+		static bool Find(const char* name, size_t len, ORDER& order);
+
+		/*! Rebuilds the orders from scratch. */
+		void Build(const TrackStore& tracks);
+
+		/*! As with TagIndex::Remove() and Add(). */
+		void Remove(const TrackStore& tracks, item_id_t id, tag_mask_t fields);
+		void Add(const TrackStore& tracks, item_id_t id, tag_mask_t fields);
+
+		/*! The ids of all tracks in 'order', which is only copied out again
+		 * if it's changed since the last call. */
+		std::shared_ptr<const std::vector<item_id_t> > Order(ORDER order);
+
+	private:
+		struct less {
+			less(const TrackOrders* orders, ORDER order) : orders(orders), order(order) { }
+			bool operator()(item_id_t a, item_id_t b) const;
+			const TrackOrders* orders;
+			ORDER order;
+		};
+		typedef std::set<item_id_t, less> set_t;
+
+		TrackOrders(const TrackOrders&) = delete;
+		TrackOrders& operator=(const TrackOrders&) = delete;
+
+		/* the fields which 'order' looks at */
+		static tag_mask_t fields(ORDER order);
+
+		const Collation& collation;
+		/* the tracks being compared, from the latest call */
+		const TrackStore* tracks;
+
+		std::vector<set_t> sets;
+		/* empty when stale */
+		std::shared_ptr<const std::vector<item_id_t> > copies[ORDER_COUNT];
+	};
+}
+
+#endif
@@ -0,0 +1,222 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "track-store.h"
+#include "logging.h"
+
+/* heap strings are packed into blocks of this size */
+#define BLOCK_SIZE (64 * 1024)
+
+// STRINGPOOL
+
+size_t adaapd::StringPool::hasher::operator()(str_id_t id) const {
+	/* FNV-1a */
+	const char* str = pool->Get(id);
+	size_t hash = 2166136261u;
+	for (; *str != 0; ++str) {
+		hash = (hash ^ (unsigned char)*str) * 16777619u;
+	}
+	return hash;
+}
+
+bool adaapd::StringPool::equals::operator()(str_id_t a, str_id_t b) const {
+	return a == b || strcmp(pool->Get(a), pool->Get(b)) == 0;
+}
+
+adaapd::StringPool::StringPool()
+	: base_data(NULL), base_offsets(NULL), base_count(0), heap_count(0),
+	  block_used(0), ids(64, hasher(this), equals(this)), indexed(true) {
+	/* id 0: empty string */
+	ids.insert(append(std::string()));
+}
+
+adaapd::StringPool::StringPool(StringPool& from)
+	: base_owner(from.base_owner), base_data(from.base_data),
+	  base_offsets(from.base_offsets), base_count(from.base_count),
+	  heap(from.heap.Share()), heap_count(from.heap_count),
+	  blocks(from.blocks), block_used(from.block_used),
+	  ids(0, hasher(this), equals(this)), indexed(false) {
+	/* anything Intern()ed here goes in a new block: 'from' owns the rest of
+	 * the last one */
+	block_used = BLOCK_SIZE;
+}
+
+adaapd::str_id_t adaapd::StringPool::Intern(const std::string& str) {
+	if (str.empty()) {
+		return STR_NONE;
+	}
+	if (!indexed) {
+		ids.rehash(Size() * 2);
+		for (str_id_t id = 0; id < Size(); ++id) {
+			ids.insert(id);
+		}
+		indexed = true;
+	}
+
+	/* tentatively append the string so that it can be looked up by id, then
+	 * roll it back if it turns out to already be present. the rolled back
+	 * bytes were never part of a string, so nobody else can be reading them. */
+	size_t old_blocks = blocks.size(), old_used = block_used;
+	str_id_t id = append(str);
+	std::pair<ids_t::const_iterator, bool> result = ids.insert(id);
+	if (!result.second) {
+		--heap_count;
+		blocks.resize(old_blocks);
+		block_used = old_used;
+		return *result.first;
+	}
+	return id;
+}
+
+adaapd::str_id_t adaapd::StringPool::append(const std::string& str) {
+	size_t size = str.size() + 1;
+	char* dest;
+	if (size > BLOCK_SIZE) {
+		/* gets its own block, which is full from the start */
+		dest = new char[size];
+		blocks.push_back(std::shared_ptr<char>(dest, std::default_delete<char[]>()));
+		block_used = BLOCK_SIZE;
+	} else {
+		if (blocks.empty() || BLOCK_SIZE - block_used < size) {
+			blocks.push_back(std::shared_ptr<char>(new char[BLOCK_SIZE],
+							std::default_delete<char[]>()));
+			block_used = 0;
+		}
+		dest = blocks.back().get() + block_used;
+		block_used += size;
+	}
+	memcpy(dest, str.c_str(), size);
+
+	entry e;
+	e.str = dest;
+	e.len = str.size();
+	heap.Grow(heap_count + 1, e);
+	heap.Set(heap_count, e);
+	return base_count + heap_count++;
+}
+
+void adaapd::StringPool::setBase(const std::shared_ptr<const void>& owner,
+		const char* data_, const uint32_t* offsets_, size_t count) {
+	base_owner = owner;
+	base_data = data_;
+	base_offsets = offsets_;
+	base_count = count;
+	heap = Column<entry>();
+	heap_count = 0;
+	blocks.clear();
+	block_used = 0;
+	ids.clear();
+	indexed = false;
+}
+
+// TRACKSTORE
+
+adaapd::TrackStore::TrackStore()
+	: count(0), end(0) {
+	/* item id 0 is never used */
+	grow(1);
+}
+
+adaapd::TrackStore::TrackStore(TrackStore& from)
+	: count(from.count), end(from.end), live(from.live.Share()),
+	  paths(from.paths.Share()), mtimes(from.mtimes.Share()), pool(from.pool),
+	  path_pool(from.path_pool) {
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		ints[i] = from.ints[i].Share();
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		strs[i] = from.strs[i].Share();
+	}
+}
+
+std::shared_ptr<const adaapd::TrackStore> adaapd::TrackStore::Snapshot() {
+	return std::shared_ptr<const TrackStore>(new TrackStore(*this));
+}
+
+void adaapd::TrackStore::Set(item_id_t id, const TrackInfo& info) {
+	if (id == 0) {
+		ERR_DIR("INTERNAL ERROR: Got item id 0!");
+		return;
+	}
+	if (id >= end) {
+		grow(id + 1);
+	}
+	if (live.Get(id) == 0) {
+		live.Set(id, 1);
+		++count;
+	}
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		ints[i].Set(id, info.ints[i]);
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		strs[i].Set(id, pool.Intern(info.strs[i]));
+	}
+	paths.Set(id, path_pool.Intern(info.path));
+	mtimes.Set(id, info.mtime);
+}
+
+void adaapd::TrackStore::Remove(item_id_t id) {
+	if (!Has(id)) {
+		return;
+	}
+	live.Set(id, 0);
+	--count;
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		ints[i].Set(id, TAG_INT_NONE);
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		strs[i].Set(id, STR_NONE);
+	}
+	paths.Set(id, STR_NONE);
+	mtimes.Set(id, 0);
+}
+
+adaapd::tag_mask_t adaapd::TrackStore::Diff(item_id_t id, const TrackInfo& info) const {
+	if (!Has(id)) {
+		return TAG_MASK_ALL;
+	}
+	tag_mask_t mask = 0;
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		if (ints[i].Get(id) != info.ints[i]) {
+			mask |= TagBit((Tag_IntId)i);
+		}
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		str_id_t str = strs[i].Get(id);
+		if (pool.Len(str) != info.strs[i].size() ||
+				memcmp(pool.Get(str), info.strs[i].data(), info.strs[i].size()) != 0) {
+			mask |= TagBit((Tag_StrId)i);
+		}
+	}
+	return mask;
+}
+
+void adaapd::TrackStore::grow(item_id_t end_) {
+	end = end_;
+	live.Grow(end, 0);
+	for (int i = 0; i < TAG_INT_COUNT; ++i) {
+		ints[i].Grow(end, TAG_INT_NONE);
+	}
+	for (int i = 0; i < TAG_STR_COUNT; ++i) {
+		strs[i].Grow(end, STR_NONE);
+	}
+	paths.Grow(end, STR_NONE);
+	mtimes.Grow(end, 0);
+}
@@ -0,0 +1,328 @@
+#ifndef _adaapd_track_store_h_
+#define _adaapd_track_store_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "listener.h"
+#include "tag.h"
+
+namespace adaapd {
+	/*! Dense id of a track, assigned by the Cache. 0 is never used. */
+	typedef uint32_t item_id_t;
+	/*! Id of an interned string. 0 is the empty string, used for 'missing'. */
+	typedef uint32_t str_id_t;
+	/*! Incremented each time the Cache commits changes to any tracks. */
+	typedef uint32_t revision_t;
+
+	static const str_id_t STR_NONE = 0;
+	static const tag_int_t TAG_INT_NONE = INT64_MIN;
+
+	/*! The values for a single track, as produced by the Cache. Missing ints are
+	 * TAG_INT_NONE and missing strings are empty. */
+	struct TrackInfo {
+		TrackInfo() : mtime(0) {
+			for (int i = 0; i < TAG_INT_COUNT; ++i) {
+				ints[i] = TAG_INT_NONE;
+			}
+		}
+
+		tag_int_t ints[TAG_INT_COUNT];
+		tag_str_t strs[TAG_STR_COUNT];
+		std::string path;
+		time_t mtime;
+	};
+
+	/*! Number of items in each column chunk. */
+	static const item_id_t CHUNK_BITS = 12;
+	static const item_id_t CHUNK_SIZE = 1 << CHUNK_BITS;
+
+	/*! A column of per-item values, stored as CHUNK_SIZE-item chunks. A chunk
+	 * may be backed by memory which isn't ours (eg a mapped LibraryImage or
+	 * another Column), in which case it's copied to the heap the first time
+	 * it's written. */
+	template <typename T>
+	class Column {
+	public:
+		Column() { }
+		Column(Column&&) = default;
+		Column& operator=(Column&&) = default;
+
+		/*! Returns a copy which shares all of the current chunks. From then on
+		 * neither column writes to those chunks in place, so the copy may be
+		 * read from another thread while this one keeps changing. */
+		Column Share() {
+			for (size_t i = 0; i < owned.size(); ++i) {
+				owned[i] = false;
+			}
+			return Column(*this);
+		}
+
+		T Get(item_id_t id) const {
+			return chunks[id >> CHUNK_BITS].get()[id & (CHUNK_SIZE - 1)];
+		}
+
+		void Set(item_id_t id, T val) {
+			writable(id >> CHUNK_BITS)[id & (CHUNK_SIZE - 1)] = val;
+		}
+
+		/*! Adds chunks until there's room for 'end' items, with 'fill' as the
+		 * value for the new items. */
+		void Grow(item_id_t end, T fill) {
+			while ((chunks.size() << CHUNK_BITS) < end) {
+				T* chunk = new T[CHUNK_SIZE];
+				for (item_id_t i = 0; i < CHUNK_SIZE; ++i) {
+					chunk[i] = fill;
+				}
+				chunks.push_back(std::shared_ptr<T>(chunk, std::default_delete<T[]>()));
+				owned.push_back(true);
+			}
+		}
+
+		/*! Adds a CHUNK_SIZE-item chunk which lives in memory kept alive by
+		 * 'owner'. The memory is never written to. */
+		void AddShared(const std::shared_ptr<const void>& owner, const T* data) {
+			chunks.push_back(std::shared_ptr<T>(owner, const_cast<T*>(data)));
+			owned.push_back(false);
+		}
+
+		size_t ChunkCount() const {
+			return chunks.size();
+		}
+
+		/*! Direct access to the CHUNK_SIZE contiguous values in a chunk. */
+		const T* Chunk(size_t chunk) const {
+			return chunks[chunk].get();
+		}
+
+	private:
+		/* only via Share(), which makes sure nobody writes in place */
+		Column(const Column&) = default;
+		Column& operator=(const Column&) = delete;
+
+		T* writable(size_t chunk) {
+			if (!owned[chunk]) {
+				T* copy = new T[CHUNK_SIZE];
+				std::copy(chunks[chunk].get(), chunks[chunk].get() + CHUNK_SIZE, copy);
+				chunks[chunk] = std::shared_ptr<T>(copy, std::default_delete<T[]>());
+				owned[chunk] = true;
+			}
+			return chunks[chunk].get();
+		}
+
+		std::vector<std::shared_ptr<T> > chunks;
+		std::vector<bool> owned;
+	};
+
+	class LibraryImage;
+
+	/*! Append-only storage of NUL-terminated strings, each of which is only
+	 * stored once, so that the ids are all that needs to be stored per-track.
+	 * The first strings may come from a mapped LibraryImage, with any later
+	 * strings appended on the heap. */
+	class StringPool {
+	public:
+		StringPool();
+
+		/*! Returns the id of 'str', adding it if it isn't already present. */
+		str_id_t Intern(const std::string& str);
+
+		/*! Returns the NUL-terminated string for 'id'. */
+		const char* Get(str_id_t id) const {
+			if (id < base_count) {
+				return base_data + base_offsets[id];
+			}
+			return heap.Get(id - base_count).str;
+		}
+
+		/*! Returns the length of the string for 'id', excluding the NUL. */
+		size_t Len(str_id_t id) const {
+			if (id < base_count) {
+				return base_offsets[id + 1] - base_offsets[id] - 1;
+			}
+			return heap.Get(id - base_count).len;
+		}
+
+		/*! The number of distinct strings, including the empty string. */
+		size_t Size() const {
+			return base_count + heap_count;
+		}
+
+	private:
+		friend class LibraryImage;
+		friend class TrackStore;
+
+		/* hash/compare ids by their string content */
+		struct hasher {
+			hasher(const StringPool* pool) : pool(pool) { }
+			size_t operator()(str_id_t id) const;
+			const StringPool* pool;
+		};
+		struct equals {
+			equals(const StringPool* pool) : pool(pool) { }
+			bool operator()(str_id_t a, str_id_t b) const;
+			const StringPool* pool;
+		};
+		typedef std::unordered_set<str_id_t, hasher, equals> ids_t;
+
+		struct entry {
+			const char* str;
+			uint32_t len;
+		};
+
+		/*! Shares all current strings with 'from', as with Column::Share(). */
+		StringPool(StringPool& from);
+
+		/* the id set refers back to this instance */
+		StringPool(const StringPool&) = delete;
+		StringPool& operator=(const StringPool&) = delete;
+
+		/*! Replaces the contents with 'count' strings which live in memory kept
+		 * alive by 'owner'. 'offsets' has count+1 entries. */
+		void setBase(const std::shared_ptr<const void>& owner, const char* data,
+				const uint32_t* offsets, size_t count);
+
+		/*! Appends 'str' to the heap without checking for duplicates. */
+		str_id_t append(const std::string& str);
+
+		/* mapped strings, ids [0, base_count) */
+		std::shared_ptr<const void> base_owner;
+		const char* base_data;
+		const uint32_t* base_offsets;
+		size_t base_count;
+
+		/* heap strings, ids [base_count, Size()). The bytes are packed into
+		 * blocks which never move, and bytes are never changed once they're
+		 * part of a string, so copies of the pool can share the blocks while
+		 * more strings are appended. */
+		Column<entry> heap;
+		size_t heap_count;
+		std::vector<std::shared_ptr<char> > blocks;
+		size_t block_used;
+
+		/* only built once something is Intern()ed, so that a mapped pool
+		 * costs nothing until the library changes */
+		ids_t ids;
+		bool indexed;
+	};
+
+	/*! Struct-of-arrays storage for all tracks in the library, indexed by
+	 * item id. Each Tag_IntId is its own column and strings are stored as
+	 * interned ids, so that scans/sorts/filters over the whole library only
+	 * touch the columns they need, CHUNK_SIZE contiguous values at a time. */
+	class TrackStore {
+	public:
+		TrackStore();
+
+		/*! Returns a read-only copy of the current tracks which shares their
+		 * storage. Later changes here copy whatever they touch, so the
+		 * snapshot is unaffected and may be read from other threads. */
+		std::shared_ptr<const TrackStore> Snapshot();
+
+		/*! Adds or replaces the track with the given id. */
+		void Set(item_id_t id, const TrackInfo& info);
+
+		/*! Removes the track with the given id, if present. */
+		void Remove(item_id_t id);
+
+		/*! The fields which Set(id, info) would change. All of them if
+		 * there's no track for 'id' yet. */
+		tag_mask_t Diff(item_id_t id, const TrackInfo& info) const;
+
+		/*! Whether a track exists for this id. */
+		bool Has(item_id_t id) const {
+			return id < end && live.Get(id) != 0;
+		}
+
+		/*! The number of tracks in the store. */
+		size_t Size() const {
+			return count;
+		}
+
+		/*! One past the largest item id. */
+		item_id_t End() const {
+			return end;
+		}
+
+		tag_int_t Int(item_id_t id, Tag_IntId field) const {
+			return ints[field].Get(id);
+		}
+		str_id_t StrId(item_id_t id, Tag_StrId field) const {
+			return strs[field].Get(id);
+		}
+		const char* Str(item_id_t id, Tag_StrId field) const {
+			return pool.Get(strs[field].Get(id));
+		}
+		const char* Path(item_id_t id) const {
+			return path_pool.Get(paths.Get(id));
+		}
+		time_t Mtime(item_id_t id) const {
+			return mtimes.Get(id);
+		}
+
+		/*! Direct column access. Columns are padded to a multiple of
+		 * CHUNK_SIZE, where removed/unused ids have live=0, TAG_INT_NONE ints,
+		 * and STR_NONE strings. */
+		const Column<uint8_t>& LiveColumn() const {
+			return live;
+		}
+		const Column<tag_int_t>& IntColumn(Tag_IntId field) const {
+			return ints[field];
+		}
+		const Column<str_id_t>& StrColumn(Tag_StrId field) const {
+			return strs[field];
+		}
+
+		/*! The strings of the Tag_StrId columns. Paths are kept apart, so
+		 * that whatever is built over every tag string doesn't also cover
+		 * a path per track. */
+		const StringPool& Strings() const {
+			return pool;
+		}
+
+	private:
+		friend class LibraryImage;
+
+		TrackStore(TrackStore& from);
+		TrackStore(const TrackStore&) = delete;
+		TrackStore& operator=(const TrackStore&) = delete;
+
+		void grow(item_id_t end);
+
+		size_t count;
+		item_id_t end;
+		Column<uint8_t> live;
+		Column<tag_int_t> ints[TAG_INT_COUNT];
+		Column<str_id_t> strs[TAG_STR_COUNT];
+		Column<str_id_t> paths;
+		Column<int64_t> mtimes;
+		StringPool pool;
+		StringPool path_pool;
+	};
+}
+
+#endif
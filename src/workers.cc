@@ -0,0 +1,102 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include "workers.h"
+#include "logging.h"
+#include "trace.h"
+
+class adaapd::Workers::worker {
+public:
+	worker(const handler_factory_t& factory, size_t index, ev::tstamp idle_timeout)
+		: server(loop, factory(index, loop), idle_timeout), stop(loop), index(index) {
+		stop.set<worker, &worker::cb_stop>(this);
+		stop.start();
+	}
+
+	virtual ~worker() {
+		stop.stop();
+	}
+
+	void Run() {
+		std::ostringstream name;
+		name << "worker " << index;
+		trace::SetThreadName(name.str());
+		loop.run();
+	}
+
+	/* declared first: the watchers below need it to outlive them */
+	ev::dynamic_loop loop;
+	Server server;
+	/* signalled from the thread calling Stop() */
+	ev::async stop;
+	std::thread thread;
+	const size_t index;
+
+private:
+	void cb_stop(ev::async& /*async*/, int /*revents*/) {
+		loop.break_loop(ev::ALL);
+	}
+};
+
+adaapd::Workers::Workers(size_t count, handler_factory_t factory, ev::tstamp idle_timeout)
+	: factory(factory), idle_timeout(idle_timeout), workers(count, NULL),
+	  port(0), running(false) { }
+
+adaapd::Workers::~Workers() {
+	Stop();
+	for (size_t i = 0; i < workers.size(); ++i) {
+		delete workers[i];
+	}
+}
+
+bool adaapd::Workers::Start(uint16_t port_) {
+	/* the Servers are set up here so that errors can be returned, and so
+	 * that any workers after the first can share a port it picked */
+	port = port_;
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i] = new worker(factory, i, idle_timeout);
+		if (!workers[i]->server.Listen(port, true)) {
+			return false;
+		}
+		port = workers[i]->server.Port();
+	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		worker* w = workers[i];
+		w->thread = std::thread(std::bind(&worker::Run, w));
+	}
+	running = true;
+	LOG("Listening on port %d with %lu workers", port, workers.size());
+	return true;
+}
+
+void adaapd::Workers::Stop() {
+	if (!running) {
+		return;
+	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i]->stop.send();
+	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i]->thread.join();
+	}
+	running = false;
+}
@@ -0,0 +1,71 @@
+#ifndef _adaapd_workers_h_
+#define _adaapd_workers_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <functional>
+#include <vector>
+
+#include "server.h"
+
+namespace adaapd {
+	/*! Creates the request handler for worker number 'worker', which runs
+	 * 'loop'. Called from Workers::Start() on the caller's thread, but the
+	 * handler itself only ever runs on that worker's thread, so it may keep
+	 * per-worker state (eg a LibraryReader, or watchers on 'loop') without
+	 * locking. */
+	typedef std::function<handler_t(size_t worker, ev::loop_ref loop)> handler_factory_t;
+
+	/*! Serves requests on several threads, each running its own libev loop
+	 * with its own Server. The Servers all listen on the same port with
+	 * SO_REUSEPORT so the kernel spreads connections across them, and a
+	 * connection stays on the thread which accepted it. */
+	class Workers {
+	public:
+		Workers(size_t count, handler_factory_t factory, ev::tstamp idle_timeout);
+		virtual ~Workers();
+
+		/*! Starts listening on 'port' and starts the worker threads. 0 picks
+		 * a free port. */
+		bool Start(uint16_t port);
+
+		/*! Stops and joins the worker threads, closing all connections. */
+		void Stop();
+
+		/*! The port being listened on, once Start() has succeeded. */
+		uint16_t Port() const {
+			return port;
+		}
+
+		size_t Count() const {
+			return workers.size();
+		}
+
+	private:
+		class worker;
+
+		const handler_factory_t factory;
+		const ev::tstamp idle_timeout;
+		std::vector<worker*> workers;
+		uint16_t port;
+		bool running;
+	};
+}
+
+#endif
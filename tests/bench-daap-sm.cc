@@ -0,0 +1,117 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Times DaapRequest::Parse() over a set of typical DAAP requests. Built once
+ * per ragel code style (see tests/CMakeLists.txt) so that the styles can be
+ * compared with 'make bench-daap-sm'. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include <daap-sm.h>
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+#define ROUNDS 200000
+#define READ_SIZE 64
+
+static const char* REQUESTS[] = {
+	"GET /server-info HTTP/1.1\r\n"
+	"Host: 10.0.0.2:3689\r\n"
+	"Client-DAAP-Version: 3.10\r\n"
+	"Accept-Encoding: gzip\r\n"
+	"\r\n",
+
+	"GET /login?pairing-guid=0x0000000000000001 HTTP/1.1\r\n"
+	"Host: 10.0.0.2:3689\r\n"
+	"Client-DAAP-Version: 3.10\r\n"
+	"\r\n",
+
+	"GET /update?session-id=1234&revision-number=12&delta=11&daap-no-disconnect=1 HTTP/1.1\r\n"
+	"Host: 10.0.0.2:3689\r\n"
+	"Client-DAAP-Version: 3.10\r\n"
+	"Viewer-Only-Client: 1\r\n"
+	"\r\n",
+
+	"GET /databases/1/containers/1/items?session-id=1234&revision-number=12&delta=0"
+	"&type=music&sort=album&meta=dmap.itemkind,dmap.itemid,dmap.itemname,"
+	"daap.songalbum,daap.songartist,daap.songgenre,daap.songtime,daap.songtracknumber,"
+	"daap.songdiscnumber,daap.songyear,daap.songformat,daap.songdatemodified"
+	"&query=(%27com.apple.itunes.mediakind:1%27,%27com.apple.itunes.mediakind:32%27)"
+	"&index=0-99 HTTP/1.1\r\n"
+	"Host: 10.0.0.2:3689\r\n"
+	"Client-DAAP-Version: 3.10\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"User-Agent: iTunes/10.6 (Macintosh; Intel Mac OS X 10.7.3) AppleWebKit/534.53.11\r\n"
+	"\r\n",
+
+	"GET /databases/1/items/4321.mp3?session-id=1234 HTTP/1.1\r\n"
+	"Host: 10.0.0.2:3689\r\n"
+	"Range: bytes=1048576-\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n"
+};
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* parses each request 'rounds' times, feeding it 'read_size' bytes at a time */
+static void run(const std::vector<std::string>& reqs, size_t read_size, const char* label) {
+	size_t bytes = 0, count = 0, checksum = 0;
+	adaapd::DaapRequest r;
+	double start = now();
+	for (int round = 0; round < ROUNDS; ++round) {
+		for (size_t i = 0; i < reqs.size(); ++i) {
+			const std::string& req = reqs[i];
+			r.Reset();
+			adaapd::DaapRequest::RESULT res = adaapd::DaapRequest::INCOMPLETE;
+			for (size_t len = read_size; res == adaapd::DaapRequest::INCOMPLETE; len += read_size) {
+				res = r.Parse(req.data(), (len < req.size()) ? len : req.size());
+			}
+			if (res != adaapd::DaapRequest::COMPLETE) {
+				fprintf(stderr, "Failed to parse request %lu\n", i);
+				exit(EXIT_FAILURE);
+			}
+			checksum += r.Size() + r.Path().len;
+			bytes += req.size();
+			++count;
+		}
+	}
+	double elapsed = now() - start;
+	printf("-%s %-14s %7.1f ns/request %8.1f MB/s (checksum %lu)\n",
+			XSTR(RAGEL_STYLE), label, elapsed * 1e9 / count,
+			bytes / elapsed / (1024 * 1024), checksum);
+}
+
+int main() {
+	std::vector<std::string> reqs;
+	for (size_t i = 0; i < sizeof(REQUESTS) / sizeof(REQUESTS[0]); ++i) {
+		reqs.push_back(REQUESTS[i]);
+	}
+	run(reqs, adaapd::DaapRequest::MAX_SIZE, "whole");
+	run(reqs, READ_SIZE, XSTR(READ_SIZE) "-byte reads");
+	return EXIT_SUCCESS;
+}
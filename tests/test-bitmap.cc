@@ -0,0 +1,147 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iterator>
+#include <set>
+
+#include <gtest/gtest.h>
+#include <bitmap.h>
+
+using namespace adaapd;
+
+/* a sparse group, a dense group, and a few stragglers in between */
+static void fill(Bitmap& bitmap, std::set<item_id_t>& expect, item_id_t offset) {
+	for (item_id_t id = 3; id < 1000; id += 7) {
+		bitmap.Add(id + offset);
+		expect.insert(id + offset);
+	}
+	for (item_id_t id = 65536 * 2; id < 65536 * 2 + 10000; id += 1 + offset % 2) {
+		bitmap.Add(id);
+		expect.insert(id);
+	}
+	bitmap.Add(65536 * 5 + offset);
+	expect.insert(65536 * 5 + offset);
+}
+
+static std::vector<item_id_t> ids(const Bitmap& bitmap) {
+	std::vector<item_id_t> out;
+	bitmap.Ids(out);
+	return out;
+}
+
+static std::vector<item_id_t> ids(const std::set<item_id_t>& set) {
+	return std::vector<item_id_t>(set.begin(), set.end());
+}
+
+TEST(Bitmap, add_remove) {
+	Bitmap bitmap;
+	EXPECT_FALSE(bitmap.Has(5));
+	EXPECT_TRUE(bitmap.Add(5));
+	EXPECT_FALSE(bitmap.Add(5));
+	EXPECT_TRUE(bitmap.Has(5));
+	EXPECT_EQ(1, bitmap.Count());
+
+	/* past ARRAY_MAX the group turns into a bitset, and back again */
+	for (item_id_t id = 65536; id < 65536 + 6000; ++id) {
+		EXPECT_TRUE(bitmap.Add(id));
+	}
+	EXPECT_EQ(6001, bitmap.Count());
+	EXPECT_TRUE(bitmap.Has(65536 + 4500));
+	EXPECT_FALSE(bitmap.Has(65536 + 6000));
+	for (item_id_t id = 65536; id < 65536 + 5000; ++id) {
+		EXPECT_TRUE(bitmap.Remove(id));
+	}
+	EXPECT_FALSE(bitmap.Remove(65536));
+	EXPECT_EQ(1001, bitmap.Count());
+	std::vector<item_id_t> out = ids(bitmap);
+	ASSERT_EQ(1001, out.size());
+	EXPECT_EQ(5, out[0]);
+	EXPECT_EQ(65536 + 5000, out[1]);
+	EXPECT_EQ(65536 + 5999, out.back());
+
+	EXPECT_TRUE(bitmap.Remove(5));
+	EXPECT_FALSE(bitmap.Has(5));
+	bitmap.Clear();
+	EXPECT_EQ(0, bitmap.Count());
+	EXPECT_TRUE(ids(bitmap).empty());
+}
+
+TEST(Bitmap, mask) {
+	Bitmap bitmap;
+	bitmap.Add(CHUNK_SIZE + 1);
+	bitmap.Add(2 * CHUNK_SIZE - 1);
+	bitmap.Add(2 * CHUNK_SIZE);
+	std::vector<uint8_t> mask(CHUNK_SIZE);
+	bitmap.Mask(CHUNK_SIZE, &mask[0]);
+	for (item_id_t i = 0; i < CHUNK_SIZE; ++i) {
+		EXPECT_EQ((i == 1 || i == CHUNK_SIZE - 1) ? 1 : 0, mask[i]) << i;
+	}
+	bitmap.Mask(0, &mask[0]);
+	EXPECT_EQ(CHUNK_SIZE, std::count(mask.begin(), mask.end(), 0));
+
+	/* and from a bitset */
+	for (item_id_t id = 65536; id < 65536 + 5000; id += 1) {
+		bitmap.Add(id);
+	}
+	bitmap.Mask(65536 + CHUNK_SIZE, &mask[0]);
+	EXPECT_EQ(5000 - CHUNK_SIZE, std::count(mask.begin(), mask.end(), 1));
+	EXPECT_EQ(1, mask[0]);
+	EXPECT_EQ(0, mask[5000 - CHUNK_SIZE]);
+}
+
+TEST(Bitmap, algebra) {
+	Bitmap a, b;
+	std::set<item_id_t> sa, sb;
+	fill(a, sa, 0);
+	fill(b, sb, 1);
+	EXPECT_EQ(sa.size(), a.Count());
+	EXPECT_EQ(ids(sa), ids(a));
+
+	std::set<item_id_t> expect;
+	std::set_union(sa.begin(), sa.end(), sb.begin(), sb.end(),
+			std::inserter(expect, expect.begin()));
+	Bitmap result = Bitmap::Or(a, b);
+	EXPECT_EQ(expect.size(), result.Count());
+	EXPECT_EQ(ids(expect), ids(result));
+
+	expect.clear();
+	std::set_intersection(sa.begin(), sa.end(), sb.begin(), sb.end(),
+			std::inserter(expect, expect.begin()));
+	result = Bitmap::And(a, b);
+	EXPECT_EQ(expect.size(), result.Count());
+	EXPECT_EQ(ids(expect), ids(result));
+
+	expect.clear();
+	std::set_difference(sa.begin(), sa.end(), sb.begin(), sb.end(),
+			std::inserter(expect, expect.begin()));
+	result = Bitmap::AndNot(a, b);
+	EXPECT_EQ(expect.size(), result.Count());
+	EXPECT_EQ(ids(expect), ids(result));
+
+	EXPECT_TRUE(Bitmap::Or(a, Bitmap()) == a);
+	EXPECT_EQ(0, Bitmap::And(a, Bitmap()).Count());
+	EXPECT_EQ(0, Bitmap::AndNot(a, a).Count());
+	EXPECT_TRUE(Bitmap::And(a, a) == a);
+	EXPECT_TRUE(a != b);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,126 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+
+#include <gtest/gtest.h>
+#include <browse.h>
+
+using namespace adaapd;
+
+class BrowseTest : public testing::Test {
+protected:
+	BrowseTest() : lists(collation) { }
+
+	/* applies a change the way the Library does */
+	void set(item_id_t id, const char* artist, const char* genre) {
+		TrackInfo info;
+		info.path = "/music/" + std::string(artist);
+		info.strs[ARTIST] = artist;
+		info.strs[GENRE] = genre;
+		tag_mask_t fields = store.Diff(id, info);
+		lists.Remove(store, id, fields);
+		store.Set(id, info);
+		collation.Update(store.Strings());
+		lists.Add(store, id, fields);
+	}
+	void remove(item_id_t id) {
+		lists.Remove(store, id, TAG_MASK_ALL);
+		store.Remove(id);
+	}
+
+	std::vector<std::string> values(BrowseLists::LIST list) {
+		std::vector<std::string> out;
+		const std::vector<str_id_t>& ids = lists.Values(list);
+		for (size_t i = 0; i < ids.size(); ++i) {
+			out.push_back(store.Strings().Get(ids[i]));
+		}
+		return out;
+	}
+
+	TrackStore store;
+	Collation collation;
+	BrowseLists lists;
+};
+
+static std::vector<std::string> strs(const char* a = NULL, const char* b = NULL,
+		const char* c = NULL, const char* d = NULL, const char* e = NULL) {
+	std::vector<std::string> out;
+	const char* all[] = { a, b, c, d, e };
+	for (int i = 0; i < 5 && all[i] != NULL; ++i) {
+		out.push_back(all[i]);
+	}
+	return out;
+}
+
+TEST_F(BrowseTest, incremental) {
+	set(1, "beta", "Rock");
+	set(2, "Alpha", "Rock");
+	set(3, "Gamma", "");
+	set(4, "alpha", "Jazz");
+	EXPECT_EQ(strs("Alpha", "alpha", "beta", "Gamma"), values(BrowseLists::ARTISTS));
+	set(5, "The Band", "Jazz");
+	EXPECT_EQ(strs("Alpha", "alpha", "The Band", "beta", "Gamma"), values(BrowseLists::ARTISTS));
+	remove(5);
+	EXPECT_EQ(strs("Jazz", "Rock"), values(BrowseLists::GENRES));
+	EXPECT_TRUE(values(BrowseLists::COMPOSERS).empty());
+
+	/* values only go once their last track does */
+	set(1, "Delta", "Rock");
+	remove(2);
+	EXPECT_EQ(strs("alpha", "Delta", "Gamma"), values(BrowseLists::ARTISTS));
+	EXPECT_EQ(strs("Jazz", "Rock"), values(BrowseLists::GENRES));
+	set(1, "Delta", "Pop");
+	EXPECT_EQ(strs("Jazz", "Pop"), values(BrowseLists::GENRES));
+
+	BrowseLists built(collation);
+	built.Build(store);
+	for (int i = 0; i < BrowseLists::LIST_COUNT; ++i) {
+		EXPECT_EQ(lists.Values((BrowseLists::LIST)i), built.Values((BrowseLists::LIST)i));
+	}
+}
+
+TEST_F(BrowseTest, encoded) {
+	set(1, "Alpha", "Rock");
+	std::shared_ptr<const std::string> encoded = lists.Encoded(store.Strings(), BrowseLists::ARTISTS);
+	EXPECT_EQ(std::string("abro\0\0\0\x42" "mstt\0\0\0\4\0\0\0\xc8" "muty\0\0\0\1\0"
+					"mtco\0\0\0\4\0\0\0\1" "mrco\0\0\0\4\0\0\0\1"
+					"abar\0\0\0\x0d" "mlit\0\0\0\5" "Alpha", 74), *encoded);
+
+	/* kept until the list changes */
+	EXPECT_EQ(encoded, lists.Encoded(store.Strings(), BrowseLists::ARTISTS));
+	set(2, "Alpha", "Jazz");
+	EXPECT_EQ(encoded, lists.Encoded(store.Strings(), BrowseLists::ARTISTS));
+	set(2, "Beta", "Jazz");
+	EXPECT_NE(encoded, lists.Encoded(store.Strings(), BrowseLists::ARTISTS));
+
+	std::vector<str_id_t> sorted = lists.Values(BrowseLists::ARTISTS);
+	std::reverse(sorted.begin(), sorted.end());
+	sorted.push_back(sorted[0]);
+	BrowseLists::Sort(store.Strings(), sorted);
+	EXPECT_EQ(lists.Values(BrowseLists::ARTISTS), sorted);
+
+	BrowseLists::LIST list;
+	EXPECT_TRUE(BrowseLists::Find("genres", 6, list));
+	EXPECT_EQ(BrowseLists::GENRES, list);
+	EXPECT_FALSE(BrowseLists::Find("genre", 5, list));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
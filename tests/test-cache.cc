@@ -0,0 +1,223 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <cache.h>
+#include <logging.h>
+
+#define PATH(filename) "tagdata/" filename
+#define TEST_DB "test_cache.db"
+
+using namespace adaapd;
+namespace sp = std::placeholders;
+
+static FileStat make_stat(time_t mtime, off_t size, ino_t inode) {
+	FileStat stat;
+	stat.mtime = mtime;
+	stat.size = size;
+	stat.inode = inode;
+	return stat;
+}
+
+class CacheTest : public testing::Test {
+protected:
+	virtual void SetUp() {
+		rm_db();
+	}
+	virtual void TearDown() {
+		rm_db();
+	}
+
+	static void track_event(TrackStore* store, item_id_t id, FILE_EVENT_TYPE type,
+			const TrackInfo& info) {
+		if (type == FILE_REMOVED) {
+			store->Remove(id);
+		} else {
+			store->Set(id, info);
+		}
+	}
+	track_subscriber_t subscriber(TrackStore& store) {
+		return std::bind(&CacheTest::track_event, &store, sp::_1, sp::_2, sp::_3);
+	}
+
+	ev::default_loop loop;
+	TrackStore store;
+
+private:
+	void rm_db() {
+		unlink(TEST_DB);
+		unlink(TEST_DB "-wal");
+		unlink(TEST_DB "-shm");
+	}
+};
+
+TEST_F(CacheTest, skip_unchanged) {
+	Cache cache(&loop, TEST_DB, subscriber(store));
+	ASSERT_TRUE(cache.Init());
+
+	cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+	EXPECT_EQ(1, cache.Pending());
+	EXPECT_EQ(1, cache.Flush(10));
+	EXPECT_EQ(0, cache.Pending());
+
+	/* same stat: skipped */
+	cache.FileEvent(PATH("empty.mp3"), FILE_CHANGED, make_stat(100, 200, 300));
+	EXPECT_EQ(0, cache.Pending());
+
+	/* any of mtime/size/inode changing: retagged */
+	cache.FileEvent(PATH("empty.mp3"), FILE_CHANGED, make_stat(101, 200, 300));
+	EXPECT_EQ(1, cache.Pending());
+	EXPECT_EQ(1, cache.Flush(10));
+	cache.FileEvent(PATH("empty.mp3"), FILE_CHANGED, make_stat(101, 201, 300));
+	EXPECT_EQ(1, cache.Pending());
+	EXPECT_EQ(1, cache.Flush(10));
+	cache.FileEvent(PATH("empty.mp3"), FILE_CHANGED, make_stat(101, 201, 301));
+	EXPECT_EQ(1, cache.Pending());
+	EXPECT_EQ(1, cache.Flush(10));
+
+	/* repeated events before a flush are only queued once */
+	cache.FileEvent(PATH("empty.ogg"), FILE_CREATED, make_stat(1, 2, 3));
+	cache.FileEvent(PATH("empty.ogg"), FILE_CHANGED, make_stat(4, 5, 6));
+	EXPECT_EQ(1, cache.Pending());
+	EXPECT_EQ(1, cache.Flush(10));
+}
+
+static void record_commit(std::vector<revision_t>* commits, revision_t revision) {
+	commits->push_back(revision);
+}
+
+TEST_F(CacheTest, revisions) {
+	std::vector<revision_t> commits;
+	Cache cache(&loop, TEST_DB, subscriber(store),
+			std::bind(&record_commit, &commits, sp::_1));
+	ASSERT_TRUE(cache.Init());
+	EXPECT_EQ(0, cache.Revision());
+
+	cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+	cache.FileEvent(PATH("empty.ogg"), FILE_CREATED, make_stat(400, 500, 600));
+	EXPECT_EQ(2, cache.Flush(10));
+	EXPECT_EQ(1, cache.Revision());
+	ASSERT_EQ(1, commits.size());
+	EXPECT_EQ(1, commits[0]);
+
+	/* nothing the subscriber would see: no new revision */
+	cache.FileEvent(PATH("not_a_song.txt"), FILE_CREATED, make_stat(1, 2, 3));
+	EXPECT_EQ(1, cache.Flush(10));
+	EXPECT_EQ(1, cache.Revision());
+	EXPECT_EQ(1, commits.size());
+
+	cache.FileEvent(PATH("empty.ogg"), FILE_REMOVED, FileStat());
+	EXPECT_EQ(1, cache.Flush(10));
+	EXPECT_EQ(2, cache.Revision());
+	ASSERT_EQ(2, commits.size());
+	EXPECT_EQ(2, commits[1]);
+
+	/* a bump is stored, but publishing it is up to the caller */
+	EXPECT_EQ(3, cache.Bump());
+	EXPECT_EQ(3, cache.Revision());
+	EXPECT_EQ(2, commits.size());
+	Cache reopened(&loop, TEST_DB, subscriber(store));
+	ASSERT_TRUE(reopened.Init());
+	EXPECT_EQ(3, reopened.Revision());
+}
+
+TEST_F(CacheTest, warm_start) {
+	{
+		Cache cache(&loop, TEST_DB, subscriber(store));
+		ASSERT_TRUE(cache.Init());
+		cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+		cache.FileEvent(PATH("empty.ogg"), FILE_CREATED, make_stat(400, 500, 600));
+		cache.FileEvent(PATH("not_a_song.txt"), FILE_CREATED, make_stat(1, 2, 3));
+		EXPECT_EQ(3, cache.Flush(10));
+	}
+
+	/* the tracks which were valid last time are loaded from the db */
+	TrackStore warm_store;
+	Cache cache(&loop, TEST_DB, subscriber(warm_store));
+	ASSERT_TRUE(cache.Init());
+	EXPECT_EQ(0, warm_store.Size());
+	ASSERT_TRUE(cache.LoadTracks());
+	EXPECT_EQ(store.Size(), warm_store.Size());
+	for (item_id_t id = 0; id < store.End(); ++id) {
+		ASSERT_EQ(store.Has(id), warm_store.Has(id));
+		if (store.Has(id)) {
+			EXPECT_STREQ(store.Path(id), warm_store.Path(id));
+			EXPECT_STREQ(store.Str(id, TITLE), warm_store.Str(id, TITLE));
+			EXPECT_EQ(store.Int(id, YEAR), warm_store.Int(id, YEAR));
+		}
+	}
+
+	cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+	cache.FileEvent(PATH("not_a_song.txt"), FILE_CREATED, make_stat(1, 2, 3));
+	EXPECT_EQ(0, cache.Pending());
+	cache.FileEvent(PATH("empty.ogg"), FILE_CREATED, make_stat(400, 500, 601));
+	EXPECT_EQ(1, cache.Pending());
+}
+
+TEST_F(CacheTest, remove_and_prune) {
+	{
+		Cache cache(&loop, TEST_DB, subscriber(store));
+		ASSERT_TRUE(cache.Init());
+		cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+		cache.FileEvent(PATH("empty.ogg"), FILE_CREATED, make_stat(400, 500, 600));
+		EXPECT_EQ(2, cache.Flush(10));
+
+		cache.FileEvent(PATH("empty.mp3"), FILE_REMOVED, FileStat());
+		EXPECT_EQ(1, cache.Pending());
+		EXPECT_EQ(1, cache.Flush(10));
+
+		/* removing something we never had is a no-op */
+		cache.FileEvent(PATH("empty.wma"), FILE_REMOVED, FileStat());
+		EXPECT_EQ(0, cache.Pending());
+	}
+
+	{
+		/* empty.ogg wasn't seen this time around */
+		Cache cache(&loop, TEST_DB, subscriber(store));
+		ASSERT_TRUE(cache.Init());
+		cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+		EXPECT_EQ(1, cache.Pending());
+		EXPECT_EQ(1, cache.Prune());
+		EXPECT_EQ(2, cache.Flush(10));
+	}
+
+	Cache cache(&loop, TEST_DB, subscriber(store));
+	ASSERT_TRUE(cache.Init());
+	cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+	EXPECT_EQ(0, cache.Pending());
+	cache.FileEvent(PATH("empty.ogg"), FILE_CREATED, make_stat(400, 500, 600));
+	EXPECT_EQ(1, cache.Pending());
+}
+
+TEST_F(CacheTest, flush_from_loop) {
+	Cache cache(&loop, TEST_DB, subscriber(store));
+	ASSERT_TRUE(cache.Init());
+	cache.FileEvent(PATH("empty.mp3"), FILE_CREATED, make_stat(100, 200, 300));
+	cache.FileEvent(PATH("empty.ogg"), FILE_CREATED, make_stat(400, 500, 600));
+	EXPECT_EQ(2, cache.Pending());
+	/* returns once the idle watcher has drained the queue */
+	loop.run();
+	EXPECT_EQ(0, cache.Pending());
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,135 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <gtest/gtest.h>
+#include <track-order.h>
+
+using namespace adaapd;
+
+TEST(Collation, keys) {
+	EXPECT_EQ("beatles", CollationKey("The Beatles"));
+	EXPECT_EQ("the", CollationKey("The"));
+	EXPECT_EQ("theater", CollationKey("Theater"));
+	EXPECT_EQ("bjork", CollationKey("Bj\xc3\xb6rk"));
+	EXPECT_EQ("aeon flux", CollationKey("  \xc3\x86on -- Flux! "));
+	EXPECT_EQ("strasse", CollationKey("Stra\xc3\x9f" "e"));
+	EXPECT_EQ("ac dc", CollationKey("AC/DC"));
+	/* other scripts are left alone */
+	EXPECT_EQ("\xe6\x97\xa5", CollationKey("\xe6\x97\xa5"));
+	EXPECT_EQ("", CollationKey(""));
+}
+
+TEST(Collation, compare) {
+	TrackStore store;
+	TrackInfo info;
+	info.path = "/a";
+	info.strs[ARTIST] = "The Beatles";
+	info.strs[ALBUM] = "beatles";
+	info.strs[TITLE] = "Beatles For Sale, Vol. 2";
+	info.strs[GENRE] = "Beatles For Sale, Vol. 1";
+	store.Set(1, info);
+	Collation collation;
+	collation.Update(store.Strings());
+	EXPECT_EQ(0, collation.Compare(store.StrId(1, ARTIST), store.StrId(1, ALBUM)));
+	EXPECT_LT(0, collation.Compare(store.StrId(1, TITLE), store.StrId(1, GENRE)));
+	EXPECT_GT(0, collation.Compare(store.StrId(1, ALBUM), store.StrId(1, GENRE)));
+	EXPECT_LT(0, collation.Compare(store.StrId(1, ARTIST), STR_NONE));
+
+	/* only the tags get keys, not the path */
+	info.path = "/b";
+	store.Set(2, info);
+	collation.Update(store.Strings());
+	EXPECT_EQ(5, collation.Size());
+}
+
+class TrackOrdersTest : public testing::Test {
+protected:
+	TrackOrdersTest() : orders(collation) { }
+
+	/* applies a change the way the Library does */
+	void set(item_id_t id, const char* artist, const char* album, tag_int_t track,
+			const char* title) {
+		TrackInfo info;
+		info.path = "/music/" + std::string(title);
+		info.strs[ARTIST] = artist;
+		info.strs[ALBUM] = album;
+		info.strs[TITLE] = title;
+		info.ints[TRACK_NUMBER] = track;
+		tag_mask_t fields = store.Diff(id, info);
+		orders.Remove(store, id, fields);
+		store.Set(id, info);
+		collation.Update(store.Strings());
+		orders.Add(store, id, fields);
+	}
+
+	std::vector<item_id_t> order(TrackOrders::ORDER order) {
+		return *orders.Order(order);
+	}
+
+	TrackStore store;
+	Collation collation;
+	TrackOrders orders;
+};
+
+static std::vector<item_id_t> ids(item_id_t a, item_id_t b, item_id_t c, item_id_t d) {
+	std::vector<item_id_t> out;
+	out.push_back(a);
+	out.push_back(b);
+	out.push_back(c);
+	out.push_back(d);
+	return out;
+}
+
+TEST_F(TrackOrdersTest, incremental) {
+	set(1, "The Zombies", "Odessey", 2, "Care of Cell 44");
+	set(2, "Abba", "Arrival", 1, "When I Kissed the Teacher");
+	set(3, "The Zombies", "Odessey", 1, "Zebra");
+	set(4, "abba", "Arrival", 2, "Dancing Queen");
+	EXPECT_EQ(ids(2, 4, 3, 1), order(TrackOrders::BY_ARTIST));
+	EXPECT_EQ(ids(2, 4, 3, 1), order(TrackOrders::BY_ALBUM));
+	EXPECT_EQ(ids(1, 4, 2, 3), order(TrackOrders::BY_NAME));
+
+	/* only the orders which look at a changed field are copied again */
+	std::shared_ptr<const std::vector<item_id_t> > by_name = orders.Order(TrackOrders::BY_NAME);
+	set(3, "Beach Boys", "Odessey", 1, "Zebra");
+	EXPECT_EQ(by_name, orders.Order(TrackOrders::BY_NAME));
+	EXPECT_EQ(ids(2, 4, 3, 1), order(TrackOrders::BY_ARTIST));
+	set(1, "The Zombies", "Odessey", 2, "Also Sprach");
+	EXPECT_EQ(ids(1, 4, 2, 3), order(TrackOrders::BY_NAME));
+	set(2, "Abba", "Arrival", 3, "When I Kissed the Teacher");
+	EXPECT_EQ(ids(4, 2, 3, 1), order(TrackOrders::BY_ARTIST));
+
+	orders.Remove(store, 4, TAG_MASK_ALL);
+	store.Remove(4);
+	EXPECT_EQ(3, order(TrackOrders::BY_ALBUM).size());
+
+	TrackOrders built(collation);
+	built.Build(store);
+	for (int o = 0; o < TrackOrders::ORDER_COUNT; ++o) {
+		EXPECT_EQ(order((TrackOrders::ORDER)o), *built.Order((TrackOrders::ORDER)o));
+	}
+
+	TrackOrders::ORDER found;
+	EXPECT_TRUE(TrackOrders::Find("album", 5, found));
+	EXPECT_EQ(TrackOrders::BY_ALBUM, found);
+	EXPECT_FALSE(TrackOrders::Find("albums", 6, found));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,146 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <atomic>
+
+#include <gtest/gtest.h>
+#include <compressor.h>
+#include <logging.h>
+
+using namespace adaapd;
+namespace sp = std::placeholders;
+
+static std::string inflate_all(const std::string& in, ENCODING encoding) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	EXPECT_EQ(Z_OK, inflateInit2(&stream, (encoding == ENCODING_GZIP) ? 15 + 16 : 15));
+	stream.next_in = (Bytef*)in.data();
+	stream.avail_in = in.size();
+	std::string out;
+	int ret;
+	do {
+		char buf[4096];
+		stream.next_out = (Bytef*)buf;
+		stream.avail_out = sizeof(buf);
+		ret = inflate(&stream, Z_NO_FLUSH);
+		out.append(buf, sizeof(buf) - stream.avail_out);
+	} while (ret == Z_OK);
+	EXPECT_EQ(Z_STREAM_END, ret);
+	inflateEnd(&stream);
+	return out;
+}
+
+static std::shared_ptr<const Response> make_body(const std::string& text) {
+	std::shared_ptr<Response> body(new Response);
+	/* split into several pieces */
+	for (size_t i = 0; i < text.size(); i += 1000) {
+		body->Append(text.substr(i, 1000));
+	}
+	return body;
+}
+
+static std::string make_text(size_t size) {
+	std::string text;
+	while (text.size() < size) {
+		text.append("mlit\0\0\0\x0c" "miid\0\0\0\4", 16);
+		text.push_back((char)(text.size() % 251));
+	}
+	return text;
+}
+
+static void record(std::atomic<int>* calls,
+		std::shared_ptr<const std::string>* out,
+		const std::shared_ptr<const std::string>& data) {
+	*out = data;
+	++*calls;
+}
+
+static void wait_for(std::atomic<int>& calls, int count) {
+	for (int i = 0; i < 5000 && calls < count; ++i) {
+		usleep(1000);
+	}
+	ASSERT_EQ(count, calls);
+}
+
+TEST(Compressor, round_trip) {
+	std::string text = make_text(100000);
+	std::shared_ptr<const Response> body = make_body(text);
+
+	std::string out;
+	ASSERT_TRUE(Compressor::Deflate(*body, ENCODING_GZIP, out));
+	EXPECT_LT(out.size(), text.size() / 4);
+	EXPECT_EQ(text, inflate_all(out, ENCODING_GZIP));
+
+	out.clear();
+	ASSERT_TRUE(Compressor::Deflate(*body, ENCODING_DEFLATE, out));
+	EXPECT_EQ(text, inflate_all(out, ENCODING_DEFLATE));
+
+	out.clear();
+	ASSERT_TRUE(Compressor::Deflate(Response(), ENCODING_GZIP, out));
+	EXPECT_EQ("", inflate_all(out, ENCODING_GZIP));
+}
+
+TEST(Compressor, once_per_revision) {
+	Compressor compressor;
+	std::string text = make_text(50000);
+	std::shared_ptr<const Response> body = make_body(text);
+	EXPECT_FALSE(compressor.Get(1, 7, ENCODING_GZIP));
+
+	std::atomic<int> calls(0);
+	std::shared_ptr<const std::string> a, b, c;
+	compressor.Compress(1, 7, ENCODING_GZIP, body, std::bind(&record, &calls, &a, sp::_1));
+	compressor.Compress(1, 7, ENCODING_GZIP, body, std::bind(&record, &calls, &b, sp::_1));
+	wait_for(calls, 2);
+	ASSERT_TRUE(a);
+	/* both got the same, single, result */
+	EXPECT_EQ(a, b);
+	EXPECT_EQ(text, inflate_all(*a, ENCODING_GZIP));
+	EXPECT_EQ(a, compressor.Get(1, 7, ENCODING_GZIP));
+
+	/* other variants and encodings are kept apart */
+	EXPECT_FALSE(compressor.Get(1, 8, ENCODING_GZIP));
+	EXPECT_FALSE(compressor.Get(1, 7, ENCODING_DEFLATE));
+
+	/* a cached result is handed over right away */
+	compressor.Compress(1, 7, ENCODING_GZIP, body, std::bind(&record, &calls, &c, sp::_1));
+	EXPECT_EQ(3, calls);
+	EXPECT_EQ(a, c);
+
+	/* a new revision replaces everything */
+	compressor.Compress(2, 7, ENCODING_DEFLATE, body, std::bind(&record, &calls, &c, sp::_1));
+	wait_for(calls, 4);
+	EXPECT_FALSE(compressor.Get(1, 7, ENCODING_GZIP));
+	EXPECT_EQ(c, compressor.Get(2, 7, ENCODING_DEFLATE));
+
+	/* stragglers on an old revision are answered but not kept */
+	compressor.Compress(1, 9, ENCODING_GZIP, body, std::bind(&record, &calls, &c, sp::_1));
+	wait_for(calls, 5);
+	ASSERT_TRUE(c);
+	EXPECT_EQ(text, inflate_all(*c, ENCODING_GZIP));
+	EXPECT_FALSE(compressor.Get(1, 9, ENCODING_GZIP));
+	EXPECT_FALSE(compressor.Get(2, 9, ENCODING_GZIP));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
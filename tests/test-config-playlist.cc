@@ -0,0 +1,224 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <future>
+
+#include <gtest/gtest.h>
+#include <config-playlist.h>
+
+#include "test-tracks.h"
+
+#define TEST_IMAGE "test_config_playlist.img"
+#define TEST_PLAYLISTS "test_config_playlist.yaml"
+#define TEST_OTHER "test_config_playlist.other.yaml"
+
+using namespace adaapd;
+
+/* hands out 'specs', optionally waiting for 'go' first */
+class TestPlaylistFile : public PlaylistFile {
+public:
+	TestPlaylistFile() : PlaylistFile("playlists.test"), waiting(false), reads(0) { }
+
+	bool Read(playlists_t& list) {
+		if (go.valid()) {
+			waiting = true;
+			go.get();
+		}
+		++reads;
+		list = specs;
+		return true;
+	}
+	bool Write(const playlists_t& /*list*/) {
+		return false;
+	}
+
+	playlists_t specs;
+	std::shared_future<void> go;
+	std::atomic<bool> waiting;
+	std::atomic<int> reads;
+};
+
+class ConfigPlaylistTest : public testing::Test {
+protected:
+	virtual void SetUp() {
+		rm_image();
+	}
+	virtual void TearDown() {
+		rm_image();
+	}
+
+	void run_until(PlaylistReloader& reloader, size_t swapped) {
+		while (reloader.Swapped() < swapped) {
+			loop.run(ev::ONCE);
+		}
+	}
+
+	ev::default_loop loop;
+
+private:
+	void rm_image() {
+		unlink(TEST_IMAGE);
+		unlink(TEST_IMAGE ".delta");
+		unlink(TEST_IMAGE ".tmp");
+		unlink(TEST_PLAYLISTS);
+		unlink(TEST_OTHER);
+	}
+};
+
+TEST_F(ConfigPlaylistTest, reload) {
+	Library library(TEST_IMAGE);
+	library.TrackEvent(1, FILE_CREATED, TestTrack(1), 1);
+	library.TrackEvent(3, FILE_CREATED, TestTrack(3), 1);
+	library.Committed(1);
+	LibraryReader reader(library);
+	EXPECT_EQ(0, reader.Get().playlists->size());
+
+	std::shared_ptr<TestPlaylistFile> file(new TestPlaylistFile);
+	file->specs.resize(1);
+	file->specs[0].name = "early";
+	file->specs[0].rule = Rule::Int(TRACK_NUMBER, Rule::INT_LE, 2);
+	PlaylistReloader reloader(&loop, library, file);
+	reloader.Reload();
+	run_until(reloader, 1);
+
+	const LibrarySnapshot& one = reader.Get();
+	ASSERT_EQ(1, one.playlists->size());
+	EXPECT_EQ("early", (*one.playlists)[0].name);
+	EXPECT_TRUE((*one.playlists)[0].members.Has(1));
+	EXPECT_FALSE((*one.playlists)[0].members.Has(3));
+	uint32_t generation = one.playlist_generation;
+
+	/* changes arriving mid-build coalesce into one more build, and only
+	 * the latest is swapped in */
+	file->specs[0].rule = Rule::Int(TRACK_NUMBER, Rule::INT_GE, 3);
+	reloader.Reload();
+	reloader.Reload();
+	run_until(reloader, 2);
+	EXPECT_EQ(3, file->reads);
+	const LibrarySnapshot& two = reader.Get();
+	EXPECT_EQ(generation + 1, two.playlist_generation);
+	EXPECT_FALSE((*two.playlists)[0].members.Has(1));
+	EXPECT_TRUE((*two.playlists)[0].members.Has(3));
+}
+
+TEST_F(ConfigPlaylistTest, catch_up) {
+	Library library(TEST_IMAGE);
+	library.TrackEvent(1, FILE_CREATED, TestTrack(1), 1);
+	library.TrackEvent(3, FILE_CREATED, TestTrack(3), 1);
+	library.Committed(1);
+	LibraryReader reader(library);
+
+	std::shared_ptr<TestPlaylistFile> file(new TestPlaylistFile);
+	file->specs.resize(1);
+	file->specs[0].name = "early";
+	file->specs[0].rule = Rule::Int(TRACK_NUMBER, Rule::INT_LE, 2);
+	std::promise<void> go;
+	file->go = go.get_future().share();
+	PlaylistReloader reloader(&loop, library, file);
+	reloader.Reload();
+
+	/* the build has taken revision 1 by the time it reads the file, so
+	 * these are only picked up when it's swapped in */
+	while (!file->waiting) {
+		std::this_thread::yield();
+	}
+	library.TrackEvent(3, FILE_CHANGED, TestTrack(3).Int(TRACK_NUMBER, 2), 2);
+	library.TrackEvent(1, FILE_REMOVED, TrackInfo(), 2);
+	library.TrackEvent(2, FILE_CREATED, TestTrack(2), 2);
+	library.Committed(2);
+	library.TrackEvent(4, FILE_CREATED, TestTrack(4).Int(TRACK_NUMBER, 1), 3);
+
+	/* meanwhile clients keep seeing the old playlists */
+	EXPECT_EQ(0, reader.Get().playlists->size());
+	go.set_value();
+	run_until(reloader, 1);
+
+	/* revision 3 is still being applied, so the playlists go out against
+	 * revision 2 and track 4 only with its own revision */
+	const LibrarySnapshot& swapped = reader.Get();
+	EXPECT_EQ(2, swapped.revision);
+	ASSERT_EQ(1, swapped.playlists->size());
+	const Bitmap& before = (*swapped.playlists)[0].members;
+	EXPECT_TRUE(before.Has(2));
+	EXPECT_TRUE(before.Has(3));
+	EXPECT_FALSE(before.Has(4));
+	EXPECT_EQ(2, before.Count());
+
+	library.Committed(3);
+	const LibrarySnapshot& snapshot = reader.Get();
+	EXPECT_EQ(3, snapshot.revision);
+	ASSERT_EQ(1, snapshot.playlists->size());
+	const Bitmap& members = (*snapshot.playlists)[0].members;
+	EXPECT_FALSE(members.Has(1));
+	EXPECT_TRUE(members.Has(2));
+	EXPECT_TRUE(members.Has(3));
+	EXPECT_TRUE(members.Has(4));
+	EXPECT_EQ(3, members.Count());
+}
+
+TEST_F(ConfigPlaylistTest, watch) {
+	Library library(TEST_IMAGE);
+	library.TrackEvent(1, FILE_CREATED, TestTrack(1), 1);
+	library.TrackEvent(3, FILE_CREATED, TestTrack(3), 1);
+	library.Committed(1);
+	LibraryReader reader(library);
+
+	playlists_t specs(1);
+	specs[0].name = "early";
+	specs[0].rule = Rule::Int(TRACK_NUMBER, Rule::INT_LE, 2);
+	playlist_file_t file = PlaylistFile::Create(TEST_PLAYLISTS);
+	ASSERT_TRUE(file->Write(specs));
+
+	/* an existing file is loaded right away */
+	PlaylistReloader reloader(&loop, library, file);
+	ASSERT_TRUE(reloader.Init());
+	run_until(reloader, 1);
+	ASSERT_EQ(1, reader.Get().playlists->size());
+	EXPECT_EQ("early", (*reader.Get().playlists)[0].name);
+
+	/* other files in the directory don't matter */
+	specs[0].name = "late";
+	ASSERT_TRUE(PlaylistFile::Create(TEST_OTHER)->Write(specs));
+	for (int i = 0; i < 20; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	EXPECT_EQ(1, reloader.Swapped());
+
+	/* until one is moved over the watched one */
+	ASSERT_EQ(0, rename(TEST_OTHER, TEST_PLAYLISTS));
+	run_until(reloader, 2);
+	EXPECT_EQ("late", (*reader.Get().playlists)[0].name);
+
+	/* and removing it keeps what's there */
+	unlink(TEST_PLAYLISTS);
+	for (int i = 0; i < 20; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	EXPECT_EQ(2, reloader.Swapped());
+	EXPECT_EQ("late", (*reader.Get().playlists)[0].name);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
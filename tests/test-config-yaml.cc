@@ -0,0 +1,190 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <config-yaml.h>
+
+#define TEST_PATH "test_config.yaml"
+
+using namespace adaapd;
+
+class ConfigYamlTest : public testing::Test {
+protected:
+	virtual void TearDown() {
+		unlink(TEST_PATH);
+		unlink(TEST_PATH ".tmp");
+	}
+
+	void write(const char* text) {
+		FILE* f = fopen(TEST_PATH, "wb");
+		ASSERT_TRUE(f != NULL);
+		fputs(text, f);
+		fclose(f);
+	}
+
+	bool read(playlists_t& list) {
+		list.clear();
+		return PlaylistFile::Create(TEST_PATH)->Read(list);
+	}
+};
+
+TEST_F(ConfigYamlTest, config) {
+	write("music: /music\n"
+			"port: 3690\n");
+	config_file_t file = ConfigFile::Create(TEST_PATH);
+	ASSERT_TRUE(file.get() != NULL);
+	Config config;
+	EXPECT_TRUE(file->Read(config));
+	EXPECT_EQ("/music", config.music_dir);
+	EXPECT_EQ(3690, config.port);
+	EXPECT_EQ("adaapd.db", config.cache_path);
+	EXPECT_TRUE(config.playlist_path.empty());
+
+	config.playlist_path = "/etc/playlists.yaml";
+	EXPECT_TRUE(file->Write(config));
+	Config again;
+	EXPECT_TRUE(file->Read(again));
+	EXPECT_EQ("/music", again.music_dir);
+	EXPECT_EQ("/etc/playlists.yaml", again.playlist_path);
+	EXPECT_EQ(3690, again.port);
+
+	write("music: /music\nport: 70000\n");
+	EXPECT_FALSE(file->Read(config));
+	write("music: /music\nmusik: /music\n");
+	EXPECT_FALSE(file->Read(config));
+
+	EXPECT_TRUE(ConfigFile::Create("config.ini").get() == NULL);
+}
+
+TEST_F(ConfigYamlTest, playlists) {
+	write("- name: Nineties rock\n"
+			"  rule:\n"
+			"    all:\n"
+			"      - genre: {contains: rock}\n"
+			"      - year: {range: [1990, 1999]}\n"
+			"      - not: {in: Christmas}\n"
+			"- name: Good\n"
+			"  rule: {rating: {ge: 80, lt: 100}}\n"
+			"- name: Favourites\n"
+			"  paths:\n"
+			"    - /music/a.mp3\n"
+			"    - \"/music/b: the sequel.mp3\"\n");
+	playlists_t list;
+	ASSERT_TRUE(read(list));
+	ASSERT_EQ(3, list.size());
+
+	EXPECT_EQ("Nineties rock", list[0].name);
+	const Rule& rock = list[0].rule;
+	EXPECT_EQ(Rule::ALL, rock.type);
+	ASSERT_EQ(3, rock.rules.size());
+	EXPECT_EQ(Rule::STR_CONTAINS, rock.rules[0].type);
+	EXPECT_EQ(GENRE, rock.rules[0].field);
+	EXPECT_EQ("rock", rock.rules[0].text);
+	EXPECT_EQ(Rule::INT_RANGE, rock.rules[1].type);
+	EXPECT_EQ(YEAR, rock.rules[1].field);
+	EXPECT_EQ(1990, rock.rules[1].value);
+	EXPECT_EQ(1999, rock.rules[1].value2);
+	EXPECT_EQ(Rule::NOT, rock.rules[2].type);
+	EXPECT_EQ(Rule::IN, rock.rules[2].rules[0].type);
+	EXPECT_EQ("Christmas", rock.rules[2].rules[0].text);
+	EXPECT_TRUE(list[0].paths.empty());
+
+	/* several comparisons on one field must all hold */
+	const Rule& good = list[1].rule;
+	EXPECT_EQ(Rule::ALL, good.type);
+	ASSERT_EQ(2, good.rules.size());
+	EXPECT_EQ(Rule::INT_GE, good.rules[0].type);
+	EXPECT_EQ(USER_RATING, good.rules[0].field);
+	EXPECT_EQ(80, good.rules[0].value);
+	EXPECT_EQ(Rule::INT_LT, good.rules[1].type);
+
+	/* paths only: the rule matches nothing */
+	EXPECT_EQ(Rule::ANY, list[2].rule.type);
+	EXPECT_TRUE(list[2].rule.rules.empty());
+	ASSERT_EQ(2, list[2].paths.size());
+	EXPECT_EQ("/music/b: the sequel.mp3", list[2].paths[1]);
+
+	/* and back again */
+	ASSERT_TRUE(PlaylistFile::Create(TEST_PATH)->Write(list));
+	playlists_t again;
+	ASSERT_TRUE(read(again));
+	ASSERT_EQ(3, again.size());
+	EXPECT_EQ(3, again[0].rule.rules.size());
+	EXPECT_EQ(1999, again[0].rule.rules[1].value2);
+	EXPECT_EQ("Christmas", again[0].rule.rules[2].rules[0].text);
+	EXPECT_EQ(2, again[1].rule.rules.size());
+	EXPECT_EQ(Rule::ANY, again[2].rule.type);
+	EXPECT_EQ(list[2].paths, again[2].paths);
+
+	write("");
+	EXPECT_TRUE(read(list));
+	EXPECT_TRUE(list.empty());
+}
+
+TEST_F(ConfigYamlTest, errors) {
+	playlists_t list;
+	/* syntax */
+	write("- name: [unclosed\n");
+	EXPECT_FALSE(read(list));
+	/* structure */
+	write("name: not a list\n");
+	EXPECT_FALSE(read(list));
+	write("- rule: {artist: x}\n");
+	EXPECT_FALSE(read(list));
+	write("- name: x\n");
+	EXPECT_FALSE(read(list));
+	write("- name: x\n  rule: {artist: x, album: y}\n");
+	EXPECT_FALSE(read(list));
+	/* values */
+	write("- name: x\n  rule: {artst: x}\n");
+	EXPECT_FALSE(read(list));
+	write("- name: x\n  rule: {year: {contains: 1}}\n");
+	EXPECT_FALSE(read(list));
+	write("- name: x\n  rule: {year: nineteen}\n");
+	EXPECT_FALSE(read(list));
+	write("- name: x\n  rule: {year: {range: [1, 2, 3]}}\n");
+	EXPECT_FALSE(read(list));
+	write("- name: x\n  rule: {title: {matches: \"(\"}}\n");
+	EXPECT_FALSE(read(list));
+	write("- &a {name: x, paths: []}\n- *a\n");
+	EXPECT_FALSE(read(list));
+}
+
+TEST_F(ConfigYamlTest, many_paths) {
+	FILE* f = fopen(TEST_PATH, "wb");
+	ASSERT_TRUE(f != NULL);
+	fputs("- name: Static\n  paths:\n", f);
+	for (int i = 0; i < 5000; ++i) {
+		fprintf(f, "    - /music/artist %d/album/%d.mp3\n", i / 10, i);
+	}
+	fclose(f);
+
+	playlists_t list;
+	ASSERT_TRUE(read(list));
+	ASSERT_EQ(1, list.size());
+	ASSERT_EQ(5000, list[0].paths.size());
+	EXPECT_EQ("/music/artist 499/album/4999.mp3", list[0].paths[4999]);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
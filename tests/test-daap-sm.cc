@@ -0,0 +1,137 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <daap-sm.h>
+
+using namespace adaapd;
+
+static std::string str(const std::string& buf, const Span& span) {
+	return buf.substr(span.off, span.len);
+}
+
+TEST(DaapRequest, items) {
+	std::string req =
+		"GET /databases/1/containers/2/items?session-id=1234&revision-number=5"
+		"&delta=4&type=music&meta=dmap.itemid,dmap.itemname,daap.songartist"
+		"&query=%27dmap.itemname:a%20b%27&unknown=x&sort HTTP/1.1\r\n"
+		"Host: 10.0.0.2:3689\r\n"
+		"Client-DAAP-Version:  3.10 \r\n"
+		"accept-encoding: gzip\r\n"
+		"\r\n"
+		"GET /next";
+	DaapRequest r;
+	ASSERT_EQ(DaapRequest::COMPLETE, r.Parse(req.data(), req.size()));
+	EXPECT_EQ(req.find("GET /next"), r.Size());
+	EXPECT_EQ(METHOD_GET, r.Method());
+	EXPECT_TRUE(r.KeepAlive());
+	EXPECT_EQ("/databases/1/containers/2/items", str(req, r.Path()));
+
+	uint32_t val;
+	ASSERT_TRUE(DaapRequest::ToUInt(req.data(), r.Param(PARAM_SESSION_ID), val));
+	EXPECT_EQ(1234, val);
+	ASSERT_TRUE(DaapRequest::ToUInt(req.data(), r.Param(PARAM_REVISION_NUMBER), val));
+	EXPECT_EQ(5, val);
+	ASSERT_TRUE(DaapRequest::ToUInt(req.data(), r.Param(PARAM_DELTA), val));
+	EXPECT_EQ(4, val);
+	EXPECT_EQ("music", str(req, r.Param(PARAM_TYPE)));
+	EXPECT_EQ("dmap.itemid,dmap.itemname,daap.songartist", str(req, r.Param(PARAM_META)));
+	EXPECT_EQ("'dmap.itemname:a b'", DaapRequest::Decode(req.data(), r.Param(PARAM_QUERY)));
+	EXPECT_TRUE(r.HasParam(PARAM_SORT));
+	EXPECT_EQ(0, r.Param(PARAM_SORT).len);
+	EXPECT_FALSE(r.HasParam(PARAM_INDEX));
+
+	EXPECT_EQ("3.10", str(req, r.Header(HEADER_CLIENT_DAAP_VERSION)));
+	EXPECT_EQ("gzip", str(req, r.Header(HEADER_ACCEPT_ENCODING)));
+	EXPECT_FALSE(r.HasHeader(HEADER_RANGE));
+}
+
+TEST(DaapRequest, incremental) {
+	std::string req =
+		"GET /databases/1/items/7.mp3?session-id=99 HTTP/1.0\r\n"
+		"Connection: Keep-Alive\r\n"
+		"Range: bytes=100-\r\n"
+		"\r\n";
+	/* one byte at a time, as if each arrived in its own read() */
+	DaapRequest r;
+	for (size_t i = 1; i < req.size(); ++i) {
+		ASSERT_EQ(DaapRequest::INCOMPLETE, r.Parse(req.data(), i)) << i;
+	}
+	ASSERT_EQ(DaapRequest::COMPLETE, r.Parse(req.data(), req.size()));
+	EXPECT_EQ(req.size(), r.Size());
+	EXPECT_EQ("/databases/1/items/7.mp3", str(req, r.Path()));
+	EXPECT_EQ("99", str(req, r.Param(PARAM_SESSION_ID)));
+	EXPECT_EQ("bytes=100-", str(req, r.Header(HEADER_RANGE)));
+	EXPECT_TRUE(r.KeepAlive());
+
+	/* the buffer may move between calls */
+	r.Reset();
+	std::string copy = req.substr(0, 20);
+	ASSERT_EQ(DaapRequest::INCOMPLETE, r.Parse(copy.data(), copy.size()));
+	copy = req;
+	ASSERT_EQ(DaapRequest::COMPLETE, r.Parse(copy.data(), copy.size()));
+	EXPECT_EQ("/databases/1/items/7.mp3", str(copy, r.Path()));
+}
+
+TEST(DaapRequest, keep_alive) {
+	std::string req = "GET /server-info HTTP/1.0\n\n";
+	DaapRequest r;
+	ASSERT_EQ(DaapRequest::COMPLETE, r.Parse(req.data(), req.size()));
+	EXPECT_FALSE(r.KeepAlive());
+
+	req = "GET /login HTTP/1.1\r\nConnection: close\r\n\r\n";
+	r.Reset();
+	ASSERT_EQ(DaapRequest::COMPLETE, r.Parse(req.data(), req.size()));
+	EXPECT_FALSE(r.KeepAlive());
+	EXPECT_EQ("/login", str(req, r.Path()));
+	EXPECT_FALSE(r.HasParam(PARAM_SESSION_ID));
+
+	req = "POST /logout HTTP/1.1\r\nContent-Length: 12\r\n\r\n";
+	r.Reset();
+	ASSERT_EQ(DaapRequest::COMPLETE, r.Parse(req.data(), req.size()));
+	EXPECT_EQ(METHOD_POST, r.Method());
+	EXPECT_EQ(12, r.ContentLength());
+	EXPECT_TRUE(r.KeepAlive());
+}
+
+TEST(DaapRequest, invalid) {
+	const char* bad[] = {
+		"FOO / HTTP/1.1\r\n\r\n",
+		"GET  / HTTP/1.1\r\n\r\n",
+		"GET / HTTP/2.0\r\n\r\n",
+		"GET /a b HTTP/1.1\r\n\r\n",
+		"GET / HTTP/1.1\r\nNoColon\r\n\r\n",
+		"GET / HTTP/1.1\r\nContent-Length: x\r\n\r\n",
+		NULL
+	};
+	for (const char** b = bad; *b != NULL; ++b) {
+		DaapRequest r;
+		EXPECT_EQ(DaapRequest::INVALID, r.Parse(*b, strlen(*b))) << *b;
+		/* stays invalid */
+		EXPECT_EQ(DaapRequest::INVALID, r.Parse(*b, strlen(*b))) << *b;
+	}
+
+	std::string big = "GET /" + std::string(DaapRequest::MAX_SIZE, 'a') + " HTTP/1.1\r\n\r\n";
+	DaapRequest r;
+	EXPECT_EQ(DaapRequest::TOO_LARGE, r.Parse(big.data(), big.size()));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
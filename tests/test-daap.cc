@@ -0,0 +1,626 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <gtest/gtest.h>
+#include <daap.h>
+
+#define TEST_IMAGE "test_daap.img"
+#define TEST_SONG "test_daap.mp3"
+#define SONG_SIZE 300000
+
+namespace sp = std::placeholders;
+
+using namespace adaapd;
+
+class DaapTest : public testing::Test {
+protected:
+	DaapTest()
+		: library(TEST_IMAGE), daap(library, loop, &compressor),
+		  server(loop, std::bind(&Daap::Handle, &daap, sp::_1, sp::_2, sp::_3), 1) { }
+
+	virtual void SetUp() {
+		rm_files();
+		song.resize(SONG_SIZE);
+		for (size_t i = 0; i < song.size(); ++i) {
+			song[i] = (char)(i * 7 + i / 251);
+		}
+		FILE* file = fopen(TEST_SONG, "w");
+		ASSERT_TRUE(file != NULL);
+		ASSERT_EQ(1, fwrite(song.data(), song.size(), 1, file));
+		fclose(file);
+
+		TrackInfo info;
+		info.path = TEST_SONG;
+		info.mtime = 1234;
+		library.TrackEvent(5, FILE_CREATED, info, 1);
+		library.Committed(1);
+
+		ASSERT_TRUE(server.Listen(0));
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(server.Port());
+		ASSERT_EQ(0, connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+	}
+	virtual void TearDown() {
+		close(fd);
+		rm_files();
+	}
+
+	/* sends 'req' and returns the response, split into head and body */
+	std::string get(const std::string& req, std::string& body, bool head_only = false) {
+		EXPECT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+		std::string resp;
+		size_t head_end = std::string::npos, len = (size_t)-1;
+		for (int i = 0; i < 5000 && resp.size() < len; ++i) {
+			loop.run(ev::NOWAIT);
+			char buf[65536];
+			ssize_t got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+			if (got > 0) {
+				resp.append(buf, got);
+			} else if (got == 0) {
+				break;
+			} else {
+				usleep(1000);
+			}
+			if (head_end == std::string::npos &&
+					(head_end = resp.find("\r\n\r\n")) != std::string::npos) {
+				size_t cl = resp.find("Content-Length: ");
+				len = head_end + 4 + (head_only ? 0 : atol(resp.c_str() + cl + 16));
+			}
+		}
+		if (head_end == std::string::npos) {
+			return resp;
+		}
+		body = resp.substr(head_end + 4);
+		return resp.substr(0, head_end + 2);
+	}
+
+	ev::default_loop loop;
+	Library library;
+	Compressor compressor;
+	Daap daap;
+	Server server;
+	int fd;
+	std::string song;
+
+private:
+	void rm_files() {
+		unlink(TEST_IMAGE);
+		unlink(TEST_IMAGE ".delta");
+		unlink(TEST_SONG);
+	}
+};
+
+TEST_F(DaapTest, whole) {
+	std::string body;
+	std::string head = get("GET /databases/1/items/5.mp3?session-id=1 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 200 OK\r\n")) << head;
+	EXPECT_NE(std::string::npos, head.find("Content-Type: audio/mpeg\r\n")) << head;
+	EXPECT_NE(std::string::npos, head.find("Accept-Ranges: bytes\r\n")) << head;
+	EXPECT_TRUE(body == song);
+
+	/* HEAD: same length, no body */
+	head = get("HEAD /databases/1/items/5.mp3 HTTP/1.1\r\n\r\n", body, true);
+	EXPECT_NE(std::string::npos, head.find("Content-Length: 300000\r\n")) << head;
+	EXPECT_EQ("", body);
+
+	head = get("GET /databases/1/items/6.mp3 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 404 Not Found\r\n")) << head;
+	head = get("GET /databases/1/items/5 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 404 Not Found\r\n")) << head;
+}
+
+TEST_F(DaapTest, ranges) {
+	std::string body;
+	std::string head = get("GET /databases/1/items/5.mp3 HTTP/1.1\r\n"
+			"Range: bytes=1000-1999\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 206 Partial Content\r\n")) << head;
+	EXPECT_NE(std::string::npos, head.find("Content-Range: bytes 1000-1999/300000\r\n")) << head;
+	EXPECT_TRUE(body == song.substr(1000, 1000));
+
+	head = get("GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=299000-\r\n\r\n", body);
+	EXPECT_NE(std::string::npos, head.find("Content-Range: bytes 299000-299999/300000\r\n")) << head;
+	EXPECT_TRUE(body == song.substr(299000));
+
+	/* suffix, and an end past the end of the file */
+	head = get("GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=-10\r\n\r\n", body);
+	EXPECT_NE(std::string::npos, head.find("Content-Range: bytes 299990-299999/300000\r\n")) << head;
+	EXPECT_TRUE(body == song.substr(299990));
+	head = get("GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=5-999999\r\n\r\n", body);
+	EXPECT_NE(std::string::npos, head.find("Content-Range: bytes 5-299999/300000\r\n")) << head;
+	EXPECT_TRUE(body == song.substr(5));
+
+	head = get("GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=300000-\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 416 ")) << head;
+	EXPECT_NE(std::string::npos, head.find("Content-Range: bytes */300000\r\n")) << head;
+	EXPECT_EQ("", body);
+
+	/* multiple or malformed ranges: the whole file */
+	head = get("GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=0-1,5-6\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 200 OK\r\n")) << head;
+	EXPECT_TRUE(body == song);
+	head = get("GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=9-1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 200 OK\r\n")) << head;
+}
+
+TEST_F(DaapTest, pipelined) {
+	/* a file response followed by another: the second waits for the file */
+	std::string req =
+		"GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=0-99999\r\n\r\n"
+		"GET /databases/1/items/5.mp3 HTTP/1.1\r\nRange: bytes=100000-100009\r\n\r\n";
+	std::string body;
+	std::string head = get(req, body);
+	EXPECT_NE(std::string::npos, head.find("Content-Range: bytes 0-99999/300000\r\n")) << head;
+	EXPECT_TRUE(body.substr(0, 100000) == song.substr(0, 100000));
+
+	std::string rest = body.substr(100000);
+	for (int i = 0; i < 1000 && rest.find(song.substr(100000, 10)) == std::string::npos; ++i) {
+		loop.run(ev::NOWAIT);
+		char buf[4096];
+		ssize_t got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (got > 0) {
+			rest.append(buf, got);
+		} else {
+			usleep(1000);
+		}
+	}
+	EXPECT_EQ(0, rest.find("HTTP/1.1 206 Partial Content\r\n")) << rest;
+	size_t body_start = rest.find("\r\n\r\n");
+	ASSERT_NE(std::string::npos, body_start);
+	EXPECT_TRUE(rest.substr(body_start + 4) == song.substr(100000, 10));
+}
+
+/* finds the value of the first 'code' field within 'dmap' */
+static std::string field(const std::string& dmap, const char* code, size_t from = 0) {
+	size_t pos = dmap.find(code, from);
+	if (pos == std::string::npos || pos + 8 > dmap.size()) {
+		return "";
+	}
+	const unsigned char* len = (const unsigned char*)dmap.data() + pos + 4;
+	return dmap.substr(pos + 8, len[0] << 24 | len[1] << 16 | len[2] << 8 | len[3]);
+}
+
+TEST_F(DaapTest, items) {
+	TrackInfo info;
+	info.path = "/music/b.ogg";
+	info.strs[TITLE] = "Title B";
+	info.strs[ARTIST] = "Artist";
+	info.ints[YEAR] = 1999;
+	library.TrackEvent(6, FILE_CREATED, info, 2);
+	library.Committed(2);
+
+	std::string body;
+	std::string head = get("GET /databases/1/items HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 200 OK\r\n")) << head;
+	EXPECT_EQ(0, body.find("adbs"));
+	EXPECT_EQ(body.size() - 8, field(body, "adbs").size());
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mrco"));
+	std::string mlcl = field(body, "mlcl");
+	EXPECT_EQ(body.size(), body.find("mlcl") + 8 + mlcl.size());
+
+	/* the first item has no tags, just its id and format */
+	EXPECT_EQ(std::string("\0\0\0\5", 4), field(mlcl, "miid"));
+	EXPECT_EQ("mp3", field(mlcl, "asfm"));
+	size_t second = 8 + field(mlcl, "mlit").size();
+	EXPECT_EQ(std::string("\0\0\0\6", 4), field(mlcl, "miid", second));
+	EXPECT_EQ("Title B", field(mlcl, "minm", second));
+	EXPECT_EQ("Artist", field(mlcl, "asar", second));
+	EXPECT_EQ(std::string("\x07\xcf", 2), field(mlcl, "asyr", second));
+	EXPECT_EQ("ogg", field(mlcl, "asfm", second));
+
+	/* a retagged track is reencoded, a removed one is dropped */
+	info.strs[TITLE] = "New Title";
+	library.TrackEvent(6, FILE_CHANGED, info, 3);
+	library.TrackEvent(5, FILE_REMOVED, TrackInfo(), 3);
+	library.Committed(3);
+	head = get("GET /databases/1/items HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\1", 4), field(body, "mrco"));
+	EXPECT_EQ("New Title", field(body, "minm"));
+	EXPECT_EQ(body.size() - 8, field(body, "adbs").size());
+
+	head = get("GET /databases/1/containers/1/items HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, body.find("apso"));
+	EXPECT_EQ(body.size() - 8, field(body, "apso").size());
+	EXPECT_EQ(std::string("\0\0\0\6", 4), field(body, "mcti"));
+
+	head = get("GET /update HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\3", 4), field(body, "musr"));
+
+	/* a subset of the fields is encoded on the fly */
+	head = get("GET /databases/1/items?meta=dmap.itemid%2Cdmap.itemname HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(body.size() - 8, field(body, "adbs").size());
+	EXPECT_EQ(std::string("mlit\0\0\0\x1d" "miid\0\0\0\4\0\0\0\6" "minm\0\0\0\x09New Title", 37),
+			field(body, "mlcl"));
+	head = get("GET /databases/1/containers/1/items?meta=dmap.itemid HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\6", 20),
+			field(body, "mlcl"));
+}
+
+TEST_F(DaapTest, playlists) {
+	std::vector<Playlist> specs(1);
+	specs[0].name = "Nineties";
+	specs[0].rule = Rule::Int(YEAR, Rule::INT_RANGE, 1990, 1999);
+	library.SetPlaylists(specs);
+
+	TrackInfo info;
+	info.path = "/music/b.ogg";
+	info.ints[YEAR] = 1999;
+	library.TrackEvent(6, FILE_CREATED, info, 2);
+	info.ints[YEAR] = 2001;
+	library.TrackEvent(7, FILE_CREATED, info, 2);
+	library.Committed(2);
+
+	std::string body;
+	get("GET /databases/1/containers HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(body.size() - 8, field(body, "aply").size());
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mrco"));
+	size_t second = body.find("mlit", body.find("mlit") + 1);
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "miid", second));
+	EXPECT_EQ("Nineties", field(body, "minm", second));
+	EXPECT_EQ(std::string("\0\0\0\1", 4), field(body, "mimc", second));
+
+	get("GET /databases/1/containers/2/items?meta=dmap.itemid HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(body.size() - 8, field(body, "apso").size());
+	EXPECT_EQ(std::string("mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\6", 20),
+			field(body, "mlcl"));
+
+	/* kept up to date with the tracks */
+	library.TrackEvent(7, FILE_CHANGED, info, 3);
+	info.ints[YEAR] = 1995;
+	library.TrackEvent(7, FILE_CHANGED, info, 3);
+	library.Committed(3);
+	get("GET /databases/1/containers/2/items?meta=dmap.itemid HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mrco"));
+
+	std::string head = get("GET /databases/1/containers/3/items HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 404 ")) << head;
+}
+
+TEST_F(DaapTest, query) {
+	TrackInfo info;
+	info.path = "/music/b.ogg";
+	info.strs[ARTIST] = "Some Artist";
+	info.strs[ALBUM] = "Album";
+	library.TrackEvent(6, FILE_CREATED, info, 2);
+	info.strs[ALBUM] = "Other";
+	library.TrackEvent(7, FILE_CREATED, info, 2);
+	library.Committed(2);
+
+	std::string body;
+	std::string head = get("GET /databases/1/items?meta=dmap.itemid&query="
+			"%28%27daap.songartist:Some+Artist%27+%27daap.songalbum:Other%27%29 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 200 OK\r\n")) << head;
+	EXPECT_EQ(std::string("\0\0\0\1", 4), field(body, "mtco"));
+	EXPECT_EQ(std::string("mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\7", 20),
+			field(body, "mlcl"));
+
+	/* the preencoded entries */
+	head = get("GET /databases/1/items?query=%27daap.songartist:some+artist%27 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(body.size() - 8, field(body, "adbs").size());
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mrco"));
+	EXPECT_EQ(std::string("\0\0\0\6", 4), field(body, "miid"));
+
+	head = get("GET /databases/1/containers/1/items?meta=dmap.itemid&query="
+			"%27daap.songalbum!:Other%27 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mrco"));
+
+	head = get("GET /databases/1/items?query=%27daap.songartist HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 400 ")) << head;
+}
+
+TEST_F(DaapTest, browse) {
+	TrackInfo info;
+	info.path = "/music/b.ogg";
+	info.strs[ARTIST] = "Beta";
+	info.strs[ALBUM] = "One";
+	library.TrackEvent(6, FILE_CREATED, info, 2);
+	info.strs[ARTIST] = "Alpha";
+	library.TrackEvent(7, FILE_CREATED, info, 2);
+	info.strs[ALBUM] = "Two";
+	library.TrackEvent(8, FILE_CREATED, info, 2);
+	library.Committed(2);
+
+	std::string body;
+	std::string head = get("GET /databases/1/browse/artists HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 200 OK\r\n")) << head;
+	EXPECT_EQ(body.size() - 8, field(body, "abro").size());
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mtco"));
+	EXPECT_EQ(std::string("mlit\0\0\0\5" "Alpha" "mlit\0\0\0\4" "Beta", 25),
+			field(body, "abar"));
+
+	head = get("GET /databases/1/browse/albums?filter=%27daap.songartist:Alpha%27 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("mlit\0\0\0\3" "One" "mlit\0\0\0\3" "Two", 22),
+			field(body, "abal"));
+	head = get("GET /databases/1/browse/albums?filter=%27daap.songartist:Beta%27 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("mlit\0\0\0\3" "One", 11), field(body, "abal"));
+
+	head = get("GET /databases/1/browse/composers HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\0", 4), field(body, "mtco"));
+	head = get("GET /databases/1/browse/moods HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(0, head.find("HTTP/1.1 404 ")) << head;
+}
+
+TEST_F(DaapTest, sorted) {
+	TrackInfo info;
+	info.path = "/music/b.ogg";
+	info.strs[TITLE] = "B";
+	info.strs[ARTIST] = "The Zombies";
+	library.TrackEvent(6, FILE_CREATED, info, 2);
+	info.strs[TITLE] = "C";
+	info.strs[ARTIST] = "Abba";
+	library.TrackEvent(7, FILE_CREATED, info, 2);
+	library.Committed(2);
+
+	std::string body;
+	get("GET /databases/1/items?meta=dmap.itemid&sort=artist HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\5"
+					"mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\7"
+					"mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\6", 60),
+			field(body, "mlcl"));
+
+	/* the preencoded entries, in order */
+	get("GET /databases/1/items?sort=name HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(body.size() - 8, field(body, "adbs").size());
+	size_t second = body.find("mlit", body.find("mlit") + 1);
+	EXPECT_EQ("B", field(body, "minm", second));
+
+	get("GET /databases/1/containers/1/items?meta=dmap.itemid&sort=name&query="
+			"%27daap.songartist!:Abba%27 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\5"
+					"mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\6", 40),
+			field(body, "mlcl"));
+}
+
+TEST_F(DaapTest, delta) {
+	TrackInfo info;
+	info.path = "/music/b.ogg";
+	info.strs[TITLE] = "B";
+	library.TrackEvent(6, FILE_CREATED, info, 2);
+	library.TrackEvent(7, FILE_CREATED, info, 2);
+	library.Committed(2);
+	info.strs[TITLE] = "B2";
+	library.TrackEvent(6, FILE_CHANGED, info, 3);
+	library.TrackEvent(5, FILE_REMOVED, TrackInfo(), 3);
+	library.Committed(3);
+
+	std::string body;
+	get("GET /databases/1/items?revision-number=3&delta=2 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(body.size() - 8, field(body, "adbs").size());
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mtco"));
+	EXPECT_EQ(std::string("\0\0\0\1", 4), field(body, "mrco"));
+	EXPECT_EQ("B2", field(body, "minm"));
+	std::string mudl = field(body, "mudl");
+	EXPECT_EQ(std::string("miid\0\0\0\4\0\0\0\5", 12), mudl);
+
+	get("GET /databases/1/containers/1/items?revision-number=3&delta=1 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(body.size() - 8, field(body, "apso").size());
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mrco"));
+	EXPECT_EQ(mudl, field(body, "mudl"));
+
+	/* nothing new */
+	get("GET /databases/1/items?revision-number=3&delta=3 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\0", 4), field(body, "mrco"));
+	EXPECT_EQ(std::string::npos, body.find("mudl"));
+
+	/* from the future: everything */
+	get("GET /databases/1/items?revision-number=3&delta=9 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(body, "mrco"));
+}
+
+static std::string inflate_all(const std::string& in, int window_bits) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	EXPECT_EQ(Z_OK, inflateInit2(&stream, window_bits));
+	stream.next_in = (Bytef*)in.data();
+	stream.avail_in = in.size();
+	std::string out;
+	int ret;
+	do {
+		char buf[4096];
+		stream.next_out = (Bytef*)buf;
+		stream.avail_out = sizeof(buf);
+		ret = inflate(&stream, Z_NO_FLUSH);
+		out.append(buf, sizeof(buf) - stream.avail_out);
+	} while (ret == Z_OK);
+	EXPECT_EQ(Z_STREAM_END, ret);
+	inflateEnd(&stream);
+	return out;
+}
+
+TEST_F(DaapTest, compressed) {
+	TrackInfo info;
+	info.path = "/music/b.ogg";
+	info.strs[ARTIST] = "Artist";
+	for (item_id_t id = 10; id < 100; ++id) {
+		info.strs[TITLE] = "Title " + std::to_string(id);
+		library.TrackEvent(id, FILE_CREATED, info, 2);
+	}
+	library.Committed(2);
+
+	std::string plain, body;
+	std::string head = get("GET /databases/1/items HTTP/1.1\r\n\r\n", plain);
+	EXPECT_EQ(std::string::npos, head.find("Content-Encoding"));
+	EXPECT_GT(plain.size(), 1024);
+
+	/* compressed in the background, then cached for the revision */
+	for (int i = 0; i < 2; ++i) {
+		head = get("GET /databases/1/items HTTP/1.1\r\n"
+				"Accept-Encoding: deflate, gzip\r\n\r\n", body);
+		EXPECT_NE(std::string::npos, head.find("Content-Encoding: gzip\r\n")) << head;
+		EXPECT_NE(std::string::npos, head.find("Vary: Accept-Encoding\r\n")) << head;
+		EXPECT_LT(body.size(), plain.size());
+		EXPECT_EQ(plain, inflate_all(body, 15 + 16));
+		EXPECT_TRUE(compressor.Get(2, (uint64_t)1 << 32 | dmap::ITEM_FIELDS, ENCODING_GZIP));
+	}
+
+	/* q=0 turns an encoding down */
+	head = get("GET /databases/1/containers/1/items HTTP/1.1\r\n"
+			"Accept-Encoding: gzip;q=0, deflate;q=0.5\r\n\r\n", body);
+	EXPECT_NE(std::string::npos, head.find("Content-Encoding: deflate\r\n")) << head;
+	body = inflate_all(body, 15);
+	EXPECT_EQ(0, body.find("apso"));
+	EXPECT_EQ(body.size() - 8, field(body, "apso").size());
+	head = get("GET /databases/1/items HTTP/1.1\r\n"
+			"Accept-Encoding: gzip;q=0.0\r\n\r\n", body);
+	EXPECT_EQ(std::string::npos, head.find("Content-Encoding"));
+	EXPECT_EQ(plain, body);
+
+	/* each meta= set is its own variant */
+	head = get("GET /databases/1/items?meta=dmap.itemid HTTP/1.1\r\n"
+			"Accept-Encoding: gzip\r\n\r\n", body);
+	EXPECT_NE(std::string::npos, head.find("Content-Encoding: gzip\r\n")) << head;
+	body = inflate_all(body, 15 + 16);
+	EXPECT_EQ(std::string("mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\5", 20),
+			field(body, "mlcl").substr(0, 20));
+
+	/* deltas and small responses aren't worth it */
+	head = get("GET /databases/1/items?revision-number=2&delta=1 HTTP/1.1\r\n"
+			"Accept-Encoding: gzip\r\n\r\n", body);
+	EXPECT_EQ(std::string::npos, head.find("Content-Encoding"));
+	library.TrackEvent(5, FILE_REMOVED, TrackInfo(), 3);
+	for (item_id_t id = 11; id < 100; ++id) {
+		library.TrackEvent(id, FILE_REMOVED, TrackInfo(), 3);
+	}
+	library.Committed(3);
+	head = get("GET /databases/1/items HTTP/1.1\r\n"
+			"Accept-Encoding: gzip\r\n\r\n", body);
+	EXPECT_EQ(std::string::npos, head.find("Content-Encoding"));
+	EXPECT_EQ("Title 10", field(body, "minm"));
+}
+
+TEST_F(DaapTest, update_long_poll) {
+	std::string body;
+	/* out of date: answered right away */
+	get("GET /update?revision-number=0 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\1", 4), field(body, "musr"));
+
+	/* up to date: waits for the next revision */
+	std::string req = "GET /update?revision-number=1 HTTP/1.1\r\n\r\n"
+		"GET /update HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	for (int i = 0; i < 20; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	char c;
+	EXPECT_EQ(-1, recv(fd, &c, 1, MSG_DONTWAIT));
+	EXPECT_EQ(1, server.Clients());
+
+	/* the pipelined request behind it is answered after it, though with
+	 * the revision as of when it was received */
+	TrackInfo info;
+	info.path = "/music/c.mp3";
+	library.TrackEvent(9, FILE_CREATED, info, 2);
+	library.Committed(2);
+	std::string resp;
+	for (int i = 0; i < 1000 && resp.size() < 2 * 36; ++i) {
+		loop.run(ev::NOWAIT);
+		char buf[1024];
+		ssize_t got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (got > 0) {
+			resp.append(buf, got);
+		} else {
+			usleep(1000);
+		}
+	}
+	size_t first = resp.find("mupd");
+	ASSERT_NE(std::string::npos, first) << resp;
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(resp, "musr"));
+	size_t second = resp.find("mupd", first + 1);
+	ASSERT_NE(std::string::npos, second) << resp;
+	EXPECT_EQ(std::string("\0\0\0\1", 4), field(resp, "musr", second));
+}
+
+TEST_F(DaapTest, update_playlist_swap) {
+	std::string req = "GET /update?revision-number=1 HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	std::vector<Playlist> specs(1);
+	specs[0].name = "Nineties";
+	specs[0].rule = Rule::Int(YEAR, Rule::INT_RANGE, 1990, 1999);
+
+	/* republishing the same revision isn't news to the waiter */
+	library.SetPlaylists(specs);
+	for (int i = 0; i < 20; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	char c;
+	EXPECT_EQ(-1, recv(fd, &c, 1, MSG_DONTWAIT));
+
+	/* a swap with its own revision is */
+	std::shared_ptr<const LibrarySnapshot> from = library.Published();
+	std::unique_ptr<PlaylistSet> built(new PlaylistSet);
+	built->Load(specs, *from->tracks, from->paths.get());
+	library.SwapPlaylists(specs, std::move(built), *from, 2);
+	std::string resp;
+	for (int i = 0; i < 1000 && resp.find("musr") == std::string::npos; ++i) {
+		loop.run(ev::NOWAIT);
+		char buf[1024];
+		ssize_t got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (got > 0) {
+			resp.append(buf, got);
+		} else {
+			usleep(1000);
+		}
+	}
+	EXPECT_EQ(std::string("\0\0\0\2", 4), field(resp, "musr"));
+
+	/* and no tracks changed with it */
+	std::string body;
+	get("GET /databases/1/items?revision-number=2&delta=1 HTTP/1.1\r\n\r\n", body);
+	EXPECT_EQ(std::string("\0\0\0\0", 4), field(body, "mrco"));
+}
+
+TEST(FileCache, reuse) {
+	FILE* file = fopen(TEST_SONG, "w");
+	ASSERT_TRUE(file != NULL);
+	fputs("hello", file);
+	fclose(file);
+
+	FileCache cache(1);
+	std::shared_ptr<const OpenFile> a = cache.Open(TEST_SONG, 1);
+	ASSERT_TRUE((bool)a);
+	EXPECT_EQ(5, a->size);
+	EXPECT_EQ(a, cache.Open(TEST_SONG, 1));
+	/* changed since: reopened */
+	std::shared_ptr<const OpenFile> b = cache.Open(TEST_SONG, 2);
+	EXPECT_NE(a, b);
+	EXPECT_EQ(1, cache.Size());
+	/* the old one is still usable by whoever holds it */
+	char c;
+	EXPECT_EQ(1, pread(a->fd, &c, 1, 0));
+
+	EXPECT_FALSE((bool)cache.Open("nonexistent_file", 1));
+	unlink(TEST_SONG);
+}
+
+int main(int argc, char **argv) {
+	signal(SIGPIPE, SIG_IGN);
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
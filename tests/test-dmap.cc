@@ -0,0 +1,100 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <dmap.h>
+
+using namespace adaapd;
+
+#define STR(literal) std::string(literal, sizeof(literal) - 1)
+
+TEST(Dmap, writers) {
+	std::string out;
+	dmap::Byte(out, "mikd", 2);
+	EXPECT_EQ(STR("mikd\0\0\0\1\2"), out);
+	out.clear();
+	dmap::Short(out, "asyr", 1999);
+	EXPECT_EQ(STR("asyr\0\0\0\2\x07\xcf"), out);
+	out.clear();
+	dmap::Long(out, "mper", 0x0102030405060708ULL);
+	EXPECT_EQ(STR("mper\0\0\0\x08\1\2\3\4\5\6\7\x08"), out);
+	out.clear();
+
+	size_t begin = dmap::Begin(out, "mupd");
+	dmap::Int(out, "musr", 5);
+	dmap::String(out, "minm", "ab");
+	dmap::End(out, begin);
+	EXPECT_EQ(STR("mupd\0\0\0\x16" "musr\0\0\0\4\0\0\0\5" "minm\0\0\0\2ab"), out);
+}
+
+TEST(Dmap, fields) {
+	EXPECT_EQ(dmap::Bit(dmap::FIELD_ITEM_ID) | dmap::Bit(dmap::FIELD_TITLE) |
+			dmap::Bit(dmap::FIELD_YEAR),
+			dmap::Fields("dmap.itemid,dmap.itemname,daap.songyear,com.apple.itunes.unknown"));
+	EXPECT_EQ(0, dmap::Fields(""));
+	EXPECT_EQ(0, dmap::Fields("dmap.itemidx,dmap.item"));
+	EXPECT_EQ(dmap::Bit(dmap::FIELD_ITEM_KIND), dmap::Fields(",dmap.itemkind,"));
+}
+
+TEST(Dmap, plans) {
+	TrackStore tracks;
+	TrackInfo info;
+	info.path = "/music/a.flac";
+	info.strs[TITLE] = "Title";
+	info.ints[YEAR] = 1999;
+	info.ints[SAMPLE_RATE] = 44100;
+	tracks.Set(3, info);
+	tracks.Set(4, TrackInfo());
+
+	dmap::EncodePlan plan(dmap::Fields("dmap.itemid,dmap.itemname,daap.songyear,"
+					"daap.songsamplerate,daap.songformat,daap.songartist"));
+	std::string out;
+	plan.Item(out, tracks, 3);
+	EXPECT_EQ(STR("mlit\0\0\0\x3b"
+					"miid\0\0\0\4\0\0\0\3"
+					"asfm\0\0\0\4flac"
+					"minm\0\0\0\5Title"
+					"assr\0\0\0\4\0\0\xac\x44"
+					"asyr\0\0\0\2\x07\xcf"), out);
+
+	/* missing values are left out */
+	out.clear();
+	plan.Item(out, tracks, 4);
+	EXPECT_EQ(STR("mlit\0\0\0\x0c" "miid\0\0\0\4\0\0\0\4"), out);
+
+	std::vector<item_id_t> ids;
+	ids.push_back(4);
+	ids.push_back(3);
+	std::string items;
+	plan.Items(items, tracks, ids);
+	std::string expected;
+	plan.Item(expected, tracks, 4);
+	plan.Item(expected, tracks, 3);
+	EXPECT_EQ(expected, items);
+
+	/* nothing at all */
+	out.clear();
+	dmap::EncodePlan empty(0);
+	empty.Item(out, tracks, 3);
+	EXPECT_EQ(STR("mlit\0\0\0\0"), out);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
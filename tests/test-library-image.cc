@@ -0,0 +1,359 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <library-image.h>
+#include <logging.h>
+
+#include "test-tracks.h"
+
+#define TEST_IMAGE "test_library.img"
+
+using namespace adaapd;
+
+static void expect_same(const TrackStore& a, const TrackStore& b) {
+	ASSERT_EQ(a.Size(), b.Size());
+	ASSERT_EQ(a.End(), b.End());
+	for (item_id_t id = 0; id < a.End(); ++id) {
+		ASSERT_EQ(a.Has(id), b.Has(id)) << id;
+		if (!a.Has(id)) {
+			continue;
+		}
+		EXPECT_STREQ(a.Path(id), b.Path(id));
+		EXPECT_EQ(a.Mtime(id), b.Mtime(id));
+		for (int i = 0; i < TAG_INT_COUNT; ++i) {
+			EXPECT_EQ(a.Int(id, (Tag_IntId)i), b.Int(id, (Tag_IntId)i));
+		}
+		for (int i = 0; i < TAG_STR_COUNT; ++i) {
+			EXPECT_STREQ(a.Str(id, (Tag_StrId)i), b.Str(id, (Tag_StrId)i));
+		}
+	}
+}
+
+class LibraryImageTest : public testing::Test {
+protected:
+	virtual void SetUp() {
+		rm_image();
+	}
+	virtual void TearDown() {
+		rm_image();
+	}
+
+private:
+	void rm_image() {
+		unlink(TEST_IMAGE);
+		unlink(TEST_IMAGE ".delta");
+		unlink(TEST_IMAGE ".tmp");
+	}
+};
+
+TEST_F(LibraryImageTest, missing) {
+	LibraryImage image(TEST_IMAGE);
+	TrackStore store;
+	revision_t revision;
+	EXPECT_FALSE(image.Load(store, 10, revision));
+	EXPECT_EQ(0, store.Size());
+}
+
+TEST_F(LibraryImageTest, write_load) {
+	TrackStore store;
+	for (item_id_t id = 1; id < 3 * CHUNK_SIZE; id += 3) {
+		store.Set(id, TestTrack(id));
+	}
+	store.Remove(4);
+	/* leaves an unreferenced string behind, which shouldn't be written */
+	store.Set(7, TestTrack(8));
+
+	{
+		LibraryImage image(TEST_IMAGE);
+		ASSERT_TRUE(image.Write(store, 5));
+	}
+
+	LibraryImage image(TEST_IMAGE);
+	TrackStore loaded;
+	revision_t revision = 0;
+	ASSERT_TRUE(image.Load(loaded, 5, revision));
+	EXPECT_EQ(5, revision);
+	expect_same(store, loaded);
+	EXPECT_LT(loaded.Strings().Size(), store.Strings().Size());
+
+	/* the mapped store can still be modified */
+	loaded.Set(2, TestTrack(2));
+	loaded.Set(3 * CHUNK_SIZE + 1, TestTrack(3 * CHUNK_SIZE + 1));
+	loaded.Remove(1);
+	store.Set(2, TestTrack(2));
+	store.Set(3 * CHUNK_SIZE + 1, TestTrack(3 * CHUNK_SIZE + 1));
+	store.Remove(1);
+	expect_same(store, loaded);
+
+	/* an image newer than what the caller expects is rejected */
+	TrackStore too_new;
+	EXPECT_FALSE(image.Load(too_new, 4, revision));
+	EXPECT_EQ(0, too_new.Size());
+}
+
+TEST_F(LibraryImageTest, delta) {
+	TrackStore store;
+	for (item_id_t id = 1; id < 100; ++id) {
+		store.Set(id, TestTrack(id));
+	}
+	{
+		LibraryImage image(TEST_IMAGE);
+		ASSERT_TRUE(image.Write(store, 1));
+
+		/* revision 2 and 3 changes */
+		TrackInfo info = TestTrack(200);
+		store.Set(200, info);
+		ASSERT_TRUE(image.Append(200, FILE_CREATED, info, 2));
+		store.Remove(10);
+		ASSERT_TRUE(image.Append(10, FILE_REMOVED, TrackInfo(), 2));
+		info = TestTrack(5);
+		info.strs[ALBUM] = "new album";
+		store.Set(5, info);
+		ASSERT_TRUE(image.Append(5, FILE_CHANGED, info, 3));
+		EXPECT_EQ(3, image.DeltaCount());
+	}
+
+	{
+		/* revision 3 wasn't committed: ignored */
+		LibraryImage image(TEST_IMAGE);
+		TrackStore loaded;
+		revision_t revision = 0;
+		ASSERT_TRUE(image.Load(loaded, 2, revision));
+		EXPECT_EQ(2, revision);
+		EXPECT_STREQ("", loaded.Str(5, ALBUM));
+		EXPECT_TRUE(loaded.Has(200));
+		EXPECT_FALSE(loaded.Has(10));
+	}
+
+	LibraryImage image(TEST_IMAGE);
+	TrackStore loaded;
+	revision_t revision = 0;
+	ASSERT_TRUE(image.Load(loaded, 3, revision));
+	EXPECT_EQ(3, revision);
+	EXPECT_EQ(3, image.DeltaCount());
+	expect_same(store, loaded);
+
+	/* a revision without any track changes still counts */
+	ASSERT_TRUE(image.Mark(4));
+	{
+		LibraryImage marked(TEST_IMAGE);
+		TrackStore reloaded;
+		ASSERT_TRUE(marked.Load(reloaded, 4, revision));
+		EXPECT_EQ(4, revision);
+		expect_same(store, reloaded);
+	}
+
+	/* compacting empties the delta log */
+	ASSERT_TRUE(image.Write(loaded, 3));
+	EXPECT_EQ(0, image.DeltaCount());
+	TrackStore compacted;
+	ASSERT_TRUE(image.Load(compacted, 3, revision));
+	EXPECT_EQ(3, revision);
+	EXPECT_EQ(0, image.DeltaCount());
+	expect_same(store, compacted);
+}
+
+TEST_F(LibraryImageTest, write_in_halves) {
+	TrackStore store;
+	store.Set(1, TestTrack(1));
+	LibraryImage image(TEST_IMAGE);
+	ASSERT_TRUE(image.Write(store, 1));
+	store.Set(2, TestTrack(2));
+	ASSERT_TRUE(image.Append(2, FILE_CREATED, TestTrack(2), 2));
+
+	/* revision 3 arrives while revision 2 is being written */
+	std::shared_ptr<const TrackStore> snapshot = store.Snapshot();
+	uint64_t end = image.DeltaEnd();
+	store.Set(3, TestTrack(3));
+	ASSERT_TRUE(image.Append(3, FILE_CREATED, TestTrack(3), 3));
+	ASSERT_TRUE(image.WriteImage(*snapshot, 2));
+	ASSERT_TRUE(image.DropDelta(end));
+	EXPECT_EQ(1, image.DeltaCount());
+	ASSERT_TRUE(image.Append(4, FILE_REMOVED, TrackInfo(), 4));
+	EXPECT_EQ(2, image.DeltaCount());
+	store.Remove(4);
+
+	LibraryImage reloaded(TEST_IMAGE);
+	TrackStore loaded;
+	revision_t revision = 0;
+	ASSERT_TRUE(reloaded.Load(loaded, 4, revision));
+	EXPECT_EQ(4, revision);
+	EXPECT_EQ(2, reloaded.DeltaCount());
+	expect_same(store, loaded);
+}
+
+TEST_F(LibraryImageTest, truncated_delta) {
+	TrackStore store;
+	store.Set(1, TestTrack(1));
+	{
+		LibraryImage image(TEST_IMAGE);
+		ASSERT_TRUE(image.Write(store, 1));
+		ASSERT_TRUE(image.Append(2, FILE_CREATED, TestTrack(2), 2));
+		ASSERT_TRUE(image.Append(3, FILE_CREATED, TestTrack(3), 2));
+	}
+	/* chop off part of the last record */
+	FILE* f = fopen(TEST_IMAGE ".delta", "r+");
+	ASSERT_TRUE(f != NULL);
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	ASSERT_EQ(0, truncate(TEST_IMAGE ".delta", size - 3));
+
+	LibraryImage image(TEST_IMAGE);
+	TrackStore loaded;
+	revision_t revision = 0;
+	ASSERT_TRUE(image.Load(loaded, 2, revision));
+	EXPECT_TRUE(loaded.Has(2));
+	EXPECT_FALSE(loaded.Has(3));
+	EXPECT_EQ(1, image.DeltaCount());
+
+	/* later records aren't lost behind the garbage */
+	ASSERT_TRUE(image.Append(4, FILE_CREATED, TestTrack(4), 3));
+	LibraryImage image2(TEST_IMAGE);
+	TrackStore loaded2;
+	ASSERT_TRUE(image2.Load(loaded2, 3, revision));
+	EXPECT_EQ(3, revision);
+	EXPECT_TRUE(loaded2.Has(4));
+}
+
+TEST_F(LibraryImageTest, short_tail) {
+	TrackStore store;
+	store.Set(1, TestTrack(1));
+	{
+		LibraryImage image(TEST_IMAGE);
+		ASSERT_TRUE(image.Write(store, 1));
+		ASSERT_TRUE(image.Append(2, FILE_CREATED, TestTrack(2), 2));
+	}
+	/* less than a record header of junk after the last record */
+	FILE* f = fopen(TEST_IMAGE ".delta", "a");
+	ASSERT_TRUE(f != NULL);
+	fputs("junk", f);
+	fclose(f);
+
+	LibraryImage image(TEST_IMAGE);
+	TrackStore loaded;
+	revision_t revision = 0;
+	ASSERT_TRUE(image.Load(loaded, 2, revision));
+	EXPECT_TRUE(loaded.Has(2));
+	ASSERT_TRUE(image.Append(3, FILE_CREATED, TestTrack(3), 3));
+
+	LibraryImage image2(TEST_IMAGE);
+	TrackStore loaded2;
+	ASSERT_TRUE(image2.Load(loaded2, 3, revision));
+	EXPECT_TRUE(loaded2.Has(2));
+	EXPECT_TRUE(loaded2.Has(3));
+}
+
+TEST_F(LibraryImageTest, bad_id) {
+	TrackStore store;
+	store.Set(1, TestTrack(1));
+	{
+		LibraryImage image(TEST_IMAGE);
+		ASSERT_TRUE(image.Write(store, 1));
+		ASSERT_TRUE(image.Append(0x7fffffff, FILE_CREATED, TestTrack(2), 2));
+		ASSERT_TRUE(image.Append(3, FILE_CREATED, TestTrack(3), 2));
+	}
+	LibraryImage image(TEST_IMAGE);
+	TrackStore loaded;
+	revision_t revision = 0;
+	ASSERT_TRUE(image.Load(loaded, 2, revision));
+	/* skipped rather than making room for it */
+	EXPECT_EQ(4, loaded.End());
+	EXPECT_TRUE(loaded.Has(3));
+}
+
+TEST_F(LibraryImageTest, corrupt) {
+	FILE* f = fopen(TEST_IMAGE, "w");
+	ASSERT_TRUE(f != NULL);
+	for (int i = 0; i < 1000; ++i) {
+		fputs("not an image", f);
+	}
+	fclose(f);
+
+	LibraryImage image(TEST_IMAGE);
+	TrackStore store;
+	revision_t revision;
+	EXPECT_FALSE(image.Load(store, 10, revision));
+	EXPECT_EQ(0, store.Size());
+}
+
+static std::string read_image() {
+	std::ifstream in(TEST_IMAGE, std::ios::binary);
+	std::ostringstream out;
+	out << in.rdbuf();
+	return out.str();
+}
+
+static bool load_patched(const std::string& data) {
+	std::ofstream(TEST_IMAGE, std::ios::binary | std::ios::trunc) << data;
+	LibraryImage image(TEST_IMAGE);
+	TrackStore store;
+	revision_t revision;
+	bool ok = image.Load(store, 10, revision);
+	EXPECT_EQ(ok ? 3 : 0, store.Size());
+	return ok;
+}
+
+TEST_F(LibraryImageTest, inconsistent) {
+	TrackStore store;
+	for (item_id_t id = 1; id < 4; ++id) {
+		store.Set(id, TestTrack(id));
+	}
+	{
+		LibraryImage image(TEST_IMAGE);
+		ASSERT_TRUE(image.Write(store, 1));
+	}
+	const std::string good = read_image();
+	EXPECT_TRUE(load_patched(good));
+
+	/* a string id past the end of its pool, in the first string column */
+	const uint32_t ids[] = { 0, 1, 2, 3 };
+	std::string bad = good;
+	size_t pos = bad.find(std::string((const char*)ids, sizeof(ids)));
+	ASSERT_NE(std::string::npos, pos);
+	uint32_t past = 1000;
+	memcpy(&bad[pos + sizeof(uint32_t)], &past, sizeof(past));
+	EXPECT_FALSE(load_patched(bad));
+
+	/* a string which runs into the next one */
+	bad = good;
+	pos = bad.find(std::string("title 1\0", 8));
+	ASSERT_NE(std::string::npos, pos);
+	bad[pos + 7] = 'x';
+	EXPECT_FALSE(load_patched(bad));
+
+	/* a header which miscounts the live tracks: revision, end, count */
+	const uint32_t counts[] = { 1, 4, 3 };
+	bad = good;
+	pos = bad.find(std::string((const char*)counts, sizeof(counts)));
+	ASSERT_NE(std::string::npos, pos);
+	bad[pos + 2 * sizeof(uint32_t)] = 2;
+	EXPECT_FALSE(load_patched(bad));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
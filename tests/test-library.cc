@@ -0,0 +1,169 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+#include <library.h>
+
+#include "test-tracks.h"
+
+#define TEST_IMAGE "test_library_snapshots.img"
+
+using namespace adaapd;
+
+class LibraryTest : public testing::Test {
+protected:
+	virtual void SetUp() {
+		rm_image();
+	}
+	virtual void TearDown() {
+		rm_image();
+	}
+
+private:
+	void rm_image() {
+		unlink(TEST_IMAGE);
+		unlink(TEST_IMAGE ".delta");
+		unlink(TEST_IMAGE ".tmp");
+	}
+};
+
+TEST_F(LibraryTest, background_compaction) {
+	{
+		Library library(TEST_IMAGE);
+		/* enough changes to start writing the image after revision 1 */
+		for (item_id_t id = 1; id <= 5000; ++id) {
+			library.TrackEvent(id, FILE_CREATED, TestTrack(id), 1);
+		}
+		library.Committed(1);
+		library.TrackEvent(5001, FILE_CREATED, TestTrack(5001), 2);
+		library.Committed(2);
+		EXPECT_EQ(5001, library.Published()->tracks->Size());
+	}
+
+	/* the image is as of revision 1, the delta log only has what came after */
+	LibraryImage image(TEST_IMAGE);
+	TrackStore loaded;
+	revision_t revision = 0;
+	ASSERT_TRUE(image.Load(loaded, 2, revision));
+	EXPECT_EQ(2, revision);
+	EXPECT_EQ(5001, loaded.Size());
+	EXPECT_EQ(1, image.DeltaCount());
+}
+
+TEST_F(LibraryTest, snapshots) {
+	Library library(TEST_IMAGE);
+	LibraryReader reader(library);
+	EXPECT_EQ(0, reader.Get().revision);
+	EXPECT_EQ(0, reader.Get().tracks->Size());
+
+	library.TrackEvent(1, FILE_CREATED, TestTrack(1), 1);
+	library.TrackEvent(2, FILE_CREATED, TestTrack(2), 1);
+	/* not visible until committed */
+	EXPECT_EQ(0, reader.Get().tracks->Size());
+	library.Committed(1);
+	EXPECT_EQ(1, library.Revision());
+
+	const LibrarySnapshot& one = reader.Get();
+	EXPECT_EQ(1, one.revision);
+	EXPECT_EQ(2, one.tracks->Size());
+	std::shared_ptr<const TrackStore> tracks_one = one.tracks;
+
+	library.TrackEvent(2, FILE_REMOVED, TrackInfo(), 2);
+	library.TrackEvent(3, FILE_CREATED, TestTrack(3), 2);
+	library.Committed(2);
+
+	const LibrarySnapshot& two = reader.Get();
+	EXPECT_EQ(2, two.revision);
+	EXPECT_TRUE(two.tracks->Has(3));
+	EXPECT_FALSE(two.tracks->Has(2));
+
+	/* the old snapshot is unchanged */
+	EXPECT_TRUE(tracks_one->Has(2));
+	EXPECT_FALSE(tracks_one->Has(3));
+	EXPECT_STREQ("title 2", tracks_one->Str(2, TITLE));
+}
+
+TEST_F(LibraryTest, playlists) {
+	Library library(TEST_IMAGE);
+	std::vector<Playlist> specs(1);
+	specs[0].name = "early";
+	specs[0].rule = Rule::Int(TRACK_NUMBER, Rule::INT_LE, 2);
+	EXPECT_TRUE(library.SetPlaylists(specs));
+
+	library.TrackEvent(1, FILE_CREATED, TestTrack(1), 1);
+	library.TrackEvent(3, FILE_CREATED, TestTrack(3), 1);
+	library.Committed(1);
+	EXPECT_TRUE(library.Playlists().Members(0).Has(1));
+	EXPECT_FALSE(library.Playlists().Members(0).Has(3));
+
+	TrackInfo info = TestTrack(3);
+	info.ints[TRACK_NUMBER] = 2;
+	library.TrackEvent(3, FILE_CHANGED, info, 2);
+	library.TrackEvent(1, FILE_REMOVED, TrackInfo(), 2);
+	library.Committed(2);
+	EXPECT_FALSE(library.Playlists().Members(0).Has(1));
+	EXPECT_TRUE(library.Playlists().Members(0).Has(3));
+	EXPECT_EQ(1, library.Playlists().Members(0).Count());
+}
+
+TEST_F(LibraryTest, threaded_readers) {
+	Library library(TEST_IMAGE);
+	std::atomic<bool> done(false);
+	std::atomic<int> errors(0);
+
+	/* readers check that each snapshot is internally consistent: revision N
+	 * has tracks 1..N, each with its own title */
+	std::vector<std::thread> readers;
+	for (int i = 0; i < 4; ++i) {
+		readers.push_back(std::thread([&library, &done, &errors]() {
+			LibraryReader reader(library);
+			while (!done) {
+				const LibrarySnapshot& snap = reader.Get();
+				if (snap.tracks->Size() != snap.revision) {
+					++errors;
+				}
+				for (item_id_t id = 1; id <= snap.revision; ++id) {
+					if (snap.tracks->Int(id, TRACK_NUMBER) != id ||
+							strcmp(snap.tracks->Str(id, TITLE), TestTrack(id).Info().strs[TITLE].c_str()) != 0) {
+						++errors;
+					}
+				}
+			}
+		}));
+	}
+
+	for (revision_t rev = 1; rev <= 5000; ++rev) {
+		library.TrackEvent(rev, FILE_CREATED, TestTrack(rev), rev);
+		library.Committed(rev);
+	}
+	done = true;
+	for (size_t i = 0; i < readers.size(); ++i) {
+		readers[i].join();
+	}
+	EXPECT_EQ(0, errors);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
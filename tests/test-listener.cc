@@ -233,8 +233,10 @@ private:
 		}
 	}
 
-	void callback_event(const std::string path, adaapd::FILE_EVENT_TYPE type, time_t mtime) {
-		LOG("%s [mtime %ld, type %d]", path.c_str(), mtime, type);
+	void callback_event(const std::string path, adaapd::FILE_EVENT_TYPE type,
+			const adaapd::FileStat& stat) {
+		LOG("%s [mtime %ld, size %ld, inode %lu, type %d]", path.c_str(),
+				stat.mtime, stat.size, stat.inode, type);
 		ASSERT_FALSE(torecv.empty());
 		struct file_event event = torecv.front();
 		torecv.pop();
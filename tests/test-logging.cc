@@ -0,0 +1,211 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <logging.h>
+
+/* everything written to logging::fout since the last call */
+static std::string take_output(FILE* f) {
+	logging::Flush();
+	std::string out;
+	fseek(f, 0, SEEK_SET);
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) != 0) {
+		out.append(buf, n);
+	}
+	fseek(f, 0, SEEK_SET);
+	if (ftruncate(fileno(f), 0) != 0) {
+		ADD_FAILURE();
+	}
+	return out;
+}
+
+class LoggingTest : public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		f = tmpfile();
+		ASSERT_TRUE(f != NULL);
+		logging::Flush();
+		logging::fout = f;
+	}
+	virtual void TearDown() {
+		logging::Flush();
+		logging::fout = stdout;
+		fclose(f);
+	}
+
+	FILE* f;
+};
+
+TEST_F(LoggingTest, format) {
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%d %5u %-4lx| %lld %.3f %e %c %%\n",
+			-3, 7u, 255ul, -1234567890123ll, 3.14159, 0.5, 'z');
+	std::string expect(buf);
+	LOG_RAW("%d %5u %-4lx| %lld %.3f %e %c %%",
+			-3, 7u, 255ul, -1234567890123ll, 3.14159, 0.5, 'z');
+
+	/* integers are cut back to their conversion's size */
+	snprintf(buf, sizeof(buf), "%hhu %hd %u\n", (unsigned char)300, (short)70000, (unsigned)-1);
+	expect += buf;
+	LOG_RAW("%hhu %hd %u", 300, 70000, -1);
+
+	snprintf(buf, sizeof(buf), "[%*d] [%.*s] [%-*.*s]\n", 6, 42, 3, "abcdef", 5, 2, "xyz");
+	expect += buf;
+	LOG_RAW("[%*d] [%.*s] [%-*.*s]", 6, 42, 3, "abcdef", 5, 2, "xyz");
+
+	/* strings are copied when they're logged */
+	std::string changing("before");
+	LOG_RAW("%s", changing.c_str());
+	changing = "after";
+	expect += "before\n";
+
+	const char* null = NULL;
+	LOG_RAW("%s", null);
+	expect += "(null)\n";
+
+	/* mismatches don't reach snprintf */
+	LOG_RAW("%s %d", 5);
+	expect += "(bad %s) (missing)\n";
+
+	LOG("x=%d", 1);
+	expect += "LOG TestBody  x=1\n";
+
+	EXPECT_EQ(expect, take_output(f));
+}
+
+TEST_F(LoggingTest, levels) {
+	DEBUG_RAW("%s", "hidden");
+	logging::SetLevel("test-logging", logging::LEVEL_DEBUG);
+	DEBUG_RAW("%s", "shown");
+	logging::SetLevel("other", logging::LEVEL_NONE);
+	LOG_RAW("%s", "still shown");
+
+	/* arguments to disabled messages aren't evaluated */
+	int evaluated = 0;
+	ASSERT_TRUE(logging::Configure("error, cache = debug"));
+	LOG_RAW("%d", ++evaluated);
+	EXPECT_EQ(0, evaluated);
+	ERR_RAW("%d", ++evaluated);
+	EXPECT_EQ(1, evaluated);
+
+	/* bad lists change nothing */
+	EXPECT_FALSE(logging::Configure("debug,test-logging=loud"));
+	EXPECT_FALSE(logging::Configure("=debug"));
+	LOG_RAW("%s", "hidden");
+
+	ASSERT_TRUE(logging::Configure("log"));
+	EXPECT_EQ("shown\nstill shown\n", take_output(f));
+}
+
+static void log_thread(int thread, int count) {
+	for (int i = 0; i < count; ++i) {
+		LOG_RAW("%d %d", thread, i);
+		if (i % 5 == 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+TEST_F(LoggingTest, threads) {
+	/* all from one call site, so under its rate limit */
+	const int threads = 4, count = 25;
+	std::vector<std::thread> running;
+	for (int t = 0; t < threads; ++t) {
+		running.push_back(std::thread(log_thread, t, count));
+	}
+	for (size_t t = 0; t < running.size(); ++t) {
+		running[t].join();
+	}
+	std::string out = take_output(f);
+
+	/* everything is there, and each thread's messages are in order */
+	std::vector<int> next(threads, 0);
+	size_t lines = 0;
+	const char* c = out.c_str();
+	int thread, i, n;
+	while (sscanf(c, "%d %d\n%n", &thread, &i, &n) == 2) {
+		ASSERT_TRUE(thread >= 0 && thread < threads);
+		EXPECT_EQ(next[thread], i);
+		next[thread] = i + 1;
+		++lines;
+		c += n;
+	}
+	EXPECT_EQ((size_t)(threads * count), lines);
+}
+
+TEST_F(LoggingTest, rate_limit) {
+	for (int i = 0; i < 150; ++i) {
+		LOG_RAW("message %d", i);
+	}
+	std::string out = take_output(f);
+	size_t lines = 0;
+	for (size_t i = 0; i < out.size(); ++i) {
+		lines += (out[i] == '\n') ? 1 : 0;
+	}
+	EXPECT_EQ(100, lines);
+
+	/* the rest are counted once the window is over */
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	EXPECT_EQ("LOG logging  Suppressed 50 more messages like: message %d\n", take_output(f));
+}
+
+TEST_F(LoggingTest, rate_limit_sites) {
+	/* the same format from two places is limited separately */
+	for (int i = 0; i < 100; ++i) {
+		LOG_RAW("site %d", i);
+		LOG_RAW("site %d", i);
+	}
+	std::string out = take_output(f);
+	size_t lines = 0;
+	for (size_t i = 0; i < out.size(); ++i) {
+		lines += (out[i] == '\n') ? 1 : 0;
+	}
+	EXPECT_EQ(200, lines);
+}
+
+TEST_F(LoggingTest, errors_unlimited) {
+	FILE* err = tmpfile();
+	ASSERT_TRUE(err != NULL);
+	logging::ferr = err;
+	for (int i = 0; i < 150; ++i) {
+		ERR_RAW("error %d", i);
+	}
+	std::string out = take_output(err);
+	logging::ferr = stderr;
+	fclose(err);
+	size_t lines = 0;
+	for (size_t i = 0; i < out.size(); ++i) {
+		lines += (out[i] == '\n') ? 1 : 0;
+	}
+	EXPECT_EQ(150, lines);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,100 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <metrics.h>
+
+using namespace adaapd;
+
+static void count(Counter* counter, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		counter->Add();
+	}
+}
+
+TEST(MetricsTest, counter) {
+	Counter& counter = Metrics::Get().GetCounter("test_counter_total", "A counter");
+	EXPECT_EQ(&counter, &Metrics::Get().GetCounter("test_counter_total", "A counter"));
+	EXPECT_EQ(0, counter.Value());
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < 8; ++i) {
+		threads.push_back(std::thread(count, &counter, 10000));
+	}
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+	counter.Add(5);
+	EXPECT_EQ(80005, counter.Value());
+}
+
+TEST(MetricsTest, histogram) {
+	std::vector<uint64_t> bounds;
+	bounds.push_back(10);
+	bounds.push_back(100);
+	Histogram h(bounds, 0.5);
+	h.Observe(0);
+	h.Observe(10);
+	h.Observe(11);
+	h.Observe(1000);
+	h.Observe(1000);
+	EXPECT_EQ(2, h.Bucket(0));
+	EXPECT_EQ(1, h.Bucket(1));
+	EXPECT_EQ(2, h.Bucket(2));
+	EXPECT_EQ(5, h.Count());
+	EXPECT_EQ(2021, h.Sum());
+
+	const std::vector<uint64_t>& latency = LatencyBuckets();
+	ASSERT_FALSE(latency.empty());
+	for (size_t i = 1; i < latency.size(); ++i) {
+		EXPECT_LT(latency[i - 1], latency[i]);
+	}
+}
+
+TEST(MetricsTest, write) {
+	Metrics::Get().GetGauge("test_gauge", "A gauge", "kind=\"a\"").Set(-3);
+	Metrics::Get().GetGauge("test_gauge", "A gauge", "kind=\"b\"").Add(7);
+	std::vector<uint64_t> bounds;
+	bounds.push_back(1000);
+	Histogram& h = Metrics::Get().GetHistogram("test_seconds", "A histogram", bounds, 1e-3);
+	h.Observe(500);
+	h.Observe(2500);
+
+	std::string out;
+	Metrics::Get().Write(out);
+	EXPECT_NE(std::string::npos, out.find(
+					"# HELP test_gauge A gauge\n"
+					"# TYPE test_gauge gauge\n"
+					"test_gauge{kind=\"a\"} -3\n"
+					"test_gauge{kind=\"b\"} 7\n")) << out;
+	EXPECT_NE(std::string::npos, out.find(
+					"# HELP test_seconds A histogram\n"
+					"# TYPE test_seconds histogram\n"
+					"test_seconds_bucket{le=\"1\"} 1\n"
+					"test_seconds_bucket{le=\"+Inf\"} 2\n"
+					"test_seconds_sum 3\n"
+					"test_seconds_count 2\n")) << out;
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
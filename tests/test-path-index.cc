@@ -0,0 +1,111 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <path-index.h>
+
+using namespace adaapd;
+
+static std::string make_path(item_id_t id) {
+	std::ostringstream path;
+	path << "/music/artist " << id % 100 << "/" << id << ".mp3";
+	return path.str();
+}
+
+static void set(TrackStore& store, item_id_t id, const std::string& path) {
+	TrackInfo info;
+	info.path = path;
+	store.Set(id, info);
+}
+
+TEST(PathIndexTest, find) {
+	TrackStore store;
+	PathIndex paths;
+	item_id_t id;
+	EXPECT_FALSE(paths.Find(store, "/music/a.mp3", id));
+
+	set(store, 1, "/music/a.mp3");
+	paths.Add(store, 1);
+	set(store, 7, "/music/b.mp3");
+	paths.Add(store, 7);
+	EXPECT_EQ(2, paths.Size());
+	ASSERT_TRUE(paths.Find(store, "/music/a.mp3", id));
+	EXPECT_EQ(1, id);
+	ASSERT_TRUE(paths.Find(store, "/music/b.mp3", id));
+	EXPECT_EQ(7, id);
+	/* prefixes of a path aren't it */
+	EXPECT_FALSE(paths.Find(store, "/music/b.mp", id));
+	EXPECT_FALSE(paths.Find(store, "/music/b.mp3.bak", id));
+	const char* buf = "/music/b.mp3.bak";
+	ASSERT_TRUE(paths.Find(store, buf, 12, id));
+	EXPECT_EQ(7, id);
+
+	/* snapshots don't see later changes */
+	std::shared_ptr<const TrackStore> tracks = store.Snapshot();
+	std::shared_ptr<const PathIndex> snapshot = paths.Snapshot();
+	paths.Remove(store, 1);
+	store.Remove(1);
+	EXPECT_FALSE(paths.Find(store, "/music/a.mp3", id));
+	EXPECT_TRUE(snapshot->Find(*tracks, "/music/a.mp3", id));
+	EXPECT_EQ(1, paths.Size());
+	EXPECT_EQ(2, snapshot->Size());
+}
+
+TEST(PathIndexTest, churn) {
+	/* enough to grow a few times, with removals shifting entries around */
+	TrackStore store;
+	PathIndex paths;
+	std::map<std::string, item_id_t> expected;
+	for (item_id_t id = 1; id < 20000; ++id) {
+		set(store, id, make_path(id));
+		paths.Add(store, id);
+		expected[make_path(id)] = id;
+		if (id % 3 == 0) {
+			item_id_t gone = id / 2;
+			if (store.Has(gone)) {
+				paths.Remove(store, gone);
+				store.Remove(gone);
+				expected.erase(make_path(gone));
+			}
+		}
+	}
+	EXPECT_EQ(expected.size(), paths.Size());
+	for (item_id_t id = 1; id < 20000; ++id) {
+		item_id_t found;
+		bool has = paths.Find(store, make_path(id), found);
+		ASSERT_EQ(store.Has(id), has) << id;
+		if (has) {
+			EXPECT_EQ(id, found);
+		}
+	}
+
+	PathIndex built;
+	built.Build(store);
+	EXPECT_EQ(expected.size(), built.Size());
+	item_id_t found;
+	ASSERT_TRUE(built.Find(store, make_path(19999), found));
+	EXPECT_EQ(19999, found);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
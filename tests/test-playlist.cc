@@ -0,0 +1,284 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <playlist.h>
+
+#include "test-tracks.h"
+
+using namespace adaapd;
+
+class PlaylistTest : public testing::Test {
+protected:
+	virtual void SetUp() {
+		store.Set(1, TestTrack("/music/Alpha").Str(ARTIST, "Alpha").Str(GENRE, "Rock")
+				.Int(YEAR, 1999).Int(USER_RATING, 80));
+		store.Set(2, TestTrack("/music/Beta").Str(ARTIST, "Beta").Str(GENRE, "rock")
+				.Int(YEAR, 2005).Int(USER_RATING, 100));
+		store.Set(3, TestTrack("/music/Gamma Ray").Str(ARTIST, "Gamma Ray").Str(GENRE, "Jazz")
+				.Int(YEAR, 1975).Int(USER_RATING, 40));
+		store.Set(4, TestTrack("/music/"));
+		/* far away, in another chunk */
+		store.Set(2 * CHUNK_SIZE + 5, TestTrack("/music/Delta").Str(ARTIST, "Delta").Str(GENRE, "Pop")
+				.Int(YEAR, 2012).Int(USER_RATING, 60));
+		store.Set(6, TestTrack("/music/Removed").Str(ARTIST, "Removed").Str(GENRE, "Rock")
+				.Int(YEAR, 2000).Int(USER_RATING, 100));
+		store.Remove(6);
+	}
+
+	/* matches with both the chunked and the per-track paths, which need
+	 * to agree */
+	std::vector<item_id_t> match(const Rule& rule) {
+		PlaylistFilter filter;
+		EXPECT_TRUE(filter.Compile(rule));
+		std::vector<item_id_t> ids;
+		filter.Match(store, ids);
+		std::vector<item_id_t> single;
+		for (item_id_t id = 0; id < store.End(); ++id) {
+			if (filter.Match(store, id)) {
+				single.push_back(id);
+			}
+		}
+		EXPECT_EQ(ids, single);
+		return ids;
+	}
+
+	TrackStore store;
+};
+
+static std::vector<item_id_t> ids(item_id_t a = 0, item_id_t b = 0, item_id_t c = 0) {
+	std::vector<item_id_t> out;
+	if (a != 0) out.push_back(a);
+	if (b != 0) out.push_back(b);
+	if (c != 0) out.push_back(c);
+	return out;
+}
+
+TEST_F(PlaylistTest, ints) {
+	EXPECT_EQ(ids(1, 2, 3), match(Rule::Int(YEAR, Rule::INT_LT, 2012)));
+	EXPECT_EQ(ids(2, 2 * CHUNK_SIZE + 5), match(Rule::Int(YEAR, Rule::INT_GE, 2005)));
+	EXPECT_EQ(ids(1, 2), match(Rule::Int(YEAR, Rule::INT_RANGE, 1990, 2010)));
+	EXPECT_EQ(ids(2), match(Rule::Int(USER_RATING, Rule::INT_EQ, 100)));
+	EXPECT_EQ(ids(1, 3, 2 * CHUNK_SIZE + 5), match(Rule::Int(USER_RATING, Rule::INT_LE, 80)));
+	/* missing values never match, even for "not equal" */
+	std::vector<item_id_t> ne = match(Rule::Int(USER_RATING, Rule::INT_NE, 100));
+	EXPECT_EQ(3, ne.size());
+	EXPECT_EQ(ids(1, 3, 2 * CHUNK_SIZE + 5), ne);
+	EXPECT_EQ(ids(), match(Rule::Int(YEAR, Rule::INT_LT, TAG_INT_NONE + 1)));
+	EXPECT_EQ(ids(), match(Rule::Int(YEAR, Rule::INT_GT, INT64_MAX)));
+}
+
+TEST_F(PlaylistTest, strings) {
+	EXPECT_EQ(ids(1, 2), match(Rule::Str(GENRE, Rule::STR_IS, "ROCK")));
+	EXPECT_EQ(ids(3), match(Rule::Str(ARTIST, Rule::STR_CONTAINS, "ray")));
+	EXPECT_EQ(ids(3), match(Rule::Str(ARTIST, Rule::STR_STARTS, "gam")));
+	EXPECT_EQ(ids(1, 3), match(Rule::Str(ARTIST, Rule::STR_MATCHES, "^(alpha|gamma)")));
+	/* an empty substring still needs a value to be there */
+	EXPECT_EQ(4, match(Rule::Str(GENRE, Rule::STR_CONTAINS, "")).size());
+
+	PlaylistFilter filter;
+	EXPECT_FALSE(filter.Compile(Rule::Str(ARTIST, Rule::STR_MATCHES, "(unclosed")));
+	std::vector<item_id_t> none;
+	filter.Match(store, none);
+	EXPECT_TRUE(none.empty());
+}
+
+TEST_F(PlaylistTest, groups) {
+	Rule rule = Rule::Group(Rule::ALL);
+	rule.rules.push_back(Rule::Str(GENRE, Rule::STR_IS, "rock"));
+	rule.rules.push_back(Rule::Not(Rule::Int(USER_RATING, Rule::INT_EQ, 100)));
+	EXPECT_EQ(ids(1), match(rule));
+
+	Rule any = Rule::Group(Rule::ANY);
+	any.rules.push_back(rule);
+	any.rules.push_back(Rule::Int(YEAR, Rule::INT_LT, 1980));
+	any.rules.push_back(Rule::Str(GENRE, Rule::STR_IS, "pop"));
+	EXPECT_EQ(ids(1, 3, 2 * CHUNK_SIZE + 5), match(any));
+
+	/* everything and nothing */
+	EXPECT_EQ(5, match(Rule::Group(Rule::ALL)).size());
+	EXPECT_EQ(ids(), match(Rule::Group(Rule::ANY)));
+	EXPECT_EQ(ids(4), match(Rule::Not(Rule::Str(ARTIST, Rule::STR_CONTAINS, ""))));
+
+	PlaylistFilter filter;
+	EXPECT_FALSE(filter.Compile(Rule::Group(Rule::NOT)));
+	EXPECT_FALSE(filter.Compile(Rule::Int((Tag_IntId)TAG_INT_COUNT, Rule::INT_EQ, 1)));
+}
+
+TEST_F(PlaylistTest, new_strings) {
+	PlaylistFilter filter;
+	ASSERT_TRUE(filter.Compile(Rule::Str(GENRE, Rule::STR_CONTAINS, "wave")));
+	std::vector<item_id_t> out;
+	filter.Match(store, out);
+	EXPECT_TRUE(out.empty());
+
+	/* strings interned after the first match are picked up */
+	store.Set(7, TestTrack("/music/Epsilon").Str(ARTIST, "Epsilon").Str(GENRE, "Darkwave")
+			.Int(YEAR, 1985).Int(USER_RATING, 20));
+	EXPECT_TRUE(filter.Match(store, 7));
+	filter.Match(store, out);
+	EXPECT_EQ(ids(7), out);
+}
+
+static std::vector<item_id_t> members(const PlaylistSet& set, size_t playlist) {
+	std::vector<item_id_t> out;
+	set.Members(playlist).Ids(out);
+	return out;
+}
+
+TEST_F(PlaylistTest, incremental) {
+	std::vector<Playlist> specs(4);
+	specs[0].name = "top rated";
+	specs[0].rule = Rule::Int(USER_RATING, Rule::INT_GE, 80);
+	specs[1].name = "rock";
+	specs[1].rule = Rule::Str(GENRE, Rule::STR_IS, "rock");
+	specs[2].name = "everything";
+	specs[3].name = "broken";
+	specs[3].rule = Rule::Str(GENRE, Rule::STR_MATCHES, "[");
+
+	PlaylistSet set;
+	EXPECT_FALSE(set.Load(specs, store));
+	ASSERT_EQ(4, set.Size());
+	EXPECT_EQ("rock", set.Name(1));
+	EXPECT_EQ(ids(1, 2), members(set, 0));
+	EXPECT_EQ(ids(1, 2), members(set, 1));
+	EXPECT_EQ(5, set.Members(2).Count());
+	EXPECT_EQ(0, set.Members(3).Count());
+
+	/* a new rating: only the rating matters */
+	TrackInfo info = TestTrack("/music/Gamma Ray").Str(ARTIST, "Gamma Ray").Str(GENRE, "Jazz")
+			.Int(YEAR, 1975).Int(USER_RATING, 100);
+	tag_mask_t changed = store.Diff(3, info);
+	EXPECT_EQ(TagBit(USER_RATING), changed);
+	store.Set(3, info);
+	set.Update(store, 3, changed);
+	EXPECT_EQ(ids(1, 2, 3), members(set, 0));
+	EXPECT_EQ(ids(1, 2), members(set, 1));
+
+	/* a retag which a playlist doesn't look at leaves it alone, even if
+	 * it'd match now */
+	info = TestTrack("/music/Alpha").Str(ARTIST, "Alpha").Str(GENRE, "Jazz")
+			.Int(YEAR, 1999).Int(USER_RATING, 80);
+	changed = store.Diff(1, info);
+	EXPECT_EQ(TagBit(GENRE), changed);
+	store.Set(1, info);
+	set.Update(store, 1, TagBit(YEAR));
+	EXPECT_EQ(ids(1, 2), members(set, 1));
+	set.Update(store, 1, changed);
+	EXPECT_EQ(ids(2), members(set, 1));
+
+	/* added and removed tracks are looked at by everything */
+	store.Set(8, TestTrack("/music/New").Str(ARTIST, "New").Str(GENRE, "ROCK")
+			.Int(YEAR, 2020).Int(USER_RATING, 20));
+	set.Update(store, 8, TAG_MASK_ALL);
+	EXPECT_EQ(ids(2, 8), members(set, 1));
+	EXPECT_EQ(6, set.Members(2).Count());
+	store.Remove(2);
+	set.Update(store, 2, TAG_MASK_ALL);
+	EXPECT_EQ(ids(1, 3), members(set, 0));
+	EXPECT_EQ(ids(8), members(set, 1));
+	EXPECT_EQ(5, set.Members(2).Count());
+	EXPECT_FALSE(set.Members(2).Has(2));
+}
+
+TEST_F(PlaylistTest, combined) {
+	std::vector<Playlist> specs(5);
+	specs[0].name = "rock";
+	specs[0].rule = Rule::Str(GENRE, Rule::STR_IS, "rock");
+	specs[1].name = "top rated";
+	specs[1].rule = Rule::Int(USER_RATING, Rule::INT_GE, 80);
+	/* pure set algebra */
+	specs[2].name = "rock or top";
+	specs[2].rule = Rule::Group(Rule::ANY);
+	specs[2].rule.rules.push_back(Rule::In("rock"));
+	specs[2].rule.rules.push_back(Rule::In("top rated"));
+	specs[3].name = "not rock";
+	specs[3].rule = Rule::Group(Rule::ALL);
+	specs[3].rule.rules.push_back(Rule::Not(Rule::In("rock")));
+	/* mixed with a tag condition */
+	specs[4].name = "old rock";
+	specs[4].rule = Rule::Group(Rule::ALL);
+	specs[4].rule.rules.push_back(Rule::In("rock"));
+	specs[4].rule.rules.push_back(Rule::Int(YEAR, Rule::INT_LT, 2000));
+
+	PlaylistSet set;
+	ASSERT_TRUE(set.Load(specs, store));
+	EXPECT_EQ(ids(1, 2), members(set, 2));
+	EXPECT_EQ(ids(3, 4, 2 * CHUNK_SIZE + 5), members(set, 3));
+	EXPECT_EQ(ids(1), members(set, 4));
+
+	/* a genre change moves the track through everything built on "rock" */
+	TrackInfo info = TestTrack("/music/Gamma Ray").Str(ARTIST, "Gamma Ray").Str(GENRE, "Rock")
+			.Int(YEAR, 1975).Int(USER_RATING, 40);
+	tag_mask_t changed = store.Diff(3, info);
+	store.Set(3, info);
+	set.Update(store, 3, changed);
+	EXPECT_EQ(ids(1, 2, 3), members(set, 2));
+	EXPECT_EQ(ids(4, 2 * CHUNK_SIZE + 5), members(set, 3));
+	EXPECT_EQ(ids(1, 3), members(set, 4));
+	EXPECT_TRUE(set.Changed());
+	EXPECT_FALSE(set.Changed());
+
+	/* only earlier playlists may be used */
+	specs[0].rule = Rule::In("top rated");
+	EXPECT_FALSE(set.Load(specs, store));
+	EXPECT_EQ(0, set.Members(0).Count());
+}
+
+TEST_F(PlaylistTest, statics) {
+	std::vector<Playlist> specs(3);
+	specs[0].name = "favourites";
+	specs[0].rule = Rule::Group(Rule::ANY);
+	specs[0].paths.push_back("/music/Beta");
+	specs[0].paths.push_back("/music/Delta");
+	specs[0].paths.push_back("/music/Later");
+	/* both listed and matched */
+	specs[1].name = "jazz and beta";
+	specs[1].rule = Rule::Str(GENRE, Rule::STR_IS, "jazz");
+	specs[1].paths.push_back("/music/Beta");
+	specs[2].name = "not favourites";
+	specs[2].rule = Rule::Not(Rule::In("favourites"));
+
+	PathIndex paths;
+	paths.Build(store);
+	PlaylistSet set;
+	ASSERT_TRUE(set.Load(specs, store, &paths));
+	EXPECT_EQ(ids(2, 2 * CHUNK_SIZE + 5), members(set, 0));
+	EXPECT_EQ(ids(2, 3), members(set, 1));
+	EXPECT_EQ(ids(1, 3, 4), members(set, 2));
+
+	/* a listed track which shows up later, and one which goes away */
+	store.Set(9, TestTrack("/music/Later").Str(ARTIST, "Later").Str(GENRE, "Pop")
+			.Int(YEAR, 2020).Int(USER_RATING, 20));
+	set.Update(store, 9, TAG_MASK_ALL);
+	store.Remove(2);
+	set.Update(store, 2, TAG_MASK_ALL);
+	EXPECT_EQ(ids(9, 2 * CHUNK_SIZE + 5), members(set, 0));
+	EXPECT_EQ(ids(3), members(set, 1));
+	EXPECT_FALSE(set.Members(2).Has(9));
+
+	/* without an index, one is built */
+	PlaylistSet unindexed;
+	ASSERT_TRUE(unindexed.Load(specs, store));
+	EXPECT_EQ(members(set, 0), members(unindexed, 0));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
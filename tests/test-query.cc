@@ -0,0 +1,223 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <gtest/gtest.h>
+#include <query.h>
+
+#include "test-tracks.h"
+
+using namespace adaapd;
+
+class QueryTest : public testing::Test {
+protected:
+	virtual void SetUp() {
+		set(1, TestTrack("/music/Alpha/First").Str(ARTIST, "Alpha")
+				.Str(ALBUM, "First").Str(GENRE, "Rock").Int(YEAR, 1999));
+		set(2, TestTrack("/music/Beta/Second").Str(ARTIST, "Beta")
+				.Str(ALBUM, "Second").Str(GENRE, "rock").Int(YEAR, 2005));
+		set(3, TestTrack("/music/Alpha/Second").Str(ARTIST, "Alpha")
+				.Str(ALBUM, "Second").Str(GENRE, "Jazz").Int(YEAR, 1975));
+		set(4, TestTrack("/music//"));
+		set(2 * CHUNK_SIZE + 5, TestTrack("/music/alpha/Third").Str(ARTIST, "alpha")
+				.Str(ALBUM, "Third").Str(GENRE, "Pop").Int(YEAR, 2012));
+	}
+
+	/* applies a change the way the Library does */
+	void set(item_id_t id, const TrackInfo& info) {
+		tag_mask_t fields = store.Diff(id, info);
+		index.Remove(store, id, fields);
+		store.Set(id, info);
+		search.Update(store.Strings());
+		index.Add(store, id, fields);
+	}
+
+	/* answers 'query' from the index, checking against a plain scan */
+	std::vector<item_id_t> match(const std::string& query) {
+		Rule rule;
+		EXPECT_TRUE(ParseQuery(query, rule)) << query;
+		std::vector<item_id_t> ids, scanned;
+		QueryEvaluator evaluator;
+		evaluator.Match(rule, store, index, search, ids);
+		PlaylistFilter filter;
+		EXPECT_TRUE(filter.Compile(rule));
+		filter.Match(store, scanned);
+		EXPECT_EQ(scanned, ids) << query;
+		return ids;
+	}
+
+	TrackStore store;
+	TagIndex index;
+	SearchIndex search;
+};
+
+static std::vector<item_id_t> ids(item_id_t a = 0, item_id_t b = 0, item_id_t c = 0) {
+	std::vector<item_id_t> out;
+	if (a != 0) out.push_back(a);
+	if (b != 0) out.push_back(b);
+	if (c != 0) out.push_back(c);
+	return out;
+}
+
+TEST_F(QueryTest, index) {
+	const StringPool& pool = store.Strings();
+	str_id_t alpha = store.StrId(1, ARTIST);
+	ASSERT_TRUE(index.Postings(ARTIST, alpha) != NULL);
+	EXPECT_EQ(ids(1, 3), *index.Postings(ARTIST, alpha));
+	EXPECT_TRUE(index.Postings(ARTIST, pool.Size() + 100) == NULL);
+	EXPECT_FALSE(TagIndex::Indexed(COMMENT));
+
+	/* a snapshot keeps the lists as they were */
+	std::shared_ptr<const TagIndex> snapshot = index.Snapshot();
+	set(1, TestTrack("/music/Beta/First").Str(ARTIST, "Beta")
+			.Str(ALBUM, "First").Str(GENRE, "Rock").Int(YEAR, 1999));
+	EXPECT_EQ(ids(3), *index.Postings(ARTIST, alpha));
+	EXPECT_EQ(ids(1, 2), *index.Postings(ARTIST, store.StrId(2, ARTIST)));
+	EXPECT_EQ(ids(1, 3), *snapshot->Postings(ARTIST, alpha));
+
+	index.Remove(store, 3, TagIndex::Fields());
+	store.Remove(3);
+	EXPECT_TRUE(index.Postings(ARTIST, alpha) == NULL);
+
+	TagIndex built;
+	built.Build(store);
+	EXPECT_EQ(*index.Postings(GENRE, store.StrId(1, GENRE)),
+			*built.Postings(GENRE, store.StrId(1, GENRE)));
+}
+
+TEST_F(QueryTest, terms) {
+	EXPECT_EQ(ids(1, 3, 2 * CHUNK_SIZE + 5), match("'daap.songartist:Alpha'"));
+	EXPECT_EQ(ids(3), match("'daap.songartist:alpha'+'daap.songalbum:Second'"));
+	EXPECT_EQ(ids(3), match("'daap.songartist:alpha' 'daap.songalbum:Second'"));
+	EXPECT_EQ(ids(1, 2, 3), match("('daap.songgenre:rock','daap.songalbum:Second')"));
+	EXPECT_EQ(ids(1, 2 * CHUNK_SIZE + 5),
+			match("'daap.songartist:Alpha'+'daap.songalbum!:Second'"));
+	EXPECT_EQ(ids(2), match("'daap.songartist!:Alpha'+'daap.songgenre:Rock'"));
+	EXPECT_EQ(ids(2, 4), match("'daap.songartist!:Alpha'"));
+	EXPECT_EQ(ids(), match("'daap.songartist:Nobody'"));
+
+	/* not indexed, or mixed */
+	EXPECT_EQ(ids(1), match("'daap.songyear:1999'"));
+	EXPECT_EQ(ids(3), match("'daap.songartist:Alpha'+('daap.songyear:1975','daap.songyear:1')"));
+	EXPECT_EQ(ids(1, 2 * CHUNK_SIZE + 5), match("'daap.songalbum:*ir*'"));
+	EXPECT_EQ(ids(2, 3), match("'daap.songalbum:Sec*'"));
+	EXPECT_EQ(ids(2, 3), match("'daap.songalbum:*ond'"));
+
+	EXPECT_EQ(ids(1, 3, 2 * CHUNK_SIZE + 5), match("'daap.songartist:al*'"));
+	EXPECT_EQ(ids(2), match("'daap.songartist:*eta'+'daap.songgenre:*ck'"));
+
+	/* ignored */
+	EXPECT_EQ(ids(1, 3, 2 * CHUNK_SIZE + 5),
+			match("'daap.songartist:Alpha'+'com.apple.itunes.mediakind:1'"));
+}
+
+TEST_F(QueryTest, parse) {
+	Rule rule;
+	ASSERT_TRUE(ParseQuery("'daap.songartist:It\\'s \\*'", rule));
+	EXPECT_EQ(Rule::STR_IS, rule.type);
+	EXPECT_EQ("It's *", rule.text);
+
+	ASSERT_TRUE(ParseQuery("(('daap.songyear:1'+'daap.songyear!:2'),'dmap.itemname:x*')", rule));
+	EXPECT_EQ(Rule::ANY, rule.type);
+	ASSERT_EQ(2, rule.rules.size());
+	EXPECT_EQ(Rule::ALL, rule.rules[0].type);
+	EXPECT_EQ(Rule::NOT, rule.rules[0].rules[1].type);
+	EXPECT_EQ(Rule::STR_STARTS, rule.rules[1].type);
+	EXPECT_EQ("x", rule.rules[1].text);
+
+	EXPECT_FALSE(ParseQuery("", rule));
+	EXPECT_FALSE(ParseQuery("'daap.songartist:Foo", rule));
+	EXPECT_FALSE(ParseQuery("('daap.songartist:Foo'", rule));
+	EXPECT_FALSE(ParseQuery("'daap.songartist'", rule));
+	EXPECT_FALSE(ParseQuery("'daap.songartist:Foo',", rule));
+}
+
+TEST_F(QueryTest, gallop) {
+	/* a short list against a long one */
+	for (item_id_t id = 10; id < 3000; ++id) {
+		const char* album = (id % 1000 == 0) ? "Rare" : "Common";
+		set(id, TestTrack(std::string("/music/Many/") + album).Str(ARTIST, "Many")
+				.Str(ALBUM, album).Str(GENRE, "Noise").Int(YEAR, 2000));
+	}
+	EXPECT_EQ(ids(1000, 2000), match("'daap.songartist:Many'+'daap.songalbum:Rare'"));
+	EXPECT_EQ(ids(1000, 2000), match("'daap.songalbum:Rare'+'daap.songgenre:Noise'"));
+	EXPECT_EQ(2988, match("'daap.songartist:Many'+'daap.songalbum!:Rare'").size());
+}
+
+TEST(SearchIndex, find) {
+	TrackStore store;
+	const char* titles[] = { "Hello World", "hello again", "Say Hello", "Yellow", "Ab" };
+	for (size_t i = 0; i < sizeof(titles) / sizeof(titles[0]); ++i) {
+		TrackInfo info;
+		info.path = titles[i];
+		info.strs[TITLE] = titles[i];
+		store.Set(i + 1, info);
+	}
+	const StringPool& pool = store.Strings();
+	SearchIndex search;
+	search.Update(pool);
+	std::vector<str_id_t> found;
+	search.Find(pool, Rule::STR_CONTAINS, "ELLO", found);
+	EXPECT_EQ(4, found.size());
+	found.clear();
+	search.Find(pool, Rule::STR_STARTS, "hello", found);
+	ASSERT_EQ(2, found.size());
+	EXPECT_STREQ("Hello World", pool.Get(found[0]));
+	EXPECT_STREQ("hello again", pool.Get(found[1]));
+	found.clear();
+	search.Find(pool, Rule::STR_ENDS, "hello", found);
+	ASSERT_EQ(1, found.size());
+	EXPECT_STREQ("Say Hello", pool.Get(found[0]));
+	found.clear();
+	search.Find(pool, Rule::STR_IS, "YELLOW", found);
+	ASSERT_EQ(1, found.size());
+	EXPECT_STREQ("Yellow", pool.Get(found[0]));
+
+	/* too short for a gram, and grams in the wrong order */
+	found.clear();
+	search.Find(pool, Rule::STR_CONTAINS, "b", found);
+	ASSERT_EQ(1, found.size());
+	EXPECT_STREQ("Ab", pool.Get(found[0]));
+	found.clear();
+	search.Find(pool, Rule::STR_CONTAINS, "worldhello", found);
+	EXPECT_TRUE(found.empty());
+
+	/* new strings are picked up, while a snapshot keeps what it had even
+	 * though their lists are shared */
+	std::shared_ptr<const SearchIndex> snapshot = search.Snapshot();
+	TrackInfo info;
+	info.path = "new";
+	info.strs[TITLE] = "Mellow";
+	store.Set(10, info);
+	search.Update(pool);
+	found.clear();
+	search.Find(pool, Rule::STR_CONTAINS, "ellow", found);
+	EXPECT_EQ(2, found.size());
+	found.clear();
+	search.Find(pool, Rule::STR_IS, "mellow", found);
+	EXPECT_EQ(1, found.size());
+	found.clear();
+	snapshot->Find(pool, Rule::STR_CONTAINS, "ellow", found);
+	EXPECT_EQ(1, found.size());
+	found.clear();
+	snapshot->Find(pool, Rule::STR_IS, "mellow", found);
+	EXPECT_TRUE(found.empty());
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
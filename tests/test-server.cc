@@ -0,0 +1,269 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <server.h>
+
+namespace sp = std::placeholders;
+
+using namespace adaapd;
+
+/* the last request for /park */
+static parked_t parked;
+
+/* responds with the path as a text/plain body, or a large body for /big */
+static void handler(const char* buf, const DaapRequest& request, Response& response) {
+	std::string path(buf + request.Path().off, request.Path().len);
+	response.content_type = "text/plain";
+	if (path == "/park") {
+		parked = response.Park();
+	} else if (path == "/big") {
+		std::shared_ptr<std::string> chunk(new std::string(10000, 'x'));
+		for (int i = 0; i < 100; ++i) {
+			response.Append(chunk);
+		}
+	} else {
+		response.Append(path);
+	}
+}
+
+static std::string expected(const std::string& path, bool close = false) {
+	std::ostringstream oss;
+	oss << "HTTP/1.1 200 OK\r\n"
+		<< "DAAP-Server: adaapd/1.0\r\n"
+		<< "Content-Type: text/plain\r\n"
+		<< "Content-Length: " << path.size() << "\r\n"
+		<< (close ? "Connection: close\r\n" : "")
+		<< "\r\n" << path;
+	return oss.str();
+}
+
+class ServerTest : public testing::Test {
+protected:
+	ServerTest()
+		: server(loop, std::bind(&handler, sp::_1, sp::_2, sp::_3), 0.2) { }
+
+	virtual void SetUp() {
+		ASSERT_TRUE(server.Listen(0));
+	}
+
+	int connect_client() {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(server.Port());
+		EXPECT_EQ(0, connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+		return fd;
+	}
+
+	/* runs the loop until 'len' bytes have been received or the server
+	 * closes the connection */
+	std::string receive(int fd, size_t len, bool* closed = NULL) {
+		std::string ret;
+		for (int i = 0; i < 5000 && ret.size() < len; ++i) {
+			loop.run(ev::NOWAIT);
+			char buf[65536];
+			ssize_t got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+			if (got > 0) {
+				ret.append(buf, got);
+			} else if (got == 0) {
+				if (closed != NULL) {
+					*closed = true;
+				}
+				break;
+			} else {
+				usleep(1000);
+			}
+		}
+		return ret;
+	}
+
+	/* runs the loop until the server closes the connection */
+	bool wait_closed(int fd) {
+		bool closed = false;
+		std::string extra = receive(fd, (size_t)-1, &closed);
+		EXPECT_EQ("", extra);
+		return closed;
+	}
+
+	ev::default_loop loop;
+	Server server;
+};
+
+TEST_F(ServerTest, pipelining) {
+	int fd = connect_client();
+	std::string reqs =
+		"GET /one HTTP/1.1\r\n\r\n"
+		"GET /two?x=1 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+		"GET /thr";
+	ASSERT_EQ(reqs.size(), send(fd, reqs.data(), reqs.size(), 0));
+	std::string resps = expected("/one") + expected("/two");
+	EXPECT_EQ(resps, receive(fd, resps.size()));
+	EXPECT_EQ(1, server.Clients());
+
+	/* the rest of a request which was split across writes */
+	reqs = "ee HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(reqs.size(), send(fd, reqs.data(), reqs.size(), 0));
+	EXPECT_EQ(expected("/three"), receive(fd, expected("/three").size()));
+
+	/* lots of pipelined requests at once */
+	reqs.clear();
+	resps.clear();
+	for (int i = 0; i < 100; ++i) {
+		std::ostringstream path;
+		path << "/" << i;
+		reqs += "GET " + path.str() + " HTTP/1.1\r\n\r\n";
+		resps += expected(path.str());
+	}
+	ASSERT_EQ(reqs.size(), send(fd, reqs.data(), reqs.size(), 0));
+	EXPECT_EQ(resps, receive(fd, resps.size()));
+	EXPECT_EQ(1, server.Clients());
+	close(fd);
+}
+
+TEST_F(ServerTest, close) {
+	int fd = connect_client();
+	std::string req = "GET /a HTTP/1.0\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	EXPECT_EQ(expected("/a", true), receive(fd, expected("/a", true).size()));
+	EXPECT_TRUE(wait_closed(fd));
+	EXPECT_EQ(0, server.Clients());
+	close(fd);
+
+	/* closed by the client */
+	fd = connect_client();
+	for (int i = 0; i < 100 && server.Clients() == 0; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	EXPECT_EQ(1, server.Clients());
+	close(fd);
+	for (int i = 0; i < 100 && server.Clients() != 0; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	EXPECT_EQ(0, server.Clients());
+}
+
+TEST_F(ServerTest, invalid) {
+	int fd = connect_client();
+	std::string req = "BLAH\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	std::string resp = receive(fd, 1024);
+	EXPECT_EQ(0, resp.find("HTTP/1.1 400 Bad Request\r\n")) << resp;
+	EXPECT_NE(std::string::npos, resp.find("Connection: close\r\n")) << resp;
+	EXPECT_EQ(0, server.Clients());
+	close(fd);
+}
+
+TEST_F(ServerTest, head_and_big) {
+	int fd = connect_client();
+	std::string req = "HEAD /big HTTP/1.1\r\n\r\nGET /big HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+
+	std::string head =
+		"HTTP/1.1 200 OK\r\n"
+		"DAAP-Server: adaapd/1.0\r\n"
+		"Content-Type: text/plain\r\n"
+		"Content-Length: 1000000\r\n"
+		"\r\n";
+	std::string resp = receive(fd, 2 * head.size() + 1000000);
+	ASSERT_EQ(2 * head.size() + 1000000, resp.size());
+	EXPECT_EQ(head + head, resp.substr(0, 2 * head.size()));
+	EXPECT_EQ(std::string(1000000, 'x'), resp.substr(2 * head.size()));
+	close(fd);
+}
+
+TEST_F(ServerTest, park) {
+	int fd = connect_client();
+	std::string req = "GET /park HTTP/1.1\r\n\r\nGET /after HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	/* nothing is sent while the first is parked, even after the idle
+	 * timeout */
+	for (int i = 0; i < 300; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	char c;
+	EXPECT_EQ(-1, recv(fd, &c, 1, MSG_DONTWAIT));
+	ASSERT_TRUE(parked && parked->Waiting());
+	EXPECT_EQ(1, server.Clients());
+
+	Response response;
+	response.content_type = "text/plain";
+	response.Append("/park");
+	parked->Finish(response);
+	EXPECT_FALSE(parked->Waiting());
+	std::string resps = expected("/park") + expected("/after");
+	EXPECT_EQ(resps, receive(fd, resps.size()));
+
+	/* a client hanging up while parked */
+	req = "GET /park HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	for (int i = 0; i < 100 && !parked->Waiting(); ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	ASSERT_TRUE(parked->Waiting());
+	close(fd);
+	for (int i = 0; i < 100 && server.Clients() != 0; ++i) {
+		loop.run(ev::NOWAIT);
+		usleep(1000);
+	}
+	EXPECT_EQ(0, server.Clients());
+	EXPECT_FALSE(parked->Waiting());
+	/* finishing it is harmless */
+	parked->Finish(response);
+	parked.reset();
+}
+
+TEST_F(ServerTest, idle_timeout) {
+	int fd = connect_client();
+	std::string req = "GET /a HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	EXPECT_EQ(expected("/a"), receive(fd, expected("/a").size()));
+	EXPECT_EQ(1, server.Clients());
+
+	/* the server hangs up once the client has been quiet for a while */
+	bool closed = false;
+	for (int i = 0; i < 1000 && !closed; ++i) {
+		loop.run(ev::NOWAIT);
+		char c;
+		closed = (recv(fd, &c, 1, MSG_DONTWAIT) == 0);
+		usleep(1000);
+	}
+	EXPECT_TRUE(closed);
+	EXPECT_EQ(0, server.Clients());
+	close(fd);
+}
+
+int main(int argc, char **argv) {
+	signal(SIGPIPE, SIG_IGN);
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
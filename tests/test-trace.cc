@@ -0,0 +1,99 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <thread>
+
+#include <gtest/gtest.h>
+#include <trace.h>
+
+using namespace adaapd;
+
+static size_t count(const std::string& haystack, const std::string& needle) {
+	size_t n = 0;
+	for (size_t pos = haystack.find(needle); pos != std::string::npos;
+		 pos = haystack.find(needle, pos + 1)) {
+		++n;
+	}
+	return n;
+}
+
+static void traced_thread() {
+	trace::SetThreadName("other \"thread\"");
+	TraceSpan span("other", "a\\b\n");
+}
+
+TEST(TraceTest, disabled) {
+	trace::Clear();
+	{
+		TraceSpan span("nothing", "/some/path");
+		EXPECT_FALSE(span.Active());
+	}
+	std::string out;
+	trace::Write(out);
+	EXPECT_EQ(0, count(out, "nothing"));
+}
+
+TEST(TraceTest, spans) {
+	trace::Clear();
+	trace::Enable(true);
+	{
+		TraceSpan outer("outer");
+		EXPECT_TRUE(outer.Active());
+		TraceSpan inner("inner", "/music/a.mp3");
+	}
+	std::thread thread(traced_thread);
+	thread.join();
+	trace::Enable(false);
+	{
+		TraceSpan after("after");
+	}
+
+	std::string out;
+	trace::Write(out);
+	EXPECT_EQ(0, out.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+	EXPECT_EQ(1, count(out, "\"name\":\"outer\",\"cat\":\"adaapd\",\"ph\":\"X\""));
+	EXPECT_EQ(1, count(out, "\"name\":\"inner\""));
+	EXPECT_EQ(1, count(out, "\"args\":{\"detail\":\"/music/a.mp3\"}"));
+	EXPECT_EQ(0, count(out, "\"after\""));
+	/* escaped for JSON */
+	EXPECT_EQ(1, count(out, "\"args\":{\"name\":\"other \\\"thread\\\"\"}"));
+	EXPECT_EQ(1, count(out, "\"detail\":\"a\\\\b\\u000a\""));
+
+	trace::Clear();
+	out.clear();
+	trace::Write(out);
+	EXPECT_EQ(0, count(out, "\"ph\":\"X\""));
+}
+
+TEST(TraceTest, overwrite) {
+	trace::Clear();
+	trace::Enable(true);
+	for (size_t i = 0; i < 20000; ++i) {
+		TraceSpan span("many");
+	}
+	trace::Enable(false);
+	std::string out;
+	trace::Write(out);
+	/* only the most recent are kept */
+	EXPECT_EQ(16384, count(out, "\"name\":\"many\""));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,232 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <track-store.h>
+#include <logging.h>
+
+#include "test-tracks.h"
+
+using namespace adaapd;
+
+TEST(StringPool, intern) {
+	StringPool pool;
+	EXPECT_EQ(1, pool.Size());
+	EXPECT_EQ(STR_NONE, pool.Intern(""));
+	EXPECT_STREQ("", pool.Get(STR_NONE));
+
+	str_id_t a = pool.Intern("hello");
+	str_id_t b = pool.Intern("world");
+	EXPECT_NE(a, b);
+	EXPECT_NE(STR_NONE, a);
+	EXPECT_EQ(a, pool.Intern("hello"));
+	EXPECT_EQ(b, pool.Intern(std::string("wor") + "ld"));
+	EXPECT_EQ(3, pool.Size());
+
+	EXPECT_STREQ("hello", pool.Get(a));
+	EXPECT_EQ(5, pool.Len(a));
+	EXPECT_STREQ("world", pool.Get(b));
+	EXPECT_EQ(0, pool.Len(STR_NONE));
+
+	/* lots of strings, forcing rehashes and buffer growth */
+	for (int i = 0; i < 10000; ++i) {
+		std::ostringstream oss;
+		oss << "str" << i;
+		str_id_t id = pool.Intern(oss.str());
+		EXPECT_STREQ(oss.str().c_str(), pool.Get(id));
+	}
+	EXPECT_EQ(10003, pool.Size());
+	EXPECT_EQ(a, pool.Intern("hello"));
+	EXPECT_STREQ("str9999", pool.Get(pool.Intern("str9999")));
+	EXPECT_EQ(10003, pool.Size());
+}
+
+TEST(TrackStore, set_remove) {
+	TrackStore store;
+	EXPECT_EQ(0, store.Size());
+	EXPECT_FALSE(store.Has(0));
+	EXPECT_FALSE(store.Has(5));
+
+	store.Set(5, TestTrack("/a/b.mp3").Str(ARTIST, "arty").Str(TITLE, "tracky")
+			.Int(YEAR, 1492).Mtime(1234));
+	store.Set(2, TestTrack("/a/c.mp3").Str(ARTIST, "arty").Str(TITLE, "other")
+			.Int(YEAR, 2012).Mtime(1234));
+	EXPECT_EQ(2, store.Size());
+	EXPECT_EQ(6, store.End());
+	EXPECT_TRUE(store.Has(5));
+	EXPECT_TRUE(store.Has(2));
+	EXPECT_FALSE(store.Has(3));
+
+	EXPECT_STREQ("/a/b.mp3", store.Path(5));
+	EXPECT_STREQ("arty", store.Str(5, ARTIST));
+	EXPECT_STREQ("tracky", store.Str(5, TITLE));
+	EXPECT_STREQ("", store.Str(5, ALBUM));
+	EXPECT_EQ(STR_NONE, store.StrId(5, ALBUM));
+	EXPECT_EQ(1492, store.Int(5, YEAR));
+	EXPECT_EQ(TAG_INT_NONE, store.Int(5, BPM));
+	EXPECT_EQ(1234, store.Mtime(5));
+
+	/* interned: shared artist */
+	EXPECT_EQ(store.StrId(2, ARTIST), store.StrId(5, ARTIST));
+	/* paths are kept out of the tag strings: "", arty, tracky, other */
+	EXPECT_EQ(4, store.Strings().Size());
+
+	/* columns */
+	const Column<tag_int_t>& years = store.IntColumn(YEAR);
+	EXPECT_EQ(1, years.ChunkCount());
+	EXPECT_EQ(TAG_INT_NONE, years.Chunk(0)[3]);
+	EXPECT_EQ(2012, years.Chunk(0)[2]);
+	EXPECT_EQ(1492, years.Chunk(0)[5]);
+	EXPECT_EQ(TAG_INT_NONE, years.Chunk(0)[CHUNK_SIZE - 1]);
+	const Column<uint8_t>& live = store.LiveColumn();
+	EXPECT_EQ(0, live.Get(0));
+	EXPECT_EQ(1, live.Get(2));
+	EXPECT_EQ(0, live.Get(4));
+
+	/* update */
+	store.Set(5, TestTrack("/a/b.mp3").Str(ARTIST, "arty2").Str(TITLE, "tracky")
+			.Int(YEAR, 1493).Mtime(1234));
+	EXPECT_EQ(2, store.Size());
+	EXPECT_STREQ("arty2", store.Str(5, ARTIST));
+	EXPECT_EQ(1493, store.Int(5, YEAR));
+
+	/* removal */
+	store.Remove(5);
+	store.Remove(5);
+	store.Remove(100);
+	EXPECT_EQ(1, store.Size());
+	EXPECT_FALSE(store.Has(5));
+	EXPECT_EQ(TAG_INT_NONE, store.Int(5, YEAR));
+	EXPECT_EQ(STR_NONE, store.StrId(5, ARTIST));
+
+	/* spanning several chunks */
+	store.Set(3 * CHUNK_SIZE + 7, TestTrack("/x.ogg").Int(YEAR, 1).Mtime(1234));
+	EXPECT_EQ(2, store.Size());
+	EXPECT_EQ(3 * CHUNK_SIZE + 8, store.End());
+	EXPECT_EQ(4, store.IntColumn(YEAR).ChunkCount());
+	EXPECT_EQ(1, store.Int(3 * CHUNK_SIZE + 7, YEAR));
+	EXPECT_EQ(TAG_INT_NONE, store.Int(2 * CHUNK_SIZE, YEAR));
+}
+
+TEST(TrackStore, diff) {
+	TrackStore store;
+	TrackInfo info;
+	info.path = "/a.mp3";
+	info.strs[TITLE] = "Title";
+	info.ints[YEAR] = 2000;
+	EXPECT_EQ(TAG_MASK_ALL, store.Diff(1, info));
+	store.Set(1, info);
+	EXPECT_EQ(0, store.Diff(1, info));
+
+	info.strs[TITLE] = "Titl";
+	info.ints[YEAR] = TAG_INT_NONE;
+	info.ints[BPM] = 120;
+	EXPECT_EQ(TagBit(TITLE) | TagBit(YEAR) | TagBit(BPM), store.Diff(1, info));
+	/* the path isn't a tag */
+	info = TrackInfo();
+	info.path = "/b.mp3";
+	info.strs[TITLE] = "Title";
+	info.ints[YEAR] = 2000;
+	EXPECT_EQ(0, store.Diff(1, info));
+}
+
+TEST(Column, copy_on_write) {
+	Column<int> a;
+	a.Grow(10, -1);
+	a.Set(3, 3);
+
+	/* copies share chunks until one of them writes */
+	Column<int> b = a.Share();
+	EXPECT_EQ(a.Chunk(0), b.Chunk(0));
+	b.Set(4, 4);
+	EXPECT_NE(a.Chunk(0), b.Chunk(0));
+	EXPECT_EQ(-1, a.Get(4));
+	EXPECT_EQ(4, b.Get(4));
+	EXPECT_EQ(3, b.Get(3));
+
+	/* including the original, even after the copy is gone */
+	const int* shared = a.Chunk(0);
+	{
+		Column<int> c = a.Share();
+	}
+	a.Set(5, 5);
+	EXPECT_NE(shared, a.Chunk(0));
+	EXPECT_EQ(5, a.Get(5));
+
+	/* chunks backed by someone else's memory are never written */
+	std::shared_ptr<int> owner(new int[CHUNK_SIZE], std::default_delete<int[]>());
+	for (item_id_t i = 0; i < CHUNK_SIZE; ++i) {
+		owner.get()[i] = 7;
+	}
+	Column<int> c;
+	c.AddShared(owner, owner.get());
+	EXPECT_EQ(owner.get(), c.Chunk(0));
+	c.Set(0, 8);
+	EXPECT_NE(owner.get(), c.Chunk(0));
+	EXPECT_EQ(7, owner.get()[0]);
+	EXPECT_EQ(8, c.Get(0));
+	EXPECT_EQ(7, c.Get(1));
+}
+
+TEST(TrackStore, snapshot) {
+	TrackStore store;
+	store.Set(1, TestTrack("/a.mp3").Str(ARTIST, "Artist").Str(TITLE, "Alpha")
+			.Int(YEAR, 2001).Mtime(1234));
+	store.Set(2, TestTrack("/b.mp3").Str(ARTIST, "Artist").Str(TITLE, "Beta")
+			.Int(YEAR, 2002).Mtime(1234));
+
+	std::shared_ptr<const TrackStore> snap = store.Snapshot();
+	EXPECT_EQ(&store.IntColumn(YEAR).Chunk(0)[0], &snap->IntColumn(YEAR).Chunk(0)[0]);
+
+	/* changes after the snapshot don't show up in it */
+	store.Set(1, TestTrack("/a.mp3").Str(ARTIST, "Someone").Str(TITLE, "Alpha 2")
+			.Int(YEAR, 2011).Mtime(1234));
+	store.Remove(2);
+	store.Set(CHUNK_SIZE + 3, TestTrack("/c.mp3").Str(ARTIST, "Artist").Str(TITLE, "Gamma")
+			.Int(YEAR, 2003).Mtime(1234));
+	std::string big(100 * 1024, 'x');
+	store.Set(4, TestTrack("/d.mp3").Str(ARTIST, "Artist").Str(TITLE, big)
+			.Int(YEAR, 2004).Mtime(1234));
+
+	EXPECT_EQ(2, snap->Size());
+	EXPECT_EQ(3, snap->End());
+	EXPECT_STREQ("Alpha", snap->Str(1, TITLE));
+	EXPECT_STREQ("Artist", snap->Str(1, ARTIST));
+	EXPECT_EQ(2001, snap->Int(1, YEAR));
+	EXPECT_TRUE(snap->Has(2));
+	EXPECT_STREQ("/b.mp3", snap->Path(2));
+
+	EXPECT_EQ(3, store.Size());
+	EXPECT_STREQ("Alpha 2", store.Str(1, TITLE));
+	EXPECT_STREQ("Someone", store.Str(1, ARTIST));
+	EXPECT_EQ(2011, store.Int(1, YEAR));
+	EXPECT_FALSE(store.Has(2));
+	EXPECT_STREQ("Gamma", store.Str(CHUNK_SIZE + 3, TITLE));
+	EXPECT_EQ(big, store.Str(4, TITLE));
+	EXPECT_EQ(big.size(), store.Strings().Len(store.StrId(4, TITLE)));
+
+	/* previously interned strings are still found */
+	EXPECT_EQ(snap->StrId(1, ARTIST), store.StrId(CHUNK_SIZE + 3, ARTIST));
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}
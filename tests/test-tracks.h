@@ -0,0 +1,76 @@
+#ifndef _adaapd_test_tracks_h_
+#define _adaapd_test_tracks_h_
+
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+
+#include <sstream>
+#include <string>
+
+#include <track-store.h>
+
+/* Builds a TrackInfo for a test one field at a time, eg
+ *
+ *   store.Set(1, TestTrack("/a.mp3").Str(ARTIST, "Alpha").Int(YEAR, 1999));
+ */
+class TestTrack {
+public:
+	TestTrack(const std::string& path) {
+		info.path = path;
+	}
+
+	/* track 'id' of a numbered library: /music/<id>.mp3, titled "title <id>",
+	 * by "even" or "odd", with 'id' as its track number */
+	explicit TestTrack(adaapd::item_id_t id) {
+		std::ostringstream path, title;
+		path << "/music/" << id << ".mp3";
+		title << "title " << id;
+		info.path = path.str();
+		info.strs[adaapd::TITLE] = title.str();
+		info.strs[adaapd::ARTIST] = (id % 2 == 0) ? "even" : "odd";
+		info.ints[adaapd::TRACK_NUMBER] = id;
+		info.mtime = id * 10;
+	}
+
+	TestTrack& Str(adaapd::Tag_StrId field, const std::string& value) {
+		info.strs[field] = value;
+		return *this;
+	}
+	TestTrack& Int(adaapd::Tag_IntId field, adaapd::tag_int_t value) {
+		info.ints[field] = value;
+		return *this;
+	}
+	TestTrack& Mtime(time_t mtime) {
+		info.mtime = mtime;
+		return *this;
+	}
+
+	const adaapd::TrackInfo& Info() const {
+		return info;
+	}
+	operator const adaapd::TrackInfo&() const {
+		return info;
+	}
+
+private:
+	adaapd::TrackInfo info;
+};
+
+#endif
@@ -0,0 +1,144 @@
+/*
+  adaapd - A DAAP daemon.
+  Copyright (C) 2012  Nicholas Parker
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <arpa/inet.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+#include <workers.h>
+
+namespace sp = std::placeholders;
+
+using namespace adaapd;
+
+#define WORKERS 4
+#define CLIENTS 64
+
+/* responds with "<worker>:<thread id>", checking it's on the same thread as
+ * last time */
+class worker_handler {
+public:
+	worker_handler(size_t worker) : worker(worker) { }
+
+	void Handle(const char* /*buf*/, const DaapRequest& /*request*/, Response& response) {
+		if (thread == std::thread::id()) {
+			thread = std::this_thread::get_id();
+		}
+		std::ostringstream oss;
+		oss << worker << ":" << (thread == std::this_thread::get_id());
+		response.content_type = "text/plain";
+		response.Append(oss.str());
+	}
+
+private:
+	const size_t worker;
+	std::thread::id thread;
+};
+
+static handler_t make_handler(std::vector<std::shared_ptr<worker_handler> >* handlers,
+		size_t worker, ev::loop_ref /*loop*/) {
+	std::shared_ptr<worker_handler> handler(new worker_handler(worker));
+	handlers->push_back(handler);
+	return std::bind(&worker_handler::Handle, handler.get(), sp::_1, sp::_2, sp::_3);
+}
+
+static int connect_client(uint16_t port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	EXPECT_EQ(0, connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+	return fd;
+}
+
+/* sends a request and returns the body of the response */
+static std::string request(int fd) {
+	std::string req = "GET / HTTP/1.1\r\n\r\n";
+	EXPECT_EQ(req.size(), send(fd, req.data(), req.size(), 0));
+	std::string resp;
+	char buf[1024];
+	size_t body = std::string::npos;
+	while (body == std::string::npos || resp.size() < body + 3) {
+		ssize_t len = recv(fd, buf, sizeof(buf), 0);
+		if (len <= 0) {
+			ADD_FAILURE() << "recv failed";
+			return "";
+		}
+		resp.append(buf, len);
+		body = resp.find("\r\n\r\n");
+		if (body != std::string::npos) {
+			body += 4;
+		}
+	}
+	return resp.substr(body);
+}
+
+TEST(Workers, serve) {
+	std::vector<std::shared_ptr<worker_handler> > handlers;
+	Workers workers(WORKERS, std::bind(&make_handler, &handlers, sp::_1, sp::_2), 10);
+	ASSERT_TRUE(workers.Start(0));
+	EXPECT_NE(0, workers.Port());
+	EXPECT_EQ(WORKERS, workers.Count());
+	EXPECT_EQ(WORKERS, handlers.size());
+
+	std::vector<int> fds;
+	std::set<std::string> seen;
+	for (int i = 0; i < CLIENTS; ++i) {
+		fds.push_back(connect_client(workers.Port()));
+	}
+	for (int round = 0; round < 3; ++round) {
+		for (int i = 0; i < CLIENTS; ++i) {
+			std::string body = request(fds[i]);
+			ASSERT_EQ(3, body.size()) << body;
+			/* each worker always runs on its own thread */
+			EXPECT_EQ('1', body[2]) << body;
+			seen.insert(body);
+		}
+	}
+	/* the kernel hashes connections across the listeners, so with this many
+	 * clients more than one worker should have seen some */
+	EXPECT_LT(1, seen.size());
+
+	workers.Stop();
+	for (int i = 0; i < CLIENTS; ++i) {
+		close(fds[i]);
+	}
+}
+
+TEST(Workers, stop_idle) {
+	std::vector<std::shared_ptr<worker_handler> > handlers;
+	Workers workers(2, std::bind(&make_handler, &handlers, sp::_1, sp::_2), 10);
+	ASSERT_TRUE(workers.Start(0));
+	workers.Stop();
+	/* stopping again is harmless */
+	workers.Stop();
+}
+
+int main(int argc, char **argv) {
+	signal(SIGPIPE, SIG_IGN);
+	::testing::InitGoogleTest( &argc, argv );
+	return RUN_ALL_TESTS();
+}